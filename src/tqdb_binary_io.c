@@ -18,8 +18,13 @@ void tqdb_writer_init(tqdb_writer_t* w, FILE* f, uint8_t* buf, size_t buf_size)
     w->buf_pos = 0;
 }
 
+void tqdb_writer_init_mem(tqdb_writer_t* w, uint8_t* buf, size_t buf_size) {
+    tqdb_writer_init(w, NULL, buf, buf_size);
+}
+
 void tqdb_writer_flush(tqdb_writer_t* w) {
-    if (w->error || w->buf_pos == 0) return;
+    /* A memory writer keeps its bytes in buf */
+    if (w->error || w->buf_pos == 0 || !w->file) return;
     if (fwrite(w->buf, 1, w->buf_pos, w->file) != w->buf_pos) {
         w->error = true;
     }
@@ -45,6 +50,12 @@ void tqdb_write_raw(tqdb_writer_t* w, const void* data, size_t len) {
         return;
     }
 
+    /* A memory writer cannot grow past its buffer */
+    if (!w->file) {
+        w->error = true;
+        return;
+    }
+
     /* Flush buffer first */
     tqdb_writer_flush(w);
     if (w->error) return;
@@ -109,6 +120,12 @@ void tqdb_reader_init(tqdb_reader_t* r, FILE* f, uint8_t* buf, size_t buf_size)
     r->buf_filled = 0;
 }
 
+void tqdb_reader_init_mem(tqdb_reader_t* r, const uint8_t* data, size_t len) {
+    /* Never written through: the buffer is only refilled from a file */
+    tqdb_reader_init(r, NULL, (uint8_t*)data, len);
+    r->buf_filled = len;
+}
+
 uint32_t tqdb_reader_crc(tqdb_reader_t* r) {
     return tqdb_crc32_finalize(r->crc);
 }
@@ -128,7 +145,7 @@ void tqdb_read_raw(tqdb_reader_t* r, void* data, size_t len) {
             r->buf_pos += to_copy;
             written += to_copy;
         } else {
-            r->buf_filled = fread(r->buf, 1, r->buf_size, r->file);
+            r->buf_filled = r->file ? fread(r->buf, 1, r->buf_size, r->file) : 0;
             r->buf_pos = 0;
             if (r->buf_filled == 0) {
                 r->error = true;
@@ -210,7 +227,7 @@ void tqdb_read_skip(tqdb_reader_t* r, size_t len) {
             r->buf_pos += skip;
             len -= skip;
         } else {
-            r->buf_filled = fread(r->buf, 1, r->buf_size, r->file);
+            r->buf_filled = r->file ? fread(r->buf, 1, r->buf_size, r->file) : 0;
             r->buf_pos = 0;
             if (r->buf_filled == 0) {
                 r->error = true;
@@ -2,8 +2,15 @@
  * @file tqdb_cache.c
  * @brief LRU cache implementation for TQDB
  *
- * Simple array-based LRU cache for frequently accessed entities.
- * Cache entries store serialized entity data to avoid trait dependency issues.
+ * Array-based LRU cache for frequently accessed entities, with an
+ * open-addressing hash index over (type_idx, id) for O(1) lookups and
+ * intrusive doubly-linked recency lists for O(1) promotion and eviction.
+ * Plain LRU keeps one list. SLRU splits it into probation, where new keys
+ * start and are evicted from, and protected, for keys hit again.
+ * The cache is split into shards by key hash, each a complete cache with
+ * an equal share of the limits and its own lock. An optional L2 list keeps
+ * evicted entities in their compact serialized form, read back on a hit.
+ * Entries hold the deserialized entity in a block of a per-type slab.
  */
 
 #include "tqdb_internal.h"
@@ -15,35 +22,320 @@
 #define TQDB_WAL_OP_DELETE 3
 #endif
 
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Shards
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static uint64_t cache_hash(uint8_t type_idx, uint32_t id) {
+    uint64_t key = ((uint64_t)type_idx << 32) | id;
+    return key * 0x9E3779B97F4A7C15ULL;
+}
+
+/* Shard owning a key: top hash bits, which the index (bits 32 and up) rarely reaches */
+static tqdb_cache_shard_t* cache_shard(const tqdb_cache_t* cache, uint8_t type_idx, uint32_t id) {
+    if (cache->shard_count == 1) return &cache->shards[0];
+    return &cache->shards[cache_hash(type_idx, id) >> cache->shard_shift];
+}
+
+static void cache_lock(tqdb_t db, tqdb_cache_shard_t* shard) {
+    if (shard->lock) db->mutex_ops->lock(shard->lock, UINT32_MAX);
+}
+
+static void cache_unlock(tqdb_t db, tqdb_cache_shard_t* shard) {
+    if (shard->lock) db->mutex_ops->unlock(shard->lock);
+}
+
+/* A shard's part of a byte quota (0 stays 0 = none) */
+static size_t cache_share(const tqdb_cache_t* cache, size_t bytes) {
+    size_t share = bytes / cache->shard_count;
+    return (bytes && !share) ? 1 : share;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Recency List
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* Empty recency lists; every entry on the free list except pinned ones */
+static void cache_reset_lists(tqdb_cache_shard_t* shard) {
+    for (int seg = 0; seg < TQDB_CACHE_LISTS; seg++) {
+        shard->lru_head[seg] = 0;
+        shard->lru_tail[seg] = 0;
+        shard->seg_count[seg] = 0;
+    }
+    shard->free_head = 0;
+    for (size_t i = shard->pool; i-- > 0;) {
+        shard->entries[i].prev = 0;
+        if (shard->entries[i].pins) continue;
+        shard->entries[i].next = shard->free_head;
+        shard->free_head = (uint32_t)i + 1;
+    }
+}
+
+static void cache_unlink(tqdb_cache_shard_t* shard, uint32_t slot) {
+    tqdb_cache_entry_t* entry = &shard->entries[slot - 1];
+    uint8_t seg = entry->segment;
+    if (entry->prev) shard->entries[entry->prev - 1].next = entry->next;
+    else shard->lru_head[seg] = entry->next;
+    if (entry->next) shard->entries[entry->next - 1].prev = entry->prev;
+    else shard->lru_tail[seg] = entry->prev;
+    entry->prev = 0;
+    entry->next = 0;
+    shard->seg_count[seg]--;
+}
+
+/* Link an unlinked entry in as most recently used of a segment */
+static void cache_push_front(tqdb_cache_shard_t* shard, uint32_t slot, uint8_t seg) {
+    tqdb_cache_entry_t* entry = &shard->entries[slot - 1];
+    entry->segment = seg;
+    entry->prev = 0;
+    entry->next = shard->lru_head[seg];
+    if (shard->lru_head[seg]) shard->entries[shard->lru_head[seg] - 1].prev = slot;
+    else shard->lru_tail[seg] = slot;
+    shard->lru_head[seg] = slot;
+    shard->seg_count[seg]++;
+}
+
+/* Move an entry to the front of a segment */
+static void cache_move(tqdb_cache_shard_t* shard, uint32_t slot, uint8_t seg) {
+    if (shard->lru_head[seg] == slot) return;
+    cache_unlink(shard, slot);
+    cache_push_front(shard, slot, seg);
+}
+
+/**
+ * Record a hit. Under SLRU a second touch promotes a probationary entry;
+ * when the protected segment overflows, its least recently used entry
+ * drops back to the front of probation for another chance.
+ */
+static void cache_hit(tqdb_cache_shard_t* shard, uint32_t slot) {
+    if (shard->policy != TQDB_CACHE_SLRU) {
+        cache_move(shard, slot, TQDB_CACHE_PROBATION);
+        return;
+    }
+
+    cache_move(shard, slot, TQDB_CACHE_PROTECTED);
+    if (shard->seg_count[TQDB_CACHE_PROTECTED] > shard->protected_max) {
+        cache_move(shard, shard->lru_tail[TQDB_CACHE_PROTECTED], TQDB_CACHE_PROBATION);
+    }
+}
+
+/* Unlink an entry and return it to the free list */
+static void cache_release(tqdb_cache_shard_t* shard, uint32_t slot) {
+    cache_unlink(shard, slot);
+    shard->entries[slot - 1].id = 0;
+    shard->entries[slot - 1].next = shard->free_head;
+    shard->free_head = slot;
+    shard->count--;
+}
+
+/* Take a pinned entry out of the cache; its entity lives until the last unpin */
+static void cache_detach(tqdb_cache_shard_t* shard, uint32_t slot) {
+    cache_unlink(shard, slot);
+    shard->entries[slot - 1].id = 0;
+    shard->entries[slot - 1].segment = TQDB_CACHE_DETACHED;
+    shard->count--;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Entity Slabs
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* Bytes a cached entity counts against the budget: its slab block size */
+static size_t cache_charge(const tqdb_trait_t* trait) {
+    return (trait->struct_size + TQDB_CACHE_SLAB_ALIGN - 1) &
+           ~(size_t)(TQDB_CACHE_SLAB_ALIGN - 1);
+}
+
+/**
+ * Block from the shard's arena, which types without a maximum share under
+ * a byte budget. It is carved as they first need blocks, and a freed block
+ * goes back to its type only. The budget bounds the bytes cached, so the
+ * arena runs short only when one type holds blocks freed by a shift in the
+ * mix; the caller then falls back to the heap.
+ */
+static void* cache_arena_alloc(tqdb_t db, tqdb_cache_shard_t* shard, tqdb_cache_slab_t* slab,
+                               size_t stride) {
+    if (slab->arena_free) {
+        uint8_t* block = shard->arena + (size_t)(slab->arena_free - 1) * TQDB_CACHE_SLAB_ALIGN;
+        memcpy(&slab->arena_free, block, sizeof(uint32_t));
+        return block;
+    }
+    if (!shard->arena && !shard->arena_failed) {
+        shard->arena = (uint8_t*)tqdb_alloc(db, shard->max_bytes);
+        shard->arena_failed = !shard->arena;
+    }
+    if (!shard->arena || shard->max_bytes - shard->arena_used < stride) return NULL;
+
+    uint8_t* block = shard->arena + shard->arena_used;
+    shard->arena_used += stride;
+    return block;
+}
+
+/**
+ * Block for a cached entity of a type. Each type's slab is allocated on
+ * first use, so churn never reaches the allocator. It holds one block per
+ * cache entry, or as many as the type's cache_max_bytes allows. Under a
+ * byte budget, types without a maximum take blocks from the shard arena
+ * instead, so memory held for entities stays within the budget. Blocks
+ * the slab or arena cannot supply come from the heap.
+ */
+static void* cache_entity_alloc(tqdb_t db, tqdb_cache_shard_t* shard, uint8_t type_idx) {
+    tqdb_cache_slab_t* slab = &shard->slabs[type_idx];
+    const tqdb_trait_t* trait = db->traits[type_idx];
+    size_t type_max = cache_share(db->cache, trait->cache_max_bytes);
+    void* block = NULL;
+
+    if (shard->max_bytes && !type_max) {
+        block = cache_arena_alloc(db, shard, slab, cache_charge(trait));
+    } else if (!slab->blocks && !slab->failed) {
+        size_t stride = cache_charge(trait);
+        size_t n = shard->capacity;
+        if (type_max && type_max / stride < n) {
+            n = type_max / stride;
+        }
+        if (n > 0 && stride <= SIZE_MAX / n - sizeof(uint32_t)) {
+            slab->blocks = (uint8_t*)tqdb_alloc(db, n * (stride + sizeof(uint32_t)));
+        }
+        if (!slab->blocks) {
+            slab->failed = true;
+        } else {
+            slab->stride = stride;
+            slab->count = (uint32_t)n;
+            slab->free = (uint32_t*)(slab->blocks + n * stride);
+            for (size_t i = 0; i < n; i++) {
+                slab->free[i] = (uint32_t)(n - 1 - i);
+            }
+            slab->free_count = (uint32_t)n;
+        }
+    }
+
+    if (!block && slab->blocks && slab->free_count > 0) {
+        block = slab->blocks + (size_t)slab->free[--slab->free_count] * slab->stride;
+    }
+    if (!block) block = tqdb_alloc(db, trait->struct_size);
+    if (block) {
+        shard->bytes += cache_charge(trait);
+        shard->type_bytes[type_idx] += cache_charge(trait);
+    }
+    return block;
+}
+
+static void cache_free_entity(tqdb_t db, tqdb_cache_shard_t* shard, tqdb_cache_entry_t* entry) {
+    if (!entry->entity) return;
+    if (entry->segment == TQDB_CACHE_L2) {
+        uint32_t len;
+        memcpy(&len, entry->entity, sizeof(len));
+        shard->l2_bytes -= sizeof(uint32_t) + len;
+        tqdb_dealloc(db, entry->entity);
+        entry->entity = NULL;
+        return;
+    }
+
+    const tqdb_trait_t* trait = db->traits[entry->type_idx];
+    if (trait && trait->destroy) {
+        trait->destroy(entry->entity);
+    }
+
+    tqdb_cache_slab_t* slab = &shard->slabs[entry->type_idx];
+    uint8_t* block = (uint8_t*)entry->entity;
+    if (slab->blocks && block >= slab->blocks &&
+        block < slab->blocks + (size_t)slab->count * slab->stride) {
+        slab->free[slab->free_count++] = (uint32_t)((size_t)(block - slab->blocks) / slab->stride);
+    } else if (shard->arena && block >= shard->arena && block < shard->arena + shard->arena_used) {
+        memcpy(block, &slab->arena_free, sizeof(uint32_t));
+        slab->arena_free = (uint32_t)((size_t)(block - shard->arena) / TQDB_CACHE_SLAB_ALIGN + 1);
+    } else {
+        tqdb_dealloc(db, entry->entity);
+    }
+    entry->entity = NULL;
+    shard->bytes -= cache_charge(trait);
+    shard->type_bytes[entry->type_idx] -= cache_charge(trait);
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Cache Initialization
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-tqdb_err_t tqdb_cache_init(tqdb_t db, size_t capacity) {
-    if (!db) return TQDB_ERR_INVALID_ARG;
-    if (capacity == 0) capacity = TQDB_CACHE_SIZE_DEFAULT;
+static tqdb_err_t cache_shard_init(tqdb_t db, tqdb_cache_shard_t* shard, size_t capacity,
+                                   uint8_t policy, size_t max_bytes, size_t l2_max_bytes) {
+    /* The L2 holds serialized entities down to 32 bytes */
+    size_t pool = capacity + l2_max_bytes / 32;
+
+    /* Index table at most half full keeps probe chains short */
+    size_t index_size = 2;
+    while (index_size < pool * 2) index_size <<= 1;
+
+    /* Allocate entries array and index */
+    shard->entries = (tqdb_cache_entry_t*)tqdb_alloc(db, pool * sizeof(tqdb_cache_entry_t));
+    shard->index = (uint32_t*)tqdb_alloc(db, index_size * sizeof(uint32_t));
+    if (!shard->entries || !shard->index) return TQDB_ERR_NO_MEM;
+    memset(shard->entries, 0, pool * sizeof(tqdb_cache_entry_t));
+    memset(shard->index, 0, index_size * sizeof(uint32_t));
+
+    if (db->mutex_ops) {
+        shard->lock = db->mutex_ops->create();
+        if (!shard->lock) return TQDB_ERR_NO_MEM;
+    }
+
+    shard->index_mask = index_size - 1;
+    shard->capacity = capacity;
+    shard->pool = pool;
+    shard->policy = policy;
+    shard->max_bytes = max_bytes;
+    shard->l2_max_bytes = l2_max_bytes;
+    /* Probation keeps at least one entry so new keys always have room */
+    shard->protected_max = capacity - 1 - (capacity - 1) / 5;
+    cache_reset_lists(shard);
+    return TQDB_OK;
+}
+
+tqdb_err_t tqdb_cache_init(tqdb_t db, size_t capacity, uint8_t policy, size_t max_bytes,
+                           size_t shards, size_t l2_bytes) {
+    if (!db || policy > TQDB_CACHE_SLRU) return TQDB_ERR_INVALID_ARG;
+    if (capacity == 0) {
+        /* Under a byte budget, leave room for entities down to 32 bytes */
+        capacity = max_bytes / 32 > TQDB_CACHE_SIZE_DEFAULT ? max_bytes / 32
+                                                             : TQDB_CACHE_SIZE_DEFAULT;
+    }
+    if (capacity > UINT32_MAX / 4 || l2_bytes / 32 > UINT32_MAX / 4 - capacity) {
+        return TQDB_ERR_INVALID_ARG;
+    }
+
+    /* A power of two, each shard keeping at least one entry */
+    size_t shard_count = 1;
+    uint8_t shard_bits = 0;
+    while (shard_count < shards && shard_count < TQDB_CACHE_MAX_SHARDS &&
+           shard_count * 2 <= capacity) {
+        shard_count <<= 1;
+        shard_bits++;
+    }
 
     /* Allocate cache structure */
     db->cache = (tqdb_cache_t*)tqdb_alloc(db, sizeof(tqdb_cache_t));
     if (!db->cache) return TQDB_ERR_NO_MEM;
 
     memset(db->cache, 0, sizeof(tqdb_cache_t));
-
-    /* Allocate entries array */
-    db->cache->entries = (tqdb_cache_entry_t*)tqdb_alloc(db,
-        capacity * sizeof(tqdb_cache_entry_t));
-    if (!db->cache->entries) {
+    db->cache->shards = (tqdb_cache_shard_t*)tqdb_alloc(db,
+        shard_count * sizeof(tqdb_cache_shard_t));
+    if (!db->cache->shards) {
         tqdb_dealloc(db, db->cache);
         db->cache = NULL;
         return TQDB_ERR_NO_MEM;
     }
-
-    memset(db->cache->entries, 0, capacity * sizeof(tqdb_cache_entry_t));
-    db->cache->capacity = capacity;
-    db->cache->count = 0;
-    db->cache->access_counter = 0;
-    db->cache->hits = 0;
-    db->cache->misses = 0;
+    memset(db->cache->shards, 0, shard_count * sizeof(tqdb_cache_shard_t));
+    db->cache->shard_count = shard_count;
+    db->cache->shard_shift = (uint8_t)(64 - shard_bits);
+
+    for (size_t s = 0; s < shard_count; s++) {
+        tqdb_err_t err = cache_shard_init(db, &db->cache->shards[s],
+                                          (capacity + shard_count - 1) / shard_count, policy,
+                                          cache_share(db->cache, max_bytes),
+                                          cache_share(db->cache, l2_bytes));
+        if (err != TQDB_OK) {
+            tqdb_cache_destroy(db);
+            return err;
+        }
+    }
 
     return TQDB_OK;
 }
@@ -55,134 +347,408 @@ tqdb_err_t tqdb_cache_init(tqdb_t db, size_t capacity) {
 void tqdb_cache_destroy(tqdb_t db) {
     if (!db || !db->cache) return;
 
-    /* Free all cached entity data */
-    for (size_t i = 0; i < db->cache->capacity; i++) {
-        if (db->cache->entries[i].entity) {
-            const tqdb_trait_t* trait = db->traits[db->cache->entries[i].type_idx];
-            if (trait && trait->destroy) {
-                trait->destroy(db->cache->entries[i].entity);
+    for (size_t s = 0; s < db->cache->shard_count; s++) {
+        tqdb_cache_shard_t* shard = &db->cache->shards[s];
+
+        /* Free all cached entity data, then the slabs it lived in */
+        if (shard->entries) {
+            for (size_t i = 0; i < shard->pool; i++) {
+                cache_free_entity(db, shard, &shard->entries[i]);
             }
-            tqdb_dealloc(db, db->cache->entries[i].entity);
-            db->cache->entries[i].entity = NULL;
         }
+        for (size_t t = 0; t < TQDB_MAX_ENTITY_TYPES; t++) {
+            tqdb_dealloc(db, shard->slabs[t].blocks);
+        }
+        tqdb_dealloc(db, shard->arena);
+        tqdb_dealloc(db, shard->l2_stage);
+
+        tqdb_dealloc(db, shard->entries);
+        tqdb_dealloc(db, shard->index);
+        if (shard->lock) db->mutex_ops->destroy(shard->lock);
     }
 
-    tqdb_dealloc(db, db->cache->entries);
+    tqdb_cache_drop_keys(db);
+    tqdb_dealloc(db, db->cache->warm_path);
+    tqdb_dealloc(db, db->cache->shards);
     tqdb_dealloc(db, db->cache);
     db->cache = NULL;
 }
 
 /* ═══════════════════════════════════════════════════════════════════════════
- * Cache Lookup
+ * Hash Index
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static size_t cache_home(const tqdb_cache_shard_t* shard, uint8_t type_idx, uint32_t id) {
+    return (size_t)(cache_hash(type_idx, id) >> 32) & shard->index_mask;
+}
+
+/* Index position holding (type_idx, id), or the empty position ending its probe */
+static size_t cache_probe(const tqdb_cache_shard_t* shard, uint8_t type_idx, uint32_t id) {
+    size_t pos = cache_home(shard, type_idx, id);
+    while (shard->index[pos] != 0) {
+        const tqdb_cache_entry_t* entry = &shard->entries[shard->index[pos] - 1];
+        if (entry->id == id && entry->type_idx == type_idx) break;
+        pos = (pos + 1) & shard->index_mask;
+    }
+    return pos;
+}
+
+/* Clear an index position, shifting later probe-chain members back into the hole */
+static void cache_unindex(tqdb_cache_shard_t* shard, size_t pos) {
+    size_t hole = pos;
+    size_t next = (pos + 1) & shard->index_mask;
+
+    while (shard->index[next] != 0) {
+        const tqdb_cache_entry_t* entry = &shard->entries[shard->index[next] - 1];
+        size_t home = cache_home(shard, entry->type_idx, entry->id);
+        /* Movable unless its home lies between the hole and its position */
+        if (((next - home) & shard->index_mask) >= ((next - hole) & shard->index_mask)) {
+            shard->index[hole] = shard->index[next];
+            hole = next;
+        }
+        next = (next + 1) & shard->index_mask;
+    }
+    shard->index[hole] = 0;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Eviction
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-tqdb_cache_entry_t* tqdb_cache_get(tqdb_t db, uint8_t type_idx, uint32_t id) {
-    if (!db || !db->cache || id == 0) return NULL;
-
-    for (size_t i = 0; i < db->cache->capacity; i++) {
-        tqdb_cache_entry_t* entry = &db->cache->entries[i];
-        if (entry->id != 0 &&
-            entry->type_idx == type_idx &&
-            entry->id == id) {
-            /* Update LRU counter */
-            entry->access_count = ++db->cache->access_counter;
-            db->cache->hits++;
-            return entry;
+/**
+ * Least recently used entry that may be evicted, probation first: of type
+ * only_type if >= 0, never keep. With for_type >= 0, entries of other
+ * types are passed over while their type is at or below cache_min_bytes.
+ * The walk usually stops at the tail.
+ */
+static uint32_t cache_victim(tqdb_t db, tqdb_cache_shard_t* shard, int only_type, int for_type,
+                             uint32_t keep) {
+    for (int seg = 0; seg < TQDB_CACHE_SEGMENTS; seg++) {
+        for (uint32_t slot = shard->lru_tail[seg]; slot; slot = shard->entries[slot - 1].prev) {
+            const tqdb_cache_entry_t* entry = &shard->entries[slot - 1];
+            if (slot == keep || entry->pins) continue;
+            if (only_type >= 0 && entry->type_idx != only_type) continue;
+            if (for_type >= 0 && entry->type_idx != for_type && entry->entity) {
+                const tqdb_trait_t* trait = db->traits[entry->type_idx];
+                if (shard->type_bytes[entry->type_idx] - cache_charge(trait) <
+                    cache_share(db->cache, trait->cache_min_bytes)) {
+                    continue;
+                }
+            }
+            return slot;
         }
     }
+    return 0;
+}
+
+/* Unindex an entry and free it, whichever list it is on */
+static void cache_drop(tqdb_t db, tqdb_cache_shard_t* shard, uint32_t slot) {
+    tqdb_cache_entry_t* entry = &shard->entries[slot - 1];
+    cache_free_entity(db, shard, entry);
+    cache_unindex(shard, cache_probe(shard, entry->type_idx, entry->id));
+    cache_release(shard, slot);
+}
+
+/* Entries outside the L2 */
+static size_t cache_l1_count(const tqdb_cache_shard_t* shard) {
+    return shard->seg_count[TQDB_CACHE_PROBATION] + shard->seg_count[TQDB_CACHE_PROTECTED];
+}
 
-    db->cache->misses++;
-    return NULL;
+/* Drop the L2's least recently demoted entries, never keep, until bytes more fit */
+static bool cache_l2_make_room(tqdb_t db, tqdb_cache_shard_t* shard, size_t bytes,
+                               uint32_t keep) {
+    while (shard->l2_bytes + bytes > shard->l2_max_bytes) {
+        uint32_t slot = shard->lru_tail[TQDB_CACHE_L2];
+        if (slot != 0 && slot == keep) slot = shard->entries[slot - 1].prev;
+        if (slot == 0) return false;
+        cache_drop(db, shard, slot);
+    }
+    return true;
+}
+
+/**
+ * Move an entity out of the segments into the L2 as its trait's serialized
+ * bytes, which for short strings in fixed buffers are a fraction of
+ * struct_size. The entry keeps its index position. Returns false, leaving
+ * the entry alone, when there is no L2 or the bytes do not fit.
+ */
+static bool cache_demote(tqdb_t db, tqdb_cache_shard_t* shard, uint32_t slot, uint32_t keep) {
+    tqdb_cache_entry_t* entry = &shard->entries[slot - 1];
+    if (!shard->l2_max_bytes || !entry->entity) return false;
+    const tqdb_trait_t* trait = db->traits[entry->type_idx];
+
+    /* Twice the struct leaves room for a length before every field */
+    size_t stage_size = trait->struct_size * 2 + 64;
+    if (shard->l2_stage_size < stage_size) {
+        uint8_t* stage = (uint8_t*)tqdb_alloc(db, stage_size);
+        if (!stage) return false;
+        tqdb_dealloc(db, shard->l2_stage);
+        shard->l2_stage = stage;
+        shard->l2_stage_size = stage_size;
+    }
+
+    tqdb_writer_t w;
+    tqdb_writer_init_mem(&w, shard->l2_stage, shard->l2_stage_size);
+    trait->write(&w, entry->entity);
+    if (tqdb_write_error(&w)) return false;
+
+    uint32_t len = (uint32_t)w.buf_pos;
+    size_t size = sizeof(uint32_t) + len;
+    if (size > shard->l2_max_bytes || !cache_l2_make_room(db, shard, size, keep)) return false;
+    uint8_t* blob = (uint8_t*)tqdb_alloc(db, size);
+    if (!blob) return false;
+    memcpy(blob, &len, sizeof(len));
+    memcpy(blob + sizeof(len), shard->l2_stage, len);
+
+    cache_free_entity(db, shard, entry);
+    entry->entity = blob;
+    shard->l2_bytes += size;
+    cache_move(shard, slot, TQDB_CACHE_L2);
+    return true;
+}
+
+/* Demote an entry to the L2, or drop it if it cannot go there */
+static void cache_evict(tqdb_t db, tqdb_cache_shard_t* shard, uint32_t slot, uint32_t keep) {
+    if (!cache_demote(db, shard, slot, keep)) cache_drop(db, shard, slot);
+}
+
+/**
+ * Evict until charge more bytes of type_idx fit, there is room for one
+ * more entry outside the L2 if new_l1, and an entry is free if new_entry.
+ */
+static bool cache_make_room(tqdb_t db, tqdb_cache_shard_t* shard, uint8_t type_idx,
+                            size_t charge, bool new_l1, bool new_entry, uint32_t keep) {
+    size_t type_max = cache_share(db->cache, db->traits[type_idx]->cache_max_bytes);
+
+    while (type_max && shard->type_bytes[type_idx] + charge > type_max) {
+        uint32_t victim = cache_victim(db, shard, type_idx, -1, keep);
+        if (!victim) return false;
+        cache_evict(db, shard, victim, keep);
+    }
+    while ((shard->max_bytes && shard->bytes + charge > shard->max_bytes) ||
+           (new_l1 && cache_l1_count(shard) >= shard->capacity)) {
+        uint32_t victim = cache_victim(db, shard, -1, type_idx, keep);
+        if (!victim) victim = cache_victim(db, shard, -1, -1, keep);
+        if (!victim) return false;
+        cache_evict(db, shard, victim, keep);
+    }
+
+    /* The rest of the pool is held by the L2 and by pinned entries */
+    while (new_entry && shard->free_head == 0) {
+        uint32_t victim = shard->lru_tail[TQDB_CACHE_L2];
+        if (victim == keep) victim = 0;
+        if (!victim) victim = cache_victim(db, shard, -1, type_idx, keep);
+        if (!victim) victim = cache_victim(db, shard, -1, -1, keep);
+        if (!victim) return false;
+        cache_drop(db, shard, victim);
+    }
+    return true;
+}
+
+/**
+ * Deserialize an L2 entry back into probation, making room there as for a
+ * new key. Returns false, with the entry dropped, if that or the read fails.
+ */
+static bool cache_promote(tqdb_t db, tqdb_cache_shard_t* shard, uint32_t slot) {
+    tqdb_cache_entry_t* entry = &shard->entries[slot - 1];
+    const tqdb_trait_t* trait = db->traits[entry->type_idx];
+
+    void* entity = NULL;
+    if (cache_make_room(db, shard, entry->type_idx, cache_charge(trait), true, false, slot)) {
+        entity = cache_entity_alloc(db, shard, entry->type_idx);
+    }
+    if (!entity) {
+        cache_drop(db, shard, slot);
+        return false;
+    }
+
+    uint8_t* blob = (uint8_t*)entry->entity;
+    uint32_t len;
+    memcpy(&len, blob, sizeof(len));
+    tqdb_reader_t r;
+    tqdb_reader_init_mem(&r, blob + sizeof(len), len);
+    if (trait->init) trait->init(entity);
+    trait->read(&r, entity);
+
+    cache_free_entity(db, shard, entry);
+    entry->entity = entity;
+    cache_move(shard, slot, TQDB_CACHE_PROBATION);
+    if (tqdb_read_error(&r)) {
+        cache_drop(db, shard, slot);
+        return false;
+    }
+    return true;
+}
+
+/* Drop a key if cached (caller holds the shard lock) */
+static void cache_remove(tqdb_t db, tqdb_cache_shard_t* shard, uint8_t type_idx, uint32_t id) {
+    size_t pos = cache_probe(shard, type_idx, id);
+    uint32_t slot = shard->index[pos];
+    if (slot == 0) return;
+
+    cache_unindex(shard, pos);
+    if (shard->entries[slot - 1].pins) {
+        cache_detach(shard, slot);
+        return;
+    }
+
+    /* Free entity data and mark as empty */
+    cache_free_entity(db, shard, &shard->entries[slot - 1]);
+    cache_release(shard, slot);
 }
 
 /* ═══════════════════════════════════════════════════════════════════════════
- * Find LRU Entry
+ * Cache Lookup
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-static size_t cache_find_lru_index(tqdb_cache_t* cache) {
-    size_t lru_idx = 0;
-    uint32_t min_access = UINT32_MAX;
+/* Slot holding a key, promoted out of the L2 if it was there (0 = not cached) */
+static uint32_t cache_lookup(tqdb_t db, tqdb_cache_shard_t* shard, uint8_t type_idx,
+                             uint32_t id, bool count_stats) {
+    uint32_t slot = shard->index[cache_probe(shard, type_idx, id)];
+    if (slot != 0 && shard->entries[slot - 1].segment == TQDB_CACHE_L2) {
+        if (!cache_promote(db, shard, slot)) {
+            slot = 0;
+        } else if (count_stats) {
+            shard->l2_hits++;
+            shard->hits++;
+        }
+    } else if (slot != 0 && count_stats) {
+        shard->seg_hits[shard->entries[slot - 1].segment]++;
+        shard->hits++;
+    }
 
-    /* First, try to find an empty slot */
-    for (size_t i = 0; i < cache->capacity; i++) {
-        if (cache->entries[i].id == 0) {
-            return i;
+    if (slot == 0) {
+        if (count_stats) shard->misses++;
+        return 0;
+    }
+    cache_hit(shard, slot);
+    return slot;
+}
+
+int tqdb_cache_get(tqdb_t db, uint8_t type_idx, uint32_t id, void* out) {
+    if (!db || !db->cache || id == 0) return -1;
+
+    tqdb_cache_shard_t* shard = cache_shard(db->cache, type_idx, id);
+    cache_lock(db, shard);
+
+    int result = -1;
+    uint32_t slot = cache_lookup(db, shard, type_idx, id, true);
+    if (slot != 0) {
+        tqdb_cache_entry_t* entry = &shard->entries[slot - 1];
+        if (entry->op == TQDB_WAL_OP_DELETE) {
+            result = 0;
+        } else if (entry->entity) {
+            /* Copy out while the shard still owns the entry */
+            if (out) {
+                const tqdb_trait_t* trait = db->traits[type_idx];
+                if (trait->init) trait->init(out);
+                memcpy(out, entry->entity, trait->struct_size);
+            }
+            result = 1;
         }
-        if (cache->entries[i].access_count < min_access) {
-            min_access = cache->entries[i].access_count;
-            lru_idx = i;
+    }
+
+    cache_unlock(db, shard);
+    return result;
+}
+
+int tqdb_cache_pin(tqdb_t db, uint8_t type_idx, uint32_t id, bool count_stats, tqdb_ref_t* ref) {
+    if (!db || !db->cache || id == 0) return -1;
+
+    tqdb_cache_shard_t* shard = cache_shard(db->cache, type_idx, id);
+    cache_lock(db, shard);
+
+    int result = -1;
+    uint32_t slot = cache_lookup(db, shard, type_idx, id, count_stats);
+    if (slot != 0) {
+        tqdb_cache_entry_t* entry = &shard->entries[slot - 1];
+        if (entry->op == TQDB_WAL_OP_DELETE) {
+            result = 0;
+        } else if (entry->entity && entry->pins < UINT16_MAX) {
+            entry->pins++;
+            ref->entity = entry->entity;
+            ref->shard = (uint32_t)(shard - db->cache->shards);
+            ref->slot = slot;
+            ref->type_idx = type_idx;
+            result = 1;
         }
     }
 
-    return lru_idx;
+    cache_unlock(db, shard);
+    return result;
+}
+
+void tqdb_cache_unpin(tqdb_t db, const tqdb_ref_t* ref) {
+    tqdb_cache_shard_t* shard = &db->cache->shards[ref->shard];
+    cache_lock(db, shard);
+
+    tqdb_cache_entry_t* entry = &shard->entries[ref->slot - 1];
+    if (--entry->pins == 0 && entry->segment == TQDB_CACHE_DETACHED) {
+        /* Last reader of a replaced version: now the entry can be reused */
+        cache_free_entity(db, shard, entry);
+        entry->segment = TQDB_CACHE_PROBATION;
+        entry->next = shard->free_head;
+        shard->free_head = ref->slot;
+    }
+
+    cache_unlock(db, shard);
 }
 
 /* ═══════════════════════════════════════════════════════════════════════════
  * Cache Insert/Update
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-tqdb_err_t tqdb_cache_put(tqdb_t db, uint8_t type_idx, uint32_t id,
-                          const void* entity, uint8_t op) {
-    if (!db || !db->cache || id == 0) return TQDB_ERR_INVALID_ARG;
-    if (type_idx >= db->trait_count) return TQDB_ERR_INVALID_ARG;
-
+static tqdb_err_t cache_put(tqdb_t db, tqdb_cache_shard_t* shard, uint8_t type_idx, uint32_t id,
+                            const void* entity, uint8_t op) {
     const tqdb_trait_t* trait = db->traits[type_idx];
-    if (!trait) return TQDB_ERR_INVALID_ARG;
-
-    /* Check if already in cache */
-    tqdb_cache_entry_t* existing = NULL;
-    for (size_t i = 0; i < db->cache->capacity; i++) {
-        tqdb_cache_entry_t* entry = &db->cache->entries[i];
-        if (entry->id != 0 &&
-            entry->type_idx == type_idx &&
-            entry->id == id) {
-            existing = entry;
-            break;
-        }
+    size_t pos = cache_probe(shard, type_idx, id);
+    uint32_t slot = shard->index[pos];
+
+    /* A pinned version stays with its readers; the new one gets an entry of its own */
+    if (slot != 0 && shard->entries[slot - 1].pins) {
+        cache_unindex(shard, pos);
+        cache_detach(shard, slot);
+        slot = 0;
+    }
+
+    /* Already cached: free old entity data, so its bytes no longer count */
+    bool in_l2 = slot != 0 && shard->entries[slot - 1].segment == TQDB_CACHE_L2;
+    if (slot != 0) cache_free_entity(db, shard, &shard->entries[slot - 1]);
+
+    /* Evict by the type's quota, the byte budget, then the entry count */
+    size_t charge = (op != TQDB_WAL_OP_DELETE && entity) ? cache_charge(trait) : 0;
+    if (!cache_make_room(db, shard, type_idx, charge, slot == 0 || in_l2, slot == 0, slot)) {
+        if (slot != 0) cache_remove(db, shard, type_idx, id);
+        return TQDB_ERR_FULL;
     }
 
     tqdb_cache_entry_t* target;
-    if (existing) {
-        target = existing;
-        /* Free old entity data */
-        if (target->entity) {
-            if (trait->destroy) trait->destroy(target->entity);
-            tqdb_dealloc(db, target->entity);
-            target->entity = NULL;
-        }
+    if (slot != 0) {
+        target = &shard->entries[slot - 1];
+        cache_move(shard, slot, in_l2 ? TQDB_CACHE_PROBATION : target->segment);
     } else {
-        /* Find slot (empty or LRU) */
-        size_t idx = cache_find_lru_index(db->cache);
-        target = &db->cache->entries[idx];
-
-        /* Evict if occupied */
-        if (target->id != 0 && target->entity) {
-            const tqdb_trait_t* old_trait = db->traits[target->type_idx];
-            if (old_trait && old_trait->destroy) {
-                old_trait->destroy(target->entity);
-            }
-            tqdb_dealloc(db, target->entity);
-            target->entity = NULL;
-        }
-
-        if (target->id == 0) {
-            db->cache->count++;
-        }
+        /* Evictions may have shifted the chain our empty position ended */
+        pos = cache_probe(shard, type_idx, id);
+        slot = shard->free_head;
+        target = &shard->entries[slot - 1];
+        shard->free_head = target->next;
+        cache_push_front(shard, slot, TQDB_CACHE_PROBATION);
+        shard->index[pos] = slot;
+        shard->count++;
     }
 
     /* Set ID */
     target->id = id;
     target->type_idx = type_idx;
     target->op = op;
-    target->access_count = ++db->cache->access_counter;
 
     /* Copy entity data if not a delete */
     if (op != TQDB_WAL_OP_DELETE && entity) {
-        target->entity = tqdb_alloc(db, trait->struct_size);
+        target->entity = cache_entity_alloc(db, shard, type_idx);
         if (!target->entity) {
             /* Clear entry on allocation failure */
-            target->id = 0;
-            db->cache->count--;
+            cache_unindex(shard, cache_probe(shard, type_idx, id));
+            cache_release(shard, slot);
             return TQDB_ERR_NO_MEM;
         }
         memcpy(target->entity, entity, trait->struct_size);
@@ -193,6 +759,18 @@ tqdb_err_t tqdb_cache_put(tqdb_t db, uint8_t type_idx, uint32_t id,
     return TQDB_OK;
 }
 
+tqdb_err_t tqdb_cache_put(tqdb_t db, uint8_t type_idx, uint32_t id,
+                          const void* entity, uint8_t op) {
+    if (!db || !db->cache || id == 0) return TQDB_ERR_INVALID_ARG;
+    if (type_idx >= db->trait_count || !db->traits[type_idx]) return TQDB_ERR_INVALID_ARG;
+
+    tqdb_cache_shard_t* shard = cache_shard(db->cache, type_idx, id);
+    cache_lock(db, shard);
+    tqdb_err_t err = cache_put(db, shard, type_idx, id, entity, op);
+    cache_unlock(db, shard);
+    return err;
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Cache Invalidation
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -200,46 +778,148 @@ tqdb_err_t tqdb_cache_put(tqdb_t db, uint8_t type_idx, uint32_t id,
 void tqdb_cache_invalidate(tqdb_t db, uint8_t type_idx, uint32_t id) {
     if (!db || !db->cache || id == 0) return;
 
-    for (size_t i = 0; i < db->cache->capacity; i++) {
-        tqdb_cache_entry_t* entry = &db->cache->entries[i];
-        if (entry->id != 0 &&
-            entry->type_idx == type_idx &&
-            entry->id == id) {
-            /* Free entity data */
-            if (entry->entity) {
-                const tqdb_trait_t* trait = db->traits[type_idx];
-                if (trait && trait->destroy) {
-                    trait->destroy(entry->entity);
-                }
-                tqdb_dealloc(db, entry->entity);
+    tqdb_cache_shard_t* shard = cache_shard(db->cache, type_idx, id);
+    cache_lock(db, shard);
+    cache_remove(db, shard, type_idx, id);
+    cache_unlock(db, shard);
+}
+
+void tqdb_cache_invalidate_all(tqdb_t db) {
+    if (!db || !db->cache) return;
+
+    for (size_t s = 0; s < db->cache->shard_count; s++) {
+        tqdb_cache_shard_t* shard = &db->cache->shards[s];
+        cache_lock(db, shard);
+        for (size_t i = 0; i < shard->pool; i++) {
+            tqdb_cache_entry_t* entry = &shard->entries[i];
+            if (entry->pins) {
+                entry->id = 0;
+                entry->segment = TQDB_CACHE_DETACHED;
+            } else if (entry->id != 0) {
+                cache_free_entity(db, shard, entry);
+                entry->id = 0;
             }
-            /* Mark as empty */
-            entry->id = 0;
-            entry->entity = NULL;
-            db->cache->count--;
-            return;
         }
+        memset(shard->index, 0, (shard->index_mask + 1) * sizeof(uint32_t));
+        shard->count = 0;
+        cache_reset_lists(shard);
+        cache_unlock(db, shard);
     }
 }
 
-void tqdb_cache_invalidate_all(tqdb_t db) {
-    if (!db || !db->cache) return;
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Warm-up Keys
+ * ═══════════════════════════════════════════════════════════════════════════ */
 
-    for (size_t i = 0; i < db->cache->capacity; i++) {
-        tqdb_cache_entry_t* entry = &db->cache->entries[i];
-        if (entry->id != 0) {
-            if (entry->entity) {
-                const tqdb_trait_t* trait = db->traits[entry->type_idx];
-                if (trait && trait->destroy) {
-                    trait->destroy(entry->entity);
-                }
-                tqdb_dealloc(db, entry->entity);
+/**
+ * Key file (db_path + ".warm"):
+ *   magic: u32 = 0x4D525754 ("TWRM"), version: u16 = 1,
+ *   types: u16 (entity types registered when written), count: u32,
+ *   then count records of type_idx: u8, id: u32, hottest first.
+ */
+#define TQDB_CACHE_WARM_MAGIC 0x4D525754
+#define TQDB_CACHE_WARM_VERSION 1
+
+tqdb_err_t tqdb_cache_load_keys(tqdb_t db, const char* path) {
+    tqdb_cache_t* cache = db->cache;
+    size_t len = strlen(path) + 1;
+    cache->warm_path = (char*)tqdb_alloc(db, len);
+    if (!cache->warm_path) return TQDB_ERR_NO_MEM;
+    memcpy(cache->warm_path, path, len);
+
+    FILE* f = fopen(path, "rb");
+    if (!f) return TQDB_OK;  /* Nothing saved yet */
+
+    tqdb_reader_t r;
+    tqdb_reader_init(&r, f, db->scratch, db->scratch_size);
+    uint32_t magic = tqdb_read_u32(&r);
+    uint16_t version = tqdb_read_u16(&r);
+    uint16_t types = tqdb_read_u16(&r);
+    uint32_t count = tqdb_read_u32(&r);
+    if (tqdb_read_error(&r) || magic != TQDB_CACHE_WARM_MAGIC ||
+        version != TQDB_CACHE_WARM_VERSION || types == 0 || types > TQDB_MAX_ENTITY_TYPES) {
+        fclose(f);
+        return TQDB_OK;  /* Unusable: start cold */
+    }
+
+    /* More keys than fit would only evict each other */
+    size_t capacity = cache->shards[0].capacity * cache->shard_count;
+    if (count > capacity) count = (uint32_t)capacity;
+    if (count > 0) {
+        cache->warm_keys = (uint64_t*)tqdb_alloc(db, count * sizeof(uint64_t));
+        if (!cache->warm_keys) {
+            fclose(f);
+            return TQDB_ERR_NO_MEM;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t type_idx = tqdb_read_u8(&r);
+        uint32_t id = tqdb_read_u32(&r);
+        if (tqdb_read_error(&r)) break;
+        if (type_idx < types && id != 0) {
+            cache->warm_keys[cache->warm_count++] = ((uint64_t)type_idx << 32) | id;
+        }
+    }
+    fclose(f);
+
+    cache->warm_types = types;
+    return TQDB_OK;
+}
+
+tqdb_err_t tqdb_cache_save_keys(tqdb_t db) {
+    tqdb_cache_t* cache = db->cache;
+    if (!cache || !cache->warm_path) return TQDB_OK;
+
+    /* Keys never prefetched (types not all registered) stay on disk */
+    if (cache->warm_types != 0) return TQDB_OK;
+
+    uint32_t count = 0;
+    for (size_t s = 0; s < cache->shard_count; s++) {
+        const tqdb_cache_shard_t* shard = &cache->shards[s];
+        for (size_t i = 0; i < shard->pool; i++) {
+            const tqdb_cache_entry_t* entry = &shard->entries[i];
+            if (entry->id != 0 && entry->entity && entry->segment < TQDB_CACHE_SEGMENTS) count++;
+        }
+    }
+
+    FILE* f = fopen(cache->warm_path, "wb");
+    if (!f) return TQDB_ERR_IO;
+
+    tqdb_writer_t w;
+    tqdb_writer_init(&w, f, db->scratch, db->scratch_size);
+    tqdb_write_u32(&w, TQDB_CACHE_WARM_MAGIC);
+    tqdb_write_u16(&w, TQDB_CACHE_WARM_VERSION);
+    tqdb_write_u16(&w, (uint16_t)db->trait_count);
+    tqdb_write_u32(&w, count);
+
+    /* Protected before probation, each from its most recently used end */
+    for (int seg = TQDB_CACHE_SEGMENTS - 1; seg >= 0; seg--) {
+        for (size_t s = 0; s < cache->shard_count; s++) {
+            const tqdb_cache_shard_t* shard = &cache->shards[s];
+            for (uint32_t slot = shard->lru_head[seg]; slot; slot = shard->entries[slot - 1].next) {
+                const tqdb_cache_entry_t* entry = &shard->entries[slot - 1];
+                if (!entry->entity) continue;
+                tqdb_write_u8(&w, entry->type_idx);
+                tqdb_write_u32(&w, entry->id);
             }
-            entry->id = 0;
-            entry->entity = NULL;
         }
     }
-    db->cache->count = 0;
+    tqdb_writer_flush(&w);
+
+    bool ok = !tqdb_write_error(&w);
+    if (fclose(f) != 0) ok = false;
+    if (!ok) {
+        remove(cache->warm_path);
+        return TQDB_ERR_IO;
+    }
+    return TQDB_OK;
+}
+
+void tqdb_cache_drop_keys(tqdb_t db) {
+    tqdb_dealloc(db, db->cache->warm_keys);
+    db->cache->warm_keys = NULL;
+    db->cache->warm_count = 0;
+    db->cache->warm_types = 0;
 }
 
 /* ═══════════════════════════════════════════════════════════════════════════
@@ -248,21 +928,88 @@ void tqdb_cache_invalidate_all(tqdb_t db) {
 
 void tqdb_cache_clear(tqdb_t db) {
     tqdb_cache_invalidate_all(db);
-    if (db && db->cache) {
-        db->cache->hits = 0;
-        db->cache->misses = 0;
+    if (!db || !db->cache) return;
+
+    for (size_t s = 0; s < db->cache->shard_count; s++) {
+        tqdb_cache_shard_t* shard = &db->cache->shards[s];
+        cache_lock(db, shard);
+        shard->hits = 0;
+        shard->misses = 0;
+        shard->l2_hits = 0;
+        memset(shard->seg_hits, 0, sizeof(shard->seg_hits));
+        cache_unlock(db, shard);
     }
 }
 
 void tqdb_cache_stats(tqdb_t db, size_t* out_hits, size_t* out_misses) {
-    if (!db || !db->cache) {
-        if (out_hits) *out_hits = 0;
-        if (out_misses) *out_misses = 0;
-        return;
+    size_t hits = 0, misses = 0;
+
+    /* Each shard counts its own, so hits never contend on one counter */
+    if (db && db->cache) {
+        for (size_t s = 0; s < db->cache->shard_count; s++) {
+            tqdb_cache_shard_t* shard = &db->cache->shards[s];
+            cache_lock(db, shard);
+            hits += shard->hits;
+            misses += shard->misses;
+            cache_unlock(db, shard);
+        }
+    }
+
+    if (out_hits) *out_hits = hits;
+    if (out_misses) *out_misses = misses;
+}
+
+size_t tqdb_cache_bytes(tqdb_t db, const char* type) {
+    if (!db || !db->cache) return 0;
+
+    int type_idx = -1;
+    if (type) {
+        type_idx = tqdb_find_trait_index(db, type);
+        if (type_idx < 0) return 0;
+    }
+
+    size_t bytes = 0;
+    for (size_t s = 0; s < db->cache->shard_count; s++) {
+        tqdb_cache_shard_t* shard = &db->cache->shards[s];
+        cache_lock(db, shard);
+        bytes += type_idx < 0 ? shard->bytes : shard->type_bytes[type_idx];
+        cache_unlock(db, shard);
+    }
+    return bytes;
+}
+
+void tqdb_cache_segment_stats(tqdb_t db, size_t* out_probation_hits,
+                              size_t* out_protected_hits) {
+    size_t seg_hits[TQDB_CACHE_SEGMENTS] = {0};
+
+    if (db && db->cache) {
+        for (size_t s = 0; s < db->cache->shard_count; s++) {
+            tqdb_cache_shard_t* shard = &db->cache->shards[s];
+            cache_lock(db, shard);
+            for (int seg = 0; seg < TQDB_CACHE_SEGMENTS; seg++) seg_hits[seg] += shard->seg_hits[seg];
+            cache_unlock(db, shard);
+        }
+    }
+
+    if (out_probation_hits) *out_probation_hits = seg_hits[TQDB_CACHE_PROBATION];
+    if (out_protected_hits) *out_protected_hits = seg_hits[TQDB_CACHE_PROTECTED];
+}
+
+void tqdb_cache_l2_stats(tqdb_t db, size_t* out_hits, size_t* out_bytes) {
+    size_t hits = 0, bytes = 0;
+
+    if (db && db->cache) {
+        for (size_t s = 0; s < db->cache->shard_count; s++) {
+            tqdb_cache_shard_t* shard = &db->cache->shards[s];
+            cache_lock(db, shard);
+            hits += shard->l2_hits;
+            bytes += shard->l2_bytes;
+            cache_unlock(db, shard);
+        }
     }
 
-    if (out_hits) *out_hits = db->cache->hits;
-    if (out_misses) *out_misses = db->cache->misses;
+    if (out_hits) *out_hits = hits;
+    if (out_bytes) *out_bytes = bytes;
 }
 
 #endif /* TQDB_ENABLE_CACHE */
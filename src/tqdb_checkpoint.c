@@ -0,0 +1,1248 @@
+/**
+ * @file tqdb_checkpoint.c
+ * @brief Bounded-memory WAL checkpoint and compaction for TQDB
+ */
+
+#include "tqdb_internal.h"
+
+#if TQDB_ENABLE_WAL
+
+/**
+ * Checkpoint implementation (only compiled when TQDB_ENABLE_WAL=1)
+ *
+ * The WAL is merged into the main database as a stream, so peak memory is
+ * the configured budget plus the scratch buffer regardless of WAL size:
+ *
+ *   1. Sort:   WAL entry headers (not entity data) are collected into the
+ *              budget buffer, sorted by (type, id, seq) and reduced to the
+ *              latest entry per key, plus any MERGE entries after it (an
+ *              operand needs the value it applies to). A full buffer is spilled to
+ *              <db_path>.spill as a sorted run. Runs are merged in groups of
+ *              CKPT_FAN_IN so the run table never grows past CKPT_MAX_RUNS.
+ *   2. Merge:  the runs are k-way merged into one (type, id) ordered stream
+ *              and joined with the ID-sorted main sections. Entity data of
+ *              WAL entries is copied raw from the WAL file, so only main
+ *              entities are deserialized. Keys ending in a PATCH or MERGE
+ *              are the exception: the base image (from the WAL, or the main
+ *              entity) is read, patched or merged, and written back.
+ *   3. Commit: the new file replaces the main DB via tqdb_install_file().
+ *
+ * All state lives in ckpt_t, so the sort and merge loops can stop after any
+ * entry and resume later (tqdb_checkpoint_step). Collapsing spilled runs
+ * is the one unit that is not split.
+ *
+ * Entity IDs are assigned in increasing order, so every section written by
+ * tqdb_add() or a checkpoint is sorted by ID.
+ */
+
+#define CKPT_FAN_IN       8     /* Runs merged per pass */
+#define CKPT_MAX_RUNS     32    /* Run table size */
+#define CKPT_COPY_CHUNK   256   /* Budget bytes reserved for copying entity data */
+#define CKPT_MIN_BUDGET   1024  /* Smallest usable budget */
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Checkpoint Structures
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/** Sort record for one WAL entry (entity data stays in the WAL file) */
+typedef struct {
+    uint64_t lsn;           /* Kept by compaction */
+    uint32_t id;
+    uint32_t seq;           /* WAL position: higher seq wins */
+    uint32_t data_pos;      /* Offset of entity data in the WAL */
+    uint32_t data_len;
+    uint32_t base_pos;      /* PATCH only: image the patch applies to */
+    uint32_t base_len;
+    uint8_t type_idx;
+    uint8_t op;             /* Latest operation */
+    uint8_t first_op;       /* Oldest operation (ADD = created in this WAL) */
+    uint8_t base_op;        /* PATCH only: op of that image, 0 = main entity */
+} ckpt_rec_t;
+
+/** Sorted run in the spill file */
+typedef struct {
+    long start;             /* Offset of first record */
+    uint32_t count;
+    uint8_t level;          /* Merge passes this run went through */
+} ckpt_run_t;
+
+/** Read cursor over a memory run or a window of a spilled run */
+typedef struct {
+    ckpt_rec_t* buf;
+    size_t cap;
+    size_t pos;
+    size_t filled;
+    long next;              /* Spill offset of the next unbuffered record */
+    uint32_t remaining;     /* Records not yet buffered */
+} ckpt_cursor_t;
+
+/** Checkpoint phases */
+enum {
+    CKPT_PHASE_SORT,
+    CKPT_PHASE_MERGE,
+    CKPT_PHASE_DONE
+};
+
+typedef struct tqdb_ckpt_s ckpt_t;
+
+struct tqdb_ckpt_s {
+    tqdb_t db;
+    FILE* wal;
+    uint32_t wal_count;     /* Entries in the WAL segment being merged */
+    bool wal_v1;            /* Segment written before LSNs */
+    FILE* spill;
+    char* spill_path;
+    const char* out_path;   /* Merged file, installed by the caller */
+    uint8_t* io_buf;        /* Split in half for main reader and writer */
+    size_t io_size;
+
+    uint8_t* mem;           /* Budget buffer */
+    uint8_t* copy_buf;      /* First CKPT_COPY_CHUNK bytes of mem */
+    ckpt_rec_t* recs;       /* Remainder of mem */
+    size_t rec_cap;
+    size_t rec_count;
+
+    ckpt_run_t runs[CKPT_MAX_RUNS];
+    size_t run_count;
+
+    ckpt_cursor_t cursors[CKPT_FAN_IN];
+    size_t cursor_count;
+
+    /* Progress */
+    uint8_t phase;
+    uint32_t budget;        /* Step budget (0 = run to completion) */
+    uint32_t step_start;    /* clock_us() when the step began */
+    uint32_t work;          /* Bytes processed in this step */
+    uint32_t wal_index;     /* Next WAL entry to sort */
+
+    /* Merge phase */
+    FILE* src;
+    FILE* dst;
+    tqdb_reader_t r;
+    tqdb_writer_t w;
+    uint32_t counts[TQDB_MAX_ENTITY_TYPES];
+    uint32_t actual_counts[TQDB_MAX_ENTITY_TYPES];
+    long counts_pos;
+    size_t type_idx;        /* Section being merged */
+    uint32_t main_index;    /* Main entities consumed in this section */
+    void* entity;           /* Section entity buffer */
+    void* base_entity;      /* Section buffer for WAL images under a PATCH */
+    bool have_entity;       /* entity holds a main entity not yet emitted */
+    ckpt_rec_t rec;
+    bool have_rec;
+};
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Record Ordering
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static int rec_cmp_key(const ckpt_rec_t* a, const ckpt_rec_t* b) {
+    if (a->type_idx != b->type_idx) return a->type_idx < b->type_idx ? -1 : 1;
+    if (a->id != b->id) return a->id < b->id ? -1 : 1;
+    return 0;
+}
+
+static int rec_cmp(const void* pa, const void* pb) {
+    const ckpt_rec_t* a = (const ckpt_rec_t*)pa;
+    const ckpt_rec_t* b = (const ckpt_rec_t*)pb;
+    int c = rec_cmp_key(a, b);
+    if (c != 0) return c;
+    return a->seq < b->seq ? -1 : (a->seq > b->seq ? 1 : 0);
+}
+
+/**
+ * Fold a newer record for the same key into an older one.
+ * The newer record wins; the older one keeps telling us how the key started.
+ * A PATCH is relative to the last full image, so it inherits that image.
+ */
+static void rec_fold(ckpt_rec_t* older, const ckpt_rec_t* newer) {
+    ckpt_rec_t prev = *older;
+    *older = *newer;
+    older->first_op = prev.first_op;
+
+    if (newer->op != TQDB_WAL_OP_PATCH) return;
+    if (prev.op == TQDB_WAL_OP_ADD || prev.op == TQDB_WAL_OP_UPDATE) {
+        older->base_pos = prev.data_pos;
+        older->base_len = prev.data_len;
+        older->base_op = prev.op;
+    } else if (prev.op == TQDB_WAL_OP_PATCH) {
+        older->base_pos = prev.base_pos;
+        older->base_len = prev.base_len;
+        older->base_op = prev.base_op;
+    }
+}
+
+/**
+ * Sort and reduce the in-memory records: per key, everything up to the
+ * latest non-MERGE record folds into one, followed by the MERGEs after it.
+ */
+static void ckpt_sort_recs(ckpt_t* c) {
+    if (c->rec_count == 0) return;
+
+    qsort(c->recs, c->rec_count, sizeof(ckpt_rec_t), rec_cmp);
+
+    size_t out = 0;
+    size_t i = 0;
+    while (i < c->rec_count) {
+        /* Key group [i, end) and its last non-MERGE record */
+        size_t end = i + 1;
+        while (end < c->rec_count && rec_cmp_key(&c->recs[i], &c->recs[end]) == 0) end++;
+        size_t last = end;
+        for (size_t j = end; j > i; j--) {
+            if (c->recs[j - 1].op != TQDB_WAL_OP_MERGE) {
+                last = j - 1;
+                break;
+            }
+        }
+
+        size_t j = i;
+        if (last < end) {
+            ckpt_rec_t head;
+            bool have_head = false;
+            for (; j <= last; j++) {
+                if (c->recs[j].op == TQDB_WAL_OP_MERGE) continue;  /* Superseded */
+                if (have_head) {
+                    rec_fold(&head, &c->recs[j]);
+                } else {
+                    head = c->recs[j];
+                    have_head = true;
+                }
+            }
+            c->recs[out++] = head;
+        }
+        for (; j < end; j++) c->recs[out++] = c->recs[j];
+        i = end;
+    }
+    c->rec_count = out;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Cursors
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static void cursor_init_file(ckpt_cursor_t* cur, const ckpt_run_t* run,
+                             ckpt_rec_t* window, size_t cap) {
+    cur->buf = window;
+    cur->cap = cap;
+    cur->pos = 0;
+    cur->filled = 0;
+    cur->next = run->start;
+    cur->remaining = run->count;
+}
+
+static const ckpt_rec_t* cursor_peek(ckpt_t* c, ckpt_cursor_t* cur) {
+    if (cur->pos < cur->filled) return &cur->buf[cur->pos];
+    if (cur->remaining == 0) return NULL;
+
+    size_t n = cur->remaining < cur->cap ? cur->remaining : cur->cap;
+    fseek(c->spill, cur->next, SEEK_SET);
+    if (fread(cur->buf, sizeof(ckpt_rec_t), n, c->spill) != n) {
+        cur->remaining = 0;
+        return NULL;
+    }
+    cur->next += (long)(n * sizeof(ckpt_rec_t));
+    cur->remaining -= (uint32_t)n;
+    cur->pos = 0;
+    cur->filled = n;
+    return &cur->buf[0];
+}
+
+/**
+ * Pop the next reduced record from the active cursors.
+ * Records sharing the smallest key fold into one up to the next MERGE;
+ * each MERGE is returned on its own.
+ */
+static bool ckpt_next(ckpt_t* c, ckpt_rec_t* out) {
+    ckpt_cursor_t* min_cur = NULL;
+    const ckpt_rec_t* min_rec = NULL;
+
+    for (size_t i = 0; i < c->cursor_count; i++) {
+        const ckpt_rec_t* rec = cursor_peek(c, &c->cursors[i]);
+        if (rec && (!min_rec || rec_cmp(rec, min_rec) < 0)) {
+            min_rec = rec;
+            min_cur = &c->cursors[i];
+        }
+    }
+    if (!min_rec) return false;
+
+    *out = *min_rec;
+    min_cur->pos++;
+    if (out->op == TQDB_WAL_OP_MERGE) return true;
+
+    /* Fold newer records for the same key (in seq order) */
+    for (;;) {
+        min_rec = NULL;
+        for (size_t i = 0; i < c->cursor_count; i++) {
+            const ckpt_rec_t* rec = cursor_peek(c, &c->cursors[i]);
+            if (rec && rec_cmp_key(rec, out) == 0 &&
+                (!min_rec || rec->seq < min_rec->seq)) {
+                min_rec = rec;
+                min_cur = &c->cursors[i];
+            }
+        }
+        if (!min_rec || min_rec->op == TQDB_WAL_OP_MERGE) break;
+        rec_fold(out, min_rec);
+        min_cur->pos++;
+    }
+
+    return true;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Run Spilling and Merging
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/** Open cursors over runs [first, first + n), one window each */
+static void ckpt_open_runs(ckpt_t* c, size_t first, size_t n, size_t windows) {
+    size_t window = c->rec_cap / windows;
+    for (size_t i = 0; i < n; i++) {
+        cursor_init_file(&c->cursors[i], &c->runs[first + i],
+                         c->recs + i * window, window);
+    }
+    c->cursor_count = n;
+}
+
+/** Merge the top n runs into a single run appended to the spill file */
+static tqdb_err_t ckpt_merge_top(ckpt_t* c, size_t n) {
+    size_t first = c->run_count - n;
+    size_t window = c->rec_cap / (n + 1);
+    ckpt_rec_t* out_buf = c->recs + n * window;
+    size_t out_count = 0;
+
+    ckpt_open_runs(c, first, n, n + 1);
+
+    fseek(c->spill, 0, SEEK_END);
+    ckpt_run_t merged = { ftell(c->spill), 0, 0 };
+    for (size_t i = first; i < c->run_count; i++) {
+        if (c->runs[i].level >= merged.level) merged.level = c->runs[i].level + 1;
+    }
+
+    ckpt_rec_t rec;
+    bool ok = true;
+    while (ok && ckpt_next(c, &rec)) {
+        out_buf[out_count++] = rec;
+        if (out_count == window) {
+            fseek(c->spill, 0, SEEK_END);
+            ok = fwrite(out_buf, sizeof(ckpt_rec_t), out_count, c->spill) == out_count;
+            merged.count += (uint32_t)out_count;
+            out_count = 0;
+        }
+    }
+    if (ok && out_count > 0) {
+        fseek(c->spill, 0, SEEK_END);
+        ok = fwrite(out_buf, sizeof(ckpt_rec_t), out_count, c->spill) == out_count;
+        merged.count += (uint32_t)out_count;
+    }
+    c->cursor_count = 0;
+    if (!ok) return TQDB_ERR_IO;
+
+    c->run_count = first;
+    c->runs[c->run_count++] = merged;
+    return TQDB_OK;
+}
+
+/** Spill the in-memory records as a sorted run */
+static tqdb_err_t ckpt_spill(ckpt_t* c) {
+    if (!c->spill) {
+        c->spill = fopen(c->spill_path, "w+b");
+        if (!c->spill) return TQDB_ERR_IO;
+    }
+
+    ckpt_sort_recs(c);
+
+    fseek(c->spill, 0, SEEK_END);
+    ckpt_run_t run = { ftell(c->spill), (uint32_t)c->rec_count, 0 };
+    if (fwrite(c->recs, sizeof(ckpt_rec_t), c->rec_count, c->spill) != c->rec_count) {
+        return TQDB_ERR_IO;
+    }
+    c->rec_count = 0;
+    c->runs[c->run_count++] = run;
+
+    /* Merge equal-level runs (keeps the run table logarithmic in WAL size) */
+    while (c->run_count >= CKPT_FAN_IN) {
+        const ckpt_run_t* top = &c->runs[c->run_count - CKPT_FAN_IN];
+        bool same_level = true;
+        for (size_t i = c->run_count - CKPT_FAN_IN; i < c->run_count; i++) {
+            if (c->runs[i].level != top->level) same_level = false;
+        }
+        if (!same_level && c->run_count < CKPT_MAX_RUNS) break;
+
+        tqdb_err_t err = ckpt_merge_top(c, CKPT_FAN_IN);
+        if (err != TQDB_OK) return err;
+    }
+
+    return TQDB_OK;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Step Budget
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static bool ckpt_over_budget(ckpt_t* c) {
+    if (c->budget == 0) return false;
+    if (c->db->clock_us) {
+        return (uint32_t)(c->db->clock_us() - c->step_start) >= c->budget;
+    }
+    return c->work >= c->budget;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Phase 1: Sort WAL
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/** Collapse the runs to one cursor set once every entry is sorted */
+static tqdb_err_t ckpt_sort_finish(ckpt_t* c) {
+    if (c->run_count == 0) {
+        /* Everything fit in memory: single in-memory run */
+        ckpt_sort_recs(c);
+        c->cursors[0].buf = c->recs;
+        c->cursors[0].cap = c->rec_count;
+        c->cursors[0].pos = 0;
+        c->cursors[0].filled = c->rec_count;
+        c->cursors[0].remaining = 0;
+        c->cursor_count = 1;
+        return TQDB_OK;
+    }
+
+    if (c->rec_count > 0) {
+        tqdb_err_t err = ckpt_spill(c);
+        if (err != TQDB_OK) return err;
+    }
+    while (c->run_count > CKPT_FAN_IN) {
+        tqdb_err_t err = ckpt_merge_top(c, CKPT_FAN_IN);
+        if (err != TQDB_OK) return err;
+    }
+
+    ckpt_open_runs(c, 0, c->run_count, c->run_count);
+    return TQDB_OK;
+}
+
+/** Sort WAL entries until the budget runs out; the WAL stays positioned */
+static tqdb_err_t ckpt_sort_wal(ckpt_t* c) {
+    tqdb_t db = c->db;
+
+    tqdb_wal_entry_t e;
+    while (c->wal_index < c->wal_count && !ckpt_over_budget(c)) {
+        bool read = c->wal_v1 ? tqdb_wal_read_v1_entry(c->wal, &e)
+                              : tqdb_wal_read_entry(c->wal, &e);
+        if (!read) {
+            c->wal_index = c->wal_count;  /* Torn tail */
+            break;
+        }
+        uint32_t seq = c->wal_index++;
+        c->work += (c->wal_v1 ? TQDB_WAL_V1_ENTRY_HEADER_SIZE : TQDB_WAL_ENTRY_HEADER_SIZE)
+                   + e.data_len;
+        if (e.data_len > 0) fseek(c->wal, e.data_len, SEEK_CUR);
+
+        /* Skip invalid entry */
+        if (e.type_idx >= db->trait_count || e.id == 0) continue;
+
+        if (c->rec_count == c->rec_cap) {
+            tqdb_err_t err = ckpt_spill(c);
+            if (err != TQDB_OK) return err;
+        }
+
+        ckpt_rec_t* rec = &c->recs[c->rec_count++];
+        rec->lsn = e.lsn;
+        rec->id = e.id;
+        rec->seq = seq;
+        rec->data_pos = (uint32_t)e.data_pos;
+        rec->data_len = e.data_len;
+        rec->type_idx = e.type_idx;
+        rec->op = e.op;
+        rec->first_op = e.op;
+        rec->base_pos = 0;
+        rec->base_len = 0;
+        rec->base_op = 0;
+    }
+
+    if (c->wal_index < c->wal_count) return TQDB_OK;  /* Resume next step */
+    return ckpt_sort_finish(c);
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Phase 2: Merge With Main Database
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/** Copy a WAL entry's serialized entity into the output */
+static bool ckpt_copy_entity(ckpt_t* c, tqdb_writer_t* w, const ckpt_rec_t* rec) {
+    fseek(c->wal, rec->data_pos, SEEK_SET);
+
+    uint32_t left = rec->data_len;
+    while (left > 0) {
+        size_t n = left < CKPT_COPY_CHUNK ? left : CKPT_COPY_CHUNK;
+        if (fread(c->copy_buf, 1, n, c->wal) != n) return false;
+        tqdb_write_raw(w, c->copy_buf, n);
+        left -= (uint32_t)n;
+    }
+    return true;
+}
+
+/** Position a reader over WAL data, buffered in copy_buf */
+static void ckpt_wal_reader(ckpt_t* c, tqdb_reader_t* r, uint32_t pos) {
+    fseek(c->wal, pos, SEEK_SET);
+    tqdb_reader_init(r, c->wal, c->copy_buf, CKPT_COPY_CHUNK);
+}
+
+/**
+ * Deserialize the state a folded record leaves: its WAL image, or for a
+ * PATCH the image (or main) it patches. head NULL means main as is.
+ * *out is NULL when there is nothing (deleted, or never reached main).
+ */
+static tqdb_err_t ckpt_materialize(ckpt_t* c, const ckpt_rec_t* head, void* main,
+                                   void** out) {
+    const tqdb_trait_t* trait = c->db->traits[c->type_idx];
+    tqdb_reader_t r;
+
+    *out = NULL;
+    if (head && head->op == TQDB_WAL_OP_DELETE) return TQDB_OK;
+
+    /* Image position: the record itself, or the base under a PATCH */
+    bool patch = head && head->op == TQDB_WAL_OP_PATCH;
+    bool image = head && (!patch || head->base_op != 0);
+    if (!image) {
+        *out = main;
+    } else {
+        if (!c->base_entity) {
+            c->base_entity = tqdb_alloc(c->db, trait->struct_size);
+            if (!c->base_entity) return TQDB_ERR_NO_MEM;
+        }
+        if (trait->init) trait->init(c->base_entity);
+        ckpt_wal_reader(c, &r, patch ? head->base_pos : head->data_pos);
+        trait->read(&r, c->base_entity);
+        c->work += patch ? head->base_len : head->data_len;
+        *out = c->base_entity;
+        if (tqdb_read_error(&r)) {
+            if (trait->destroy) trait->destroy(c->base_entity);
+            *out = NULL;
+            return TQDB_ERR_CORRUPT;
+        }
+    }
+    if (!*out || !patch) return TQDB_OK;
+
+    if (!trait->patch) return TQDB_ERR_CORRUPT;
+    ckpt_wal_reader(c, &r, head->data_pos);
+    trait->patch(&r, *out);
+    c->work += head->data_len;
+    return tqdb_read_error(&r) ? TQDB_ERR_CORRUPT : TQDB_OK;
+}
+
+/** Write a materialized entity and release it unless it is main */
+static void ckpt_write_entity(ckpt_t* c, void* entity, void* main) {
+    const tqdb_trait_t* trait = c->db->traits[c->type_idx];
+    trait->write(&c->w, entity);
+    c->actual_counts[c->type_idx]++;
+    if (entity != main && trait->destroy) trait->destroy(entity);
+}
+
+/**
+ * Emit the current key's WAL records (unless they delete) and advance past
+ * them. main is the main entity they replace, or NULL. Plain records fold
+ * into one head that is copied raw; MERGE records after it are applied to
+ * a deserialized entity, in seq order.
+ */
+static tqdb_err_t ckpt_emit_rec(ckpt_t* c, void* main) {
+    if (c->rec.type_idx != c->type_idx) {
+        c->have_rec = ckpt_next(c, &c->rec);
+        return TQDB_OK;
+    }
+
+    const tqdb_trait_t* trait = c->db->traits[c->type_idx];
+    tqdb_err_t err = TQDB_OK;
+    ckpt_rec_t head;
+    bool have_head = false;
+    void* entity = NULL;        /* State with merges applied */
+    bool folded = false;        /* Merges seen since the head */
+
+    for (;;) {
+        ckpt_rec_t rec = c->rec;
+        if (rec.op == TQDB_WAL_OP_MERGE) {
+            if (!folded && err == TQDB_OK) {
+                err = ckpt_materialize(c, have_head ? &head : NULL, main, &entity);
+            }
+            folded = true;
+            if (entity && err == TQDB_OK) {
+                tqdb_reader_t r;
+                if (!trait->merge) err = TQDB_ERR_CORRUPT;
+                if (err == TQDB_OK) {
+                    ckpt_wal_reader(c, &r, rec.data_pos);
+                    trait->merge(&r, entity);
+                    if (tqdb_read_error(&r)) err = TQDB_ERR_CORRUPT;
+                }
+                c->work += rec.data_len;
+            }
+        } else {
+            /* A full record supersedes the merges before it */
+            if (entity && entity != main && trait->destroy) trait->destroy(entity);
+            entity = NULL;
+            folded = false;
+            if (have_head) {
+                rec_fold(&head, &rec);
+            } else {
+                head = rec;
+                have_head = true;
+            }
+        }
+
+        c->have_rec = ckpt_next(c, &c->rec);
+        if (!c->have_rec || rec_cmp_key(&c->rec, &rec) != 0) break;
+    }
+
+    if (err != TQDB_OK) {
+        if (entity && entity != main && trait->destroy) trait->destroy(entity);
+        return err;
+    }
+    if (folded) {
+        if (entity) ckpt_write_entity(c, entity, main);
+    } else if (head.op == TQDB_WAL_OP_PATCH) {
+        err = ckpt_materialize(c, &head, main, &entity);
+        if (err == TQDB_OK && entity) ckpt_write_entity(c, entity, main);
+    } else if (head.op != TQDB_WAL_OP_DELETE) {
+        if (!ckpt_copy_entity(c, &c->w, &head)) err = TQDB_ERR_CORRUPT;
+        c->actual_counts[c->type_idx]++;
+        c->work += head.data_len;
+    }
+    return err;
+}
+
+static tqdb_err_t ckpt_merge_begin(ckpt_t* c) {
+    tqdb_t db = c->db;
+
+    size_t half = c->io_size / 2;
+    uint8_t* read_buf = c->io_buf;
+    uint8_t* write_buf = c->io_buf + half;
+
+    c->src = tqdb_open_for_read(db);
+    c->dst = fopen(c->out_path, "wb");
+    if (!c->dst) return TQDB_ERR_IO;
+
+    /* Write header placeholder */
+    tqdb_header_t hdr = { TQDB_MAGIC, TQDB_VERSION, 0, 0, 0 };
+    tqdb_write_header(c->dst, &hdr);
+
+    tqdb_writer_init(&c->w, c->dst, write_buf, half);
+
+    /* Read source counts */
+    if (c->src) {
+        for (size_t i = 0; i < db->trait_count; i++) {
+            uint32_t n;
+            if (fread(&n, 4, 1, c->src) != 1) break;
+            if (n <= db->traits[i]->max_count) {
+                c->counts[i] = n;
+            }
+        }
+    }
+
+    /* Write counts placeholder (rewritten once actual counts are known) */
+    c->counts_pos = ftell(c->dst);
+    for (size_t i = 0; i < db->trait_count; i++) {
+        tqdb_write_u32(&c->w, c->counts[i]);
+    }
+
+    if (c->src) {
+        tqdb_reader_init(&c->r, c->src, read_buf, half);
+    }
+
+    c->have_rec = ckpt_next(c, &c->rec);
+    return TQDB_OK;
+}
+
+/**
+ * Merge one unit: a WAL record, a main entity, or a section boundary.
+ * WAL records ordered before the current main entity go first; a record
+ * with the same ID replaces or deletes it.
+ */
+static tqdb_err_t ckpt_merge_unit(ckpt_t* c) {
+    tqdb_t db = c->db;
+    const tqdb_trait_t* trait = db->traits[c->type_idx];
+
+    if (!c->entity) {
+        c->entity = tqdb_alloc(db, trait->struct_size);
+        if (!c->entity) return TQDB_ERR_NO_MEM;
+    }
+
+    /* Existing entities from main DB */
+    if (c->src && c->main_index < c->counts[c->type_idx]) {
+        if (!c->have_entity) {
+            if (trait->init) trait->init(c->entity);
+            trait->read(&c->r, c->entity);
+            if (tqdb_read_error(&c->r)) {
+                c->main_index = c->counts[c->type_idx];
+                return TQDB_OK;
+            }
+            c->have_entity = true;
+            c->work += (uint32_t)trait->struct_size;
+        }
+
+        uint32_t entity_id = trait->get_id(c->entity);
+        if (c->have_rec && c->rec.type_idx <= c->type_idx &&
+            (c->rec.type_idx < c->type_idx || c->rec.id < entity_id)) {
+            return ckpt_emit_rec(c, NULL);
+        }
+
+        tqdb_err_t err = TQDB_OK;
+        if (c->have_rec && c->rec.type_idx == c->type_idx && c->rec.id == entity_id) {
+            /* Replaced, patched or deleted by the WAL */
+            err = ckpt_emit_rec(c, c->entity);
+        } else {
+            trait->write(&c->w, c->entity);
+            c->actual_counts[c->type_idx]++;
+        }
+
+        if (trait->destroy) trait->destroy(c->entity);
+        c->have_entity = false;
+        c->main_index++;
+        return err;
+    }
+
+    /* Remaining WAL entries of this type are new entities */
+    if (c->have_rec && c->rec.type_idx <= c->type_idx) {
+        return ckpt_emit_rec(c, NULL);
+    }
+
+    tqdb_dealloc(db, c->entity);
+    c->entity = NULL;
+    if (c->base_entity) {
+        tqdb_dealloc(db, c->base_entity);
+        c->base_entity = NULL;
+    }
+    c->type_idx++;
+    c->main_index = 0;
+    return TQDB_OK;
+}
+
+static tqdb_err_t ckpt_merge_end(ckpt_t* c) {
+    tqdb_t db = c->db;
+
+    if (c->src) {
+        fclose(c->src);
+        c->src = NULL;
+    }
+
+    /* Finalize writer */
+    tqdb_writer_flush(&c->w);
+    if (tqdb_write_error(&c->w)) return TQDB_ERR_IO;
+
+    /* Rewrite counts */
+    fseek(c->dst, c->counts_pos, SEEK_SET);
+    for (size_t i = 0; i < db->trait_count; i++) {
+        fwrite(&c->actual_counts[i], 4, 1, c->dst);
+    }
+
+    /* Patch CRC in header */
+    uint32_t crc = tqdb_writer_crc(&c->w);
+    fseek(c->dst, 8, SEEK_SET);
+    fwrite(&crc, 4, 1, c->dst);
+
+    fflush(c->dst);
+    fclose(c->dst);
+    c->dst = NULL;
+
+    return TQDB_OK;
+}
+
+static tqdb_err_t ckpt_merge_main(ckpt_t* c) {
+    tqdb_err_t err = TQDB_OK;
+    while (err == TQDB_OK && c->type_idx < c->db->trait_count && !ckpt_over_budget(c)) {
+        err = ckpt_merge_unit(c);
+    }
+    if (err != TQDB_OK || c->type_idx < c->db->trait_count) return err;
+    return ckpt_merge_end(c);
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Checkpoint Driver
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static void ckpt_cleanup(ckpt_t* c) {
+    if (c->wal) fclose(c->wal);
+    if (c->spill) {
+        fclose(c->spill);
+        remove(c->spill_path);
+    }
+    if (c->src) fclose(c->src);
+    if (c->dst) {
+        /* Unfinished output */
+        fclose(c->dst);
+        remove(c->out_path);
+    }
+    if (c->entity) {
+        if (c->have_entity && c->db->traits[c->type_idx]->destroy) {
+            c->db->traits[c->type_idx]->destroy(c->entity);
+        }
+        tqdb_dealloc(c->db, c->entity);
+    }
+    if (c->base_entity) tqdb_dealloc(c->db, c->base_entity);
+    tqdb_dealloc(c->db, c->spill_path);
+    tqdb_dealloc(c->db, c->mem);
+}
+
+static tqdb_err_t ckpt_open(ckpt_t* c, tqdb_t db, const char* wal_path, uint32_t entry_count,
+                            const char* out_path, uint8_t* buf, size_t buf_size) {
+    memset(c, 0, sizeof(*c));
+    c->db = db;
+    c->wal_count = entry_count;
+    c->out_path = out_path;
+    c->io_buf = buf;
+    c->io_size = buf_size;
+    c->phase = CKPT_PHASE_SORT;
+
+    size_t budget = db->wal.ckpt_mem_budget;
+    if (budget < CKPT_MIN_BUDGET) budget = CKPT_MIN_BUDGET;
+
+    size_t path_len = strlen(db->db_path) + 7;
+    c->spill_path = (char*)tqdb_alloc(db, path_len);
+    c->mem = (uint8_t*)tqdb_alloc(db, budget);
+    if (!c->spill_path || !c->mem) return TQDB_ERR_NO_MEM;
+    snprintf(c->spill_path, path_len, "%s.spill", db->db_path);
+
+    c->copy_buf = c->mem;
+    c->recs = (ckpt_rec_t*)(c->mem + CKPT_COPY_CHUNK);
+    c->rec_cap = (budget - CKPT_COPY_CHUNK) / sizeof(ckpt_rec_t);
+
+    c->wal = fopen(wal_path, "rb");
+    if (!c->wal) return TQDB_ERR_IO;
+    tqdb_wal_header_t hdr;
+    if (!tqdb_wal_read_header(c->wal, &hdr)) return TQDB_ERR_IO;  /* Leaves c->wal at entries */
+    c->wal_v1 = hdr.version < 2;
+
+    return TQDB_OK;
+}
+
+/** Advance through the phases until done or out of budget */
+static tqdb_err_t ckpt_run(ckpt_t* c, uint32_t budget) {
+    c->budget = budget;
+    c->work = 0;
+    if (budget > 0 && c->db->clock_us) c->step_start = c->db->clock_us();
+
+    tqdb_err_t err = TQDB_OK;
+    while (err == TQDB_OK && c->phase != CKPT_PHASE_DONE && !ckpt_over_budget(c)) {
+        switch (c->phase) {
+        case CKPT_PHASE_SORT:
+            err = ckpt_sort_wal(c);
+            if (err == TQDB_OK && c->wal_index == c->wal_count) {
+                err = ckpt_merge_begin(c);
+                c->phase = CKPT_PHASE_MERGE;
+            }
+            break;
+        case CKPT_PHASE_MERGE:
+            err = ckpt_merge_main(c);
+            if (err == TQDB_OK && !c->dst) c->phase = CKPT_PHASE_DONE;
+            break;
+        }
+    }
+    return err;
+}
+
+/**
+ * Merge one WAL segment with the main DB into out_path.
+ * Touches no shared state besides reading the main file, so it can run on
+ * a worker thread given its own buf.
+ */
+tqdb_err_t tqdb_checkpoint_merge_segment(tqdb_t db, const char* wal_path, uint32_t entry_count,
+                                         const char* out_path, uint8_t* buf, size_t buf_size) {
+    ckpt_t c;
+    tqdb_err_t err = ckpt_open(&c, db, wal_path, entry_count, out_path, buf, buf_size);
+    if (err == TQDB_OK) err = ckpt_run(&c, 0);
+    ckpt_cleanup(&c);
+    return err;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * WAL Compaction
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/** Append a reduced record to the compacted WAL, CRC patched after the data */
+static bool compact_write(ckpt_t* c, FILE* out, const ckpt_rec_t* rec, uint8_t op) {
+    uint32_t data_len = op == TQDB_WAL_OP_DELETE ? 0 : rec->data_len;
+    long start = ftell(out);
+
+    uint32_t crc = 0xFFFFFFFF;
+    crc = tqdb_crc32_update(crc, &op, 1);
+    crc = tqdb_crc32_update(crc, &rec->type_idx, 1);
+    crc = tqdb_crc32_update(crc, (const uint8_t*)&rec->id, 4);
+    crc = tqdb_crc32_update(crc, (const uint8_t*)&rec->lsn, 8);
+    crc = tqdb_crc32_update(crc, (const uint8_t*)&data_len, 4);
+
+    bool ok = fwrite(&crc, 4, 1, out) == 1
+        && fwrite(&op, 1, 1, out) == 1
+        && fwrite(&rec->type_idx, 1, 1, out) == 1
+        && fwrite(&rec->id, 4, 1, out) == 1
+        && fwrite(&rec->lsn, 8, 1, out) == 1
+        && fwrite(&data_len, 4, 1, out) == 1;
+
+    fseek(c->wal, rec->data_pos, SEEK_SET);
+    uint32_t left = data_len;
+    while (ok && left > 0) {
+        size_t n = left < CKPT_COPY_CHUNK ? left : CKPT_COPY_CHUNK;
+        ok = fread(c->copy_buf, 1, n, c->wal) == n
+            && fwrite(c->copy_buf, 1, n, out) == n;
+        crc = tqdb_crc32_update(crc, c->copy_buf, n);
+        left -= (uint32_t)n;
+    }
+    if (!ok) return false;
+
+    crc = tqdb_crc32_finalize(crc);
+    fseek(out, start, SEEK_SET);
+    ok = fwrite(&crc, 4, 1, out) == 1;
+    fseek(out, 0, SEEK_END);
+    return ok;
+}
+
+/**
+ * Rewrite the active WAL with one record per (type, id), reusing the
+ * checkpoint sort. An entity added in this WAL keeps ADD with its latest
+ * image, or vanishes if it was deleted again. A trailing PATCH keeps its
+ * base image in front of it, and MERGE operands after the last full record
+ * are kept as they are. Records keep their LSNs; the keys of dropped ones go
+ * to the change feed history, or the feed floor rises past vanished
+ * entities. The main file is untouched.
+ */
+tqdb_err_t tqdb_checkpoint_compact(tqdb_t db) {
+    if (!db->wal.enabled || db->wal.entry_count == 0) return TQDB_OK;
+
+    ckpt_t c;
+    tqdb_err_t err = ckpt_open(&c, db, db->wal.path, db->wal.entry_count, NULL, NULL, 0);
+    if (err == TQDB_OK) err = ckpt_sort_wal(&c);  /* No budget: sorts everything */
+    if (err == TQDB_OK && db->wal.hist_max > 0) tqdb_wal_retire(db, db->wal.path);
+
+    FILE* out = NULL;
+    if (err == TQDB_OK) {
+        out = fopen(db->wal.compact_path, "wb");
+        if (!out) err = TQDB_ERR_IO;
+    }
+
+    tqdb_wal_header_t hdr = {
+        .magic = TQDB_WAL_MAGIC,
+        .version = TQDB_WAL_VERSION,
+        .flags = 0,
+        .db_crc = db->wal.db_crc,
+        .entry_count = 0,
+        .last_lsn = db->wal.last_lsn,
+        .floor_lsn = db->wal.floor_lsn
+    };
+    if (err == TQDB_OK && !tqdb_wal_write_header(out, &hdr)) err = TQDB_ERR_IO;
+    uint64_t vanished = 0;  /* Newest LSN of an entity that leaves no record */
+
+    /* Refill the key set as records are written: every surviving key is unique */
+    tqdb_wal_keys_clear(db);
+    bool keys_ok = true;
+
+    ckpt_rec_t rec;
+    while (err == TQDB_OK && ckpt_next(&c, &rec)) {
+        uint8_t op = rec.op;
+        if (rec.first_op == TQDB_WAL_OP_ADD) {
+            if (op == TQDB_WAL_OP_DELETE) {
+                /* Never reached the main file */
+                if (rec.lsn > vanished) vanished = rec.lsn;
+                continue;
+            }
+            if (op != TQDB_WAL_OP_PATCH) op = TQDB_WAL_OP_ADD;
+        }
+        if (rec.op == TQDB_WAL_OP_PATCH && rec.base_op != 0) {
+            ckpt_rec_t base = rec;  /* Shares the PATCH's LSN */
+            base.data_pos = rec.base_pos;
+            base.data_len = rec.base_len;
+            uint8_t base_op = rec.first_op == TQDB_WAL_OP_ADD ? TQDB_WAL_OP_ADD
+                                                              : TQDB_WAL_OP_UPDATE;
+            if (!compact_write(&c, out, &base, base_op)) {
+                err = TQDB_ERR_IO;
+                break;
+            }
+            hdr.entry_count++;
+        }
+        if (!compact_write(&c, out, &rec, op)) {
+            err = TQDB_ERR_IO;
+            break;
+        }
+        hdr.entry_count++;
+        keys_ok = keys_ok && tqdb_wal_key_add(db, op, rec.type_idx, rec.id);
+    }
+
+    long size = 0;
+    if (err == TQDB_OK) {
+        if (db->wal.hist_max == 0 && vanished > hdr.floor_lsn) hdr.floor_lsn = vanished;
+        if (!tqdb_wal_write_header(out, &hdr)) err = TQDB_ERR_IO;
+        fseek(out, 0, SEEK_END);
+        size = ftell(out);
+        if (fflush(out) != 0) err = TQDB_ERR_IO;
+    }
+    if (out) fclose(out);
+    ckpt_cleanup(&c);
+
+    if (err == TQDB_OK) db->files_gen++;
+    if (err == TQDB_OK && rename(db->wal.compact_path, db->wal.path) != 0) {
+        /* Platforms that refuse to rename over a file; recovery finishes this */
+        remove(db->wal.path);
+        if (rename(db->wal.compact_path, db->wal.path) != 0) {
+            tqdb_wal_keys_clear(db);
+            return TQDB_ERR_IO;  /* Keep the compacted copy: it is the only one */
+        }
+    }
+    if (err != TQDB_OK) {
+        remove(db->wal.compact_path);
+        tqdb_wal_keys_clear(db);  /* Behind the old WAL: rebuilt if asked again */
+        return err;
+    }
+
+    db->wal.entry_count = hdr.entry_count;
+    db->wal.file_size = (uint32_t)size;
+    db->wal.floor_lsn = hdr.floor_lsn;
+    if (keys_ok) {
+        db->wal.key_entries = hdr.entry_count;  /* Base images ride with their PATCH */
+        db->wal.dup_count = 0;
+    } else {
+        tqdb_wal_keys_clear(db);
+    }
+    db->wal.scan_bytes = 0;  /* The main file is untouched: its cost still holds */
+    return TQDB_OK;
+}
+
+/** Merge a segment on the calling thread and install the result */
+static tqdb_err_t merge_segment_sync(tqdb_t db, const char* wal_path, uint32_t entry_count) {
+    tqdb_err_t err = tqdb_checkpoint_merge_segment(db, wal_path, entry_count,
+                                                   db->tmp_path, db->scratch, db->scratch_size);
+    if (err != TQDB_OK) return err;
+
+    err = tqdb_install_file(db, db->tmp_path);
+    if (err != TQDB_OK) return err;
+
+#if TQDB_ENABLE_CACHE
+    /* Clear cache after checkpoint */
+    if (db->cache) {
+        tqdb_cache_invalidate_all(db);
+    }
+#endif
+
+    return TQDB_OK;
+}
+
+/**
+ * Merge WAL entries into main database.
+ * Called by tqdb_wal_checkpoint_internal(). The frozen segment (if any)
+ * is older than the active WAL, so it is merged first.
+ */
+tqdb_err_t tqdb_checkpoint_merge(tqdb_t db) {
+    if (!db || !db->wal.enabled || !db->wal.path) return TQDB_OK;
+
+    /* A failed worker leaves its frozen segment for the retry below */
+    tqdb_checkpoint_wait(db);
+
+    tqdb_err_t err;
+    if (db->wal.frozen_count > 0) {
+        /* Left over from a failed worker or a crash */
+        err = merge_segment_sync(db, db->wal.frozen_path, db->wal.frozen_count);
+        if (err != TQDB_OK) return err;
+        tqdb_wal_retire(db, db->wal.frozen_path);
+        remove(db->wal.frozen_path);
+        db->wal.frozen_count = 0;
+        db->wal.frozen_size = 0;
+    }
+
+    if (db->wal.entry_count == 0) return TQDB_OK;
+    return merge_segment_sync(db, db->wal.path, db->wal.entry_count);
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Background Checkpoint
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/**
+ * Worker: merge the frozen segment into db_path + ".ckpt".
+ * Writers keep appending to the active WAL and readers keep using the old
+ * main file plus both segments; only the final install (done by the next
+ * locked caller) changes what they see.
+ */
+static void ckpt_worker(void* arg) {
+    tqdb_t db = (tqdb_t)arg;
+
+    tqdb_err_t err = tqdb_checkpoint_merge_segment(db, db->wal.frozen_path,
+                                                   db->wal.frozen_count, db->wal.ckpt_path,
+                                                   db->wal.ckpt_buf, db->scratch_size);
+
+    db->mutex_ops->lock(db->wal.ckpt_flag, UINT32_MAX);
+    db->wal.ckpt_result = err;
+    db->wal.ckpt_done = true;
+    db->mutex_ops->unlock(db->wal.ckpt_flag);
+}
+
+static bool ckpt_is_done(tqdb_t db) {
+    db->mutex_ops->lock(db->wal.ckpt_flag, UINT32_MAX);
+    bool done = db->wal.ckpt_done;
+    db->mutex_ops->unlock(db->wal.ckpt_flag);
+    return done;
+}
+
+/** Install a merged frozen segment and drop the segment */
+static tqdb_err_t ckpt_install_frozen(tqdb_t db) {
+    tqdb_err_t err = tqdb_install_file(db, db->wal.ckpt_path);
+    if (err != TQDB_OK) {
+        /* Keep the frozen segment; the next checkpoint retries it */
+        remove(db->wal.ckpt_path);
+        return err;
+    }
+
+    tqdb_wal_retire(db, db->wal.frozen_path);
+    remove(db->wal.frozen_path);
+    db->wal.frozen_count = 0;
+    db->wal.frozen_size = 0;
+
+    /* Cached entities are still current: the logical contents did not change */
+    return TQDB_OK;
+}
+
+/** Join the finished worker and swap in its output (caller holds the lock) */
+static tqdb_err_t ckpt_finish(tqdb_t db) {
+    db->thread_ops->join(db->wal.ckpt_thread);
+    db->wal.ckpt_thread = NULL;
+    db->wal.ckpt_running = false;
+    db->wal.ckpt_done = false;
+
+    tqdb_dealloc(db, db->wal.ckpt_buf);
+    db->wal.ckpt_buf = NULL;
+
+    if (db->wal.ckpt_result != TQDB_OK) {
+        remove(db->wal.ckpt_path);
+        return db->wal.ckpt_result;
+    }
+    return ckpt_install_frozen(db);
+}
+
+void tqdb_checkpoint_poll(tqdb_t db) {
+    if (!db->wal.ckpt_running || !ckpt_is_done(db)) return;
+    ckpt_finish(db);
+}
+
+bool tqdb_checkpoint_due(tqdb_t db) {
+    if (db->wal.ckpt_running && ckpt_is_done(db)) return true;
+    return tqdb_wal_should_checkpoint(db);
+}
+
+/** Freeze the active WAL as the frozen segment and start a fresh one */
+static tqdb_err_t ckpt_freeze(tqdb_t db) {
+    remove(db->wal.frozen_path);
+    if (rename(db->wal.path, db->wal.frozen_path) != 0) return TQDB_ERR_IO;
+    db->wal.frozen_count = db->wal.entry_count;
+    db->wal.frozen_size = db->wal.file_size;
+
+    return tqdb_wal_reset(db);
+}
+
+tqdb_err_t tqdb_checkpoint_rotate(tqdb_t db) {
+    tqdb_checkpoint_poll(db);
+    if (db->wal.ckpt_running || db->wal.step) {
+        return TQDB_OK;  /* Keep appending until it lands */
+    }
+
+    if (db->wal.frozen_count == 0) {
+        tqdb_err_t err = ckpt_freeze(db);
+        if (err != TQDB_OK) return err;
+    }
+
+    db->wal.ckpt_buf = (uint8_t*)tqdb_alloc(db, db->scratch_size);
+    if (!db->wal.ckpt_buf) return TQDB_ERR_NO_MEM;
+
+    db->wal.ckpt_done = false;
+    db->wal.ckpt_running = true;
+    db->wal.ckpt_thread = db->thread_ops->start(ckpt_worker, db);
+    if (!db->wal.ckpt_thread) {
+        /* No thread available: merge the frozen segment inline */
+        db->wal.ckpt_running = false;
+        tqdb_dealloc(db, db->wal.ckpt_buf);
+        db->wal.ckpt_buf = NULL;
+        return tqdb_checkpoint_merge(db);
+    }
+
+    return TQDB_OK;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Incremental Checkpoint
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static void step_release(tqdb_t db) {
+    ckpt_cleanup(db->wal.step);
+    tqdb_dealloc(db, db->wal.step);
+    tqdb_dealloc(db, db->wal.step_buf);
+    db->wal.step = NULL;
+    db->wal.step_buf = NULL;
+}
+
+/**
+ * Run the stepped merge for up to budget (0 = to completion).
+ * Installs the result when the merge completes; on error the partial
+ * output is dropped and the frozen segment kept for a retry.
+ */
+static tqdb_err_t step_advance(tqdb_t db, uint32_t budget, bool* out_done) {
+    ckpt_t* c = db->wal.step;
+
+    tqdb_err_t err = ckpt_run(c, budget);
+    if (err == TQDB_OK && c->phase != CKPT_PHASE_DONE) {
+        *out_done = false;
+        return TQDB_OK;
+    }
+
+    step_release(db);
+    if (err == TQDB_OK) err = ckpt_install_frozen(db);
+    *out_done = err == TQDB_OK;
+    return err;
+}
+
+tqdb_err_t tqdb_checkpoint_wait(tqdb_t db) {
+    if (db->wal.step) {
+        bool done;
+        return step_advance(db, 0, &done);
+    }
+    if (!db->wal.ckpt_running) return TQDB_OK;
+    return ckpt_finish(db);  /* join blocks until the worker returns */
+}
+
+tqdb_err_t tqdb_checkpoint_step(tqdb_t db, uint32_t budget_us, bool* out_done) {
+    bool done = true;
+    if (out_done) *out_done = true;
+    if (!db) return TQDB_ERR_INVALID_ARG;
+    if (!db->wal.enabled) return TQDB_OK;
+#if TQDB_ENABLE_MULTIPROC
+    if (db->mp.shm) return TQDB_ERR_INVALID_ARG;  /* Steps would span file locks */
+#endif
+
+    /* Check for deferred WAL recovery */
+    tqdb_wal_check_recovery(db);
+
+    if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
+
+    tqdb_err_t err = TQDB_OK;
+    tqdb_checkpoint_poll(db);
+    if (db->wal.ckpt_running) {
+        /* A worker owns the frozen segment */
+        done = false;
+    } else {
+        if (!db->wal.step && db->wal.frozen_count == 0 && db->wal.entry_count > 0) {
+            err = ckpt_freeze(db);
+        }
+        if (err == TQDB_OK && !db->wal.step && db->wal.frozen_count > 0) {
+            db->wal.step = (ckpt_t*)tqdb_alloc(db, sizeof(ckpt_t));
+            db->wal.step_buf = (uint8_t*)tqdb_alloc(db, db->scratch_size);
+            if (!db->wal.step || !db->wal.step_buf) {
+                tqdb_dealloc(db, db->wal.step);
+                tqdb_dealloc(db, db->wal.step_buf);
+                db->wal.step = NULL;
+                db->wal.step_buf = NULL;
+                err = TQDB_ERR_NO_MEM;
+            } else {
+                err = ckpt_open(db->wal.step, db, db->wal.frozen_path, db->wal.frozen_count,
+                                db->wal.ckpt_path, db->wal.step_buf, db->scratch_size);
+                if (err != TQDB_OK) step_release(db);
+            }
+        }
+        if (err == TQDB_OK && db->wal.step) {
+            err = step_advance(db, budget_us, &done);
+        }
+    }
+
+    tqdb_unlock(db);
+    if (out_done) *out_done = done && err == TQDB_OK;
+    return err;
+}
+
+#endif /* TQDB_ENABLE_WAL */
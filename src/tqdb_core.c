@@ -69,7 +69,7 @@ int tqdb_find_trait_index(tqdb_t db, const char* name) {
  * File Header I/O
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-static bool write_header(FILE* f, const tqdb_header_t* h) {
+bool tqdb_write_header(FILE* f, const tqdb_header_t* h) {
     return fwrite(&h->magic, 4, 1, f) == 1
         && fwrite(&h->version, 2, 1, f) == 1
         && fwrite(&h->flags, 2, 1, f) == 1
@@ -89,7 +89,7 @@ static bool read_header(FILE* f, tqdb_header_t* h) {
  * File Recovery
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-static FILE* open_for_read(tqdb_t db) {
+FILE* tqdb_open_for_read(tqdb_t db) {
     FILE* f = fopen(db->db_path, "rb");
     if (!f) {
         /* Try recovering from temp or backup */
@@ -123,6 +123,758 @@ static FILE* open_for_read(tqdb_t db) {
     return f;
 }
 
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Atomic File Install
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+tqdb_err_t tqdb_install_file(tqdb_t db, const char* tmp_path) {
+    /* Keep the old file as backup until the new one is in place */
+    db->files_gen++;
+    remove(db->bak_path);
+    rename(db->db_path, db->bak_path);
+    if (rename(tmp_path, db->db_path) != 0) {
+        rename(db->bak_path, db->db_path);
+        return TQDB_ERR_IO;
+    }
+    remove(db->bak_path);
+#if TQDB_ENABLE_WAL
+    db->wal.main_cost_known = false;
+#endif
+
+    return TQDB_OK;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Section Navigation
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+void tqdb_skip_to_type(tqdb_t db, tqdb_reader_t* r, const uint32_t* counts, int type_idx,
+                       void** temp) {
+    for (int i = 0; i < type_idx; i++) {
+        const tqdb_trait_t* t = db->traits[i];
+        for (uint32_t j = 0; j < counts[i] && !tqdb_read_error(r); j++) {
+            if (t->skip) {
+                t->skip(r);
+            } else {
+                /* Must read and discard */
+                void* tmp = temp ? temp[i] : NULL;
+                if (!tmp) {
+                    tmp = tqdb_alloc(db, t->struct_size);
+                    if (!tmp) {
+                        r->error = true;
+                        return;
+                    }
+                    if (temp) temp[i] = tmp;
+                }
+                if (t->init) t->init(tmp);
+                t->read(r, tmp);
+                if (t->destroy) t->destroy(tmp);
+                if (!temp) tqdb_dealloc(db, tmp);
+            }
+        }
+    }
+}
+
+tqdb_err_t tqdb_main_find(tqdb_session_t session, uint8_t type_idx, uint32_t id, void* out) {
+    tqdb_t db = session->db;
+    const tqdb_trait_t* trait = db->traits[type_idx];
+
+    if (trait->init) trait->init(out);
+
+    FILE* f = tqdb_session_main(session);
+    if (!f) return TQDB_ERR_NOT_FOUND;
+
+    /* Read counts */
+    uint32_t counts[TQDB_MAX_ENTITY_TYPES] = {0};
+    for (size_t i = 0; i < db->trait_count; i++) {
+        fread(&counts[i], 4, 1, f);
+    }
+
+    tqdb_reader_t r;
+    tqdb_reader_init(&r, f, session->buf, db->scratch_size);
+
+    tqdb_err_t result = TQDB_ERR_NOT_FOUND;
+
+    /* Skip to target type */
+    tqdb_skip_to_type(db, &r, counts, type_idx, session->temp);
+
+    /* Search in target type */
+    for (uint32_t i = 0; i < counts[type_idx] && !tqdb_read_error(&r); i++) {
+        trait->read(&r, out);
+        if (trait->get_id(out) == id) {
+            result = TQDB_OK;
+            break;
+        }
+        /* Reset for next read */
+        if (trait->destroy) trait->destroy(out);
+        if (trait->init) trait->init(out);
+    }
+
+    tqdb_session_put(session, f);
+    return result;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Session Files
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static void session_drop_files(tqdb_session_t session) {
+    if (session->main) fclose(session->main);
+    session->main = NULL;
+#if TQDB_ENABLE_WAL
+    for (size_t i = 0; i < TQDB_WAL_MAX_SEGMENTS; i++) {
+        if (session->seg_files[i]) fclose(session->seg_files[i]);
+        session->seg_files[i] = NULL;
+        session->seg_paths[i] = NULL;
+    }
+#endif
+}
+
+/* Held files are only good until a checkpoint replaces them (session entered) */
+static void session_sync(tqdb_session_t session) {
+    if (session->files_gen == session->view_gen) return;
+    session_drop_files(session);
+    session->files_gen = session->view_gen;
+}
+
+FILE* tqdb_session_main(tqdb_session_t session) {
+    if (!session->keep_files) return tqdb_open_for_read(session->db);
+
+    session_sync(session);
+    if (session->main) {
+        fseek(session->main, TQDB_HEADER_SIZE, SEEK_SET);
+    } else {
+        session->main = tqdb_open_for_read(session->db);
+    }
+    return session->main;
+}
+
+FILE* tqdb_session_seg(tqdb_session_t session, const char* path) {
+    if (!session->keep_files) return fopen(path, "rb");
+
+#if TQDB_ENABLE_WAL
+    /* Segments are the WAL and its frozen part, so each path has a slot */
+    session_sync(session);
+    size_t slot = TQDB_WAL_MAX_SEGMENTS;
+    for (size_t i = 0; i < TQDB_WAL_MAX_SEGMENTS; i++) {
+        if (session->seg_paths[i] == path) return session->seg_files[i];
+        if (!session->seg_paths[i] && slot == TQDB_WAL_MAX_SEGMENTS) slot = i;
+    }
+    if (slot == TQDB_WAL_MAX_SEGMENTS) slot = 0;
+
+    if (session->seg_files[slot]) fclose(session->seg_files[slot]);
+    session->seg_files[slot] = fopen(path, "rb");
+    session->seg_paths[slot] = session->seg_files[slot] ? path : NULL;
+    return session->seg_files[slot];
+#else
+    return fopen(path, "rb");
+#endif
+}
+
+void tqdb_session_put(tqdb_session_t session, FILE* f) {
+    if (f && !session->keep_files) fclose(f);
+}
+
+#if TQDB_ENABLE_WAL
+void tqdb_session_note_scan(tqdb_session_t session) {
+    session->scans++;
+}
+
+/* Charge the session's WAL scans to the read penalty (reader state held) */
+static void session_charge_scans(tqdb_session_t session) {
+    for (; session->scans > 0; session->scans--) tqdb_wal_note_scan(session->db);
+}
+#endif
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Live-ID Bitmaps
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/**
+ * One bit per ID, set while the entity exists. IDs are assigned densely, so
+ * the bitmap stays small and answers existence, misses and counts without
+ * touching the files. Built on first use from the main section and the WAL
+ * (caller holds the lock); writes keep it current after that.
+ */
+static bool live_grow(tqdb_t db, tqdb_live_t* live, uint32_t id) {
+    size_t bytes = live->bytes ? live->bytes : 16;
+    while (bytes <= id / 8) bytes *= 2;
+    if (bytes == live->bytes) return true;
+
+    uint8_t* bits = (uint8_t*)tqdb_alloc(db, bytes);
+    if (!bits) return false;
+    memset(bits, 0, bytes);
+    if (live->bits) {
+        memcpy(bits, live->bits, live->bytes);
+        tqdb_dealloc(db, live->bits);
+    }
+    live->bits = bits;
+    live->bytes = bytes;
+    return true;
+}
+
+static void live_set(tqdb_live_t* live, uint32_t id, bool on) {
+    uint8_t mask = (uint8_t)(1u << (id & 7));
+    bool was = (live->bits[id / 8] & mask) != 0;
+    if (on && !was) {
+        live->bits[id / 8] |= mask;
+        live->count++;
+    } else if (!on && was) {
+        live->bits[id / 8] &= (uint8_t)~mask;
+        live->count--;
+    }
+}
+
+static void live_drop(tqdb_t db, tqdb_live_t* live) {
+    tqdb_dealloc(db, live->bits);
+    memset(live, 0, sizeof(*live));
+}
+
+static bool live_build(tqdb_t db, int type_idx) {
+    const tqdb_trait_t* trait = db->traits[type_idx];
+    tqdb_live_t* live = &db->live[type_idx];
+    bool ok = live_grow(db, live, 0);
+
+    FILE* f = tqdb_open_for_read(db);
+    void* tmp = tqdb_alloc(db, trait->struct_size);
+    if (!tmp) ok = false;
+    if (f && ok) {
+        uint32_t counts[TQDB_MAX_ENTITY_TYPES] = {0};
+        for (size_t i = 0; i < db->trait_count; i++) {
+            fread(&counts[i], 4, 1, f);
+        }
+
+        tqdb_reader_t r;
+        tqdb_reader_init(&r, f, db->scratch, db->scratch_size);
+        tqdb_skip_to_type(db, &r, counts, type_idx, db->session.temp);
+
+        for (uint32_t i = 0; ok && i < counts[type_idx]; i++) {
+            if (trait->init) trait->init(tmp);
+            trait->read(&r, tmp);
+            if (tqdb_read_error(&r)) {
+                ok = false;
+                break;
+            }
+            uint32_t id = trait->get_id(tmp);
+            if (trait->destroy) trait->destroy(tmp);
+            ok = live_grow(db, live, id);
+            if (ok) live_set(live, id, true);
+        }
+    }
+    tqdb_dealloc(db, tmp);
+    if (f) fclose(f);
+
+#if TQDB_ENABLE_WAL
+    /* Net effect of the WAL, oldest segment first */
+    if (ok && db->wal.enabled && tqdb_wal_pending(db) > 0) {
+        tqdb_wal_seg_t segs[TQDB_WAL_MAX_SEGMENTS];
+        size_t seg_count = tqdb_wal_segments(db, segs);
+        for (size_t s = 0; ok && s < seg_count; s++) {
+            FILE* wal = fopen(segs[s].path, "rb");
+            if (!wal) {
+                ok = false;
+                break;
+            }
+            fseek(wal, TQDB_WAL_HEADER_SIZE, SEEK_SET);
+
+            tqdb_wal_entry_t e;
+            for (uint32_t i = 0; i < segs[s].entry_count && tqdb_wal_read_entry(wal, &e); i++) {
+                if (e.data_len > 0) fseek(wal, e.data_len, SEEK_CUR);
+                if (e.type_idx != (uint8_t)type_idx) continue;
+                if (e.op == TQDB_WAL_OP_ADD || e.op == TQDB_WAL_OP_DELETE) {
+                    ok = live_grow(db, live, e.id);
+                    if (!ok) break;
+                    live_set(live, e.id, e.op == TQDB_WAL_OP_ADD);
+                }
+            }
+            fclose(wal);
+        }
+    }
+#endif
+
+    if (!ok) live_drop(db, live);
+    return ok;
+}
+
+/* Build a type's bitmap on demand, unless other readers may run (caller holds the lock) */
+static bool live_ready(tqdb_t db, int type_idx) {
+    if (db->live[type_idx].bits) return true;
+    return !db->reader_lock && live_build(db, type_idx);
+}
+
+/* 1 if id exists, 0 if not, -1 if the bitmap is unavailable (caller holds the lock) */
+static int live_test(tqdb_t db, int type_idx, uint32_t id) {
+    tqdb_live_t* live = &db->live[type_idx];
+    if (!live_ready(db, type_idx)) return -1;
+    if (id / 8 >= live->bytes) return 0;
+    return (live->bits[id / 8] >> (id & 7)) & 1;
+}
+
+void tqdb_live_note(tqdb_t db, uint8_t type_idx, uint32_t id, bool exists) {
+    tqdb_live_t* live = &db->live[type_idx];
+    if (!live->bits) return;  /* Built from the files on first use */
+    if (!live_grow(db, live, id)) {
+        live_drop(db, live);
+        return;
+    }
+    live_set(live, id, exists);
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Resident Types
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static tqdb_err_t view_foreach(const struct tqdb_snapshot_s* view, int type_idx,
+                               const tqdb_trait_t* trait, void** temp,
+                               tqdb_iter_fn fn, void* ctx);
+static tqdb_err_t fold_operand(tqdb_session_t session, const tqdb_trait_t* trait,
+                               const void* operand, void* entity);
+
+/**
+ * A view of the current files for a scan under the lock (open view->main
+ * after). Its WAL is the entered session's, or with session NULL the WAL
+ * as it stands (caller holds the lock exclusively).
+ */
+static void view_init(tqdb_t db, struct tqdb_snapshot_s* view, tqdb_session_t session) {
+    memset(view, 0, sizeof(*view));
+    view->db = db;
+    view->trait_count = db->trait_count;
+    view->buf = db->scratch;
+#if TQDB_ENABLE_WAL
+    if (session) {
+        view->seg_count = session->seg_count;
+        memcpy(view->segs, session->segs, sizeof(view->segs));
+    } else if (db->wal.enabled && tqdb_wal_pending(db) > 0) {
+        view->seg_count = tqdb_wal_segments(db, view->segs);
+    }
+#else
+    (void)session;
+#endif
+}
+
+/**
+ * A resident type keeps every entity in one ID-sorted array, loaded on first
+ * use and updated by each write after it reaches the WAL or main file.
+ * Returns the position of id, or where it would be inserted.
+ */
+static uint32_t resident_search(tqdb_t db, int type_idx, uint32_t id, bool* out_found) {
+    const tqdb_trait_t* trait = db->traits[type_idx];
+    const tqdb_resident_t* res = &db->resident[type_idx];
+    uint32_t lo = 0, hi = res->count;
+
+    /* IDs grow, so appends hit the fast path */
+    if (hi > 0 && trait->get_id(res->data + (size_t)(hi - 1) * trait->struct_size) < id) {
+        lo = hi;
+    }
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t mid_id = trait->get_id(res->data + (size_t)mid * trait->struct_size);
+        if (mid_id == id) {
+            *out_found = true;
+            return mid;
+        }
+        if (mid_id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    *out_found = false;
+    return lo;
+}
+
+static void* resident_find(tqdb_t db, int type_idx, uint32_t id) {
+    bool found;
+    uint32_t pos = resident_search(db, type_idx, id, &found);
+    return found ? db->resident[type_idx].data + (size_t)pos * db->traits[type_idx]->struct_size
+                 : NULL;
+}
+
+static bool resident_put(tqdb_t db, int type_idx, const void* entity) {
+    const tqdb_trait_t* trait = db->traits[type_idx];
+    tqdb_resident_t* res = &db->resident[type_idx];
+    size_t size = trait->struct_size;
+
+    bool found;
+    uint32_t pos = resident_search(db, type_idx, trait->get_id(entity), &found);
+    if (!found) {
+        if (res->count == res->cap) {
+            uint32_t cap = res->cap ? res->cap * 2 : 16;
+            uint8_t* data = (uint8_t*)tqdb_alloc(db, (size_t)cap * size);
+            if (!data) return false;
+            if (res->data) {
+                memcpy(data, res->data, (size_t)res->count * size);
+                tqdb_dealloc(db, res->data);
+            }
+            res->data = data;
+            res->cap = cap;
+        }
+        memmove(res->data + (size_t)(pos + 1) * size, res->data + (size_t)pos * size,
+                (size_t)(res->count - pos) * size);
+        res->count++;
+    }
+    memcpy(res->data + (size_t)pos * size, entity, size);
+    return true;
+}
+
+static void resident_remove(tqdb_t db, int type_idx, uint32_t id) {
+    tqdb_resident_t* res = &db->resident[type_idx];
+    size_t size = db->traits[type_idx]->struct_size;
+
+    bool found;
+    uint32_t pos = resident_search(db, type_idx, id, &found);
+    if (!found) return;
+    memmove(res->data + (size_t)pos * size, res->data + (size_t)(pos + 1) * size,
+            (size_t)(res->count - pos - 1) * size);
+    res->count--;
+}
+
+static void resident_drop(tqdb_t db, int type_idx) {
+    tqdb_dealloc(db, db->resident[type_idx].data);
+    memset(&db->resident[type_idx], 0, sizeof(tqdb_resident_t));
+}
+
+typedef struct {
+    tqdb_t db;
+    int type_idx;
+    bool failed;
+} resident_load_t;
+
+static bool resident_load_entity(const void* entity, void* ctx) {
+    resident_load_t* load = (resident_load_t*)ctx;
+    if (!resident_put(load->db, load->type_idx, entity)) {
+        load->failed = true;
+        return false;
+    }
+    return true;
+}
+
+/* Load a resident type's array from the files (caller holds the lock exclusively) */
+static bool resident_load(tqdb_t db, int type_idx) {
+    tqdb_resident_t* res = &db->resident[type_idx];
+    struct tqdb_snapshot_s view;
+    view_init(db, &view, NULL);
+
+    resident_load_t load = { db, type_idx, false };
+    view.main = tqdb_open_for_read(db);
+    view_foreach(&view, type_idx, db->traits[type_idx], db->session.temp, resident_load_entity,
+                 &load);
+    if (view.main) fclose(view.main);
+
+    if (load.failed) {
+        resident_drop(db, type_idx);
+        return false;
+    }
+    res->loaded = true;
+    return true;
+}
+
+/**
+ * True if type_idx is resident and loaded (caller holds the lock). Loads
+ * on first use, unless other readers may run: then read_prepare does.
+ */
+static bool resident_ready(tqdb_t db, int type_idx) {
+    if (!db->traits[type_idx]->resident) return false;
+    if (db->resident[type_idx].loaded) return true;
+    return !db->reader_lock && resident_load(db, type_idx);
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Read Locking
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/* Checkpoint work reads bring due, and lazy loads (caller holds the lock exclusively) */
+static void read_prepare(tqdb_t db, int type_idx, bool need_live) {
+#if TQDB_ENABLE_WAL
+    /* Swap in a finished background checkpoint, or start one reads have paid for */
+    if (tqdb_lock_writable(db)) {
+        tqdb_checkpoint_poll(db);
+        tqdb_wal_maybe_checkpoint(db);
+    }
+#endif
+    if (db->traits[type_idx]->resident && !db->resident[type_idx].loaded) {
+        resident_load(db, type_idx);
+    }
+    if (need_live && !db->resident[type_idx].loaded && !db->live[type_idx].bits) {
+        live_build(db, type_idx);
+    }
+}
+
+/* True if read_prepare has work to do (caller holds the lock shared) */
+static bool read_prepare_due(tqdb_t db, int type_idx, bool need_live) {
+    if (db->traits[type_idx]->resident && !db->resident[type_idx].loaded) return true;
+    if (need_live && !db->resident[type_idx].loaded && !db->live[type_idx].bits) return true;
+
+    bool due = false;
+#if TQDB_ENABLE_WAL
+    tqdb_reader_enter(db);
+    due = tqdb_checkpoint_due(db);
+    tqdb_reader_leave(db);
+#endif
+    return due;
+}
+
+/* The mutex shared, then the stripe of type_idx (only while writes are striped) */
+static bool stripe_lock(tqdb_t db, int type_idx, bool exclusive) {
+    if (!tqdb_lock_shared(db)) return false;
+    void* stripe = db->type_locks[type_idx];
+    if (!stripe) return true;
+
+    bool ok = exclusive ? db->mutex_ops->lock(stripe, 5000)
+                        : db->mutex_ops->lock_shared(stripe, 5000);
+    if (!ok) tqdb_unlock_shared(db);
+    return ok;
+}
+
+static void stripe_unlock(tqdb_t db, int type_idx, bool exclusive) {
+    void* stripe = db->type_locks[type_idx];
+    if (stripe) {
+        if (exclusive) {
+            db->mutex_ops->unlock(stripe);
+        } else {
+            db->mutex_ops->unlock_shared(stripe);
+        }
+    }
+    tqdb_unlock_shared(db);
+}
+
+/**
+ * Lock for a read of type_idx, need_live if it consults the live bitmap.
+ * With shared locks, readers leave database state as it is (bar the cache,
+ * which locks its own shards), so what a read brings due runs first in a
+ * short exclusive pass. Writes to other types go on meanwhile.
+ */
+static bool read_lock(tqdb_t db, int type_idx, bool need_live) {
+    if (!db->reader_lock) {
+        /* Other processes read alongside; a checkpoint the reads brought due waits for them */
+        if (!tqdb_lock_as(db, false)) return false;
+#if TQDB_ENABLE_WAL
+        if (!tqdb_lock_writable(db) && tqdb_checkpoint_due(db)) {
+            tqdb_unlock(db);
+            if (!tqdb_lock(db)) return false;
+        }
+#endif
+        read_prepare(db, type_idx, need_live);
+        return true;
+    }
+
+    if (!stripe_lock(db, type_idx, false)) return false;
+    if (!read_prepare_due(db, type_idx, need_live)) return true;
+    stripe_unlock(db, type_idx, false);
+
+    if (!tqdb_lock(db)) return false;
+    read_prepare(db, type_idx, need_live);
+    tqdb_unlock(db);
+    return stripe_lock(db, type_idx, false);
+}
+
+static void read_unlock(tqdb_t db, int type_idx) {
+    if (!db->reader_lock) {
+        tqdb_unlock(db);
+        return;
+    }
+    stripe_unlock(db, type_idx, false);
+}
+
+/**
+ * Lock for a write of type_idx. Striped writes hold the mutex shared and
+ * their type's stripe exclusively, so reads and writes of other types go
+ * on; db->write_lock only orders the WAL appends themselves.
+ */
+static bool write_lock(tqdb_t db, int type_idx) {
+    if (!db->write_lock) return tqdb_lock(db);
+    return stripe_lock(db, type_idx, true);
+}
+
+/* Unlock after a write, then run the checkpoint it brought due */
+static tqdb_err_t write_unlock(tqdb_t db, int type_idx) {
+    (void)type_idx;  /* Unused without WAL */
+#if TQDB_ENABLE_WAL
+    if (db->write_lock) {
+        tqdb_reader_enter(db);
+        if (db->write_sessions[type_idx]) session_charge_scans(db->write_sessions[type_idx]);
+        bool due = tqdb_checkpoint_due(db);
+        tqdb_reader_leave(db);
+
+        stripe_unlock(db, type_idx, true);
+        if (!due) return TQDB_OK;
+
+        /* The write is in: with readers about, the checkpoint is left to them */
+        if (!db->mutex_ops->lock(db->mutex, 0)) return TQDB_OK;
+        tqdb_checkpoint_poll(db);
+        tqdb_err_t err = tqdb_wal_maybe_checkpoint(db);
+        tqdb_unlock(db);
+        return err;
+    }
+
+    session_charge_scans(&db->session);
+    tqdb_err_t err = tqdb_wal_maybe_checkpoint(db);
+    tqdb_unlock(db);
+    return err;
+#else
+    tqdb_unlock(db);
+    return TQDB_OK;
+#endif
+}
+
+/**
+ * File reads through a session, which work from the WAL as it stands on
+ * entry. The database's sessions are shared, so their readers hold the
+ * reader lock throughout; private ones only take it for the snapshot.
+ */
+static void session_enter(tqdb_session_t session) {
+    tqdb_t db = session->db;
+    tqdb_reader_enter(db);
+    session->view_gen = db->files_gen;
+#if TQDB_ENABLE_WAL
+    session->seg_count = db->wal.enabled ? tqdb_wal_segments(db, session->segs) : 0;
+#endif
+    if (session->keep_files) tqdb_reader_leave(db);
+}
+
+static void session_leave(tqdb_session_t session) {
+    tqdb_t db = session->db;
+    bool held = !session->keep_files;
+#if TQDB_ENABLE_WAL
+    /* Scans are charged on the way out */
+    if (!held && session->scans > 0) {
+        tqdb_reader_enter(db);
+        held = true;
+    }
+    session_charge_scans(session);
+#endif
+    if (held) tqdb_reader_leave(db);
+}
+
+/* The session reads through the database take */
+static tqdb_session_t db_session(tqdb_t db) {
+    return db->read_session ? db->read_session : &db->session;
+}
+
+/**
+ * The session a write of type_idx reads through (caller holds its stripe,
+ * NULL = no memory). Striped writes each have their own, so they decode
+ * alongside each other without sharing scratch.
+ */
+static tqdb_session_t write_session(tqdb_t db, int type_idx) {
+    if (!db->write_lock) return &db->session;
+
+    tqdb_session_t* slot = &db->write_sessions[type_idx];
+    if (!*slot && tqdb_session_open(db, slot) == TQDB_OK) {
+        (*slot)->keep_files = false;  /* Files per read, like the database's session */
+    }
+    return *slot;
+}
+
+/* A write reached the files: apply it to a loaded copy (entity NULL = deleted) */
+static void resident_note(tqdb_t db, int type_idx, uint32_t id, const void* entity) {
+    if (!db->resident[type_idx].loaded) return;
+    if (!entity) {
+        resident_remove(db, type_idx, id);
+    } else if (!resident_put(db, type_idx, entity)) {
+        resident_drop(db, type_idx);  /* Reloaded on next use */
+    }
+}
+
+#if TQDB_ENABLE_CACHE
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Cache Prefetch
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    tqdb_t db;
+    uint8_t type_idx;
+    const uint32_t* ids;          /* Sorted, unique */
+    size_t count;
+    size_t found;
+} prefetch_ctx_t;
+
+static int id_cmp(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static bool prefetch_entity(const void* entity, void* ctx) {
+    prefetch_ctx_t* pf = (prefetch_ctx_t*)ctx;
+    uint32_t id = pf->db->traits[pf->type_idx]->get_id(entity);
+    if (bsearch(&id, pf->ids, pf->count, sizeof(uint32_t), id_cmp)) {
+        tqdb_cache_put(pf->db, pf->type_idx, id, entity, 1 /* ADD */);
+        pf->found++;
+    }
+    return pf->found < pf->count;  /* Stop once all are in */
+}
+
+/**
+ * Cache the entities of type_idx whose IDs are listed, in one scan of the
+ * type (caller holds the lock). Sorts ids in place; unknown IDs are skipped.
+ */
+static tqdb_err_t prefetch_locked(tqdb_t db, int type_idx, uint32_t* ids, size_t n) {
+    if (resident_ready(db, type_idx)) return TQDB_OK;  /* Never cached */
+
+    qsort(ids, n, sizeof(uint32_t), id_cmp);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (ids[i] == 0 || (unique > 0 && ids[unique - 1] == ids[i])) continue;
+        /* A built bitmap drops missing IDs; building one would cost a scan */
+        if (db->live[type_idx].bits && live_test(db, type_idx, ids[i]) == 0) continue;
+        ids[unique++] = ids[i];
+    }
+    if (unique == 0) return TQDB_OK;
+
+    struct tqdb_snapshot_s view;
+    view_init(db, &view, NULL);
+
+    prefetch_ctx_t pf = { db, (uint8_t)type_idx, ids, unique, 0 };
+    view.main = tqdb_open_for_read(db);
+    tqdb_err_t err = view_foreach(&view, type_idx, db->traits[type_idx], db->session.temp,
+                                  prefetch_entity, &pf);
+    if (view.main) fclose(view.main);
+    return err;
+}
+
+/* Prefetch the keys saved at the last close, one scan per type (caller holds the lock) */
+static void prefetch_warm_keys(tqdb_t db) {
+    tqdb_cache_t* cache = db->cache;
+    uint32_t* ids = (uint32_t*)tqdb_alloc(db, cache->warm_count * sizeof(uint32_t));
+    if (ids) {
+        for (size_t t = 0; t < db->trait_count; t++) {
+            size_t n = 0;
+            for (uint32_t i = 0; i < cache->warm_count; i++) {
+                if ((cache->warm_keys[i] >> 32) == t) ids[n++] = (uint32_t)cache->warm_keys[i];
+            }
+            if (n > 0) prefetch_locked(db, (int)t, ids, n);
+        }
+        tqdb_dealloc(db, ids);
+    }
+    tqdb_cache_drop_keys(db);
+}
+
+tqdb_err_t tqdb_prefetch(tqdb_t db, const char* type, const uint32_t* ids, size_t n) {
+    if (!db || !type || (!ids && n > 0)) return TQDB_ERR_INVALID_ARG;
+
+#if TQDB_ENABLE_WAL
+    /* Check for deferred WAL recovery */
+    tqdb_wal_check_recovery(db);
+#endif
+
+    int type_idx = tqdb_find_trait_index(db, type);
+    if (type_idx < 0) return TQDB_ERR_NOT_REGISTERED;
+    if (!db->cache || n == 0) return TQDB_OK;
+
+    uint32_t* sorted = (uint32_t*)tqdb_alloc(db, n * sizeof(uint32_t));
+    if (!sorted) return TQDB_ERR_NO_MEM;
+    memcpy(sorted, ids, n * sizeof(uint32_t));
+
+    if (!tqdb_lock(db)) {
+        tqdb_dealloc(db, sorted);
+        return TQDB_ERR_TIMEOUT;
+    }
+
+    tqdb_err_t err = prefetch_locked(db, type_idx, sorted, n);
+
+    tqdb_unlock(db);
+    tqdb_dealloc(db, sorted);
+    return err;
+}
+#endif /* TQDB_ENABLE_CACHE */
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Stream Context for Modifications
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -168,7 +920,7 @@ static tqdb_err_t stream_modify(tqdb_t db, const stream_ctx_t* ctx) {
     uint8_t* write_buf = db->scratch + half;
 
     /* Open source (may not exist) */
-    FILE* src = open_for_read(db);
+    FILE* src = tqdb_open_for_read(db);
 
     /* Open destination */
     FILE* dst = fopen(db->tmp_path, "wb");
@@ -179,7 +931,7 @@ static tqdb_err_t stream_modify(tqdb_t db, const stream_ctx_t* ctx) {
 
     /* Write header placeholder */
     tqdb_header_t hdr = { TQDB_MAGIC, TQDB_VERSION, 0, 0, 0 };
-    write_header(dst, &hdr);
+    tqdb_write_header(dst, &hdr);
 
     tqdb_writer_t w;
     tqdb_writer_init(&w, dst, write_buf, half);
@@ -261,6 +1013,7 @@ static tqdb_err_t stream_modify(tqdb_t db, const stream_ctx_t* ctx) {
                 /* Apply filter (return false = delete) */
                 if (ctx->filter_type_idx == (int)type_idx && ctx->filter_fn) {
                     if (!ctx->filter_fn(entity, ctx->filter_ctx)) {
+                        tqdb_live_note(db, (uint8_t)type_idx, id, false);
                         if (trait->destroy) trait->destroy(entity);
                         actual_counts[type_idx]--;
                         counts_changed = true;
@@ -333,16 +1086,22 @@ static tqdb_err_t stream_modify(tqdb_t db, const stream_ctx_t* ctx) {
     fflush(dst);
     fclose(dst);
 
-    /* Atomic swap */
-    remove(db->bak_path);
-    rename(db->db_path, db->bak_path);
-    if (rename(db->tmp_path, db->db_path) != 0) {
-        rename(db->bak_path, db->db_path);
-        return TQDB_ERR_IO;
+    tqdb_err_t err = tqdb_install_file(db, db->tmp_path);
+#if TQDB_ENABLE_CACHE
+    /* Cached copies of what changed are stale now */
+    if (err == TQDB_OK && db->cache) {
+        if (ctx->filter_type_idx >= 0 || ctx->modify_type_idx >= 0) {
+            tqdb_cache_invalidate_all(db);
+        }
+        if (ctx->update_type_idx >= 0) {
+            tqdb_cache_invalidate(db, (uint8_t)ctx->update_type_idx, ctx->update_id);
+        }
+        if (ctx->delete_type_idx >= 0) {
+            tqdb_cache_invalidate(db, (uint8_t)ctx->delete_type_idx, ctx->delete_id);
+        }
     }
-    remove(db->bak_path);
-
-    return TQDB_OK;
+#endif
+    return err;
 }
 
 /* ═══════════════════════════════════════════════════════════════════════════
@@ -353,6 +1112,13 @@ tqdb_err_t tqdb_open(const tqdb_config_t* config, tqdb_t* out_db) {
     if (!config || !config->db_path || !out_db) {
         return TQDB_ERR_INVALID_ARG;
     }
+#if TQDB_ENABLE_MULTIPROC
+    /* Processes coordinate through the WAL, and checkpoint only under the file lock */
+    if (config->multi_process && ((!config->enable_wal && !config->wal_path) ||
+                                  config->background_checkpoint)) {
+        return TQDB_ERR_INVALID_ARG;
+    }
+#endif
 
     /* Allocate database struct using provided or default allocator */
     tqdb_alloc_t alloc = config->alloc ? *config->alloc : s_default_alloc;
@@ -401,7 +1167,19 @@ tqdb_err_t tqdb_open(const tqdb_config_t* config, tqdb_t* out_db) {
     if (config->mutex) {
         db->mutex_ops = config->mutex;
         db->mutex = config->mutex->create();
+        /* Reads share the mutex when the ops can; without a reader lock they cannot.
+         * File locks belong to the process, so with other processes its calls take turns */
+        bool multi_process = false;
+#if TQDB_ENABLE_MULTIPROC
+        multi_process = config->multi_process;
+#endif
+        if (db->mutex && config->mutex->lock_shared && config->mutex->unlock_shared &&
+            !multi_process) {
+            db->reader_lock = config->mutex->create();
+        }
     }
+    db->thread_ops = config->thread;
+    db->clock_us = config->clock_us;
 
     /* Setup scratch buffer */
     db->scratch_size = config->scratch_size > 0 ? config->scratch_size : TQDB_DEFAULT_SCRATCH_SIZE;
@@ -416,6 +1194,8 @@ tqdb_err_t tqdb_open(const tqdb_config_t* config, tqdb_t* out_db) {
             return TQDB_ERR_NO_MEM;
         }
     }
+    db->session.db = db;
+    db->session.buf = db->scratch;
 
 #if TQDB_ENABLE_WAL
     /* Setup WAL if enabled (default: enabled if wal_path provided or auto-generate) */
@@ -433,26 +1213,71 @@ tqdb_err_t tqdb_open(const tqdb_config_t* config, tqdb_t* out_db) {
         }
         if (wal_path) {
             tqdb_err_t err = tqdb_wal_init(db, wal_path,
-                config->wal_max_entries, config->wal_max_size);
+                config->wal_max_entries, config->wal_max_size,
+                config->checkpoint_mem_budget, (uint8_t)config->checkpoint_policy,
+                config->wal_compact_percent, config->wal_history);
             tqdb_dealloc(db, wal_path);
             if (err != TQDB_OK) {
                 tqdb_close(db);
                 return err;
             }
+            if (config->background_checkpoint) {
+                err = tqdb_wal_enable_background(db);
+                if (err != TQDB_OK) {
+                    tqdb_close(db);
+                    return err;
+                }
+            }
             /* Recover any pending WAL entries */
+#if TQDB_ENABLE_MULTIPROC
+            if (config->multi_process) {
+                err = tqdb_mp_open(db);  /* Recovers only if no other process has it open */
+            } else {
+                err = tqdb_wal_recover(db);
+            }
+#else
             err = tqdb_wal_recover(db);
+#endif
             if (err != TQDB_OK) {
                 tqdb_close(db);
                 return err;
             }
         }
     }
+
+    /* Writes share the mutex too when reads do: they lock their type's stripe,
+     * then write_lock for the WAL, and reads get a session of their own */
+    if (db->reader_lock && db->wal.enabled) {
+        db->write_lock = config->mutex->create();
+        if (db->write_lock) {
+            tqdb_err_t err = tqdb_session_open(db, &db->read_session);
+            if (err != TQDB_OK) {
+                tqdb_close(db);
+                return err;
+            }
+            db->read_session->keep_files = false;  /* Shared under the reader lock */
+        }
+    }
 #endif
 
 #if TQDB_ENABLE_CACHE
     /* Setup cache if enabled */
     if (config->enable_cache) {
-        tqdb_err_t err = tqdb_cache_init(db, config->cache_size);
+        tqdb_err_t err = tqdb_cache_init(db, config->cache_size,
+                                         (uint8_t)config->cache_policy, config->cache_bytes,
+                                         config->cache_shards, config->cache_l2_bytes);
+        if (err == TQDB_OK && config->cache_persist) {
+            /* Keys are prefetched once the types are registered again */
+            size_t len = strlen(config->db_path) + 6;
+            char* warm_path = (char*)tqdb_alloc(db, len);
+            if (warm_path) {
+                snprintf(warm_path, len, "%s.warm", config->db_path);
+                err = tqdb_cache_load_keys(db, warm_path);
+                tqdb_dealloc(db, warm_path);
+            } else {
+                err = TQDB_ERR_NO_MEM;
+            }
+        }
         if (err != TQDB_OK) {
             tqdb_close(db);
             return err;
@@ -467,16 +1292,39 @@ tqdb_err_t tqdb_open(const tqdb_config_t* config, tqdb_t* out_db) {
 void tqdb_close(tqdb_t db) {
     if (!db) return;
 
+#if TQDB_ENABLE_CACHE
+    /* Save the cached keys for the next open (the checkpoint may clear them) */
+    tqdb_cache_save_keys(db);
+#endif
+
 #if TQDB_ENABLE_WAL
     /* Checkpoint any pending WAL entries before closing */
-    if (db->wal.enabled && db->wal.entry_count > 0) {
-        tqdb_wal_checkpoint_internal(db);
+#if TQDB_ENABLE_MULTIPROC
+    if (db->mp.shm) {
+        /* Only the last process out: the others still append to the WAL */
+        if (tqdb_lock(db)) {
+            if (tqdb_mp_alone(db) && tqdb_wal_pending(db) > 0) {
+                tqdb_wal_checkpoint_internal(db);
+            }
+            tqdb_unlock(db);
+        }
+    } else
+#endif
+    if (db->wal.enabled) {
+        tqdb_checkpoint_wait(db);
+        if (tqdb_wal_pending(db) > 0) {
+            tqdb_wal_checkpoint_internal(db);
+        }
     }
 
     /* Destroy WAL */
     tqdb_wal_destroy(db);
 #endif
 
+#if TQDB_ENABLE_MULTIPROC
+    if (db->mp.shm) tqdb_mp_close(db);
+#endif
+
 #if TQDB_ENABLE_CACHE
     /* Destroy cache */
     tqdb_cache_destroy(db);
@@ -485,11 +1333,30 @@ void tqdb_close(tqdb_t db) {
     if (db->mutex_ops && db->mutex) {
         db->mutex_ops->destroy(db->mutex);
     }
+    if (db->reader_lock) {
+        db->mutex_ops->destroy(db->reader_lock);
+    }
+    if (db->write_lock) {
+        db->mutex_ops->destroy(db->write_lock);
+    }
+    for (size_t i = 0; i < TQDB_MAX_ENTITY_TYPES; i++) {
+        if (db->type_locks[i]) db->mutex_ops->destroy(db->type_locks[i]);
+    }
+    tqdb_session_close(db->read_session);
+    for (size_t i = 0; i < TQDB_MAX_ENTITY_TYPES; i++) {
+        tqdb_session_close(db->write_sessions[i]);
+    }
 
     if (db->owns_scratch && db->scratch) {
         tqdb_dealloc(db, db->scratch);
     }
 
+    for (size_t i = 0; i < TQDB_MAX_ENTITY_TYPES; i++) {
+        live_drop(db, &db->live[i]);
+        resident_drop(db, (int)i);
+        tqdb_dealloc(db, db->session.temp[i]);
+    }
+
     tqdb_dealloc(db, db->db_path);
     tqdb_dealloc(db, db->tmp_path);
     tqdb_dealloc(db, db->bak_path);
@@ -506,6 +1373,10 @@ tqdb_err_t tqdb_register(tqdb_t db, const tqdb_trait_t* trait) {
     if (!trait->write || !trait->read || !trait->get_id || !trait->set_id) {
         return TQDB_ERR_INVALID_ARG;
     }
+    if (trait->cache_max_bytes && trait->cache_min_bytes > trait->cache_max_bytes) {
+        return TQDB_ERR_INVALID_ARG;
+    }
+    if (trait->resident && trait->destroy) return TQDB_ERR_INVALID_ARG;
 
     if (db->trait_count >= TQDB_MAX_ENTITY_TYPES) {
         return TQDB_ERR_FULL;
@@ -516,19 +1387,108 @@ tqdb_err_t tqdb_register(tqdb_t db, const tqdb_trait_t* trait) {
         return TQDB_ERR_EXISTS;
     }
 
+    /* Striped writes lock each type on its own */
+    if (db->write_lock) {
+        db->type_locks[db->trait_count] = db->mutex_ops->create();
+        if (!db->type_locks[db->trait_count]) return TQDB_ERR_NO_MEM;
+    }
+
     size_t idx = db->trait_count++;
     db->traits[idx] = trait;
 
-    /* Initialize next_id for this type by scanning existing DB */
-    db->next_id[idx] = 1;  /* Start at 1, 0 is reserved for "no ID" */
+    /* next_id is resolved on first add, once all types are registered
+     * and the section offsets in the main file are known */
+    db->next_id[idx] = 0;
+
+#if TQDB_ENABLE_CACHE
+    /* Saved cache keys can be read once their types are all back */
+    if (db->cache && db->cache->warm_types == db->trait_count) {
+        if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
+        prefetch_warm_keys(db);
+        tqdb_unlock(db);
+    }
+#endif
 
     return TQDB_OK;
 }
 
+#if TQDB_ENABLE_MULTIPROC
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Other Processes' Writes
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+void tqdb_remote_write(tqdb_t db, uint8_t type_idx, uint32_t id, uint8_t op) {
+    if (type_idx >= db->trait_count) return;  /* Not registered here */
+
+#if TQDB_ENABLE_CACHE
+    if (db->cache) tqdb_cache_invalidate(db, type_idx, id);
+#endif
+    if (op == TQDB_WAL_OP_ADD || op == TQDB_WAL_OP_DELETE) {
+        tqdb_live_note(db, type_idx, id, op == TQDB_WAL_OP_ADD);
+    }
+    if (db->resident[type_idx].loaded) resident_drop(db, type_idx);  /* Reloaded on next use */
+}
+
+void tqdb_remote_files(tqdb_t db) {
+    db->files_gen++;  /* Sessions reopen their files */
+#if TQDB_ENABLE_CACHE
+    if (db->cache) tqdb_cache_invalidate_all(db);
+#endif
+    for (size_t i = 0; i < db->trait_count; i++) {
+        live_drop(db, &db->live[i]);
+        resident_drop(db, (int)i);
+    }
+    db->wal.scan_bytes = 0;
+    db->wal.main_cost_known = false;
+    tqdb_wal_keys_clear(db);
+}
+#endif /* TQDB_ENABLE_MULTIPROC */
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * CRUD Operations
  * ═══════════════════════════════════════════════════════════════════════════ */
 
+/**
+ * First free ID for a type: one past the highest ID in the main file or WAL.
+ * IDs are assigned in increasing order, which keeps every section ID-sorted.
+ */
+static uint32_t resolve_next_id(tqdb_session_t session, int type_idx) {
+    tqdb_t db = session->db;
+    const tqdb_trait_t* trait = db->traits[type_idx];
+    uint32_t max_id = 0;
+
+    FILE* f = tqdb_open_for_read(db);
+    void* tmp = tqdb_alloc(db, trait->struct_size);
+    if (f && tmp) {
+        uint32_t counts[TQDB_MAX_ENTITY_TYPES] = {0};
+        for (size_t i = 0; i < db->trait_count; i++) {
+            fread(&counts[i], 4, 1, f);
+        }
+
+        tqdb_reader_t r;
+        tqdb_reader_init(&r, f, session->buf, db->scratch_size);
+        tqdb_skip_to_type(db, &r, counts, type_idx, session->temp);
+
+        for (uint32_t i = 0; i < counts[type_idx] && !tqdb_read_error(&r); i++) {
+            if (trait->init) trait->init(tmp);
+            trait->read(&r, tmp);
+            if (tqdb_read_error(&r)) break;
+            uint32_t id = trait->get_id(tmp);
+            if (id > max_id) max_id = id;
+            if (trait->destroy) trait->destroy(tmp);
+        }
+    }
+    if (tmp) tqdb_dealloc(db, tmp);
+    if (f) fclose(f);
+
+#if TQDB_ENABLE_WAL
+    uint32_t wal_max = tqdb_wal_max_id(db, (uint8_t)type_idx);
+    if (wal_max > max_id) max_id = wal_max;
+#endif
+
+    return max_id + 1;  /* 0 is reserved for "no ID" */
+}
+
 tqdb_err_t tqdb_add(tqdb_t db, const char* type, void* entity) {
     if (!db || !type || !entity) return TQDB_ERR_INVALID_ARG;
 
@@ -542,9 +1502,17 @@ tqdb_err_t tqdb_add(tqdb_t db, const char* type, void* entity) {
 
     int type_idx = tqdb_find_trait_index(db, type);
 
-    if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
+    if (!write_lock(db, type_idx)) return TQDB_ERR_TIMEOUT;
 
     /* Auto-generate ID */
+    if (db->next_id[type_idx] == 0) {
+        tqdb_session_t session = write_session(db, type_idx);
+        if (!session) {
+            write_unlock(db, type_idx);
+            return TQDB_ERR_NO_MEM;
+        }
+        db->next_id[type_idx] = resolve_next_id(session, type_idx);
+    }
     uint32_t new_id = db->next_id[type_idx]++;
     trait->set_id(entity, new_id);
 
@@ -553,8 +1521,9 @@ tqdb_err_t tqdb_add(tqdb_t db, const char* type, void* entity) {
     if (db->wal.enabled) {
         tqdb_err_t err = tqdb_wal_append(db, TQDB_WAL_OP_ADD,
                                           (uint8_t)type_idx, new_id, entity);
-        tqdb_unlock(db);
-        return err;
+        if (err == TQDB_OK) resident_note(db, type_idx, new_id, entity);
+        tqdb_err_t ckpt_err = write_unlock(db, type_idx);
+        return err != TQDB_OK ? err : ckpt_err;
     }
 #endif
 
@@ -568,129 +1537,179 @@ tqdb_err_t tqdb_add(tqdb_t db, const char* type, void* entity) {
     ctx.modify_type_idx = -1;
 
     tqdb_err_t err = stream_modify(db, &ctx);
+    if (err == TQDB_OK) {
+        tqdb_live_note(db, (uint8_t)type_idx, new_id, true);
+        resident_note(db, type_idx, new_id, entity);
+    }
 
-    tqdb_unlock(db);
+    write_unlock(db, type_idx);
     return err;
 }
 
-tqdb_err_t tqdb_get(tqdb_t db, const char* type, uint32_t id, void* out) {
-    if (!db || !type || id == 0 || !out) return TQDB_ERR_INVALID_ARG;
-
-#if TQDB_ENABLE_WAL
-    /* Check for deferred WAL recovery */
-    tqdb_wal_check_recovery(db);
-#endif
-
-    const tqdb_trait_t* trait = tqdb_find_trait(db, type);
-    if (!trait) return TQDB_ERR_NOT_REGISTERED;
-
-    int type_idx = tqdb_find_trait_index(db, type);
-
-    if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
-
-#if TQDB_ENABLE_CACHE
-    /* 1. Check cache first */
-    if (db->cache) {
-        tqdb_cache_entry_t* cached = tqdb_cache_get(db, (uint8_t)type_idx, id);
-        if (cached) {
-            if (cached->op == TQDB_WAL_OP_DELETE) {
-                /* Cached as deleted */
-                tqdb_unlock(db);
-                return TQDB_ERR_NOT_FOUND;
-            }
-            if (cached->entity) {
-                /* Copy from cache */
-                if (trait->init) trait->init(out);
-                memcpy(out, cached->entity, trait->struct_size);
-                tqdb_unlock(db);
-                return TQDB_OK;
-            }
-        }
-    }
-#endif
-
+/** Read one entity from the WAL, else the main file, and cache it (session entered) */
+static tqdb_err_t get_from_files(tqdb_session_t session, uint8_t type_idx, uint32_t id,
+                                 void* out) {
+    tqdb_t db = session->db;
+    (void)db;  /* Unused without WAL and cache */
 #if TQDB_ENABLE_WAL
-    /* 2. Check WAL */
-    if (db->wal.enabled && db->wal.entry_count > 0) {
-        uint8_t wal_op;
-        tqdb_err_t wal_result = tqdb_wal_find(db, (uint8_t)type_idx, id, &wal_op, out);
+    /* 3. Check WAL */
+    if (session->seg_count > 0) {
+        uint8_t wal_op = 0;
+        tqdb_err_t wal_result = tqdb_wal_find(session, type_idx, id, &wal_op, out);
         if (wal_result == TQDB_OK) {
 #if TQDB_ENABLE_CACHE
             /* Found in WAL, update cache */
             if (db->cache) {
-                tqdb_cache_put(db, (uint8_t)type_idx, id, out, wal_op);
+                tqdb_cache_put(db, type_idx, id, out, wal_op);
             }
 #endif
-            tqdb_unlock(db);
             return TQDB_OK;
         }
         /* Check if explicitly deleted in WAL */
         if (wal_result == TQDB_ERR_NOT_FOUND && wal_op == TQDB_WAL_OP_DELETE) {
-            tqdb_unlock(db);
             return TQDB_ERR_NOT_FOUND;
         }
     }
 #endif
 
-    /* 3. Check main database file */
-    FILE* f = open_for_read(db);
-    if (!f) {
-        tqdb_unlock(db);
-        return TQDB_ERR_NOT_FOUND;
+    /* 4. Check main database file */
+    tqdb_err_t result = tqdb_main_find(session, type_idx, id, out);
+#if TQDB_ENABLE_CACHE
+    if (result == TQDB_OK && db->cache) {
+        tqdb_cache_put(db, type_idx, id, out, 1 /* ADD */);
     }
+#endif
+    return result;
+}
 
-    /* Read counts */
-    uint32_t counts[TQDB_MAX_ENTITY_TYPES] = {0};
-    for (size_t i = 0; i < db->trait_count; i++) {
-        fread(&counts[i], 4, 1, f);
+/** Read one entity: resident copy or cache, then WAL, then main file (caller holds the lock) */
+static tqdb_err_t get_locked(tqdb_session_t session, const tqdb_trait_t* trait,
+                             uint8_t type_idx, uint32_t id, void* out) {
+    tqdb_t db = session->db;
+
+    /* Resident types answer from memory and bypass the cache */
+    if (resident_ready(db, type_idx)) {
+        const void* entity = resident_find(db, type_idx, id);
+        if (!entity) return TQDB_ERR_NOT_FOUND;
+        if (trait->init) trait->init(out);
+        memcpy(out, entity, trait->struct_size);
+        return TQDB_OK;
     }
 
-    tqdb_reader_t r;
-    tqdb_reader_init(&r, f, db->scratch, db->scratch_size);
+#if TQDB_ENABLE_CACHE
+    /* 1. Check cache first */
+    if (db->cache) {
+        int cached = tqdb_cache_get(db, type_idx, id, out);
+        if (cached == 0) return TQDB_ERR_NOT_FOUND;  /* Cached as deleted */
+        if (cached == 1) return TQDB_OK;
+    }
+#endif
 
-    tqdb_err_t result = TQDB_ERR_NOT_FOUND;
+    /* 2. IDs that do not exist need no file scan */
+    if (live_test(db, type_idx, id) == 0) return TQDB_ERR_NOT_FOUND;
 
-    /* Skip to target type */
-    for (int i = 0; i < type_idx; i++) {
-        const tqdb_trait_t* t = db->traits[i];
-        for (uint32_t j = 0; j < counts[i] && !tqdb_read_error(&r); j++) {
-            if (t->skip) {
-                t->skip(&r);
-            } else {
-                /* Must read and discard */
-                void* tmp = tqdb_alloc(db, t->struct_size);
-                if (tmp) {
-                    if (t->init) t->init(tmp);
-                    t->read(&r, tmp);
-                    if (t->destroy) t->destroy(tmp);
-                    tqdb_dealloc(db, tmp);
-                }
-            }
+    session_enter(session);
+    tqdb_err_t result = get_from_files(session, type_idx, id, out);
+    session_leave(session);
+    return result;
+}
+
+tqdb_err_t tqdb_session_get(tqdb_session_t session, const char* type, uint32_t id, void* out) {
+    if (!session || !type || id == 0 || !out) return TQDB_ERR_INVALID_ARG;
+    tqdb_t db = session->db;
+
+#if TQDB_ENABLE_WAL
+    /* Check for deferred WAL recovery */
+    tqdb_wal_check_recovery(db);
+#endif
+
+    const tqdb_trait_t* trait = tqdb_find_trait(db, type);
+    if (!trait) return TQDB_ERR_NOT_REGISTERED;
+
+    int type_idx = tqdb_find_trait_index(db, type);
+
+    if (!read_lock(db, type_idx, true)) return TQDB_ERR_TIMEOUT;
+    tqdb_err_t result = get_locked(session, trait, (uint8_t)type_idx, id, out);
+    read_unlock(db, type_idx);
+    return result;
+}
+
+tqdb_err_t tqdb_get(tqdb_t db, const char* type, uint32_t id, void* out) {
+    if (!db) return TQDB_ERR_INVALID_ARG;
+    return tqdb_session_get(db_session(db), type, id, out);
+}
+
+tqdb_err_t tqdb_get_ref(tqdb_t db, const char* type, uint32_t id, tqdb_ref_t* out_ref) {
+    if (!db || !type || id == 0 || !out_ref) return TQDB_ERR_INVALID_ARG;
+
+#if TQDB_ENABLE_WAL
+    /* Check for deferred WAL recovery */
+    tqdb_wal_check_recovery(db);
+#endif
+
+    const tqdb_trait_t* trait = tqdb_find_trait(db, type);
+    if (!trait) return TQDB_ERR_NOT_REGISTERED;
+
+    int type_idx = tqdb_find_trait_index(db, type);
+    memset(out_ref, 0, sizeof(*out_ref));
+    out_ref->type_idx = (uint8_t)type_idx;
+
+    if (!read_lock(db, type_idx, true)) return TQDB_ERR_TIMEOUT;
+
+#if TQDB_ENABLE_CACHE
+    /* Hit: pin the cached entity, no copy */
+    bool pinnable = db->cache && !trait->resident;
+    if (pinnable) {
+        int cached = tqdb_cache_pin(db, (uint8_t)type_idx, id, true, out_ref);
+        if (cached >= 0) {
+            read_unlock(db, type_idx);
+            return cached == 1 ? TQDB_OK : TQDB_ERR_NOT_FOUND;
         }
     }
+#endif
 
-    /* Search in target type */
-    if (trait->init) trait->init(out);
-    for (uint32_t i = 0; i < counts[type_idx] && !tqdb_read_error(&r); i++) {
-        trait->read(&r, out);
-        if (trait->get_id(out) == id) {
-            result = TQDB_OK;
+    /* Miss: read a copy, which also fills the cache, then pin what was cached */
+    void* copy = tqdb_alloc(db, trait->struct_size);
+    if (!copy) {
+        read_unlock(db, type_idx);
+        return TQDB_ERR_NO_MEM;
+    }
+
+    tqdb_err_t err = get_locked(db_session(db), trait, (uint8_t)type_idx, id, copy);
+    if (err == TQDB_OK) {
 #if TQDB_ENABLE_CACHE
-            /* Update cache */
-            if (db->cache) {
-                tqdb_cache_put(db, (uint8_t)type_idx, id, out, 1 /* ADD */);
-            }
-#endif
-            break;
+        if (pinnable && tqdb_cache_pin(db, (uint8_t)type_idx, id, false, out_ref) == 1) {
+            tqdb_dealloc(db, copy);  /* The cache took over its contents */
+            copy = NULL;
         }
-        /* Reset for next read */
-        if (trait->destroy) trait->destroy(out);
-        if (trait->init) trait->init(out);
+#endif
+        if (copy) out_ref->entity = copy;
+    } else {
+        if (trait->destroy) trait->destroy(copy);
+        tqdb_dealloc(db, copy);
     }
 
-    fclose(f);
-    tqdb_unlock(db);
-    return result;
+    read_unlock(db, type_idx);
+    return err;
+}
+
+void tqdb_release_ref(tqdb_t db, tqdb_ref_t* ref) {
+    if (!db || !ref || !ref->entity) return;
+
+#if TQDB_ENABLE_CACHE
+    if (ref->slot != 0) {
+        tqdb_cache_unpin(db, ref);
+        ref->entity = NULL;
+        return;
+    }
+#endif
+
+    /* Private copy */
+    void* copy = (void*)ref->entity;
+    const tqdb_trait_t* trait = db->traits[ref->type_idx];
+    if (trait->destroy) trait->destroy(copy);
+    tqdb_dealloc(db, copy);
+    ref->entity = NULL;
 }
 
 tqdb_err_t tqdb_update(tqdb_t db, const char* type, uint32_t id, const void* entity) {
@@ -706,20 +1725,51 @@ tqdb_err_t tqdb_update(tqdb_t db, const char* type, uint32_t id, const void* ent
 
     int type_idx = tqdb_find_trait_index(db, type);
 
+#if TQDB_ENABLE_WAL
+    /* Delta path: the base lookup doubles as the existence check */
+    if (db->wal.enabled && trait->diff && trait->patch) {
+        void* base = tqdb_alloc(db, trait->struct_size);
+        if (!base) return TQDB_ERR_NO_MEM;
+
+        if (!write_lock(db, type_idx)) {
+            tqdb_dealloc(db, base);
+            return TQDB_ERR_TIMEOUT;
+        }
+
+        tqdb_session_t session = write_session(db, type_idx);
+        bool patchable = false;
+        tqdb_err_t err = session
+            ? tqdb_wal_find_base(session, (uint8_t)type_idx, id, base, &patchable)
+            : TQDB_ERR_NO_MEM;
+        if (err == TQDB_OK) {
+            err = patchable
+                ? tqdb_wal_append_patch(db, (uint8_t)type_idx, id, base, entity)
+                : tqdb_wal_append(db, TQDB_WAL_OP_UPDATE, (uint8_t)type_idx, id, entity);
+            if (trait->destroy) trait->destroy(base);
+        }
+        if (err == TQDB_OK) resident_note(db, type_idx, id, entity);
+
+        tqdb_err_t ckpt_err = write_unlock(db, type_idx);
+        tqdb_dealloc(db, base);
+        return err != TQDB_OK ? err : ckpt_err;
+    }
+#endif
+
     /* Check existence first */
     if (!tqdb_exists(db, type, id)) {
         return TQDB_ERR_NOT_FOUND;
     }
 
-    if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
+    if (!write_lock(db, type_idx)) return TQDB_ERR_TIMEOUT;
 
 #if TQDB_ENABLE_WAL
     /* If WAL enabled, append to WAL */
     if (db->wal.enabled) {
         tqdb_err_t err = tqdb_wal_append(db, TQDB_WAL_OP_UPDATE,
                                           (uint8_t)type_idx, id, entity);
-        tqdb_unlock(db);
-        return err;
+        if (err == TQDB_OK) resident_note(db, type_idx, id, entity);
+        tqdb_err_t ckpt_err = write_unlock(db, type_idx);
+        return err != TQDB_OK ? err : ckpt_err;
     }
 #endif
 
@@ -733,8 +1783,9 @@ tqdb_err_t tqdb_update(tqdb_t db, const char* type, uint32_t id, const void* ent
     ctx.modify_type_idx = -1;
 
     tqdb_err_t err = stream_modify(db, &ctx);
+    if (err == TQDB_OK) resident_note(db, type_idx, id, entity);
 
-    tqdb_unlock(db);
+    write_unlock(db, type_idx);
     return err;
 }
 
@@ -756,15 +1807,16 @@ tqdb_err_t tqdb_delete(tqdb_t db, const char* type, uint32_t id) {
         return TQDB_ERR_NOT_FOUND;
     }
 
-    if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
+    if (!write_lock(db, type_idx)) return TQDB_ERR_TIMEOUT;
 
 #if TQDB_ENABLE_WAL
     /* If WAL enabled, append to WAL */
     if (db->wal.enabled) {
         tqdb_err_t err = tqdb_wal_append(db, TQDB_WAL_OP_DELETE,
                                           (uint8_t)type_idx, id, NULL);
-        tqdb_unlock(db);
-        return err;
+        if (err == TQDB_OK) resident_note(db, type_idx, id, NULL);
+        tqdb_err_t ckpt_err = write_unlock(db, type_idx);
+        return err != TQDB_OK ? err : ckpt_err;
     }
 #endif
 
@@ -777,13 +1829,63 @@ tqdb_err_t tqdb_delete(tqdb_t db, const char* type, uint32_t id) {
     ctx.modify_type_idx = -1;
 
     tqdb_err_t err = stream_modify(db, &ctx);
+    if (err == TQDB_OK) {
+        tqdb_live_note(db, (uint8_t)type_idx, id, false);
+        resident_note(db, type_idx, id, NULL);
+    }
 
-    tqdb_unlock(db);
+    write_unlock(db, type_idx);
     return err;
 }
 
-bool tqdb_exists(tqdb_t db, const char* type, uint32_t id) {
-    if (!db || !type || id == 0) return false;
+/* Fold an operand into an entity, round-tripping it through the session's scratch */
+static tqdb_err_t fold_operand(tqdb_session_t session, const tqdb_trait_t* trait,
+                               const void* operand, void* entity) {
+    tqdb_writer_t w;
+    tqdb_writer_init_mem(&w, session->buf, session->db->scratch_size);
+    trait->merge_write(&w, operand);
+    if (tqdb_write_error(&w)) return TQDB_ERR_NO_MEM;  /* Operand larger than scratch */
+
+    tqdb_reader_t r;
+    tqdb_reader_init_mem(&r, session->buf, w.buf_pos);
+    trait->merge(&r, entity);
+    return tqdb_read_error(&r) ? TQDB_ERR_CORRUPT : TQDB_OK;
+}
+
+/* Read-modify-write a merge operand into the main file (no WAL to defer to) */
+static tqdb_err_t merge_now(tqdb_t db, const tqdb_trait_t* trait, int type_idx,
+                            uint32_t id, const void* operand) {
+    void* entity = tqdb_alloc(db, trait->struct_size);
+    if (!entity) return TQDB_ERR_NO_MEM;
+
+    tqdb_err_t err = tqdb_main_find(&db->session, (uint8_t)type_idx, id, entity);
+    if (err == TQDB_OK) {
+        err = fold_operand(&db->session, trait, operand, entity);
+    }
+
+    if (err == TQDB_OK) {
+        stream_ctx_t ctx = {0};
+        ctx.update_type_idx = type_idx;
+        ctx.update_id = id;
+        ctx.update_entity = entity;
+        ctx.delete_type_idx = -1;
+        ctx.filter_type_idx = -1;
+        ctx.modify_type_idx = -1;
+        err = stream_modify(db, &ctx);
+        if (err == TQDB_OK) resident_note(db, type_idx, id, entity);
+    }
+
+#if TQDB_ENABLE_CACHE
+    if (db->cache) tqdb_cache_invalidate(db, (uint8_t)type_idx, id);
+#endif
+
+    if (trait->destroy) trait->destroy(entity);
+    tqdb_dealloc(db, entity);
+    return err;
+}
+
+tqdb_err_t tqdb_merge(tqdb_t db, const char* type, uint32_t id, const void* operand) {
+    if (!db || !type || id == 0 || !operand) return TQDB_ERR_INVALID_ARG;
 
 #if TQDB_ENABLE_WAL
     /* Check for deferred WAL recovery */
@@ -791,28 +1893,47 @@ bool tqdb_exists(tqdb_t db, const char* type, uint32_t id) {
 #endif
 
     const tqdb_trait_t* trait = tqdb_find_trait(db, type);
-    if (!trait) return false;
+    if (!trait) return TQDB_ERR_NOT_REGISTERED;
+    if (!trait->merge_write || !trait->merge) return TQDB_ERR_INVALID_ARG;
 
     int type_idx = tqdb_find_trait_index(db, type);
 
-#if TQDB_ENABLE_CACHE
-    /* Check cache first for deleted marker */
-    if (db->cache) {
-        tqdb_cache_entry_t* cached = tqdb_cache_get(db, (uint8_t)type_idx, id);
-        if (cached && cached->op == TQDB_WAL_OP_DELETE) {
-            return false;
-        }
-        if (cached && cached->entity) {
-            return true;
+    if (!write_lock(db, type_idx)) return TQDB_ERR_TIMEOUT;
+
+#if TQDB_ENABLE_WAL
+    /* Blind write: no lookup, the operand is folded when the entity is read */
+    if (db->wal.enabled) {
+        tqdb_err_t err = tqdb_wal_append(db, TQDB_WAL_OP_MERGE,
+                                          (uint8_t)type_idx, id, operand);
+        if (err == TQDB_OK && db->resident[type_idx].loaded) {
+            /* Fold into the resident copy too, or reload it on next use */
+            void* entity = resident_find(db, type_idx, id);
+            tqdb_session_t session = entity ? write_session(db, type_idx) : NULL;
+            if (entity && (!session || fold_operand(session, trait, operand, entity) != TQDB_OK)) {
+                resident_drop(db, type_idx);
+            }
         }
+        tqdb_err_t ckpt_err = write_unlock(db, type_idx);
+        return err != TQDB_OK ? err : ckpt_err;
     }
 #endif
 
+    /* Fallback: fold the operand into the main file now */
+    tqdb_err_t err = merge_now(db, trait, type_idx, id, operand);
+
+    write_unlock(db, type_idx);
+    return err;
+}
+
+/** Existence from the WAL, else the main file (session entered) */
+static bool exists_in_files(tqdb_session_t session, const tqdb_trait_t* trait,
+                            uint8_t type_idx, uint32_t id) {
+    tqdb_t db = session->db;
 #if TQDB_ENABLE_WAL
     /* Check WAL for existence or deletion */
-    if (db->wal.enabled && db->wal.entry_count > 0) {
+    if (session->seg_count > 0) {
         uint8_t wal_op = 0;
-        tqdb_err_t wal_result = tqdb_wal_find(db, (uint8_t)type_idx, id, &wal_op, NULL);
+        tqdb_err_t wal_result = tqdb_wal_find(session, type_idx, id, &wal_op, NULL);
         if (wal_result == TQDB_OK) {
             return true;  /* Found in WAL (add or update) */
         }
@@ -822,72 +1943,70 @@ bool tqdb_exists(tqdb_t db, const char* type, uint32_t id) {
     }
 #endif
 
-    /* Check main database */
-    void* tmp = tqdb_alloc(db, trait->struct_size);
-    if (!tmp) return false;
-
-    /* Use internal get that only checks main DB */
-    if (!tqdb_lock(db)) {
-        tqdb_dealloc(db, tmp);
-        return false;
+    /* Check main database, decoding into the type's temp entity */
+    void* tmp = session->temp[type_idx];
+    if (!tmp) {
+        tmp = tqdb_alloc(db, trait->struct_size);
+        if (!tmp) return false;
+        session->temp[type_idx] = tmp;
     }
 
-    FILE* f = open_for_read(db);
-    if (!f) {
-        tqdb_unlock(db);
-        tqdb_dealloc(db, tmp);
-        return false;
-    }
+    bool found = tqdb_main_find(session, type_idx, id, tmp) == TQDB_OK;
 
-    /* Read counts */
-    uint32_t counts[TQDB_MAX_ENTITY_TYPES] = {0};
-    for (size_t i = 0; i < db->trait_count; i++) {
-        fread(&counts[i], 4, 1, f);
-    }
+    if (trait->destroy) trait->destroy(tmp);
+    return found;
+}
 
-    tqdb_reader_t r;
-    tqdb_reader_init(&r, f, db->scratch, db->scratch_size);
+bool tqdb_session_exists(tqdb_session_t session, const char* type, uint32_t id) {
+    if (!session || !type || id == 0) return false;
+    tqdb_t db = session->db;
 
-    bool found = false;
+#if TQDB_ENABLE_WAL
+    /* Check for deferred WAL recovery */
+    tqdb_wal_check_recovery(db);
+#endif
 
-    /* Skip to target type */
-    for (int i = 0; i < type_idx; i++) {
-        const tqdb_trait_t* t = db->traits[i];
-        for (uint32_t j = 0; j < counts[i] && !tqdb_read_error(&r); j++) {
-            if (t->skip) {
-                t->skip(&r);
-            } else {
-                void* skip_tmp = tqdb_alloc(db, t->struct_size);
-                if (skip_tmp) {
-                    if (t->init) t->init(skip_tmp);
-                    t->read(&r, skip_tmp);
-                    if (t->destroy) t->destroy(skip_tmp);
-                    tqdb_dealloc(db, skip_tmp);
-                }
-            }
-        }
+    const tqdb_trait_t* trait = tqdb_find_trait(db, type);
+    if (!trait) return false;
+
+    int type_idx = tqdb_find_trait_index(db, type);
+
+    if (!read_lock(db, type_idx, true)) return false;
+
+    if (resident_ready(db, type_idx)) {
+        bool found = resident_find(db, type_idx, id) != NULL;
+        read_unlock(db, type_idx);
+        return found;
     }
 
-    /* Search in target type */
-    if (trait->init) trait->init(tmp);
-    for (uint32_t i = 0; i < counts[type_idx] && !tqdb_read_error(&r); i++) {
-        trait->read(&r, tmp);
-        if (trait->get_id(tmp) == id) {
-            found = true;
-            break;
+#if TQDB_ENABLE_CACHE
+    /* Check cache first for deleted marker */
+    if (db->cache) {
+        int cached = tqdb_cache_get(db, (uint8_t)type_idx, id, NULL);
+        if (cached >= 0) {
+            read_unlock(db, type_idx);
+            return cached == 1;
         }
-        if (trait->destroy) trait->destroy(tmp);
-        if (trait->init) trait->init(tmp);
     }
+#endif
 
-    if (trait->destroy) trait->destroy(tmp);
-    tqdb_dealloc(db, tmp);
-    fclose(f);
-    tqdb_unlock(db);
+    int live = live_test(db, type_idx, id);
+    if (live >= 0) {
+        read_unlock(db, type_idx);
+        return live == 1;
+    }
 
+    session_enter(session);
+    bool found = exists_in_files(session, trait, (uint8_t)type_idx, id);
+    session_leave(session);
+    read_unlock(db, type_idx);
     return found;
 }
 
+bool tqdb_exists(tqdb_t db, const char* type, uint32_t id) {
+    return db && tqdb_session_exists(db_session(db), type, id);
+}
+
 size_t tqdb_count(tqdb_t db, const char* type) {
     if (!db || !type) return 0;
 
@@ -899,11 +2018,25 @@ size_t tqdb_count(tqdb_t db, const char* type) {
     int type_idx = tqdb_find_trait_index(db, type);
     if (type_idx < 0) return 0;
 
-    if (!tqdb_lock(db)) return 0;
+    if (!read_lock(db, type_idx, true)) return 0;
+
+    if (resident_ready(db, type_idx)) {
+        size_t resident_count = db->resident[type_idx].count;
+        read_unlock(db, type_idx);
+        return resident_count;
+    }
+
+    /* Live-ID bitmap keeps the count */
+    if (live_ready(db, type_idx)) {
+        size_t live_count = db->live[type_idx].count;
+        read_unlock(db, type_idx);
+        return live_count;
+    }
 
     /* Get count from main DB file */
+    tqdb_reader_enter(db);
     uint32_t count = 0;
-    FILE* f = open_for_read(db);
+    FILE* f = tqdb_open_for_read(db);
     if (f) {
         fseek(f, TQDB_HEADER_SIZE + type_idx * 4, SEEK_SET);
         fread(&count, 4, 1, f);
@@ -912,44 +2045,40 @@ size_t tqdb_count(tqdb_t db, const char* type) {
 
 #if TQDB_ENABLE_WAL
     /* Adjust for WAL entries if WAL is enabled */
-    if (db->wal.enabled && db->wal.entry_count > 0 && db->wal.path) {
-        FILE* wal = fopen(db->wal.path, "rb");
-        if (wal) {
+    if (db->wal.enabled && tqdb_wal_pending(db) > 0 && db->wal.path) {
+        /* Track IDs we've seen to handle duplicates */
+        uint32_t* seen_ids = NULL;
+        uint8_t* seen_ops = NULL;
+        size_t seen_count = 0;
+        size_t seen_capacity = 0;
+
+        /* Segments come oldest first, so later ops overwrite earlier ones */
+        tqdb_wal_seg_t segs[TQDB_WAL_MAX_SEGMENTS];
+        size_t seg_count = tqdb_wal_segments(db, segs);
+        tqdb_wal_note_scan(db);
+
+        for (size_t s = 0; s < seg_count; s++) {
+            FILE* wal = fopen(segs[s].path, "rb");
+            if (!wal) continue;
+
             /* Skip WAL header */
             fseek(wal, TQDB_WAL_HEADER_SIZE, SEEK_SET);
 
-            /* Track IDs we've seen to handle duplicates */
-            uint32_t* seen_ids = NULL;
-            uint8_t* seen_ops = NULL;
-            size_t seen_count = 0;
-            size_t seen_capacity = 0;
-
-            for (uint32_t i = 0; i < db->wal.entry_count; i++) {
-                uint32_t entry_crc;
-                uint8_t op, tidx;
-                uint32_t entry_id;
-
-                if (fread(&entry_crc, 4, 1, wal) != 1) break;
-                if (fread(&op, 1, 1, wal) != 1) break;
-                if (fread(&tidx, 1, 1, wal) != 1) break;
-                if (fread(&entry_id, 4, 1, wal) != 1) break;
-
-                uint32_t data_len;
-                if (fread(&data_len, 4, 1, wal) != 1) break;
-
+            tqdb_wal_entry_t e;
+            for (uint32_t i = 0; i < segs[s].entry_count && tqdb_wal_read_entry(wal, &e); i++) {
                 /* Skip entity data */
-                if (data_len > 0) {
-                    fseek(wal, data_len, SEEK_CUR);
+                if (e.data_len > 0) {
+                    fseek(wal, e.data_len, SEEK_CUR);
                 }
 
                 /* Only process entries for our type */
-                if (tidx != (uint8_t)type_idx) continue;
+                if (e.type_idx != (uint8_t)type_idx) continue;
 
                 /* Check if we've seen this ID before */
                 bool found = false;
                 size_t found_idx = 0;
                 for (size_t j = 0; j < seen_count; j++) {
-                    if (seen_ids[j] == entry_id) {
+                    if (seen_ids[j] == e.id) {
                         found = true;
                         found_idx = j;
                         break;
@@ -957,8 +2086,14 @@ size_t tqdb_count(tqdb_t db, const char* type) {
                 }
 
                 if (found) {
-                    /* Update the operation for this ID */
-                    seen_ops[found_idx] = op;
+                    /* Net effect: ADD then UPDATE is still an ADD, ADD then DELETE is nothing */
+                    if (e.op == TQDB_WAL_OP_MERGE) {
+                        /* Folds into whatever is there; never changes the count */
+                    } else if (seen_ops[found_idx] != TQDB_WAL_OP_ADD) {
+                        seen_ops[found_idx] = e.op;
+                    } else if (e.op == TQDB_WAL_OP_DELETE) {
+                        seen_ops[found_idx] = 0;
+                    }
                 } else {
                     /* Add new ID */
                     if (seen_count >= seen_capacity) {
@@ -980,34 +2115,35 @@ size_t tqdb_count(tqdb_t db, const char* type) {
                         seen_ops = new_ops;
                         seen_capacity = new_cap;
                     }
-                    seen_ids[seen_count] = entry_id;
-                    seen_ops[seen_count] = op;
+                    seen_ids[seen_count] = e.id;
+                    seen_ops[seen_count] = e.op;
                     seen_count++;
                 }
             }
             fclose(wal);
+        }
 
-            /* Now calculate count adjustment */
-            /* For each unique ID in WAL:
-             * - ADD that doesn't exist in DB: +1
-             * - DELETE that exists in DB: -1
-             * - UPDATE: no change
-             */
-            for (size_t j = 0; j < seen_count; j++) {
-                if (seen_ops[j] == TQDB_WAL_OP_ADD) {
-                    count++;
-                } else if (seen_ops[j] == TQDB_WAL_OP_DELETE) {
-                    if (count > 0) count--;
-                }
-                /* UPDATE doesn't change count */
+        /* Now calculate count adjustment */
+        /* For each unique ID in WAL:
+         * - ADD that doesn't exist in DB: +1
+         * - DELETE that exists in DB: -1
+         * - UPDATE, PATCH, MERGE: no change
+         */
+        for (size_t j = 0; j < seen_count; j++) {
+            if (seen_ops[j] == TQDB_WAL_OP_ADD) {
+                count++;
+            } else if (seen_ops[j] == TQDB_WAL_OP_DELETE) {
+                if (count > 0) count--;
             }
-            if (seen_ids) tqdb_dealloc(db, seen_ids);
-            if (seen_ops) tqdb_dealloc(db, seen_ops);
+            /* UPDATE, PATCH and MERGE don't change count */
         }
+        if (seen_ids) tqdb_dealloc(db, seen_ids);
+        if (seen_ops) tqdb_dealloc(db, seen_ops);
     }
 #endif /* TQDB_ENABLE_WAL */
 
-    tqdb_unlock(db);
+    tqdb_reader_leave(db);
+    read_unlock(db, type_idx);
     return count;
 }
 
@@ -1023,6 +2159,7 @@ typedef struct {
     uint32_t* ids;          /* Array of IDs in WAL */
     uint8_t* ops;           /* Array of operations */
     void** entities;        /* Array of entity data (NULL for deletes) */
+    tqdb_wal_chain_t* chains; /* PATCH/MERGE records over the entity (or the main version) */
     size_t count;
     size_t capacity;
 } wal_id_set_t;
@@ -1045,6 +2182,10 @@ static void wal_id_set_destroy(tqdb_t db, wal_id_set_t* set, const tqdb_trait_t*
         tqdb_dealloc(db, set->entities);
     }
     if (set->ops) tqdb_dealloc(db, set->ops);
+    if (set->chains) {
+        for (size_t i = 0; i < set->count; i++) tqdb_wal_chain_free(db, &set->chains[i]);
+        tqdb_dealloc(db, set->chains);
+    }
 }
 
 static int wal_id_set_find(wal_id_set_t* set, uint32_t id) {
@@ -1056,16 +2197,25 @@ static int wal_id_set_find(wal_id_set_t* set, uint32_t id) {
     return -1;
 }
 
-static bool wal_id_set_add(tqdb_t db, wal_id_set_t* set, uint32_t id,
-                           uint8_t op, void* entity) {
+static bool wal_id_set_add(tqdb_t db, wal_id_set_t* set, uint32_t id, uint8_t op,
+                           void* entity, const tqdb_wal_seg_t* seg, long data_pos) {
+    bool folds = op == TQDB_WAL_OP_PATCH || op == TQDB_WAL_OP_MERGE;
     int idx = wal_id_set_find(set, id);
     if (idx >= 0) {
-        /* Update existing entry */
-        set->ops[idx] = op;
+        if (folds) {
+            /* Applied over the image once loading is done */
+            if (set->ops[idx] == TQDB_WAL_OP_DELETE) return true;
+            return tqdb_wal_chain_add(db, &set->chains[idx], seg, data_pos, op);
+        }
+        /* Update existing entry (an ADD stays an ADD across later UPDATEs) */
+        if (!(set->ops[idx] == TQDB_WAL_OP_ADD && op == TQDB_WAL_OP_UPDATE)) {
+            set->ops[idx] = op;
+        }
         if (set->entities[idx]) {
             tqdb_dealloc(db, set->entities[idx]);
         }
         set->entities[idx] = entity;
+        set->chains[idx].count = 0;
         return true;
     }
 
@@ -1075,107 +2225,220 @@ static bool wal_id_set_add(tqdb_t db, wal_id_set_t* set, uint32_t id,
         uint32_t* new_ids = (uint32_t*)tqdb_alloc(db, new_cap * sizeof(uint32_t));
         uint8_t* new_ops = (uint8_t*)tqdb_alloc(db, new_cap);
         void** new_entities = (void**)tqdb_alloc(db, new_cap * sizeof(void*));
+        tqdb_wal_chain_t* new_chains =
+            (tqdb_wal_chain_t*)tqdb_alloc(db, new_cap * sizeof(tqdb_wal_chain_t));
 
-        if (!new_ids || !new_ops || !new_entities) {
+        if (!new_ids || !new_ops || !new_entities || !new_chains) {
             if (new_ids) tqdb_dealloc(db, new_ids);
             if (new_ops) tqdb_dealloc(db, new_ops);
             if (new_entities) tqdb_dealloc(db, new_entities);
+            if (new_chains) tqdb_dealloc(db, new_chains);
             return false;
         }
 
         memset(new_ids, 0, new_cap * sizeof(uint32_t));
         memset(new_ops, 0, new_cap);
         memset(new_entities, 0, new_cap * sizeof(void*));
+        memset(new_chains, 0, new_cap * sizeof(tqdb_wal_chain_t));
 
         if (set->ids) {
             memcpy(new_ids, set->ids, set->count * sizeof(uint32_t));
             memcpy(new_ops, set->ops, set->count);
             memcpy(new_entities, set->entities, set->count * sizeof(void*));
+            memcpy(new_chains, set->chains, set->count * sizeof(tqdb_wal_chain_t));
             tqdb_dealloc(db, set->ids);
             tqdb_dealloc(db, set->ops);
             tqdb_dealloc(db, set->entities);
+            tqdb_dealloc(db, set->chains);
         }
 
         set->ids = new_ids;
         set->ops = new_ops;
         set->entities = new_entities;
+        set->chains = new_chains;
         set->capacity = new_cap;
     }
 
     set->ids[set->count] = id;
     set->ops[set->count] = op;
     set->entities[set->count] = entity;
+    memset(&set->chains[set->count], 0, sizeof(tqdb_wal_chain_t));
     set->count++;
+    if (folds) {
+        return tqdb_wal_chain_add(db, &set->chains[set->count - 1], seg, data_pos, op);
+    }
 
     return true;
 }
 
 /**
- * Load WAL entries for a specific type into the ID set
+ * Load a view's WAL entries for a specific type into the ID set
  */
-static tqdb_err_t load_wal_entries(tqdb_t db, int type_idx, const tqdb_trait_t* trait,
-                                    wal_id_set_t* set) {
-    if (!db->wal.enabled || db->wal.entry_count == 0 || !db->wal.path) {
-        return TQDB_OK;
-    }
+static tqdb_err_t load_wal_entries(const struct tqdb_snapshot_s* view, int type_idx,
+                                    const tqdb_trait_t* trait, wal_id_set_t* set) {
+    tqdb_t db = view->db;
+    size_t half = db->scratch_size / 2;
 
-    FILE* wal = fopen(db->wal.path, "rb");
-    if (!wal) return TQDB_OK;
+    for (size_t s = 0; s < view->seg_count; s++) {
+        const tqdb_wal_seg_t* seg = &view->segs[s];
+        FILE* wal = seg->file ? seg->file : fopen(seg->path, "rb");
+        if (!wal) continue;
 
-    /* Skip WAL header */
-    fseek(wal, TQDB_WAL_HEADER_SIZE, SEEK_SET);
+        /* Skip WAL header */
+        fseek(wal, TQDB_WAL_HEADER_SIZE, SEEK_SET);
 
-    size_t half = db->scratch_size / 2;
+        tqdb_wal_entry_t e;
+        for (uint32_t i = 0; i < seg->entry_count && tqdb_wal_read_entry(wal, &e); i++) {
+            /* Only process entries for our type */
+            if (e.type_idx != (uint8_t)type_idx) {
+                if (e.data_len > 0) fseek(wal, e.data_len, SEEK_CUR);
+                continue;
+            }
+
+            if (e.op == TQDB_WAL_OP_PATCH || e.op == TQDB_WAL_OP_MERGE) {
+                /* Applied once loading is done, over the final image */
+                wal_id_set_add(db, set, e.id, e.op, NULL, seg, e.data_pos);
+                if (e.data_len > 0) fseek(wal, e.data_len, SEEK_CUR);
+                continue;
+            }
 
-    for (uint32_t i = 0; i < db->wal.entry_count; i++) {
-        uint32_t entry_crc;
-        uint8_t op, tidx;
-        uint32_t entry_id;
+            void* entity = NULL;
+            if (e.op != TQDB_WAL_OP_DELETE && e.data_len > 0) {
+                entity = tqdb_alloc(db, trait->struct_size);
+                if (entity) {
+                    tqdb_reader_t r;
+                    tqdb_reader_init(&r, wal, view->buf, half);
+                    if (trait->init) trait->init(entity);
+                    trait->read(&r, entity);
+                    if (tqdb_read_error(&r)) {
+                        if (trait->destroy) trait->destroy(entity);
+                        tqdb_dealloc(db, entity);
+                        entity = NULL;
+                    }
+                }
+                fseek(wal, e.data_pos + e.data_len, SEEK_SET);
+            } else if (e.data_len > 0) {
+                fseek(wal, e.data_len, SEEK_CUR);
+            }
 
-        if (fread(&entry_crc, 4, 1, wal) != 1) break;
-        if (fread(&op, 1, 1, wal) != 1) break;
-        if (fread(&tidx, 1, 1, wal) != 1) break;
-        if (fread(&entry_id, 4, 1, wal) != 1) break;
+            wal_id_set_add(db, set, e.id, e.op, entity, NULL, 0);
+        }
 
-        uint32_t data_len;
-        if (fread(&data_len, 4, 1, wal) != 1) break;
+        if (!seg->file) fclose(wal);
+    }
 
-        /* Only process entries for our type */
-        if (tidx != (uint8_t)type_idx) {
-            if (data_len > 0) fseek(wal, data_len, SEEK_CUR);
-            continue;
+    /* Fold chains into WAL images; other keys fold over the main file entry */
+    for (size_t i = 0; i < set->count; i++) {
+        if (set->chains[i].count == 0 || !set->entities[i]) continue;
+        if (!tqdb_wal_chain_apply(db, trait, &set->chains[i], set->entities[i])) {
+            return TQDB_ERR_CORRUPT;
         }
+        set->chains[i].count = 0;
+    }
 
-        void* entity = NULL;
-        if (op != TQDB_WAL_OP_DELETE && data_len > 0) {
-            long entity_start = ftell(wal);
-            entity = tqdb_alloc(db, trait->struct_size);
-            if (entity) {
-                tqdb_reader_t r;
-                tqdb_reader_init(&r, wal, db->scratch, half);
+    return TQDB_OK;
+}
+#endif /* TQDB_ENABLE_WAL */
+
+/** Iterate one type as a view sees it: main file entities merged with its WAL */
+static tqdb_err_t view_foreach(const struct tqdb_snapshot_s* view, int type_idx,
+                               const tqdb_trait_t* trait, void** temp,
+                               tqdb_iter_fn fn, void* ctx) {
+    tqdb_t db = view->db;
+
+#if TQDB_ENABLE_WAL
+    /* Load WAL entries for this type */
+    wal_id_set_t wal_set;
+    wal_id_set_init(&wal_set);
+    load_wal_entries(view, type_idx, trait, &wal_set);
+#endif
+
+    FILE* f = view->main;
+    uint32_t db_count = 0;
+
+    if (f) {
+        /* Read counts */
+        uint32_t counts[TQDB_MAX_ENTITY_TYPES] = {0};
+        fseek(f, TQDB_HEADER_SIZE, SEEK_SET);
+        for (size_t i = 0; i < view->trait_count; i++) {
+            fread(&counts[i], 4, 1, f);
+        }
+        db_count = counts[type_idx];
+
+        tqdb_reader_t r;
+        tqdb_reader_init(&r, f, view->buf, db->scratch_size);
+
+        /* Skip to target type */
+        tqdb_skip_to_type(db, &r, counts, type_idx, temp);
+
+        /* Iterate main DB entries */
+        void* entity = tqdb_alloc(db, trait->struct_size);
+        if (entity) {
+            bool stop = false;
+            for (uint32_t i = 0; i < db_count && !tqdb_read_error(&r) && !stop; i++) {
                 if (trait->init) trait->init(entity);
                 trait->read(&r, entity);
-                if (tqdb_read_error(&r)) {
-                    if (trait->destroy) trait->destroy(entity);
-                    tqdb_dealloc(db, entity);
-                    entity = NULL;
+                if (tqdb_read_error(&r)) break;
+
+#if TQDB_ENABLE_WAL
+                uint32_t entity_id = trait->get_id(entity);
+                int wal_idx = wal_id_set_find(&wal_set, entity_id);
+
+                if (wal_idx >= 0) {
+                    /* Entity is in WAL - check operation */
+                    if (wal_set.ops[wal_idx] == TQDB_WAL_OP_DELETE) {
+                        /* Deleted - skip */
+                    } else if (wal_set.ops[wal_idx] == TQDB_WAL_OP_UPDATE) {
+                        /* Updated - use WAL version */
+                        if (wal_set.entities[wal_idx]) {
+                            if (!fn(wal_set.entities[wal_idx], ctx)) stop = true;
+                        }
+                    } else if (wal_set.ops[wal_idx] == TQDB_WAL_OP_PATCH ||
+                               wal_set.ops[wal_idx] == TQDB_WAL_OP_MERGE) {
+                        /* Patched or merged - fold the records into the main version */
+                        if (tqdb_wal_chain_apply(db, trait, &wal_set.chains[wal_idx], entity)) {
+                            if (!fn(entity, ctx)) stop = true;
+                        }
+                    }
+                    /* Mark as processed so we don't iterate it again */
+                    wal_set.ids[wal_idx] = 0;
+                } else {
+                    /* Not in WAL - use main DB version */
+                    if (!fn(entity, ctx)) stop = true;
                 }
+#else
+                /* No WAL - just use main DB version */
+                if (!fn(entity, ctx)) stop = true;
+#endif
+
+                if (trait->destroy) trait->destroy(entity);
             }
-            fseek(wal, entity_start + data_len, SEEK_SET);
-        } else if (data_len > 0) {
-            fseek(wal, data_len, SEEK_CUR);
+            tqdb_dealloc(db, entity);
         }
+    }
 
-        wal_id_set_add(db, set, entry_id, op, entity);
+#if TQDB_ENABLE_WAL
+    /* Iterate WAL ADD entries (ones not already processed) */
+    bool stop = false;
+    for (size_t i = 0; i < wal_set.count && !stop; i++) {
+        if (wal_set.ids[i] != 0 &&
+            wal_set.ops[i] == TQDB_WAL_OP_ADD &&
+            wal_set.entities[i] != NULL) {
+            if (!fn(wal_set.entities[i], ctx)) stop = true;
+        }
     }
 
-    fclose(wal);
+    wal_id_set_destroy(db, &wal_set, trait);
+#endif
+
     return TQDB_OK;
 }
-#endif /* TQDB_ENABLE_WAL */
 
-tqdb_err_t tqdb_foreach(tqdb_t db, const char* type, tqdb_iter_fn fn, void* ctx) {
-    if (!db || !type || !fn) return TQDB_ERR_INVALID_ARG;
+tqdb_err_t tqdb_session_foreach(tqdb_session_t session, const char* type,
+                                tqdb_iter_fn fn, void* ctx) {
+    if (!session || !type || !fn) return TQDB_ERR_INVALID_ARG;
+    tqdb_t db = session->db;
+    bool shared = !session->keep_files;
 
 #if TQDB_ENABLE_WAL
     /* Check for deferred WAL recovery */
@@ -1187,108 +2450,482 @@ tqdb_err_t tqdb_foreach(tqdb_t db, const char* type, tqdb_iter_fn fn, void* ctx)
 
     int type_idx = tqdb_find_trait_index(db, type);
 
-    if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
+    /* Scans through the database's shared session decode into a buffer of their own */
+    uint8_t* buf = session->buf;
+    if (shared && db->reader_lock) {
+        buf = (uint8_t*)tqdb_alloc(db, db->scratch_size);
+        if (!buf) return TQDB_ERR_NO_MEM;
+    }
+
+    if (!read_lock(db, type_idx, false)) {
+        if (buf != session->buf) tqdb_dealloc(db, buf);
+        return TQDB_ERR_TIMEOUT;
+    }
 
+    tqdb_err_t err = TQDB_OK;
+    if (resident_ready(db, type_idx)) {
+        /* Resident types iterate the in-memory array, already in ID order */
+        const tqdb_resident_t* res = &db->resident[type_idx];
+        for (uint32_t i = 0; i < res->count; i++) {
+            if (!fn(res->data + (size_t)i * trait->struct_size, ctx)) break;
+        }
+    } else {
+        /* A view that lives as long as the lock, over the session's files */
+        struct tqdb_snapshot_s view;
+        session_enter(session);
+        view_init(db, &view, session);
+        view.buf = buf;
 #if TQDB_ENABLE_WAL
-    /* Load WAL entries for this type */
-    wal_id_set_t wal_set;
-    wal_id_set_init(&wal_set);
-    load_wal_entries(db, type_idx, trait, &wal_set);
+        if (view.seg_count > 0) tqdb_session_note_scan(session);
+        for (size_t s = 0; session->keep_files && s < view.seg_count; s++) {
+            view.segs[s].file = tqdb_session_seg(session, view.segs[s].path);
+        }
 #endif
+        view.main = tqdb_session_main(session);
+        session_leave(session);
 
-    /* Open main DB file */
-    FILE* f = open_for_read(db);
-    uint32_t db_count = 0;
+        /* Callbacks may read through the database, so its session's temps stay out */
+        err = view_foreach(&view, type_idx, trait, shared ? NULL : session->temp, fn, ctx);
+        tqdb_session_put(session, view.main);
+    }
 
-    if (f) {
-        /* Read counts */
+    read_unlock(db, type_idx);
+    if (buf != session->buf) tqdb_dealloc(db, buf);
+    return err;
+}
+
+tqdb_err_t tqdb_foreach(tqdb_t db, const char* type, tqdb_iter_fn fn, void* ctx) {
+    if (!db) return TQDB_ERR_INVALID_ARG;
+    return tqdb_session_foreach(db_session(db), type, fn, ctx);
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Parallel Scans
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+#if TQDB_ENABLE_WAL
+/* A WAL overlay key and its slot in the ID set */
+typedef struct {
+    uint32_t id;
+    uint32_t idx;
+} par_key_t;
+
+static int par_key_cmp(const void* a, const void* b) {
+    uint32_t x = ((const par_key_t*)a)->id;
+    uint32_t y = ((const par_key_t*)b)->id;
+    return x < y ? -1 : x > y;
+}
+
+/* The scanned type's WAL records, shared by the workers */
+typedef struct {
+    wal_id_set_t set;
+    par_key_t* keys;            /* set, sorted by ID */
+    uint8_t* seen;              /* Per slot: met in the main file (each by one worker only) */
+} par_overlay_t;
+#endif
+
+/* One worker's share of a scan */
+typedef struct {
+    tqdb_t db;
+    const tqdb_trait_t* trait;
+    tqdb_iter_fn fn;
+    void* ctx;
+    const uint8_t* data;        /* Resident entities (NULL = main file records) */
+    FILE* main;                 /* Own main file handle */
+    long pos;                   /* Offset of the first record */
+    uint32_t count;             /* Entities or records */
+    uint8_t* buf;               /* Reader buffer (scratch_size bytes) */
+    void* entity;               /* Decode target (struct_size bytes) */
+#if TQDB_ENABLE_WAL
+    const par_overlay_t* overlay;
+#endif
+    void* thread;               /* From thread_ops (NULL = runs on the caller) */
+    bool stopped;               /* fn returned false */
+    tqdb_err_t err;
+} par_worker_t;
+
+/* File offset of the next byte a reader returns */
+static long reader_tell(tqdb_reader_t* r) {
+    return ftell(r->file) - (long)(r->buf_filled - r->buf_pos);
+}
+
+/* Deal total entities to the first n workers, in order */
+static void par_split(par_worker_t* workers, size_t n, uint32_t total) {
+    for (size_t i = 0; i < n; i++) {
+        workers[i].count = (uint32_t)(total / n + (i < total % n ? 1 : 0));
+    }
+}
+
+#if TQDB_ENABLE_WAL
+/* Pass a main file entity through the WAL overlay, as view_foreach does */
+static bool par_emit(par_worker_t* w, void* entity) {
+    const par_overlay_t* o = w->overlay;
+    uint32_t id = w->trait->get_id(entity);
+    size_t lo = 0, hi = o->set.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (o->keys[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == o->set.count || o->keys[lo].id != id) return w->fn(entity, w->ctx);
+
+    uint32_t idx = o->keys[lo].idx;
+    o->seen[idx] = 1;
+    switch (o->set.ops[idx]) {
+    case TQDB_WAL_OP_UPDATE:
+        return !o->set.entities[idx] || w->fn(o->set.entities[idx], w->ctx);
+    case TQDB_WAL_OP_PATCH:
+    case TQDB_WAL_OP_MERGE:
+        return !tqdb_wal_chain_apply(w->db, w->trait, &o->set.chains[idx], entity) ||
+               w->fn(entity, w->ctx);
+    default:
+        return true;  /* Deleted */
+    }
+}
+#endif
+
+static void par_run(void* arg) {
+    par_worker_t* w = (par_worker_t*)arg;
+    const tqdb_trait_t* trait = w->trait;
+
+    if (w->data) {
+        for (uint32_t i = 0; i < w->count; i++) {
+            if (!w->fn(w->data + (size_t)i * trait->struct_size, w->ctx)) {
+                w->stopped = true;
+                break;
+            }
+        }
+        return;
+    }
+    if (w->count == 0) return;
+
+    void* entity = w->entity;
+    tqdb_reader_t r;
+    fseek(w->main, w->pos, SEEK_SET);
+    tqdb_reader_init(&r, w->main, w->buf, w->db->scratch_size);
+
+    bool more = true;
+    for (uint32_t i = 0; i < w->count && more; i++) {
+        if (trait->init) trait->init(entity);
+        trait->read(&r, entity);
+        if (tqdb_read_error(&r)) {
+            w->err = TQDB_ERR_CORRUPT;
+            break;
+        }
+#if TQDB_ENABLE_WAL
+        more = par_emit(w, entity);
+#else
+        more = w->fn(entity, w->ctx);
+#endif
+        if (trait->destroy) trait->destroy(entity);
+    }
+    w->stopped = !more;
+}
+
+/* Start the workers but the first on threads, run the first here, then join */
+static tqdb_err_t par_run_all(tqdb_t db, par_worker_t* workers, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        if (db->thread_ops && workers[i].count > 0) {
+            workers[i].thread = db->thread_ops->start(par_run, &workers[i]);
+        }
+    }
+    par_run(&workers[0]);
+
+    tqdb_err_t err = workers[0].err;
+    for (size_t i = 1; i < n; i++) {
+        if (workers[i].thread) {
+            db->thread_ops->join(workers[i].thread);
+        } else {
+            par_run(&workers[i]);  /* No thread for it: the range runs here */
+        }
+        if (err == TQDB_OK) err = workers[i].err;
+    }
+    return err;
+}
+
+/**
+ * Scan the files in ranges (caller holds the read lock). Records carry no
+ * length, so the caller walks the section with the trait's skip to find
+ * where each range starts; a type without skip is a single range. The WAL
+ * is loaded once and sorted for the workers to look keys up in. Buffers
+ * are allocated here, so workers never call the allocator.
+ */
+static tqdb_err_t par_scan_files(tqdb_t db, int type_idx, par_worker_t* workers, size_t n) {
+    const tqdb_trait_t* trait = db->traits[type_idx];
+    uint8_t* bufs = (uint8_t*)tqdb_alloc(db, n * db->scratch_size);
+    uint8_t* entities = (uint8_t*)tqdb_alloc(db, n * trait->struct_size);
+    if (!bufs || !entities) {
+        tqdb_dealloc(db, bufs);
+        tqdb_dealloc(db, entities);
+        return TQDB_ERR_NO_MEM;
+    }
+
+    tqdb_session_t session = db_session(db);
+    struct tqdb_snapshot_s view;
+    session_enter(session);
+    view_init(db, &view, session);
+    view.buf = bufs;
+#if TQDB_ENABLE_WAL
+    if (view.seg_count > 0) tqdb_session_note_scan(session);
+#endif
+    view.main = tqdb_session_main(session);
+    session_leave(session);
+
+    tqdb_err_t err = TQDB_OK;
+#if TQDB_ENABLE_WAL
+    par_overlay_t overlay;
+    memset(&overlay, 0, sizeof(overlay));
+    wal_id_set_init(&overlay.set);
+    err = load_wal_entries(&view, type_idx, trait, &overlay.set);
+    if (err == TQDB_OK && overlay.set.count > 0) {
+        overlay.keys = (par_key_t*)tqdb_alloc(db, overlay.set.count * sizeof(par_key_t));
+        overlay.seen = (uint8_t*)tqdb_alloc(db, overlay.set.count);
+        if (!overlay.keys || !overlay.seen) {
+            err = TQDB_ERR_NO_MEM;
+        } else {
+            for (size_t i = 0; i < overlay.set.count; i++) {
+                overlay.keys[i].id = overlay.set.ids[i];
+                overlay.keys[i].idx = (uint32_t)i;
+            }
+            qsort(overlay.keys, overlay.set.count, sizeof(par_key_t), par_key_cmp);
+            memset(overlay.seen, 0, overlay.set.count);
+        }
+    }
+#endif
+
+    size_t ranges = 0;
+    if (err == TQDB_OK && view.main) {
         uint32_t counts[TQDB_MAX_ENTITY_TYPES] = {0};
-        for (size_t i = 0; i < db->trait_count; i++) {
-            fread(&counts[i], 4, 1, f);
+        fseek(view.main, TQDB_HEADER_SIZE, SEEK_SET);
+        for (size_t i = 0; i < view.trait_count; i++) {
+            fread(&counts[i], 4, 1, view.main);
         }
-        db_count = counts[type_idx];
+        uint32_t total = counts[type_idx];
 
         tqdb_reader_t r;
-        tqdb_reader_init(&r, f, db->scratch, db->scratch_size);
-
-        /* Skip to target type */
-        for (int i = 0; i < type_idx; i++) {
-            const tqdb_trait_t* t = db->traits[i];
-            for (uint32_t j = 0; j < counts[i] && !tqdb_read_error(&r); j++) {
-                if (t->skip) {
-                    t->skip(&r);
-                } else {
-                    void* tmp = tqdb_alloc(db, t->struct_size);
-                    if (tmp) {
-                        if (t->init) t->init(tmp);
-                        t->read(&r, tmp);
-                        if (t->destroy) t->destroy(tmp);
-                        tqdb_dealloc(db, tmp);
-                    }
-                }
+        tqdb_reader_init(&r, view.main, view.buf, db->scratch_size);
+        tqdb_skip_to_type(db, &r, counts, type_idx, NULL);
+
+        ranges = trait->skip ? n : 1;
+        if (ranges > total) ranges = total;
+        par_split(workers, ranges, total);
+        for (size_t i = 0; i < ranges && !tqdb_read_error(&r); i++) {
+            workers[i].pos = reader_tell(&r);
+            for (uint32_t j = 0; i + 1 < ranges && j < workers[i].count; j++) {
+                trait->skip(&r);
             }
         }
+        if (tqdb_read_error(&r)) err = TQDB_ERR_CORRUPT;
+    }
+
+    /* Each range reads through a handle and buffer of its own */
+    for (size_t i = 0; err == TQDB_OK && i < ranges; i++) {
+        workers[i].main = i == 0 ? view.main : fopen(db->db_path, "rb");
+        workers[i].buf = bufs + i * db->scratch_size;
+        workers[i].entity = entities + i * trait->struct_size;
+#if TQDB_ENABLE_WAL
+        workers[i].overlay = &overlay;
+#endif
+        if (!workers[i].main) err = TQDB_ERR_IO;
+    }
+    if (err == TQDB_OK) err = par_run_all(db, workers, n);
+
+#if TQDB_ENABLE_WAL
+    /* Keys only in the WAL have the newest IDs: they continue the last range, here */
+    bool tail = err == TQDB_OK && !workers[n - 1].stopped;
+    for (size_t i = 0; tail && i < overlay.set.count; i++) {
+        if (overlay.seen[i] || overlay.set.ops[i] != TQDB_WAL_OP_ADD) continue;
+        if (overlay.set.entities[i]) {
+            tail = workers[n - 1].fn(overlay.set.entities[i], workers[n - 1].ctx);
+        }
+    }
+    wal_id_set_destroy(db, &overlay.set, trait);
+    tqdb_dealloc(db, overlay.keys);
+    tqdb_dealloc(db, overlay.seen);
+#endif
+
+    for (size_t i = 1; i < ranges; i++) {
+        if (workers[i].main) fclose(workers[i].main);
+    }
+    tqdb_session_put(session, view.main);
+    tqdb_dealloc(db, bufs);
+    tqdb_dealloc(db, entities);
+    return err;
+}
+
+tqdb_err_t tqdb_foreach_parallel(tqdb_t db, const char* type, size_t nthreads,
+                                 tqdb_iter_fn fn, void* const* ctxs) {
+    if (!db || !type || !fn || !ctxs || nthreads == 0) return TQDB_ERR_INVALID_ARG;
+
+#if TQDB_ENABLE_WAL
+    /* Check for deferred WAL recovery */
+    tqdb_wal_check_recovery(db);
+#endif
+
+    const tqdb_trait_t* trait = tqdb_find_trait(db, type);
+    if (!trait) return TQDB_ERR_NOT_REGISTERED;
+
+    int type_idx = tqdb_find_trait_index(db, type);
+
+    par_worker_t* workers = (par_worker_t*)tqdb_alloc(db, nthreads * sizeof(par_worker_t));
+    if (!workers) return TQDB_ERR_NO_MEM;
+    memset(workers, 0, nthreads * sizeof(par_worker_t));
+    for (size_t i = 0; i < nthreads; i++) {
+        workers[i].db = db;
+        workers[i].trait = trait;
+        workers[i].fn = fn;
+        workers[i].ctx = ctxs[i];
+    }
+
+    if (!read_lock(db, type_idx, false)) {
+        tqdb_dealloc(db, workers);
+        return TQDB_ERR_TIMEOUT;
+    }
+
+    tqdb_err_t err;
+    if (resident_ready(db, type_idx)) {
+        /* Slices of the in-memory array */
+        const tqdb_resident_t* res = &db->resident[type_idx];
+        par_split(workers, nthreads, res->count);
+        size_t first = 0;
+        for (size_t i = 0; i < nthreads; i++) {
+            workers[i].data = res->data + first * trait->struct_size;
+            first += workers[i].count;
+        }
+        err = res->count > 0 ? par_run_all(db, workers, nthreads) : TQDB_OK;
+    } else {
+        err = par_scan_files(db, type_idx, workers, nthreads);
+    }
+
+    read_unlock(db, type_idx);
+    tqdb_dealloc(db, workers);
+    return err;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Snapshots
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+tqdb_err_t tqdb_snapshot_open(tqdb_t db, tqdb_snapshot_t* out_snap) {
+    if (!db || !out_snap) return TQDB_ERR_INVALID_ARG;
+    *out_snap = NULL;
+
+#if TQDB_ENABLE_WAL
+    /* Check for deferred WAL recovery */
+    tqdb_wal_check_recovery(db);
+#endif
+
+    tqdb_snapshot_t snap = (tqdb_snapshot_t)tqdb_alloc(db, sizeof(struct tqdb_snapshot_s));
+    if (!snap) return TQDB_ERR_NO_MEM;
+    memset(snap, 0, sizeof(*snap));
+    snap->db = db;
+    snap->buf = (uint8_t*)tqdb_alloc(db, db->scratch_size);
+    if (!snap->buf) {
+        tqdb_dealloc(db, snap);
+        return TQDB_ERR_NO_MEM;
+    }
+
+    if (!tqdb_lock_as(db, false)) {
+        tqdb_snapshot_close(snap);
+        return TQDB_ERR_TIMEOUT;
+    }
 
-        /* Iterate main DB entries */
-        void* entity = tqdb_alloc(db, trait->struct_size);
-        if (entity) {
-            bool stop = false;
-            for (uint32_t i = 0; i < db_count && !tqdb_read_error(&r) && !stop; i++) {
-                if (trait->init) trait->init(entity);
-                trait->read(&r, entity);
-                if (tqdb_read_error(&r)) break;
+    tqdb_err_t err = TQDB_OK;
+    snap->trait_count = db->trait_count;
+    snap->main = tqdb_open_for_read(db);
 
 #if TQDB_ENABLE_WAL
-                uint32_t entity_id = trait->get_id(entity);
-                int wal_idx = wal_id_set_find(&wal_set, entity_id);
+    tqdb_checkpoint_poll(db);
 
-                if (wal_idx >= 0) {
-                    /* Entity is in WAL - check operation */
-                    if (wal_set.ops[wal_idx] == TQDB_WAL_OP_DELETE) {
-                        /* Deleted - skip */
-                    } else if (wal_set.ops[wal_idx] == TQDB_WAL_OP_UPDATE) {
-                        /* Updated - use WAL version */
-                        if (wal_set.entities[wal_idx]) {
-                            if (!fn(wal_set.entities[wal_idx], ctx)) stop = true;
-                        }
-                    }
-                    /* Mark as processed so we don't iterate it again */
-                    wal_set.ids[wal_idx] = 0;
-                } else {
-                    /* Not in WAL - use main DB version */
-                    if (!fn(entity, ctx)) stop = true;
-                }
-#else
-                /* No WAL - just use main DB version */
-                if (!fn(entity, ctx)) stop = true;
+    if (db->wal.enabled) {
+        snap->lsn = db->wal.last_lsn;
+        if (tqdb_wal_pending(db) > 0) {
+            snap->seg_count = tqdb_wal_segments(db, snap->segs);
+        }
+        for (size_t s = 0; s < snap->seg_count; s++) {
+            snap->segs[s].file = fopen(snap->segs[s].path, "rb");
+            if (!snap->segs[s].file) err = TQDB_ERR_IO;
+        }
+    }
 #endif
 
-                if (trait->destroy) trait->destroy(entity);
-            }
-            tqdb_dealloc(db, entity);
-        }
-        fclose(f);
+    tqdb_unlock(db);
+
+    if (err != TQDB_OK) {
+        tqdb_snapshot_close(snap);
+        return err;
     }
+    *out_snap = snap;
+    return TQDB_OK;
+}
+
+void tqdb_snapshot_close(tqdb_snapshot_t snap) {
+    if (!snap) return;
 
+    if (snap->main) fclose(snap->main);
 #if TQDB_ENABLE_WAL
-    /* Iterate WAL ADD entries (ones not already processed) */
-    bool stop = false;
-    for (size_t i = 0; i < wal_set.count && !stop; i++) {
-        if (wal_set.ids[i] != 0 &&
-            wal_set.ops[i] == TQDB_WAL_OP_ADD &&
-            wal_set.entities[i] != NULL) {
-            if (!fn(wal_set.entities[i], ctx)) stop = true;
-        }
+    for (size_t s = 0; s < snap->seg_count; s++) {
+        if (snap->segs[s].file) fclose(snap->segs[s].file);
     }
+#endif
+    tqdb_dealloc(snap->db, snap->buf);
+    tqdb_dealloc(snap->db, snap);
+}
 
-    wal_id_set_destroy(db, &wal_set, trait);
+tqdb_err_t tqdb_snapshot_foreach(tqdb_snapshot_t snap, const char* type,
+                                 tqdb_iter_fn fn, void* ctx) {
+    if (!snap || !type || !fn) return TQDB_ERR_INVALID_ARG;
+
+    /* Traits are fixed once registered, so no lock is needed */
+    int type_idx = tqdb_find_trait_index(snap->db, type);
+    if (type_idx < 0) return TQDB_ERR_NOT_REGISTERED;
+    if ((size_t)type_idx >= snap->trait_count) return TQDB_OK;  /* Registered since */
+
+    return view_foreach(snap, type_idx, snap->db->traits[type_idx], NULL, fn, ctx);
+}
+
+#if TQDB_ENABLE_WAL
+uint64_t tqdb_snapshot_lsn(tqdb_snapshot_t snap) {
+    return snap ? snap->lsn : 0;
+}
 #endif
 
-    tqdb_unlock(db);
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Sessions
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+tqdb_err_t tqdb_session_open(tqdb_t db, tqdb_session_t* out_session) {
+    if (!db || !out_session) return TQDB_ERR_INVALID_ARG;
+    *out_session = NULL;
+
+    tqdb_session_t session = (tqdb_session_t)tqdb_alloc(db, sizeof(struct tqdb_session_s));
+    if (!session) return TQDB_ERR_NO_MEM;
+    memset(session, 0, sizeof(*session));
+    session->db = db;
+    session->keep_files = true;
+    session->buf = (uint8_t*)tqdb_alloc(db, db->scratch_size);
+    if (!session->buf) {
+        tqdb_dealloc(db, session);
+        return TQDB_ERR_NO_MEM;
+    }
 
+    /* No files yet: the first read opens them at the current generation */
+    *out_session = session;
     return TQDB_OK;
 }
 
+void tqdb_session_close(tqdb_session_t session) {
+    if (!session) return;
+    tqdb_t db = session->db;
+
+    session_drop_files(session);
+    for (size_t i = 0; i < TQDB_MAX_ENTITY_TYPES; i++) {
+        tqdb_dealloc(db, session->temp[i]);  /* Destroyed after each use */
+    }
+    tqdb_dealloc(db, session->buf);
+    tqdb_dealloc(db, session);
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Batch Operations
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -1303,6 +2940,11 @@ tqdb_err_t tqdb_modify_where(tqdb_t db, const char* type,
 
     if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
 
+#if TQDB_ENABLE_WAL
+    /* The worker reads the main file; let it land before rewriting it */
+    tqdb_checkpoint_wait(db);
+#endif
+
     stream_ctx_t ctx = {0};
     ctx.delete_type_idx = -1;
     ctx.update_type_idx = -1;
@@ -1314,6 +2956,7 @@ tqdb_err_t tqdb_modify_where(tqdb_t db, const char* type,
     ctx.modify_ctx = modify_ctx;
 
     tqdb_err_t err = stream_modify(db, &ctx);
+    resident_drop(db, type_idx);  /* Reloaded on next use */
 
     tqdb_unlock(db);
     return err;
@@ -1328,6 +2971,11 @@ tqdb_err_t tqdb_delete_where(tqdb_t db, const char* type,
 
     if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
 
+#if TQDB_ENABLE_WAL
+    /* The worker reads the main file; let it land before rewriting it */
+    tqdb_checkpoint_wait(db);
+#endif
+
     stream_ctx_t sctx = {0};
     sctx.delete_type_idx = -1;
     sctx.update_type_idx = -1;
@@ -1337,6 +2985,7 @@ tqdb_err_t tqdb_delete_where(tqdb_t db, const char* type,
     sctx.modify_type_idx = -1;
 
     tqdb_err_t err = stream_modify(db, &sctx);
+    resident_drop(db, type_idx);  /* Reloaded on next use */
 
     tqdb_unlock(db);
     return err;
@@ -1352,6 +3001,11 @@ tqdb_err_t tqdb_vacuum(tqdb_t db) {
     /* Vacuum is just a stream_modify with no operations - rewrites the file */
     if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
 
+#if TQDB_ENABLE_WAL
+    /* The worker reads the main file; let it land before rewriting it */
+    tqdb_checkpoint_wait(db);
+#endif
+
     stream_ctx_t ctx = {0};
     ctx.delete_type_idx = -1;
     ctx.update_type_idx = -1;
@@ -1372,348 +3026,101 @@ tqdb_err_t tqdb_flush(tqdb_t db) {
 
 #if TQDB_ENABLE_WAL
 /* ═══════════════════════════════════════════════════════════════════════════
- * WAL Checkpoint Merge
+ * Public WAL API
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-/**
- * WAL entry for in-memory replay
- */
-typedef struct {
-    uint8_t op;
-    uint8_t type_idx;
-    uint32_t id;
-    void* entity;  /* NULL for deletes */
-} wal_replay_entry_t;
+tqdb_err_t tqdb_checkpoint(tqdb_t db) {
+    if (!db) return TQDB_ERR_INVALID_ARG;
+    if (!db->wal.enabled) return TQDB_OK;
 
-/**
- * Merge WAL entries into main database.
- * Called by tqdb_wal_checkpoint_internal().
- */
-tqdb_err_t tqdb_checkpoint_merge(tqdb_t db) {
-    if (!db || !db->wal.enabled || !db->wal.path) return TQDB_OK;
-    if (db->wal.entry_count == 0) return TQDB_OK;
-
-    /* Read all WAL entries into memory */
-    FILE* wal = fopen(db->wal.path, "rb");
-    if (!wal) return TQDB_ERR_IO;
-
-    /* Skip WAL header */
-    fseek(wal, TQDB_WAL_HEADER_SIZE, SEEK_SET);
-
-    /* Allocate array for WAL entries */
-    wal_replay_entry_t* entries = (wal_replay_entry_t*)tqdb_alloc(db,
-        db->wal.entry_count * sizeof(wal_replay_entry_t));
-    if (!entries) {
-        fclose(wal);
-        return TQDB_ERR_NO_MEM;
-    }
-    memset(entries, 0, db->wal.entry_count * sizeof(wal_replay_entry_t));
+    if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
 
-    size_t half = db->scratch_size / 2;
-    uint32_t valid_entries = 0;
-
-    /* Read WAL entries */
-    for (uint32_t i = 0; i < db->wal.entry_count && valid_entries < db->wal.entry_count; i++) {
-        uint32_t entry_crc;
-        uint8_t op, type_idx;
-        uint32_t entry_id;
-
-        if (fread(&entry_crc, 4, 1, wal) != 1) break;
-        if (fread(&op, 1, 1, wal) != 1) break;
-        if (fread(&type_idx, 1, 1, wal) != 1) break;
-        if (fread(&entry_id, 4, 1, wal) != 1) break;
-
-        if (type_idx >= db->trait_count) {
-            /* Skip invalid entry */
-            uint32_t data_len;
-            fread(&data_len, 4, 1, wal);
-            fseek(wal, data_len, SEEK_CUR);
-            continue;
-        }
-
-        uint32_t data_len;
-        if (fread(&data_len, 4, 1, wal) != 1) break;
-
-        entries[valid_entries].op = op;
-        entries[valid_entries].type_idx = type_idx;
-        entries[valid_entries].id = entry_id;
-
-        /* Read entity data for non-deletes */
-        if (op != TQDB_WAL_OP_DELETE && data_len > 0) {
-            const tqdb_trait_t* trait = db->traits[type_idx];
-            /* Remember position before entity data */
-            long entity_start = ftell(wal);
-            entries[valid_entries].entity = tqdb_alloc(db, trait->struct_size);
-            if (entries[valid_entries].entity) {
-                tqdb_reader_t r;
-                tqdb_reader_init(&r, wal, db->scratch, half);
-                if (trait->init) trait->init(entries[valid_entries].entity);
-                trait->read(&r, entries[valid_entries].entity);
-                if (tqdb_read_error(&r)) {
-                    if (trait->destroy) trait->destroy(entries[valid_entries].entity);
-                    tqdb_dealloc(db, entries[valid_entries].entity);
-                    entries[valid_entries].entity = NULL;
-                }
-            }
-            /* Seek to correct position after entity (buffered reader may overshoot) */
-            fseek(wal, entity_start + data_len, SEEK_SET);
-        } else if (data_len > 0) {
-            fseek(wal, data_len, SEEK_CUR);
-        }
+    tqdb_err_t err = tqdb_wal_checkpoint_internal(db);
 
-        valid_entries++;
-    }
-    fclose(wal);
+    tqdb_unlock(db);
+    return err;
+}
 
-    /* Deduplicate: keep only the last operation for each ID */
-    for (uint32_t i = 0; i < valid_entries; i++) {
-        if (entries[i].id == 0) continue;
+tqdb_err_t tqdb_wal_compact(tqdb_t db) {
+    if (!db) return TQDB_ERR_INVALID_ARG;
+    if (!db->wal.enabled) return TQDB_OK;
 
-        for (uint32_t j = i + 1; j < valid_entries; j++) {
-            if (entries[j].id != 0 &&
-                entries[i].type_idx == entries[j].type_idx &&
-                entries[i].id == entries[j].id) {
-                /* Newer entry found, invalidate older */
-                if (entries[i].entity) {
-                    const tqdb_trait_t* trait = db->traits[entries[i].type_idx];
-                    if (trait && trait->destroy) trait->destroy(entries[i].entity);
-                    tqdb_dealloc(db, entries[i].entity);
-                }
-                entries[i].id = 0;
-                entries[i].entity = NULL;
-                break;
-            }
-        }
-    }
+    /* Check for deferred WAL recovery */
+    tqdb_wal_check_recovery(db);
 
-    /* Now stream_modify with WAL entries applied */
-    size_t read_half = db->scratch_size / 2;
-    uint8_t* read_buf = db->scratch;
-    uint8_t* write_buf = db->scratch + read_half;
+    if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
 
-    FILE* src = open_for_read(db);
-    FILE* dst = fopen(db->tmp_path, "wb");
-    if (!dst) {
-        /* Free entries */
-        for (uint32_t i = 0; i < valid_entries; i++) {
-            if (entries[i].entity) {
-                const tqdb_trait_t* trait = db->traits[entries[i].type_idx];
-                if (trait && trait->destroy) trait->destroy(entries[i].entity);
-                tqdb_dealloc(db, entries[i].entity);
-            }
-        }
-        tqdb_dealloc(db, entries);
-        if (src) fclose(src);
-        return TQDB_ERR_IO;
-    }
+    tqdb_err_t err = tqdb_checkpoint_compact(db);
 
-    /* Write header placeholder */
-    tqdb_header_t hdr = { TQDB_MAGIC, TQDB_VERSION, 0, 0, 0 };
-    write_header(dst, &hdr);
+    tqdb_unlock(db);
+    return err;
+}
 
-    tqdb_writer_t w;
-    tqdb_writer_init(&w, dst, write_buf, read_half);
+tqdb_err_t tqdb_wal_stats(tqdb_t db, size_t* out_entry_count, size_t* out_size) {
+    if (!db) return TQDB_ERR_INVALID_ARG;
 
-    /* Read source counts */
-    uint32_t counts[TQDB_MAX_ENTITY_TYPES] = {0};
-    if (src) {
-        for (size_t i = 0; i < db->trait_count; i++) {
-            uint32_t c;
-            if (fread(&c, 4, 1, src) != 1) break;
-            if (c <= db->traits[i]->max_count) {
-                counts[i] = c;
-            }
-        }
+    if (out_entry_count) {
+        *out_entry_count = db->wal.enabled ? tqdb_wal_pending(db) : 0;
     }
-
-    /* Calculate new counts based on WAL operations */
-    uint32_t new_counts[TQDB_MAX_ENTITY_TYPES];
-    memcpy(new_counts, counts, sizeof(counts));
-
-    for (uint32_t i = 0; i < valid_entries; i++) {
-        if (entries[i].id == 0) continue;
-        if (entries[i].op == TQDB_WAL_OP_ADD) {
-            new_counts[entries[i].type_idx]++;
-        } else if (entries[i].op == TQDB_WAL_OP_DELETE) {
-            if (new_counts[entries[i].type_idx] > 0) {
-                new_counts[entries[i].type_idx]--;
-            }
-        }
-        /* UPDATE doesn't change count */
+    if (out_size) {
+        *out_size = db->wal.enabled ? (size_t)db->wal.file_size + db->wal.frozen_size : 0;
     }
 
-    /* Write counts placeholder */
-    long counts_pos = ftell(dst);
-    for (size_t i = 0; i < db->trait_count; i++) {
-        tqdb_write_u32(&w, new_counts[i]);
-    }
+    return TQDB_OK;
+}
 
-    tqdb_reader_t r;
-    if (src) {
-        tqdb_reader_init(&r, src, read_buf, read_half);
-    }
+tqdb_err_t tqdb_wal_lsn(tqdb_t db, uint64_t* out_lsn) {
+    if (!db || !out_lsn) return TQDB_ERR_INVALID_ARG;
 
-    uint32_t actual_counts[TQDB_MAX_ENTITY_TYPES];
-    memset(actual_counts, 0, sizeof(actual_counts));
+    *out_lsn = db->wal.enabled ? db->wal.last_lsn : 0;
+    return TQDB_OK;
+}
 
-    /* Stream each entity type */
-    for (size_t type_idx = 0; type_idx < db->trait_count; type_idx++) {
-        const tqdb_trait_t* trait = db->traits[type_idx];
-        uint32_t n = counts[type_idx];
+tqdb_err_t tqdb_changes_since(tqdb_t db, uint64_t lsn, tqdb_change_fn fn, void* ctx) {
+    if (!db || !fn) return TQDB_ERR_INVALID_ARG;
+    if (!db->wal.enabled) return TQDB_OK;
 
-        void* entity = tqdb_alloc(db, trait->struct_size);
-        if (!entity) {
-            /* Cleanup and fail */
-            for (uint32_t i = 0; i < valid_entries; i++) {
-                if (entries[i].entity) {
-                    const tqdb_trait_t* t = db->traits[entries[i].type_idx];
-                    if (t && t->destroy) t->destroy(entries[i].entity);
-                    tqdb_dealloc(db, entries[i].entity);
-                }
-            }
-            tqdb_dealloc(db, entries);
-            if (src) fclose(src);
-            fclose(dst);
-            remove(db->tmp_path);
-            return TQDB_ERR_NO_MEM;
-        }
+    /* Check for deferred WAL recovery */
+    tqdb_wal_check_recovery(db);
 
-        /* Process existing entities from main DB */
-        if (src) {
-            for (uint32_t i = 0; i < n && !tqdb_read_error(&r); i++) {
-                if (trait->init) trait->init(entity);
-                trait->read(&r, entity);
-                if (tqdb_read_error(&r)) break;
+    if (!tqdb_lock_as(db, false)) return TQDB_ERR_TIMEOUT;
 
-                uint32_t entity_id = trait->get_id(entity);
-                bool skip = false;
-
-                /* Check if this entity is modified/deleted in WAL */
-                for (uint32_t j = 0; j < valid_entries; j++) {
-                    if (entries[j].id != 0 &&
-                        entries[j].type_idx == type_idx &&
-                        entries[j].id == entity_id) {
-                        /* Found in WAL */
-                        if (entries[j].op == TQDB_WAL_OP_DELETE) {
-                            skip = true;  /* Deleted */
-                        } else if (entries[j].op == TQDB_WAL_OP_UPDATE) {
-                            /* Write updated version instead */
-                            if (entries[j].entity) {
-                                trait->write(&w, entries[j].entity);
-                                actual_counts[type_idx]++;
-                            }
-                            skip = true;
-                            /* Mark as processed */
-                            entries[j].id = 0;
-                        }
-                        break;
-                    }
-                }
+    tqdb_checkpoint_poll(db);
 
-                if (!skip) {
-                    /* Write original entity */
-                    trait->write(&w, entity);
-                    actual_counts[type_idx]++;
-                }
+    tqdb_wal_change_t* changes;
+    size_t count;
+    tqdb_err_t err = tqdb_wal_changes(db, lsn, &changes, &count);
 
-                if (trait->destroy) trait->destroy(entity);
-            }
-        }
+    /* Report current values: they are exactly as of each key's newest LSN */
+    void* entity = NULL;
+    uint8_t entity_type = 0;
+    for (size_t i = 0; err == TQDB_OK && i < count; i++) {
+        const tqdb_wal_change_t* c = &changes[i];
+        const tqdb_trait_t* trait = db->traits[c->type_idx];
 
-        /* Write new entities from WAL (ADD operations) */
-        for (uint32_t j = 0; j < valid_entries; j++) {
-            if (entries[j].id != 0 &&
-                entries[j].type_idx == type_idx &&
-                entries[j].op == TQDB_WAL_OP_ADD &&
-                entries[j].entity) {
-                trait->write(&w, entries[j].entity);
-                actual_counts[type_idx]++;
-                entries[j].id = 0;  /* Mark as processed */
+        if (!entity || entity_type != c->type_idx) {
+            tqdb_dealloc(db, entity);
+            entity = tqdb_alloc(db, trait->struct_size);
+            entity_type = c->type_idx;
+            if (!entity) {
+                err = TQDB_ERR_NO_MEM;
+                break;
             }
         }
 
-        tqdb_dealloc(db, entity);
-    }
-
-    /* Free WAL entries */
-    for (uint32_t i = 0; i < valid_entries; i++) {
-        if (entries[i].entity) {
-            const tqdb_trait_t* trait = db->traits[entries[i].type_idx];
-            if (trait && trait->destroy) trait->destroy(entries[i].entity);
-            tqdb_dealloc(db, entries[i].entity);
+        tqdb_err_t found = get_locked(&db->session, trait, c->type_idx, c->id, entity);
+        if (found != TQDB_OK && found != TQDB_ERR_NOT_FOUND) {
+            err = found;
+            break;
         }
+        bool more = fn(trait->name, c->id, c->lsn, found == TQDB_OK ? entity : NULL, ctx);
+        if (found == TQDB_OK && trait->destroy) trait->destroy(entity);
+        if (!more) break;
     }
-    tqdb_dealloc(db, entries);
-
-    if (src) fclose(src);
-
-    /* Finalize writer */
-    tqdb_writer_flush(&w);
-    if (tqdb_write_error(&w)) {
-        fclose(dst);
-        remove(db->tmp_path);
-        return TQDB_ERR_IO;
-    }
-
-    /* Rewrite counts */
-    fseek(dst, counts_pos, SEEK_SET);
-    for (size_t i = 0; i < db->trait_count; i++) {
-        fwrite(&actual_counts[i], 4, 1, dst);
-    }
-
-    /* Patch CRC in header */
-    uint32_t crc = tqdb_writer_crc(&w);
-    fseek(dst, 8, SEEK_SET);
-    fwrite(&crc, 4, 1, dst);
-
-    fflush(dst);
-    fclose(dst);
-
-    /* Atomic swap */
-    remove(db->bak_path);
-    rename(db->db_path, db->bak_path);
-    if (rename(db->tmp_path, db->db_path) != 0) {
-        rename(db->bak_path, db->db_path);
-        return TQDB_ERR_IO;
-    }
-    remove(db->bak_path);
-
-#if TQDB_ENABLE_CACHE
-    /* Clear cache after checkpoint */
-    if (db->cache) {
-        tqdb_cache_invalidate_all(db);
-    }
-#endif
-
-    return TQDB_OK;
-}
-
-/* ═══════════════════════════════════════════════════════════════════════════
- * Public WAL API
- * ═══════════════════════════════════════════════════════════════════════════ */
-
-tqdb_err_t tqdb_checkpoint(tqdb_t db) {
-    if (!db) return TQDB_ERR_INVALID_ARG;
-    if (!db->wal.enabled) return TQDB_OK;
-
-    if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
-
-    tqdb_err_t err = tqdb_wal_checkpoint_internal(db);
+    tqdb_dealloc(db, entity);
+    tqdb_dealloc(db, changes);
 
     tqdb_unlock(db);
     return err;
 }
-
-tqdb_err_t tqdb_wal_stats(tqdb_t db, size_t* out_entry_count, size_t* out_size) {
-    if (!db) return TQDB_ERR_INVALID_ARG;
-
-    if (out_entry_count) {
-        *out_entry_count = db->wal.enabled ? db->wal.entry_count : 0;
-    }
-    if (out_size) {
-        *out_size = db->wal.enabled ? db->wal.file_size : 0;
-    }
-
-    return TQDB_OK;
-}
 #endif /* TQDB_ENABLE_WAL */
@@ -21,13 +21,29 @@
 #if TQDB_ENABLE_WAL
 /* WAL file format constants */
 #define TQDB_WAL_MAGIC      0x4C415754  /* "TWAL" little-endian */
-#define TQDB_WAL_VERSION    1
-#define TQDB_WAL_HEADER_SIZE 16
+#define TQDB_WAL_VERSION    2
+#define TQDB_WAL_HEADER_SIZE 32
+#define TQDB_WAL_ENTRY_HEADER_SIZE 22  /* crc, op, type_idx, id, lsn, data_len */
+#define TQDB_WAL_V1_ENTRY_HEADER_SIZE 14  /* Version 1: 16-byte header, no LSNs */
+#define TQDB_WAL_HIST_MAGIC 0x54534854  /* "THST" little-endian */
+#define TQDB_WAL_HIST_HEADER_SIZE 12
+#define TQDB_WAL_HIST_RECORD_SIZE 13   /* lsn, id, type_idx */
+#define TQDB_WAL_KEYS_MIN 64            /* Initial slots of the logged-key set */
+#define TQDB_WAL_COMPACT_MIN_ENTRIES 8   /* Smaller WALs are not worth compacting */
 
 /* WAL operation types */
 #define TQDB_WAL_OP_ADD     1
 #define TQDB_WAL_OP_UPDATE  2
 #define TQDB_WAL_OP_DELETE  3
+#define TQDB_WAL_OP_PATCH   4   /* Trait diff against the last full image */
+#define TQDB_WAL_OP_MERGE   5   /* Trait merge operand, folded at read time */
+#endif
+
+#if TQDB_ENABLE_MULTIPROC
+/* Shared state file (db_path + ".shm") */
+#define TQDB_SHM_MAGIC      0x4D485354  /* "TSHM" little-endian */
+#define TQDB_SHM_LOCK_BYTE  0           /* fcntl lock: shared for reads, exclusive for writes */
+#define TQDB_SHM_OPEN_BYTE  1           /* fcntl lock: shared while the database is open */
 #endif
 
 /* ═══════════════════════════════════════════════════════════════════════════
@@ -75,8 +91,24 @@ typedef struct {
     uint16_t flags;         /* Reserved */
     uint32_t db_crc;        /* CRC of main DB when WAL started */
     uint32_t entry_count;   /* Number of entries in WAL */
+    uint64_t last_lsn;      /* Highest LSN logged so far (version 2) */
+    uint64_t floor_lsn;     /* Changes up to here may be gone from the change feed */
 } tqdb_wal_header_t;
 
+/* ═══════════════════════════════════════════════════════════════════════════
+ * WAL Entry Header
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    uint32_t crc;           /* Entry CRC */
+    uint8_t op;             /* TQDB_WAL_OP_* */
+    uint8_t type_idx;       /* Entity type index */
+    uint32_t id;            /* Entity ID */
+    uint64_t lsn;           /* Log sequence number (0 in version 1) */
+    uint32_t data_len;      /* Serialized entity length (0 for DELETE) */
+    long data_pos;          /* File offset of entity data */
+} tqdb_wal_entry_t;
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * WAL State Structure
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -88,12 +120,132 @@ typedef struct {
     uint32_t db_crc;              /* CRC of main DB when WAL started */
     size_t max_entries;           /* Checkpoint threshold: entries */
     size_t max_size;              /* Checkpoint threshold: size */
+    size_t ckpt_mem_budget;       /* Checkpoint sort memory budget (bytes) */
     bool enabled;                 /* WAL enabled flag */
+    uint8_t policy;               /* tqdb_checkpoint_policy_t */
+    uint32_t scan_bytes;          /* WAL bytes scanned by reads since the WAL started */
+    uint32_t main_cost;           /* Checkpoint bytes for the main file: read and rewritten */
+    bool main_cost_known;         /* main_cost measured since the main file was last replaced */
+
+    /* Compaction: keys logged in the active WAL, to count superseded records */
+    char* compact_path;           /* path + ".new" */
+    uint8_t compact_percent;      /* Superseded share that triggers compaction */
+    uint64_t* keys;               /* Open-addressed set of (type + 1) << 32 | id, 0 = empty */
+    uint32_t key_cap;             /* Slots, a power of two (0 = none allocated) */
+    uint32_t key_count;           /* Distinct keys in the set */
+    uint32_t key_entries;         /* Active WAL entries the set covers (behind = rebuild) */
+    uint32_t dup_count;           /* Covered entries whose key was already logged */
     bool recovery_pending;        /* True if WAL recovery deferred until traits registered */
+
+    /* Change feed */
+    uint64_t last_lsn;            /* LSN of the newest record */
+    uint64_t floor_lsn;           /* Changes up to here may be gone (kept in the WAL header) */
+    char* hist_path;              /* path + ".hist": keys of retired records */
+    size_t hist_max;              /* Retained history records (0 = no history) */
+    uint32_t hist_count;          /* Records in the history file */
+
+    /* Frozen segment: older entries waiting to be checkpointed */
+    char* frozen_path;            /* path + ".1" */
+    uint32_t frozen_count;        /* Entries in frozen segment (0 = none) */
+    uint32_t frozen_size;         /* Frozen segment file size */
+
+    /* Background checkpoint */
+    bool background;              /* Checkpoint frozen segment on a worker thread */
+    bool ckpt_running;            /* Worker started and not yet finished */
+    bool ckpt_done;               /* Set by worker when done (guarded by ckpt_flag) */
+    tqdb_err_t ckpt_result;       /* Worker result (valid once ckpt_done) */
+    void* ckpt_thread;            /* Worker thread handle */
+    void* ckpt_flag;              /* Mutex guarding ckpt_done */
+    char* ckpt_path;              /* Worker output file (db_path + ".ckpt") */
+    uint8_t* ckpt_buf;            /* Worker I/O buffer (scratch_size bytes) */
+
+    /* Incremental checkpoint (tqdb_checkpoint_step) */
+    struct tqdb_ckpt_s* step;     /* Merge in progress (NULL = none) */
+    uint8_t* step_buf;            /* Its I/O buffer (scratch_size bytes) */
 } tqdb_wal_t;
+
+/** WAL segment to scan, oldest first */
+typedef struct {
+    const char* path;
+    FILE* file;             /* Pinned by a snapshot (NULL = open path) */
+    uint32_t entry_count;
+} tqdb_wal_seg_t;
+
+#define TQDB_WAL_MAX_SEGMENTS 2
+
+/** One PATCH or MERGE record to fold over a key's base */
+typedef struct {
+    const char* path;       /* Segment (db-owned) */
+    FILE* file;             /* Pinned segment, NULL = open path */
+    long pos;               /* Data offset */
+    uint8_t op;             /* TQDB_WAL_OP_PATCH or TQDB_WAL_OP_MERGE */
+} tqdb_wal_link_t;
+
+/**
+ * Records to fold over a key's last full image (or the main entry), oldest
+ * first. Each segment merges on its own, so a PATCH is relative to the state
+ * its segment started from and only the latest PATCH per segment counts.
+ * A PATCH never follows a MERGE within its segment.
+ */
+typedef struct {
+    tqdb_wal_link_t* links;
+    uint32_t count;
+    uint32_t cap;
+} tqdb_wal_chain_t;
+
+/** Key changed since a given LSN, with its newest LSN */
+typedef struct {
+    uint64_t lsn;
+    uint32_t id;
+    uint8_t type_idx;
+} tqdb_wal_change_t;
 #endif /* TQDB_ENABLE_WAL */
 
+#if TQDB_ENABLE_MULTIPROC
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Shared State (mapped from db_path + ".shm")
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/**
+ * What processes sharing the files must agree on, published by each writer
+ * as it unlocks. Every WAL append grows file_size; anything that replaces a
+ * file (checkpoint, compaction, a new WAL) bumps generation instead.
+ */
+typedef struct {
+    uint32_t magic;               /* TQDB_SHM_MAGIC */
+    uint32_t generation;          /* Bumped when a writer replaced files */
+    uint32_t recovery_pending;    /* WAL left by an earlier run still to checkpoint */
+    uint32_t db_crc;
+    uint32_t entry_count;
+    uint32_t file_size;
+    uint32_t frozen_count;
+    uint32_t frozen_size;
+    uint32_t hist_count;
+    uint64_t last_lsn;
+    uint64_t floor_lsn;
+    uint32_t next_id[TQDB_MAX_ENTITY_TYPES];  /* Highest next_id handed out, per type */
+} tqdb_shm_t;
+
+typedef struct {
+    int fd;                       /* db_path + ".shm" (-1 = not open) */
+    tqdb_shm_t* shm;              /* Mapping (NULL = single process) */
+    uint32_t generation;          /* shm->generation the local state matches */
+    uint32_t files_gen;           /* db->files_gen when the lock was taken */
+    bool exclusive;               /* Lock held for writing */
+} tqdb_mp_t;
+#endif /* TQDB_ENABLE_MULTIPROC */
+
 #if TQDB_ENABLE_CACHE
+/* Cache recency segments (plain LRU uses only probation) */
+#define TQDB_CACHE_PROBATION 0
+#define TQDB_CACHE_PROTECTED 1
+#define TQDB_CACHE_SEGMENTS  2
+#define TQDB_CACHE_L2        2  /* Serialized entities demoted from the segments above */
+#define TQDB_CACHE_LISTS     3  /* Recency lists: the segments and the L2 */
+#define TQDB_CACHE_DETACHED  3  /* Segment of a pinned entry dropped from the cache */
+
+#define TQDB_CACHE_SLAB_ALIGN 8  /* Entity block alignment within a slab */
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Cache Entry Structure
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -102,24 +254,127 @@ typedef struct {
     uint32_t id;                /* Entity ID (0 = empty slot) */
     uint8_t type_idx;           /* Entity type index */
     uint8_t op;                 /* Last WAL operation (for deleted tracking) */
-    void* entity;               /* Cached entity data (NULL if deleted) */
-    uint32_t access_count;      /* LRU counter */
+    uint8_t segment;            /* TQDB_CACHE_PROBATION, _PROTECTED, _L2 or _DETACHED */
+    uint16_t pins;              /* Outstanding tqdb_get_ref refs (never evicted while > 0) */
+    void* entity;               /* Cached entity data (NULL if deleted); in the L2 a u32
+                                   length followed by the trait's serialized bytes */
+    uint32_t prev;              /* More recently used neighbour: entry index + 1 (0 = none) */
+    uint32_t next;              /* Less recently used neighbour, or next free entry */
 } tqdb_cache_entry_t;
 
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Cache Slab (one per entity type)
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    uint8_t* blocks;              /* count blocks of stride bytes, then the free stack */
+    uint32_t* free;               /* Free block indices (top at free_count - 1) */
+    uint32_t free_count;          /* Free blocks */
+    uint32_t count;               /* Blocks in the slab */
+    size_t stride;                /* struct_size rounded up to TQDB_CACHE_SLAB_ALIGN */
+    bool failed;                  /* Slab allocation failed: use the heap */
+    uint32_t arena_free;          /* Freed shard arena blocks: offset / align + 1, chained
+                                     through the blocks' first bytes (0 = none) */
+} tqdb_cache_slab_t;
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Cache Structure
  * ═══════════════════════════════════════════════════════════════════════════ */
 
+#define TQDB_CACHE_MAX_SHARDS 64
+
+/* One lock stripe: a complete cache over the keys that hash to it */
 typedef struct {
     tqdb_cache_entry_t* entries;  /* Array of cache entries */
-    size_t capacity;              /* Max entries */
+    uint32_t* index;              /* Open-addressing table: entry index + 1 (0 = empty) */
+    size_t index_mask;            /* Table size - 1 (power of two, >= 2x capacity) */
+    size_t capacity;              /* Max entries outside the L2 */
+    size_t pool;                  /* Entries allocated: capacity plus room for the L2 */
     size_t count;                 /* Current entries */
-    uint32_t access_counter;      /* Global LRU counter */
+    uint8_t policy;               /* tqdb_cache_policy_t */
+    size_t protected_max;         /* SLRU: protected segment capacity */
+    uint32_t lru_head[TQDB_CACHE_LISTS];    /* Most recently used: entry index + 1 (0 = empty) */
+    uint32_t lru_tail[TQDB_CACHE_LISTS];    /* Least recently used */
+    size_t seg_count[TQDB_CACHE_LISTS];     /* Entries per list */
+    uint32_t free_head;           /* Unused entries, chained through next */
     size_t hits;                  /* Cache hit count */
     size_t misses;                /* Cache miss count */
+    size_t seg_hits[TQDB_CACHE_SEGMENTS];   /* Hits by the segment they landed in */
+    tqdb_cache_slab_t slabs[TQDB_MAX_ENTITY_TYPES]; /* Entity storage per type */
+    size_t max_bytes;             /* Entity byte budget (0 = entry count only) */
+    size_t bytes;                 /* Entity bytes cached (slab block sizes) */
+    uint8_t* arena;               /* max_bytes of blocks for types without a maximum */
+    size_t arena_used;            /* Arena bytes carved into blocks so far */
+    bool arena_failed;            /* Arena allocation failed: use the heap */
+    size_t type_bytes[TQDB_MAX_ENTITY_TYPES];       /* Entity bytes cached per type */
+    size_t l2_max_bytes;          /* Serialized byte budget (0 = no L2) */
+    size_t l2_bytes;              /* Serialized bytes held, length prefixes included */
+    size_t l2_hits;               /* Hits deserialized from the L2 */
+    uint8_t* l2_stage;            /* Serialization buffer for demotions */
+    size_t l2_stage_size;
+    void* lock;                   /* From mutex_ops (NULL = no locking) */
+} tqdb_cache_shard_t;
+
+typedef struct {
+    tqdb_cache_shard_t* shards;   /* Selected by the top bits of the key hash */
+    size_t shard_count;           /* Power of two */
+    uint8_t shard_shift;          /* 64 - log2(shard_count) */
+    char* warm_path;              /* Keys saved here at close (NULL = not persisted) */
+    uint64_t* warm_keys;          /* Saved (type_idx << 32 | id) keys awaiting prefetch */
+    uint32_t warm_count;          /* Keys in warm_keys */
+    uint16_t warm_types;          /* Types registered when they were saved */
 } tqdb_cache_t;
 #endif /* TQDB_ENABLE_CACHE */
 
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Live-ID Bitmap (one per entity type)
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    uint8_t* bits;                /* Bit id set while the entity exists (NULL = not built) */
+    size_t bytes;                 /* Bitmap size */
+    uint32_t count;               /* Bits set */
+} tqdb_live_t;
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Resident Type (whole type held in memory)
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    uint8_t* data;                /* Entities sorted by ID, struct_size apart */
+    uint32_t count;               /* Entities held */
+    uint32_t cap;                 /* Entities data has room for */
+    bool loaded;                  /* false = load on next use */
+} tqdb_resident_t;
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Reader Session
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/**
+ * What a read decodes through. The database embeds one over its scratch
+ * for its own calls and writes, and keeps one more for reads while writes
+ * are striped; both open files per read. tqdb_session_open() sessions own
+ * all of it and keep their files open until files_gen moves on. A file
+ * read sees the WAL as it stood when the read entered the session.
+ */
+struct tqdb_session_s {
+    tqdb_t db;
+    uint8_t* buf;                 /* Scratch (scratch_size bytes) */
+    bool keep_files;              /* Private: hold handles between reads */
+    uint32_t files_gen;           /* db->files_gen the handles belong to */
+    uint32_t view_gen;            /* db->files_gen on entry */
+    FILE* main;                   /* Held main file (NULL = none) */
+#if TQDB_ENABLE_WAL
+    tqdb_wal_seg_t segs[TQDB_WAL_MAX_SEGMENTS];  /* WAL on entry, oldest first */
+    size_t seg_count;
+    const char* seg_paths[TQDB_WAL_MAX_SEGMENTS];
+    FILE* seg_files[TQDB_WAL_MAX_SEGMENTS];      /* Held WAL segments */
+    uint32_t scans;               /* WAL scans not yet charged to the read penalty */
+#endif
+    void* temp[TQDB_MAX_ENTITY_TYPES];       /* Records skipped by decoding (NULL = none yet) */
+};
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Database Structure
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -137,12 +392,33 @@ struct tqdb_s {
     /* Mutex */
     tqdb_mutex_ops_t* mutex_ops;
     void* mutex;
+    void* reader_lock;  /* Under a shared lock, guards what readers share: their session,
+                           the WAL counts, the read penalty (NULL = reads take the mutex
+                           exclusively) */
+    void* write_lock;   /* Serializes WAL appends while writes hold the mutex shared and
+                           their type's stripe (NULL = writes take the mutex exclusively) */
+    void* type_locks[TQDB_MAX_ENTITY_TYPES];  /* Per-type stripes under a shared mutex, in
+                                                 this order (NULL without write_lock) */
+
+    /* Threads */
+    tqdb_thread_ops_t* thread_ops;
+
+    /* Clock for time-budgeted work (NULL = none) */
+    uint32_t (*clock_us)(void);
 
     /* Scratch buffer */
     uint8_t* scratch;
     size_t scratch_size;
     bool owns_scratch;  /* true if we allocated it */
 
+    /* Reads by the database itself and by writes, over scratch */
+    struct tqdb_session_s session;
+    tqdb_session_t read_session;  /* Reads through the database while stripes are in use
+                                     (NULL = session) */
+    tqdb_session_t write_sessions[TQDB_MAX_ENTITY_TYPES];  /* Reads by each type's writes
+                                     while stripes are in use, opened on first need */
+    uint32_t files_gen;  /* Bumped when the main file or a WAL segment is replaced */
+
     /* Entity traits */
     const tqdb_trait_t* traits[TQDB_MAX_ENTITY_TYPES];
     size_t trait_count;
@@ -150,6 +426,12 @@ struct tqdb_s {
     /* Auto-increment ID counter (per type) */
     uint32_t next_id[TQDB_MAX_ENTITY_TYPES];
 
+    /* Existing IDs (per type) */
+    tqdb_live_t live[TQDB_MAX_ENTITY_TYPES];
+
+    /* In-memory copies of resident types */
+    tqdb_resident_t resident[TQDB_MAX_ENTITY_TYPES];
+
 #if TQDB_ENABLE_WAL
     /* WAL state */
     tqdb_wal_t wal;
@@ -159,6 +441,32 @@ struct tqdb_s {
     /* Cache state */
     tqdb_cache_t* cache;
 #endif
+
+#if TQDB_ENABLE_MULTIPROC
+    /* Other processes' view of the files */
+    tqdb_mp_t mp;
+#endif
+};
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Snapshot Structure
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/**
+ * Read view: open handles keep the files it saw alive, since the main file
+ * and WAL segments are replaced by rename, never rewritten in place. The
+ * active WAL only grows, so its first entry_count entries stay put.
+ */
+struct tqdb_snapshot_s {
+    tqdb_t db;
+    FILE* main;                   /* Main file (NULL = none yet) */
+    size_t trait_count;           /* Sections in the main file */
+#if TQDB_ENABLE_WAL
+    tqdb_wal_seg_t segs[TQDB_WAL_MAX_SEGMENTS];
+    size_t seg_count;
+    uint64_t lsn;                 /* Newest LSN included */
+#endif
+    uint8_t* buf;                 /* Private scratch (scratch_size bytes) */
 };
 
 /* ═══════════════════════════════════════════════════════════════════════════
@@ -183,56 +491,193 @@ uint32_t tqdb_crc32_finalize(uint32_t crc);
 
 /* Binary I/O */
 void tqdb_writer_init(tqdb_writer_t* w, FILE* f, uint8_t* buf, size_t buf_size);
+/* Memory writer: fills buf only, erroring once it is full */
+void tqdb_writer_init_mem(tqdb_writer_t* w, uint8_t* buf, size_t buf_size);
 void tqdb_writer_flush(tqdb_writer_t* w);
 uint32_t tqdb_writer_crc(tqdb_writer_t* w);
 
 void tqdb_reader_init(tqdb_reader_t* r, FILE* f, uint8_t* buf, size_t buf_size);
+/* Memory reader: reads len bytes of data, then errors */
+void tqdb_reader_init_mem(tqdb_reader_t* r, const uint8_t* data, size_t len);
 uint32_t tqdb_reader_crc(tqdb_reader_t* r);
 
 /* Trait lookup */
 const tqdb_trait_t* tqdb_find_trait(tqdb_t db, const char* name);
 int tqdb_find_trait_index(tqdb_t db, const char* name);
 
+/* Main file helpers */
+bool tqdb_write_header(FILE* f, const tqdb_header_t* h);
+FILE* tqdb_open_for_read(tqdb_t db);
+tqdb_err_t tqdb_install_file(tqdb_t db, const char* tmp_path);
+/* Skip the sections before type_idx; temp holds decode space per type (NULL = allocate) */
+void tqdb_skip_to_type(tqdb_t db, tqdb_reader_t* r, const uint32_t* counts, int type_idx,
+                       void** temp);
+tqdb_err_t tqdb_main_find(tqdb_session_t session, uint8_t type_idx, uint32_t id, void* out);  /* Main file only */
+void tqdb_live_note(tqdb_t db, uint8_t type_idx, uint32_t id, bool exists);  /* ID added or deleted */
+
+/* Session files: held ones stay open, others are closed by tqdb_session_put */
+FILE* tqdb_session_main(tqdb_session_t session);  /* Main file at its counts (NULL = none) */
+FILE* tqdb_session_seg(tqdb_session_t session, const char* path);
+void tqdb_session_put(tqdb_session_t session, FILE* f);
+#if TQDB_ENABLE_WAL
+void tqdb_session_note_scan(tqdb_session_t session);  /* A full WAL scan, charged on leaving */
+#endif
+
 #if TQDB_ENABLE_WAL
 /* WAL internal functions */
-tqdb_err_t tqdb_wal_init(tqdb_t db, const char* wal_path, size_t max_entries, size_t max_size);
+tqdb_err_t tqdb_wal_init(tqdb_t db, const char* wal_path, size_t max_entries, size_t max_size,
+                         size_t ckpt_mem_budget, uint8_t policy, uint8_t compact_percent,
+                         size_t history);
+bool tqdb_wal_write_header(FILE* f, const tqdb_wal_header_t* h);
+bool tqdb_wal_read_header(FILE* f, tqdb_wal_header_t* h);  /* Any version; leaves f at entries */
+bool tqdb_wal_read_entry(FILE* f, tqdb_wal_entry_t* e);  /* Leaves f at entry data */
+bool tqdb_wal_read_v1_entry(FILE* f, tqdb_wal_entry_t* e);  /* Version 1 entry, lsn 0 */
+size_t tqdb_wal_segments(tqdb_t db, tqdb_wal_seg_t* segs);  /* Fills up to TQDB_WAL_MAX_SEGMENTS */
+tqdb_err_t tqdb_wal_reset(tqdb_t db);  /* Start an empty active WAL */
+uint32_t tqdb_wal_max_id(tqdb_t db, uint8_t type_idx);
+tqdb_err_t tqdb_wal_enable_background(tqdb_t db);
 void tqdb_wal_destroy(tqdb_t db);
 tqdb_err_t tqdb_wal_recover(tqdb_t db);
 tqdb_err_t tqdb_wal_check_recovery(tqdb_t db);  /* Deferred recovery after traits registered */
+/* Appends leave the checkpoint they bring due to the writer's unlock */
 tqdb_err_t tqdb_wal_append(tqdb_t db, uint8_t op, uint8_t type_idx,
                            uint32_t id, const void* entity);
-tqdb_err_t tqdb_wal_find(tqdb_t db, uint8_t type_idx, uint32_t id,
-                         uint8_t* out_op, void* out_entity);
+tqdb_err_t tqdb_wal_append_patch(tqdb_t db, uint8_t type_idx, uint32_t id,
+                                 const void* base, const void* entity);
+tqdb_err_t tqdb_wal_find(tqdb_session_t session, uint8_t type_idx, uint32_t id,
+                         uint8_t* out_op, void* out_entity);  /* Session entered */
+tqdb_err_t tqdb_wal_find_base(tqdb_session_t session, uint8_t type_idx, uint32_t id,
+                              void* out_entity, bool* out_patchable);  /* Writer's session */
+bool tqdb_wal_chain_add(tqdb_t db, tqdb_wal_chain_t* chain, const tqdb_wal_seg_t* seg,
+                        long pos, uint8_t op);
+void tqdb_wal_chain_free(tqdb_t db, tqdb_wal_chain_t* chain);
+bool tqdb_wal_chain_apply(tqdb_t db, const tqdb_trait_t* trait,
+                          const tqdb_wal_chain_t* chain, void* entity);
 tqdb_err_t tqdb_wal_checkpoint_internal(tqdb_t db);
 bool tqdb_wal_should_checkpoint(tqdb_t db);
+tqdb_err_t tqdb_wal_maybe_checkpoint(tqdb_t db);  /* Checkpoint if the policy says so */
+void tqdb_wal_note_scan(tqdb_t db);               /* Charge a full WAL scan to the read penalty */
+bool tqdb_wal_key_add(tqdb_t db, uint8_t op, uint8_t type_idx, uint32_t id);
+void tqdb_wal_keys_clear(tqdb_t db);              /* The active WAL was replaced */
 uint32_t tqdb_wal_compute_db_crc(tqdb_t db);
+void tqdb_wal_retire(tqdb_t db, const char* path);  /* Segment leaves: archive its keys */
+void tqdb_wal_raise_floor(tqdb_t db, uint64_t lsn);  /* Changes up to lsn are gone */
+tqdb_err_t tqdb_wal_changes(tqdb_t db, uint64_t since, tqdb_wal_change_t** out_changes,
+                            size_t* out_count);
+
+/* Checkpoint (tqdb_checkpoint.c) */
+tqdb_err_t tqdb_checkpoint_merge(tqdb_t db);
+tqdb_err_t tqdb_checkpoint_merge_segment(tqdb_t db, const char* wal_path, uint32_t entry_count,
+                                         const char* out_path, uint8_t* buf, size_t buf_size);
+tqdb_err_t tqdb_checkpoint_rotate(tqdb_t db);   /* Freeze WAL and start background merge */
+void tqdb_checkpoint_poll(tqdb_t db);           /* Install a finished background merge */
+bool tqdb_checkpoint_due(tqdb_t db);           /* A merge to install, or a checkpoint to start */
+tqdb_err_t tqdb_checkpoint_wait(tqdb_t db);     /* Finish and install background or stepped merge */
+tqdb_err_t tqdb_checkpoint_compact(tqdb_t db);  /* Rewrite the active WAL, one record per key */
+
+/* Entries not yet merged into the main DB (active + frozen segment) */
+static inline uint32_t tqdb_wal_pending(tqdb_t db) {
+    return db->wal.entry_count + db->wal.frozen_count;
+}
 #endif /* TQDB_ENABLE_WAL */
 
+#if TQDB_ENABLE_MULTIPROC
+/* Multi-process (tqdb_multiproc.c) */
+tqdb_err_t tqdb_mp_open(tqdb_t db);     /* Attach, or recover the WAL if first */
+void tqdb_mp_close(tqdb_t db);
+bool tqdb_mp_alone(tqdb_t db);         /* No other process has the database open */
+bool tqdb_mp_lock(tqdb_t db, bool exclusive);  /* File lock, then catch up */
+void tqdb_mp_unlock(tqdb_t db);        /* Publish (if exclusive), then unlock */
+
+/* Another process's writes (tqdb_core.c, caller holds the lock) */
+void tqdb_remote_write(tqdb_t db, uint8_t type_idx, uint32_t id, uint8_t op);
+void tqdb_remote_files(tqdb_t db);    /* Files replaced: drop everything derived from them */
+#endif
+
 #if TQDB_ENABLE_CACHE
 /* Cache internal functions */
-tqdb_err_t tqdb_cache_init(tqdb_t db, size_t capacity);
+tqdb_err_t tqdb_cache_init(tqdb_t db, size_t capacity, uint8_t policy, size_t max_bytes,
+                           size_t shards, size_t l2_bytes);
 void tqdb_cache_destroy(tqdb_t db);
-tqdb_cache_entry_t* tqdb_cache_get(tqdb_t db, uint8_t type_idx, uint32_t id);
+/* 1 = cached, copied to out (may be NULL); 0 = cached as deleted; -1 = not cached */
+int tqdb_cache_get(tqdb_t db, uint8_t type_idx, uint32_t id, void* out);
 tqdb_err_t tqdb_cache_put(tqdb_t db, uint8_t type_idx, uint32_t id,
                           const void* entity, uint8_t op);
+/* Like tqdb_cache_get, but pins the entry into ref instead of copying it */
+int tqdb_cache_pin(tqdb_t db, uint8_t type_idx, uint32_t id, bool count_stats, tqdb_ref_t* ref);
+void tqdb_cache_unpin(tqdb_t db, const tqdb_ref_t* ref);
 void tqdb_cache_invalidate(tqdb_t db, uint8_t type_idx, uint32_t id);
 void tqdb_cache_invalidate_all(tqdb_t db);
+tqdb_err_t tqdb_cache_load_keys(tqdb_t db, const char* path);
+tqdb_err_t tqdb_cache_save_keys(tqdb_t db);
+void tqdb_cache_drop_keys(tqdb_t db);
 #endif /* TQDB_ENABLE_CACHE */
 
 /* Mutex helpers */
-static inline bool tqdb_lock(tqdb_t db) {
-    if (db->mutex_ops && db->mutex) {
-        return db->mutex_ops->lock(db->mutex, 5000);
+
+/* The mutex, then in multi-process mode the file lock (shared unless writer) */
+static inline bool tqdb_lock_as(tqdb_t db, bool writer) {
+    if (db->mutex_ops && db->mutex && !db->mutex_ops->lock(db->mutex, 5000)) {
+        return false;
+    }
+#if TQDB_ENABLE_MULTIPROC
+    if (db->mp.shm && !tqdb_mp_lock(db, writer)) {
+        if (db->mutex_ops && db->mutex) db->mutex_ops->unlock(db->mutex);
+        return false;
     }
+#else
+    (void)writer;
+#endif
     return true;
 }
 
+static inline bool tqdb_lock(tqdb_t db) {
+    return tqdb_lock_as(db, true);
+}
+
 static inline void tqdb_unlock(tqdb_t db) {
+#if TQDB_ENABLE_MULTIPROC
+    if (db->mp.shm) tqdb_mp_unlock(db);
+#endif
     if (db->mutex_ops && db->mutex) {
         db->mutex_ops->unlock(db->mutex);
     }
 }
 
+/* False while another process may be reading the files (lock held) */
+static inline bool tqdb_lock_writable(tqdb_t db) {
+#if TQDB_ENABLE_MULTIPROC
+    if (db->mp.shm) return db->mp.exclusive;
+#endif
+    (void)db;
+    return true;
+}
+
+/* Shared lock for reads: exclusive when the ops have none */
+static inline bool tqdb_lock_shared(tqdb_t db) {
+    if (db->reader_lock) {
+        return db->mutex_ops->lock_shared(db->mutex, 5000);
+    }
+    return tqdb_lock(db);
+}
+
+static inline void tqdb_unlock_shared(tqdb_t db) {
+    if (db->reader_lock) {
+        db->mutex_ops->unlock_shared(db->mutex);
+        return;
+    }
+    tqdb_unlock(db);
+}
+
+/* Reader state, while other readers may run (no-op when reads are exclusive) */
+static inline void tqdb_reader_enter(tqdb_t db) {
+    if (db->reader_lock) db->mutex_ops->lock(db->reader_lock, UINT32_MAX);
+}
+
+static inline void tqdb_reader_leave(tqdb_t db) {
+    if (db->reader_lock) db->mutex_ops->unlock(db->reader_lock);
+}
+
 /* Allocator helpers */
 static inline void* tqdb_alloc(tqdb_t db, size_t size) {
     return db->alloc.malloc(size);
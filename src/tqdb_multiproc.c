@@ -0,0 +1,213 @@
+/**
+ * @file tqdb_multiproc.c
+ * @brief Multi-process access: fcntl locks and shared WAL state
+ *
+ * Processes that open a database with multi_process lock byte 0 of
+ * db_path + ".shm" around every call, shared for reads and exclusive for
+ * writes, and map the file for the WAL counts and ID counters. Taking the
+ * lock brings the local state up to date: appends by others are read back
+ * from the WAL tail to invalidate what they touched, and replaced files
+ * (a new generation) drop everything derived from the old ones. Byte 1 is
+ * held shared while open, so the first process in recovers and the last
+ * one out checkpoints.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "tqdb_internal.h"
+
+#if TQDB_ENABLE_MULTIPROC
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Lock, or with type F_UNLCK release, one byte of the shared file */
+static bool mp_range(int fd, short type, off_t start, bool wait) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = 1;
+
+    int rc;
+    do {
+        rc = fcntl(fd, wait ? F_SETLKW : F_SETLK, &fl);
+    } while (rc != 0 && errno == EINTR);
+    return rc == 0;
+}
+
+/* Adopt the shared WAL state (lock held) */
+static void mp_load(tqdb_t db) {
+    const tqdb_shm_t* shm = db->mp.shm;
+    db->wal.recovery_pending = shm->recovery_pending != 0;
+    db->wal.db_crc = shm->db_crc;
+    db->wal.entry_count = shm->entry_count;
+    db->wal.file_size = shm->file_size;
+    db->wal.frozen_count = shm->frozen_count;
+    db->wal.frozen_size = shm->frozen_size;
+    db->wal.hist_count = shm->hist_count;
+    db->wal.last_lsn = shm->last_lsn;
+    db->wal.floor_lsn = shm->floor_lsn;
+
+    for (size_t i = 0; i < TQDB_MAX_ENTITY_TYPES; i++) {
+        if (shm->next_id[i] > db->next_id[i]) db->next_id[i] = shm->next_id[i];
+    }
+}
+
+/* Store the local WAL state for the others (lock held exclusively) */
+static void mp_publish(tqdb_t db) {
+    tqdb_shm_t* shm = db->mp.shm;
+    if (db->files_gen != db->mp.files_gen) shm->generation++;
+    shm->recovery_pending = db->wal.recovery_pending ? 1 : 0;
+    shm->db_crc = db->wal.db_crc;
+    shm->entry_count = db->wal.entry_count;
+    shm->file_size = db->wal.file_size;
+    shm->frozen_count = db->wal.frozen_count;
+    shm->frozen_size = db->wal.frozen_size;
+    shm->hist_count = db->wal.hist_count;
+    shm->last_lsn = db->wal.last_lsn;
+    shm->floor_lsn = db->wal.floor_lsn;
+
+    for (size_t i = 0; i < TQDB_MAX_ENTITY_TYPES; i++) {
+        if (db->next_id[i] > shm->next_id[i]) shm->next_id[i] = db->next_id[i];
+    }
+    db->mp.generation = shm->generation;
+}
+
+/* Invalidate what the WAL entries between from and to touched */
+static bool mp_catch_up(tqdb_t db, uint32_t from, uint32_t to) {
+    if (from < TQDB_WAL_HEADER_SIZE || to < from) return false;
+
+    FILE* f = fopen(db->wal.path, "rb");
+    if (!f) return false;
+    fseek(f, (long)from, SEEK_SET);
+
+    bool ok = true;
+    long pos = (long)from;
+    tqdb_wal_entry_t e;
+    while (ok && pos < (long)to) {
+        ok = tqdb_wal_read_entry(f, &e) &&
+             e.data_pos + (long)e.data_len <= (long)to;
+        if (!ok) break;
+        tqdb_remote_write(db, e.type_idx, e.id, e.op);
+        pos = e.data_pos + (long)e.data_len;
+        fseek(f, pos, SEEK_SET);
+    }
+    fclose(f);
+    return ok;
+}
+
+/* Bring the local state up to date with the other processes (lock held) */
+static void mp_sync(tqdb_t db) {
+    const tqdb_shm_t* shm = db->mp.shm;
+    if (shm->generation != db->mp.generation) {
+        tqdb_remote_files(db);
+    } else if (shm->file_size != db->wal.file_size &&
+               !mp_catch_up(db, db->wal.file_size, shm->file_size)) {
+        tqdb_remote_files(db);
+    }
+    mp_load(db);
+    db->mp.generation = shm->generation;
+    db->mp.files_gen = db->files_gen;
+}
+
+bool tqdb_mp_lock(tqdb_t db, bool exclusive) {
+    if (!mp_range(db->mp.fd, exclusive ? F_WRLCK : F_RDLCK, TQDB_SHM_LOCK_BYTE, true)) {
+        return false;
+    }
+    db->mp.exclusive = exclusive;
+    mp_sync(db);
+    return true;
+}
+
+void tqdb_mp_unlock(tqdb_t db) {
+    if (db->mp.exclusive) mp_publish(db);
+    db->mp.exclusive = false;
+    mp_range(db->mp.fd, F_UNLCK, TQDB_SHM_LOCK_BYTE, false);
+}
+
+tqdb_err_t tqdb_mp_open(tqdb_t db) {
+    size_t len = strlen(db->db_path) + 5;
+    char* path = (char*)tqdb_alloc(db, len);
+    if (!path) return TQDB_ERR_NO_MEM;
+    snprintf(path, len, "%s.shm", db->db_path);
+    db->mp.fd = open(path, O_RDWR | O_CREAT, 0644);
+    tqdb_dealloc(db, path);
+    if (db->mp.fd < 0) return TQDB_ERR_IO;
+
+    /* Opens and closes are serialized by the write lock */
+    if (!mp_range(db->mp.fd, F_WRLCK, TQDB_SHM_LOCK_BYTE, true)) {
+        tqdb_mp_close(db);
+        return TQDB_ERR_IO;
+    }
+
+    /* Nobody else has the database open: whatever the file holds is stale */
+    bool first = mp_range(db->mp.fd, F_WRLCK, TQDB_SHM_OPEN_BYTE, false);
+    tqdb_err_t err = TQDB_OK;
+    if (first && ftruncate(db->mp.fd, sizeof(tqdb_shm_t)) != 0) err = TQDB_ERR_IO;
+
+    void* map = MAP_FAILED;
+    if (err == TQDB_OK) {
+        map = mmap(NULL, sizeof(tqdb_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+                   db->mp.fd, 0);
+        if (map == MAP_FAILED) err = TQDB_ERR_IO;
+    }
+
+    if (err == TQDB_OK && first) {
+        err = tqdb_wal_recover(db);
+        if (err == TQDB_OK) {
+            tqdb_shm_t* shm = (tqdb_shm_t*)map;
+            memset(shm, 0, sizeof(*shm));
+            shm->magic = TQDB_SHM_MAGIC;
+            db->mp.shm = shm;
+            db->mp.files_gen = db->files_gen;
+            mp_publish(db);
+        }
+    } else if (err == TQDB_OK) {
+        const tqdb_shm_t* shm = (const tqdb_shm_t*)map;
+        if (shm->magic != TQDB_SHM_MAGIC) {
+            err = TQDB_ERR_CORRUPT;
+        } else {
+            db->mp.shm = (tqdb_shm_t*)map;
+            mp_load(db);
+            db->mp.generation = shm->generation;
+        }
+    }
+
+    /* Downgrades byte 1 if first; either way it now marks this process */
+    if (err == TQDB_OK && !mp_range(db->mp.fd, F_RDLCK, TQDB_SHM_OPEN_BYTE, true)) {
+        err = TQDB_ERR_IO;
+    }
+    if (err != TQDB_OK) {
+        if (map != MAP_FAILED) munmap(map, sizeof(tqdb_shm_t));
+        db->mp.shm = NULL;
+        tqdb_mp_close(db);
+        return err;
+    }
+
+    mp_range(db->mp.fd, F_UNLCK, TQDB_SHM_LOCK_BYTE, false);
+    return TQDB_OK;
+}
+
+bool tqdb_mp_alone(tqdb_t db) {
+    /* Upgrading byte 1 fails while anyone else holds it */
+    return mp_range(db->mp.fd, F_WRLCK, TQDB_SHM_OPEN_BYTE, false);
+}
+
+void tqdb_mp_close(tqdb_t db) {
+    if (db->mp.shm) {
+        munmap(db->mp.shm, sizeof(tqdb_shm_t));
+        db->mp.shm = NULL;
+    }
+    if (db->mp.fd >= 0) {
+        close(db->mp.fd);  /* Releases every lock this process holds on it */
+        db->mp.fd = -1;
+    }
+}
+
+#endif /* TQDB_ENABLE_MULTIPROC */
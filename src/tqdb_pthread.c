@@ -0,0 +1,102 @@
+/**
+ * @file tqdb_pthread.c
+ * @brief POSIX threads implementation of the mutex interface
+ *
+ * Each mutex is a pthread_rwlock_t, so reads can share it. Timed waits
+ * use pthread_rwlock_timed*lock where the platform has POSIX timeouts,
+ * else retry the try-lock until the deadline.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "tqdb_internal.h"
+
+#if TQDB_ENABLE_PTHREAD
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static void* rw_create(void) {
+    pthread_rwlock_t* rw = (pthread_rwlock_t*)malloc(sizeof(pthread_rwlock_t));
+    if (rw && pthread_rwlock_init(rw, NULL) != 0) {
+        free(rw);
+        rw = NULL;
+    }
+    return rw;
+}
+
+static void rw_destroy(void* mutex) {
+    pthread_rwlock_destroy((pthread_rwlock_t*)mutex);
+    free(mutex);
+}
+
+/* Absolute CLOCK_REALTIME deadline timeout_ms from now */
+static struct timespec rw_deadline(uint32_t timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+static bool rw_acquire(pthread_rwlock_t* rw, uint32_t timeout_ms, bool shared) {
+    if (timeout_ms == UINT32_MAX) {
+        return (shared ? pthread_rwlock_rdlock(rw) : pthread_rwlock_wrlock(rw)) == 0;
+    }
+
+    struct timespec deadline = rw_deadline(timeout_ms);
+#if defined(_POSIX_TIMEOUTS) && _POSIX_TIMEOUTS > 0
+    return (shared ? pthread_rwlock_timedrdlock(rw, &deadline)
+                   : pthread_rwlock_timedwrlock(rw, &deadline)) == 0;
+#else
+    for (;;) {
+        int rc = shared ? pthread_rwlock_tryrdlock(rw) : pthread_rwlock_trywrlock(rw);
+        if (rc != EBUSY) return rc == 0;
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec > deadline.tv_sec ||
+            (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+            return false;
+        }
+        struct timespec pause = { 0, 1000000L };
+        nanosleep(&pause, NULL);
+    }
+#endif
+}
+
+static bool rw_lock(void* mutex, uint32_t timeout_ms) {
+    return rw_acquire((pthread_rwlock_t*)mutex, timeout_ms, false);
+}
+
+static bool rw_lock_shared(void* mutex, uint32_t timeout_ms) {
+    return rw_acquire((pthread_rwlock_t*)mutex, timeout_ms, true);
+}
+
+static void rw_unlock(void* mutex) {
+    pthread_rwlock_unlock((pthread_rwlock_t*)mutex);
+}
+
+static tqdb_mutex_ops_t PTHREAD_MUTEX_OPS = {
+    .create = rw_create,
+    .destroy = rw_destroy,
+    .lock = rw_lock,
+    .unlock = rw_unlock,
+    .lock_shared = rw_lock_shared,
+    .unlock_shared = rw_unlock
+};
+
+tqdb_mutex_ops_t* tqdb_pthread_mutex_ops(void) {
+    return &PTHREAD_MUTEX_OPS;
+}
+
+#endif /* TQDB_ENABLE_PTHREAD */
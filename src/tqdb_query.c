@@ -55,6 +55,7 @@ struct tqdb_query_s {
 
     size_t limit;                    /* Result limit (0 = unlimited) */
     size_t offset;                   /* Skip first N results */
+    tqdb_snapshot_t snap;            /* Read view (NULL = live database) */
 };
 
 /* ═══════════════════════════════════════════════════════════════════════════
@@ -505,6 +506,12 @@ tqdb_err_t tqdb_query_offset(tqdb_query_t q, size_t offset) {
     return TQDB_OK;
 }
 
+tqdb_err_t tqdb_query_snapshot(tqdb_query_t q, tqdb_snapshot_t snap) {
+    if (!q || (snap && snap->db != q->db)) return TQDB_ERR_INVALID_ARG;
+    q->snap = snap;
+    return TQDB_OK;
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Query Execution
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -556,6 +563,9 @@ tqdb_err_t tqdb_query_exec(tqdb_query_t q, tqdb_iter_fn fn, void* ctx) {
         .matched = 0
     };
 
+    if (q->snap) {
+        return tqdb_snapshot_foreach(q->snap, q->trait->name, query_iter_callback, &qctx);
+    }
     return tqdb_foreach(q->db, q->trait->name, query_iter_callback, &qctx);
 }
 
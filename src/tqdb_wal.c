@@ -3,6 +3,10 @@
  * @brief Write-Ahead Logging implementation for TQDB
  */
 
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L  /* ftruncate, fileno */
+#endif
+
 #include "tqdb_internal.h"
 
 #if TQDB_ENABLE_WAL
@@ -11,20 +15,31 @@
  * WAL implementation (only compiled when TQDB_ENABLE_WAL=1)
  *
  * WAL file format:
- *   Header (16 bytes):
+ *   Header (32 bytes):
  *     magic: u32      = 0x4C415754 ("TWAL")
- *     version: u16    = 1
+ *     version: u16    = 2
  *     flags: u16      = 0
  *     db_crc: u32     = CRC of main DB when WAL started
  *     entry_count: u32
+ *     last_lsn: u64   = LSN of the newest record ever logged
+ *     floor_lsn: u64  = changes up to here may be missing from the feed
  *
  *   Entry format:
  *     entry_crc: u32      (CRC of this entry, excluding this field)
- *     op: u8              (1=ADD, 2=UPDATE, 3=DELETE)
+ *     op: u8              (1=ADD, 2=UPDATE, 3=DELETE, 4=PATCH, 5=MERGE)
  *     type_idx: u8
  *     id: u32             (entity ID)
+ *     lsn: u64            (log sequence number, increasing across segments)
  *     data_len: u32       (0 for DELETE)
  *     data: [u8; data_len]
+ *
+ * Version 1 had a 16-byte header and no lsn; such a WAL is only read by the
+ * recovery checkpoint, which merges it away before anything else runs.
+ *
+ * History file (path + ".hist", only with wal_history):
+ *   magic: u32 = 0x54534854 ("THST"), version: u16 = 1, flags: u16,
+ *   count: u32, then count records of lsn: u64, id: u32, type_idx: u8.
+ *   It keeps the keys of records that left the WAL, oldest first.
  */
 
 #ifdef _WIN32
@@ -39,22 +54,57 @@
  * WAL Header I/O
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-static bool wal_write_header(FILE* f, const tqdb_wal_header_t* h) {
+bool tqdb_wal_write_header(FILE* f, const tqdb_wal_header_t* h) {
     fseek(f, 0, SEEK_SET);
     return fwrite(&h->magic, 4, 1, f) == 1
         && fwrite(&h->version, 2, 1, f) == 1
         && fwrite(&h->flags, 2, 1, f) == 1
         && fwrite(&h->db_crc, 4, 1, f) == 1
-        && fwrite(&h->entry_count, 4, 1, f) == 1;
+        && fwrite(&h->entry_count, 4, 1, f) == 1
+        && fwrite(&h->last_lsn, 8, 1, f) == 1
+        && fwrite(&h->floor_lsn, 8, 1, f) == 1;
 }
 
-static bool wal_read_header(FILE* f, tqdb_wal_header_t* h) {
+bool tqdb_wal_read_header(FILE* f, tqdb_wal_header_t* h) {
     fseek(f, 0, SEEK_SET);
-    return fread(&h->magic, 4, 1, f) == 1
+    bool ok = fread(&h->magic, 4, 1, f) == 1
         && fread(&h->version, 2, 1, f) == 1
         && fread(&h->flags, 2, 1, f) == 1
         && fread(&h->db_crc, 4, 1, f) == 1
         && fread(&h->entry_count, 4, 1, f) == 1;
+    h->last_lsn = 0;
+    h->floor_lsn = 0;
+    if (ok && h->version >= 2) {
+        ok = fread(&h->last_lsn, 8, 1, f) == 1
+            && fread(&h->floor_lsn, 8, 1, f) == 1;
+    }
+    return ok;
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * WAL Entry Header I/O
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+bool tqdb_wal_read_entry(FILE* f, tqdb_wal_entry_t* e) {
+    if (fread(&e->crc, 4, 1, f) != 1) return false;
+    if (fread(&e->op, 1, 1, f) != 1) return false;
+    if (fread(&e->type_idx, 1, 1, f) != 1) return false;
+    if (fread(&e->id, 4, 1, f) != 1) return false;
+    if (fread(&e->lsn, 8, 1, f) != 1) return false;
+    if (fread(&e->data_len, 4, 1, f) != 1) return false;
+    e->data_pos = ftell(f);
+    return true;
+}
+
+bool tqdb_wal_read_v1_entry(FILE* f, tqdb_wal_entry_t* e) {
+    if (fread(&e->crc, 4, 1, f) != 1) return false;
+    if (fread(&e->op, 1, 1, f) != 1) return false;
+    if (fread(&e->type_idx, 1, 1, f) != 1) return false;
+    if (fread(&e->id, 4, 1, f) != 1) return false;
+    if (fread(&e->data_len, 4, 1, f) != 1) return false;
+    e->lsn = 0;
+    e->data_pos = ftell(f);
+    return true;
 }
 
 /* ═══════════════════════════════════════════════════════════════════════════
@@ -62,6 +112,8 @@ static bool wal_read_header(FILE* f, tqdb_wal_header_t* h) {
  * ═══════════════════════════════════════════════════════════════════════════ */
 
 static tqdb_err_t wal_create(tqdb_t db) {
+    db->files_gen++;
+    remove(db->wal.path);  /* New file: a snapshot may still read the old one */
     FILE* f = fopen(db->wal.path, "wb");
     if (!f) return TQDB_ERR_IO;
 
@@ -70,10 +122,12 @@ static tqdb_err_t wal_create(tqdb_t db) {
         .version = TQDB_WAL_VERSION,
         .flags = 0,
         .db_crc = db->wal.db_crc,
-        .entry_count = 0
+        .entry_count = 0,
+        .last_lsn = db->wal.last_lsn,
+        .floor_lsn = db->wal.floor_lsn
     };
 
-    if (!wal_write_header(f, &hdr)) {
+    if (!tqdb_wal_write_header(f, &hdr)) {
         fclose(f);
         remove(db->wal.path);
         return TQDB_ERR_IO;
@@ -84,15 +138,41 @@ static tqdb_err_t wal_create(tqdb_t db) {
 
     db->wal.entry_count = 0;
     db->wal.file_size = TQDB_WAL_HEADER_SIZE;
+    db->wal.scan_bytes = 0;
+    db->wal.main_cost_known = false;
+    tqdb_wal_keys_clear(db);
 
     return TQDB_OK;
 }
 
+tqdb_err_t tqdb_wal_reset(tqdb_t db) {
+    return wal_create(db);
+}
+
+size_t tqdb_wal_segments(tqdb_t db, tqdb_wal_seg_t* segs) {
+    size_t n = 0;
+    if (db->wal.frozen_count > 0) {
+        segs[n].path = db->wal.frozen_path;
+        segs[n].file = NULL;
+        segs[n].entry_count = db->wal.frozen_count;
+        n++;
+    }
+    if (db->wal.entry_count > 0) {
+        segs[n].path = db->wal.path;
+        segs[n].file = NULL;
+        segs[n].entry_count = db->wal.entry_count;
+        n++;
+    }
+    return n;
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * WAL Initialization
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-tqdb_err_t tqdb_wal_init(tqdb_t db, const char* wal_path, size_t max_entries, size_t max_size) {
+tqdb_err_t tqdb_wal_init(tqdb_t db, const char* wal_path, size_t max_entries, size_t max_size,
+                         size_t ckpt_mem_budget, uint8_t policy, uint8_t compact_percent,
+                         size_t history) {
     if (!db) return TQDB_ERR_INVALID_ARG;
 
     /* Copy WAL path */
@@ -101,9 +181,36 @@ tqdb_err_t tqdb_wal_init(tqdb_t db, const char* wal_path, size_t max_entries, si
     if (!db->wal.path) return TQDB_ERR_NO_MEM;
     memcpy(db->wal.path, wal_path, path_len);
 
+    /* Frozen segment path */
+    db->wal.frozen_path = (char*)tqdb_alloc(db, path_len + 2);
+    if (!db->wal.frozen_path) return TQDB_ERR_NO_MEM;
+    snprintf(db->wal.frozen_path, path_len + 2, "%s.1", wal_path);
+
+    /* Compacted WAL, renamed over the WAL once complete */
+    db->wal.compact_path = (char*)tqdb_alloc(db, path_len + 4);
+    if (!db->wal.compact_path) return TQDB_ERR_NO_MEM;
+    snprintf(db->wal.compact_path, path_len + 4, "%s.new", wal_path);
+
+    /* Keys of retired records for the change feed */
+    db->wal.hist_path = (char*)tqdb_alloc(db, path_len + 5);
+    if (!db->wal.hist_path) return TQDB_ERR_NO_MEM;
+    snprintf(db->wal.hist_path, path_len + 5, "%s.hist", wal_path);
+    db->wal.hist_max = history;
+
+    /* Merged output of a background or stepped checkpoint */
+    size_t ckpt_len = strlen(db->db_path) + 6;
+    db->wal.ckpt_path = (char*)tqdb_alloc(db, ckpt_len);
+    if (!db->wal.ckpt_path) return TQDB_ERR_NO_MEM;
+    snprintf(db->wal.ckpt_path, ckpt_len, "%s.ckpt", db->db_path);
+
     /* Set thresholds */
     db->wal.max_entries = max_entries > 0 ? max_entries : TQDB_WAL_MAX_ENTRIES_DEFAULT;
     db->wal.max_size = max_size > 0 ? max_size : TQDB_WAL_MAX_SIZE_DEFAULT;
+    db->wal.ckpt_mem_budget = ckpt_mem_budget > 0 ? ckpt_mem_budget
+                                                   : TQDB_CHECKPOINT_MEM_BUDGET_DEFAULT;
+    db->wal.policy = policy;
+    db->wal.compact_percent = compact_percent > 0 ? compact_percent
+                                                  : TQDB_WAL_COMPACT_PERCENT_DEFAULT;
     db->wal.enabled = true;
     db->wal.entry_count = 0;
     db->wal.file_size = 0;
@@ -113,6 +220,17 @@ tqdb_err_t tqdb_wal_init(tqdb_t db, const char* wal_path, size_t max_entries, si
     return TQDB_OK;
 }
 
+tqdb_err_t tqdb_wal_enable_background(tqdb_t db) {
+    /* Needs locking for the swap and a thread for the merge */
+    if (!db->mutex_ops || !db->mutex || !db->thread_ops) return TQDB_OK;
+
+    db->wal.ckpt_flag = db->mutex_ops->create();
+    if (!db->wal.ckpt_flag) return TQDB_ERR_NO_MEM;
+
+    db->wal.background = true;
+    return TQDB_OK;
+}
+
 void tqdb_wal_destroy(tqdb_t db) {
     if (!db) return;
 
@@ -120,9 +238,287 @@ void tqdb_wal_destroy(tqdb_t db) {
         tqdb_dealloc(db, db->wal.path);
         db->wal.path = NULL;
     }
+    tqdb_dealloc(db, db->wal.frozen_path);
+    db->wal.frozen_path = NULL;
+    tqdb_dealloc(db, db->wal.ckpt_path);
+    db->wal.ckpt_path = NULL;
+    tqdb_dealloc(db, db->wal.compact_path);
+    db->wal.compact_path = NULL;
+    tqdb_dealloc(db, db->wal.keys);
+    db->wal.keys = NULL;
+    db->wal.key_cap = 0;
+    tqdb_dealloc(db, db->wal.hist_path);
+    db->wal.hist_path = NULL;
+    if (db->wal.ckpt_flag) {
+        db->mutex_ops->destroy(db->wal.ckpt_flag);
+        db->wal.ckpt_flag = NULL;
+    }
     db->wal.enabled = false;
 }
 
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Change Feed History
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+void tqdb_wal_raise_floor(tqdb_t db, uint64_t lsn) {
+    if (lsn <= db->wal.floor_lsn) return;
+    db->wal.floor_lsn = lsn;
+
+    /* Persist in the active WAL; a WAL created later copies it */
+    FILE* f = fopen(db->wal.path, "r+b");
+    if (!f) return;
+    fseek(f, 24, SEEK_SET);  /* Offset of floor_lsn in header */
+    fwrite(&db->wal.floor_lsn, 8, 1, f);
+    fflush(f);
+    fclose(f);
+}
+
+static bool hist_read_record(FILE* h, tqdb_wal_change_t* c) {
+    return fread(&c->lsn, 8, 1, h) == 1
+        && fread(&c->id, 4, 1, h) == 1
+        && fread(&c->type_idx, 1, 1, h) == 1;
+}
+
+static bool hist_write_count(FILE* h, uint32_t count) {
+    fseek(h, 8, SEEK_SET);  /* Offset of count in header */
+    return fwrite(&count, 4, 1, h) == 1;
+}
+
+/** Load the history file, or fold a disabled history into the floor */
+static void wal_hist_open(tqdb_t db) {
+    db->wal.hist_count = 0;
+    FILE* h = fopen(db->wal.hist_path, "rb");
+    if (!h) return;
+
+    uint32_t magic = 0;
+    uint16_t version = 0;
+    uint16_t flags = 0;
+    uint32_t count = 0;
+    bool ok = fread(&magic, 4, 1, h) == 1 && fread(&version, 2, 1, h) == 1
+        && fread(&flags, 2, 1, h) == 1 && fread(&count, 4, 1, h) == 1
+        && magic == TQDB_WAL_HIST_MAGIC;
+
+    if (ok && db->wal.hist_max > 0) {
+        db->wal.hist_count = count;
+        fclose(h);
+        return;
+    }
+
+    /* Dropping the history: its changes leave the feed */
+    uint64_t lost = db->wal.last_lsn;
+    if (ok) {
+        lost = 0;
+        tqdb_wal_change_t c;
+        for (uint32_t i = 0; i < count && hist_read_record(h, &c); i++) {
+            if (c.lsn > lost) lost = c.lsn;
+        }
+    }
+    fclose(h);
+    tqdb_wal_raise_floor(db, lost);
+    remove(db->wal.hist_path);
+}
+
+/** Drop the oldest records beyond hist_max, shifting the rest down */
+static bool hist_trim(tqdb_t db, FILE* h) {
+    uint32_t drop = db->wal.hist_count - (uint32_t)db->wal.hist_max;
+
+    uint64_t lost = 0;
+    tqdb_wal_change_t c;
+    fseek(h, TQDB_WAL_HIST_HEADER_SIZE, SEEK_SET);
+    for (uint32_t i = 0; i < drop; i++) {
+        if (!hist_read_record(h, &c)) return false;
+        if (c.lsn > lost) lost = c.lsn;
+    }
+    tqdb_wal_raise_floor(db, lost);  /* Before the records go */
+
+    uint8_t buf[TQDB_WAL_HIST_RECORD_SIZE * 32];
+    long src = TQDB_WAL_HIST_HEADER_SIZE + (long)drop * TQDB_WAL_HIST_RECORD_SIZE;
+    long dst = TQDB_WAL_HIST_HEADER_SIZE;
+    long end = TQDB_WAL_HIST_HEADER_SIZE + (long)db->wal.hist_count * TQDB_WAL_HIST_RECORD_SIZE;
+    while (src < end) {
+        size_t n = (size_t)(end - src) < sizeof(buf) ? (size_t)(end - src) : sizeof(buf);
+        fseek(h, src, SEEK_SET);
+        if (fread(buf, 1, n, h) != n) return false;
+        fseek(h, dst, SEEK_SET);
+        if (fwrite(buf, 1, n, h) != n) return false;
+        src += (long)n;
+        dst += (long)n;
+    }
+
+    /* Interrupted before here, the file only holds duplicate records */
+    db->wal.hist_count = (uint32_t)db->wal.hist_max;
+    if (!hist_write_count(h, db->wal.hist_count)) return false;
+    fflush(h);
+    ftruncate(fileno(h), dst);
+    return true;
+}
+
+/** Append the keys of a segment's records to the history file */
+static bool hist_append(tqdb_t db, FILE* seg, uint32_t entry_count) {
+    FILE* h = fopen(db->wal.hist_path, "r+b");
+    if (!h) {
+        h = fopen(db->wal.hist_path, "w+b");
+        if (!h) return false;
+        uint32_t magic = TQDB_WAL_HIST_MAGIC;
+        uint16_t version = 1;
+        uint16_t flags = 0;
+        db->wal.hist_count = 0;
+        if (fwrite(&magic, 4, 1, h) != 1 || fwrite(&version, 2, 1, h) != 1 ||
+            fwrite(&flags, 2, 1, h) != 1 || !hist_write_count(h, 0)) {
+            fclose(h);
+            return false;
+        }
+    }
+
+    /* Records past count are a torn tail: overwrite them */
+    fseek(h, TQDB_WAL_HIST_HEADER_SIZE + (long)db->wal.hist_count * TQDB_WAL_HIST_RECORD_SIZE,
+          SEEK_SET);
+
+    bool ok = true;
+    uint32_t count = db->wal.hist_count;
+    tqdb_wal_entry_t e;
+    for (uint32_t i = 0; ok && i < entry_count && tqdb_wal_read_entry(seg, &e); i++) {
+        if (e.data_len > 0) fseek(seg, e.data_len, SEEK_CUR);
+        ok = fwrite(&e.lsn, 8, 1, h) == 1
+            && fwrite(&e.id, 4, 1, h) == 1
+            && fwrite(&e.type_idx, 1, 1, h) == 1;
+        count++;
+    }
+
+    ok = ok && hist_write_count(h, count);
+    if (ok) db->wal.hist_count = count;
+    if (ok && db->wal.hist_count > db->wal.hist_max) ok = hist_trim(db, h);
+    if (fflush(h) != 0) ok = false;
+    fclose(h);
+    return ok;
+}
+
+/**
+ * A segment is about to be merged away or rewritten. With history its keys
+ * are archived; otherwise (or if archiving fails) its changes leave the feed.
+ */
+void tqdb_wal_retire(tqdb_t db, const char* path) {
+    FILE* seg = fopen(path, "rb");
+    if (!seg) return;
+
+    tqdb_wal_header_t hdr;
+    if (!tqdb_wal_read_header(seg, &hdr) || hdr.version < 2) {
+        fclose(seg);
+        return;  /* Version 1 records carry no LSN */
+    }
+
+    bool archived = db->wal.hist_max > 0 && hist_append(db, seg, hdr.entry_count);
+    fclose(seg);
+    if (!archived) tqdb_wal_raise_floor(db, hdr.last_lsn);
+}
+
+static int change_cmp_key(const void* pa, const void* pb) {
+    const tqdb_wal_change_t* a = (const tqdb_wal_change_t*)pa;
+    const tqdb_wal_change_t* b = (const tqdb_wal_change_t*)pb;
+    if (a->type_idx != b->type_idx) return a->type_idx < b->type_idx ? -1 : 1;
+    if (a->id != b->id) return a->id < b->id ? -1 : 1;
+    return a->lsn < b->lsn ? -1 : (a->lsn > b->lsn ? 1 : 0);
+}
+
+static int change_cmp_lsn(const void* pa, const void* pb) {
+    const tqdb_wal_change_t* a = (const tqdb_wal_change_t*)pa;
+    const tqdb_wal_change_t* b = (const tqdb_wal_change_t*)pb;
+    return a->lsn < b->lsn ? -1 : (a->lsn > b->lsn ? 1 : 0);
+}
+
+typedef struct {
+    tqdb_wal_change_t* items;
+    size_t count;
+    size_t cap;
+} change_list_t;
+
+static bool change_push(tqdb_t db, change_list_t* list, const tqdb_wal_change_t* c) {
+    if (c->type_idx >= db->trait_count || c->id == 0) return true;  /* Not readable */
+
+    if (list->count == list->cap) {
+        size_t new_cap = list->cap == 0 ? 64 : list->cap * 2;
+        tqdb_wal_change_t* items =
+            (tqdb_wal_change_t*)tqdb_alloc(db, new_cap * sizeof(tqdb_wal_change_t));
+        if (!items) return false;
+        if (list->items) {
+            memcpy(items, list->items, list->count * sizeof(tqdb_wal_change_t));
+            tqdb_dealloc(db, list->items);
+        }
+        list->items = items;
+        list->cap = new_cap;
+    }
+    list->items[list->count++] = *c;
+    return true;
+}
+
+/**
+ * Keys changed after since, each once with its newest LSN, oldest first.
+ * The caller frees *out_changes with tqdb_dealloc.
+ */
+tqdb_err_t tqdb_wal_changes(tqdb_t db, uint64_t since, tqdb_wal_change_t** out_changes,
+                            size_t* out_count) {
+    *out_changes = NULL;
+    *out_count = 0;
+    if (since < db->wal.floor_lsn) return TQDB_ERR_EXPIRED;
+
+    change_list_t list = {0};
+    bool ok = true;
+    tqdb_wal_change_t c;
+
+    /* History holds what left the WAL; duplicates of live records are harmless */
+    FILE* h = db->wal.hist_count > 0 ? fopen(db->wal.hist_path, "rb") : NULL;
+    if (h) {
+        fseek(h, TQDB_WAL_HIST_HEADER_SIZE, SEEK_SET);
+        for (uint32_t i = 0; ok && i < db->wal.hist_count && hist_read_record(h, &c); i++) {
+            if (c.lsn > since) ok = change_push(db, &list, &c);
+        }
+        fclose(h);
+    }
+
+    tqdb_wal_seg_t segs[TQDB_WAL_MAX_SEGMENTS];
+    size_t seg_count = tqdb_wal_segments(db, segs);
+    for (size_t s = 0; ok && s < seg_count; s++) {
+        FILE* f = fopen(segs[s].path, "rb");
+        if (!f) continue;
+        fseek(f, TQDB_WAL_HEADER_SIZE, SEEK_SET);
+
+        tqdb_wal_entry_t e;
+        for (uint32_t i = 0; ok && i < segs[s].entry_count && tqdb_wal_read_entry(f, &e); i++) {
+            if (e.data_len > 0) fseek(f, e.data_len, SEEK_CUR);
+            if (e.lsn <= since) continue;
+            c.lsn = e.lsn;
+            c.id = e.id;
+            c.type_idx = e.type_idx;
+            ok = change_push(db, &list, &c);
+        }
+        fclose(f);
+    }
+
+    if (!ok) {
+        tqdb_dealloc(db, list.items);
+        return TQDB_ERR_NO_MEM;
+    }
+
+    /* Keep the newest record per key, then order keys by it */
+    if (list.count > 0) {
+        qsort(list.items, list.count, sizeof(tqdb_wal_change_t), change_cmp_key);
+        size_t out = 0;
+        for (size_t i = 0; i < list.count; i++) {
+            if (out > 0 && list.items[out - 1].type_idx == list.items[i].type_idx &&
+                list.items[out - 1].id == list.items[i].id) {
+                out--;
+            }
+            list.items[out++] = list.items[i];
+        }
+        list.count = out;
+        qsort(list.items, list.count, sizeof(tqdb_wal_change_t), change_cmp_lsn);
+    }
+
+    *out_changes = list.items;
+    *out_count = list.count;
+    return TQDB_OK;
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * WAL Recovery
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -130,46 +526,76 @@ void tqdb_wal_destroy(tqdb_t db) {
 tqdb_err_t tqdb_wal_recover(tqdb_t db) {
     if (!db || !db->wal.enabled || !db->wal.path) return TQDB_OK;
 
+    /* A frozen segment means a background checkpoint did not finish */
+    tqdb_wal_header_t fh = {0};
+    FILE* frozen = fopen(db->wal.frozen_path, "rb");
+    if (frozen) {
+        if (tqdb_wal_read_header(frozen, &fh) && fh.magic == TQDB_WAL_MAGIC &&
+            fh.version <= TQDB_WAL_VERSION && fh.entry_count > 0) {
+            fseek(frozen, 0, SEEK_END);
+            db->wal.frozen_count = fh.entry_count;
+            db->wal.frozen_size = (uint32_t)ftell(frozen);
+            db->wal.recovery_pending = true;
+        }
+        fclose(frozen);
+        if (db->wal.frozen_count == 0) remove(db->wal.frozen_path);
+    }
+    remove(db->wal.ckpt_path);
+
+    /* LSNs continue after the newest segment; without it the feed restarts */
+    db->wal.last_lsn = fh.last_lsn;
+    db->wal.floor_lsn = fh.last_lsn;
+
+    /* A finished compaction may have been cut off before its rename */
+    FILE* compacted = fopen(db->wal.compact_path, "rb");
+    if (compacted) {
+        fclose(compacted);
+        FILE* wal = fopen(db->wal.path, "rb");
+        if (wal) {
+            fclose(wal);
+            remove(db->wal.compact_path);  /* Unfinished: the WAL is intact */
+        } else {
+            rename(db->wal.compact_path, db->wal.path);
+        }
+    }
+
+    tqdb_err_t err = TQDB_OK;
     FILE* f = fopen(db->wal.path, "rb");
+    tqdb_wal_header_t hdr;
     if (!f) {
         /* No WAL file - compute initial DB CRC and create fresh WAL */
         db->wal.db_crc = tqdb_wal_compute_db_crc(db);
-        return wal_create(db);
-    }
-
-    /* Read WAL header */
-    tqdb_wal_header_t hdr;
-    if (!wal_read_header(f, &hdr)) {
+        err = wal_create(db);
+    } else if (!tqdb_wal_read_header(f, &hdr) || hdr.magic != TQDB_WAL_MAGIC ||
+               hdr.version > TQDB_WAL_VERSION) {
+        /* Corrupt header or unknown version - discard WAL */
         fclose(f);
-        /* Corrupt header - discard WAL */
         remove(db->wal.path);
         db->wal.db_crc = tqdb_wal_compute_db_crc(db);
-        return wal_create(db);
-    }
-
-    /* Validate magic and version */
-    if (hdr.magic != TQDB_WAL_MAGIC || hdr.version > TQDB_WAL_VERSION) {
+        err = wal_create(db);
+    } else {
+        /* Get file size */
+        fseek(f, 0, SEEK_END);
+        long file_size = ftell(f);
         fclose(f);
-        remove(db->wal.path);
-        db->wal.db_crc = tqdb_wal_compute_db_crc(db);
-        return wal_create(db);
-    }
-
-    /* Get file size */
-    fseek(f, 0, SEEK_END);
-    long file_size = ftell(f);
-    fclose(f);
 
-    /* Store WAL state */
-    db->wal.entry_count = hdr.entry_count;
-    db->wal.file_size = (uint32_t)file_size;
-    db->wal.db_crc = hdr.db_crc;
-
-    /* If we have pending entries, defer recovery until traits are registered */
-    if (hdr.entry_count > 0) {
-        db->wal.recovery_pending = true;
+        /* Store WAL state */
+        db->wal.entry_count = hdr.entry_count;
+        db->wal.file_size = (uint32_t)file_size;
+        db->wal.db_crc = hdr.db_crc;
+        if (hdr.last_lsn > db->wal.last_lsn) db->wal.last_lsn = hdr.last_lsn;
+        db->wal.floor_lsn = hdr.floor_lsn;
+
+        /* If we have pending entries, defer recovery until traits are registered */
+        if (hdr.entry_count > 0) {
+            db->wal.recovery_pending = true;
+        } else if (hdr.version < TQDB_WAL_VERSION) {
+            err = wal_create(db);  /* Appends need the current format */
+        }
     }
+    if (err != TQDB_OK) return err;
 
+    wal_hist_open(db);
     return TQDB_OK;
 }
 
@@ -182,6 +608,20 @@ tqdb_err_t tqdb_wal_check_recovery(tqdb_t db) {
     if (!db->wal.recovery_pending) return TQDB_OK;
     if (db->trait_count == 0) return TQDB_OK;  /* Still no traits registered */
 
+#if TQDB_ENABLE_MULTIPROC
+    if (db->mp.shm) {
+        /* Whichever process gets here first recovers, under the write lock */
+        if (!tqdb_lock(db)) return TQDB_ERR_TIMEOUT;
+        tqdb_err_t err = TQDB_OK;
+        if (db->wal.recovery_pending) {
+            db->wal.recovery_pending = false;
+            err = tqdb_wal_checkpoint_internal(db);
+        }
+        tqdb_unlock(db);
+        return err;
+    }
+#endif
+
     /* Perform deferred recovery - traits are now available */
     db->wal.recovery_pending = false;
     return tqdb_wal_checkpoint_internal(db);
@@ -191,20 +631,73 @@ tqdb_err_t tqdb_wal_check_recovery(tqdb_t db) {
  * WAL Append Operation
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-tqdb_err_t tqdb_wal_append(tqdb_t db, uint8_t op, uint8_t type_idx,
-                           uint32_t id, const void* entity) {
-    if (!db || !db->wal.enabled || !db->wal.path) return TQDB_OK;
-    if (id == 0) return TQDB_ERR_INVALID_ARG;
+/**
+ * Serialize a record's data into a buffer of its own, *out_len bytes
+ * (NULL when empty). For PATCH, the trait diff is taken against base;
+ * when the trait declines, *op becomes UPDATE and the full image is
+ * written instead. Twice the struct leaves room for a length before
+ * every field; larger records double the buffer until they fit.
+ */
+static tqdb_err_t wal_encode(tqdb_t db, const tqdb_trait_t* trait, uint8_t* op,
+                             const void* base, const void* entity,
+                             uint8_t** out_data, size_t* out_len) {
+    *out_data = NULL;
+    *out_len = 0;
+    if (*op == TQDB_WAL_OP_DELETE || !entity) return TQDB_OK;
+
+    for (size_t size = trait->struct_size * 2 + 64;; size *= 2) {
+        uint8_t* buf = (uint8_t*)tqdb_alloc(db, size);
+        if (!buf) return TQDB_ERR_NO_MEM;
+
+        uint8_t rec_op = *op;
+        tqdb_writer_t w;
+        tqdb_writer_init_mem(&w, buf, size);
+        if (rec_op == TQDB_WAL_OP_PATCH && !trait->diff(&w, base, entity)) {
+            /* Patch not worth it: discard and write the full image */
+            tqdb_writer_init_mem(&w, buf, size);
+            rec_op = TQDB_WAL_OP_UPDATE;
+        }
+        if (rec_op == TQDB_WAL_OP_MERGE) {
+            trait->merge_write(&w, entity);  /* entity is the operand */
+        } else if (rec_op != TQDB_WAL_OP_PATCH) {
+            trait->write(&w, entity);
+        }
 
-    const tqdb_trait_t* trait = db->traits[type_idx];
-    if (!trait) return TQDB_ERR_INVALID_ARG;
+        if (!tqdb_write_error(&w)) {
+            *op = rec_op;
+            *out_len = w.buf_pos;
+            if (w.buf_pos > 0) {
+                *out_data = buf;
+            } else {
+                tqdb_dealloc(db, buf);  /* An empty patch carries none */
+            }
+            return TQDB_OK;
+        }
+        tqdb_dealloc(db, buf);
+    }
+}
 
+/* Striped writes encode alongside each other; their appends go one at a time */
+static bool wal_append_lock(tqdb_t db) {
+    return !db->write_lock || db->mutex_ops->lock(db->write_lock, 5000);
+}
+
+static void wal_append_unlock(tqdb_t db) {
+    if (db->write_lock) db->mutex_ops->unlock(db->write_lock);
+}
+
+/* Write an encoded record at the end of the WAL: the LSN, the counts and the key set */
+static tqdb_err_t wal_write_record(tqdb_t db, uint8_t op, uint8_t type_idx, uint32_t id,
+                                   const uint8_t* entity_data, size_t data_len) {
     /* Open WAL for append */
     FILE* f = fopen(db->wal.path, "r+b");
     if (!f) {
-        /* WAL doesn't exist, create it */
-        db->wal.db_crc = tqdb_wal_compute_db_crc(db);
+        /* WAL doesn't exist, create it (readers may be taking the counts) */
+        uint32_t db_crc = tqdb_wal_compute_db_crc(db);
+        tqdb_reader_enter(db);
+        db->wal.db_crc = db_crc;
         tqdb_err_t err = wal_create(db);
+        tqdb_reader_leave(db);
         if (err != TQDB_OK) return err;
         f = fopen(db->wal.path, "r+b");
         if (!f) return TQDB_ERR_IO;
@@ -213,53 +706,26 @@ tqdb_err_t tqdb_wal_append(tqdb_t db, uint8_t op, uint8_t type_idx,
     /* Seek to end */
     fseek(f, 0, SEEK_END);
     long entry_start = ftell(f);
+#if TQDB_ENABLE_MULTIPROC
+    /* Past the shared count: a process died mid-write, before publishing it */
+    if (db->mp.shm && entry_start > (long)db->wal.file_size) {
+        entry_start = (long)db->wal.file_size;
+        ftruncate(fileno(f), entry_start);
+        fseek(f, entry_start, SEEK_SET);
+    }
+#endif
 
     /* Calculate CRC of entry (excluding CRC field itself) */
+    uint64_t lsn = db->wal.last_lsn + 1;
     uint32_t crc = 0xFFFFFFFF;
+    uint32_t crc_len = (uint32_t)data_len;
     crc = tqdb_crc32_update(crc, &op, 1);
     crc = tqdb_crc32_update(crc, &type_idx, 1);
     crc = tqdb_crc32_update(crc, (uint8_t*)&id, 4);
-
-    /* Serialize entity to get data and data_len */
-    uint8_t* entity_data = NULL;
-    size_t data_len = 0;
-    if (op != TQDB_WAL_OP_DELETE && entity) {
-        /* Use scratch buffer to serialize entity */
-        size_t half = db->scratch_size / 2;
-        uint8_t* write_buf = db->scratch;
-
-        /* Create memory writer */
-        FILE* mem = tmpfile();
-        if (!mem) {
-            fclose(f);
-            return TQDB_ERR_IO;
-        }
-
-        tqdb_writer_t w;
-        tqdb_writer_init(&w, mem, write_buf, half);
-        trait->write(&w, entity);
-        tqdb_writer_flush(&w);
-
-        data_len = ftell(mem);
-
-        /* Read back serialized data */
-        entity_data = (uint8_t*)tqdb_alloc(db, data_len);
-        if (!entity_data) {
-            fclose(mem);
-            fclose(f);
-            return TQDB_ERR_NO_MEM;
-        }
-        fseek(mem, 0, SEEK_SET);
-        fread(entity_data, 1, data_len, mem);
-        fclose(mem);
-
-        /* Update CRC with entity data */
-        uint32_t data_len32 = (uint32_t)data_len;
-        crc = tqdb_crc32_update(crc, (uint8_t*)&data_len32, 4);
+    crc = tqdb_crc32_update(crc, (uint8_t*)&lsn, 8);
+    crc = tqdb_crc32_update(crc, (uint8_t*)&crc_len, 4);
+    if (data_len > 0) {
         crc = tqdb_crc32_update(crc, entity_data, data_len);
-    } else {
-        uint32_t zero = 0;
-        crc = tqdb_crc32_update(crc, (uint8_t*)&zero, 4);
     }
     crc = tqdb_crc32_finalize(crc);
 
@@ -269,37 +735,81 @@ tqdb_err_t tqdb_wal_append(tqdb_t db, uint8_t op, uint8_t type_idx,
     write_ok = write_ok && fwrite(&op, 1, 1, f) == 1;
     write_ok = write_ok && fwrite(&type_idx, 1, 1, f) == 1;
     write_ok = write_ok && fwrite(&id, 4, 1, f) == 1;
+    write_ok = write_ok && fwrite(&lsn, 8, 1, f) == 1;
     uint32_t data_len32 = (uint32_t)data_len;
     write_ok = write_ok && fwrite(&data_len32, 4, 1, f) == 1;
-    if (data_len > 0 && entity_data) {
+    if (data_len > 0) {
         write_ok = write_ok && fwrite(entity_data, 1, data_len, f) == data_len;
     }
 
-    if (entity_data) {
-        tqdb_dealloc(db, entity_data);
-    }
+    /* Readers only scan entries counted, so the entry lands before the count */
+    write_ok = write_ok && fflush(f) == 0;
 
     if (!write_ok) {
-        /* Truncate back to entry start */
+        /* Truncate back to entry start; sessions may have buffered the tail */
         ftruncate(fileno(f), entry_start);
+        tqdb_reader_enter(db);
+        db->files_gen++;
+        tqdb_reader_leave(db);
         fclose(f);
         return TQDB_ERR_IO;
     }
 
-    /* Update header entry count */
-    db->wal.entry_count++;
+    /* Update entry count and last LSN */
+    tqdb_reader_enter(db);
+    uint32_t entry_count = ++db->wal.entry_count;
+    db->wal.last_lsn = lsn;
     db->wal.file_size = (uint32_t)ftell(f);
+    tqdb_reader_leave(db);
+
+    /* Without memory the set falls behind and is rebuilt when compaction asks */
+    if (db->wal.key_entries + 1 == entry_count) tqdb_wal_key_add(db, op, type_idx, id);
 
     fseek(f, 12, SEEK_SET);  /* Offset of entry_count in header */
-    fwrite(&db->wal.entry_count, 4, 1, f);
+    fwrite(&entry_count, 4, 1, f);
+    fwrite(&lsn, 8, 1, f);
 
     fflush(f);
     fclose(f);
+    return TQDB_OK;
+}
+
+/**
+ * Append one record. The caller holds the type's stripe (or the lock
+ * exclusively), so the record is encoded and the type's own state updated
+ * outside write_lock; only the write at the end of the WAL waits for it.
+ */
+static tqdb_err_t wal_append(tqdb_t db, uint8_t op, uint8_t type_idx, uint32_t id,
+                             const void* base, const void* entity) {
+    if (!db || !db->wal.enabled || !db->wal.path) return TQDB_OK;
+    if (id == 0) return TQDB_ERR_INVALID_ARG;
+
+    const tqdb_trait_t* trait = db->traits[type_idx];
+    if (!trait) return TQDB_ERR_INVALID_ARG;
+
+    uint8_t* entity_data;
+    size_t data_len;
+    tqdb_err_t err = wal_encode(db, trait, &op, base, entity, &entity_data, &data_len);
+    if (err != TQDB_OK) return err;
+
+    if (!wal_append_lock(db)) {
+        tqdb_dealloc(db, entity_data);
+        return TQDB_ERR_TIMEOUT;
+    }
+    err = wal_write_record(db, op, type_idx, id, entity_data, data_len);
+    wal_append_unlock(db);
+    tqdb_dealloc(db, entity_data);
+    if (err != TQDB_OK) return err;
+
+    if (op == TQDB_WAL_OP_ADD || op == TQDB_WAL_OP_DELETE) {
+        tqdb_live_note(db, type_idx, id, op == TQDB_WAL_OP_ADD);
+    }
 
     /* Update cache if enabled */
 #if TQDB_ENABLE_CACHE
     if (db->cache) {
-        if (op == TQDB_WAL_OP_DELETE) {
+        if (op == TQDB_WAL_OP_DELETE || op == TQDB_WAL_OP_MERGE) {
+            /* A merge result is only known once read */
             tqdb_cache_invalidate(db, type_idx, id);
         } else {
             tqdb_cache_put(db, type_idx, id, entity, op);
@@ -307,107 +817,329 @@ tqdb_err_t tqdb_wal_append(tqdb_t db, uint8_t op, uint8_t type_idx,
     }
 #endif
 
-    /* Check if we should checkpoint */
-    if (tqdb_wal_should_checkpoint(db)) {
-        return tqdb_wal_checkpoint_internal(db);
-    }
-
     return TQDB_OK;
 }
 
+tqdb_err_t tqdb_wal_append(tqdb_t db, uint8_t op, uint8_t type_idx,
+                           uint32_t id, const void* entity) {
+    return wal_append(db, op, type_idx, id, NULL, entity);
+}
+
+tqdb_err_t tqdb_wal_append_patch(tqdb_t db, uint8_t type_idx, uint32_t id,
+                                 const void* base, const void* entity) {
+    return wal_append(db, TQDB_WAL_OP_PATCH, type_idx, id, base, entity);
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * WAL Find (for reads)
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-tqdb_err_t tqdb_wal_find(tqdb_t db, uint8_t type_idx, uint32_t id,
-                         uint8_t* out_op, void* out_entity) {
-    if (!db || !db->wal.enabled || !db->wal.path) return TQDB_ERR_NOT_FOUND;
-    if (id == 0 || db->wal.entry_count == 0) return TQDB_ERR_NOT_FOUND;
+/* Small private buffer for PATCH/MERGE reads: callers may hold db->scratch */
+#define WAL_CHAIN_BUF_SIZE 256
+
+bool tqdb_wal_chain_add(tqdb_t db, tqdb_wal_chain_t* chain, const tqdb_wal_seg_t* seg,
+                        long pos, uint8_t op) {
+    /* A newer PATCH in the same segment supersedes the older one */
+    if (op == TQDB_WAL_OP_PATCH && chain->count > 0) {
+        tqdb_wal_link_t* last = &chain->links[chain->count - 1];
+        if (last->op == TQDB_WAL_OP_PATCH && last->path == seg->path) {
+            last->pos = pos;
+            return true;
+        }
+    }
 
-    FILE* f = fopen(db->wal.path, "rb");
-    if (!f) return TQDB_ERR_NOT_FOUND;
+    if (chain->count == chain->cap) {
+        uint32_t new_cap = chain->cap == 0 ? 4 : chain->cap * 2;
+        tqdb_wal_link_t* links =
+            (tqdb_wal_link_t*)tqdb_alloc(db, new_cap * sizeof(tqdb_wal_link_t));
+        if (!links) return false;
+        if (chain->links) {
+            memcpy(links, chain->links, chain->count * sizeof(tqdb_wal_link_t));
+            tqdb_dealloc(db, chain->links);
+        }
+        chain->links = links;
+        chain->cap = new_cap;
+    }
 
-    /* Skip header */
-    fseek(f, TQDB_WAL_HEADER_SIZE, SEEK_SET);
+    chain->links[chain->count].path = seg->path;
+    chain->links[chain->count].file = seg->file;
+    chain->links[chain->count].pos = pos;
+    chain->links[chain->count].op = op;
+    chain->count++;
+    return true;
+}
 
-    const tqdb_trait_t* trait = db->traits[type_idx];
-    size_t half = db->scratch_size / 2;
-
-    /* Track the last matching entry (most recent wins) */
-    uint8_t found_op = 0;
-    bool found = false;
-    long found_data_pos = 0;
-    uint32_t found_data_len = 0;
-
-    /* Scan all entries */
-    for (uint32_t i = 0; i < db->wal.entry_count; i++) {
-        uint32_t entry_crc;
-        uint8_t op, tidx;
-        uint32_t entry_id;
-
-        if (fread(&entry_crc, 4, 1, f) != 1) break;
-        if (fread(&op, 1, 1, f) != 1) break;
-        if (fread(&tidx, 1, 1, f) != 1) break;
-        if (fread(&entry_id, 4, 1, f) != 1) break;
-
-        uint32_t data_len;
-        if (fread(&data_len, 4, 1, f) != 1) break;
-
-        /* Check if this entry matches */
-        if (tidx == type_idx && entry_id == id) {
-            found = true;
-            found_op = op;
-            found_data_pos = ftell(f);
-            found_data_len = data_len;
+void tqdb_wal_chain_free(tqdb_t db, tqdb_wal_chain_t* chain) {
+    if (chain->links) tqdb_dealloc(db, chain->links);
+    memset(chain, 0, sizeof(*chain));
+}
+
+bool tqdb_wal_chain_apply(tqdb_t db, const tqdb_trait_t* trait,
+                          const tqdb_wal_chain_t* chain, void* entity) {
+    (void)db;
+    uint8_t buf[WAL_CHAIN_BUF_SIZE];
+    FILE* f = NULL;
+    const char* open_path = NULL;
+    bool ok = true;
+
+    for (uint32_t i = 0; i < chain->count && ok; i++) {
+        const tqdb_wal_link_t* link = &chain->links[i];
+        void (*fold)(tqdb_reader_t*, void*) =
+            link->op == TQDB_WAL_OP_PATCH ? trait->patch : trait->merge;
+        if (!fold) {
+            ok = false;
+            break;
         }
 
-        /* Skip entity data */
-        if (data_len > 0) {
-            fseek(f, data_len, SEEK_CUR);
+        FILE* in = link->file;  /* Pinned by a snapshot */
+        if (!in) {
+            if (link->path != open_path) {
+                if (f) fclose(f);
+                f = fopen(link->path, "rb");
+                open_path = link->path;
+                if (!f) {
+                    ok = false;
+                    break;
+                }
+            }
+            in = f;
         }
+        fseek(in, link->pos, SEEK_SET);
+
+        tqdb_reader_t r;
+        tqdb_reader_init(&r, in, buf, sizeof(buf));
+        fold(&r, entity);
+        ok = !tqdb_read_error(&r);
     }
 
-    if (!found) {
-        fclose(f);
-        return TQDB_ERR_NOT_FOUND;
+    if (f) fclose(f);
+    return ok;
+}
+
+/* Latest full record for a key, plus what folds over it */
+typedef struct {
+    uint8_t op;                 /* Last ADD/UPDATE/DELETE/PATCH, 0 if none */
+    const char* image_path;     /* Last ADD/UPDATE image, NULL if none (db-owned) */
+    long image_pos;
+    uint32_t image_len;
+    tqdb_wal_chain_t chain;     /* PATCH/MERGE records after that image */
+} wal_lookup_t;
+
+static bool wal_lookup(tqdb_session_t session, uint8_t type_idx, uint32_t id,
+                       wal_lookup_t* out) {
+    tqdb_t db = session->db;
+    memset(out, 0, sizeof(*out));
+
+    /* The WAL as the session entered it: appends since are not counted yet */
+    tqdb_wal_seg_t segs[TQDB_WAL_MAX_SEGMENTS];
+    size_t seg_count = session->seg_count;
+    memcpy(segs, session->segs, sizeof(segs));
+    tqdb_session_note_scan(session);
+
+    bool ok = true;
+    for (size_t s = 0; s < seg_count && ok; s++) {
+        FILE* f = tqdb_session_seg(session, segs[s].path);
+        if (!f) continue;
+        if (session->keep_files) segs[s].file = f;  /* Chains fold through the held file */
+
+        /* Skip header */
+        fseek(f, TQDB_WAL_HEADER_SIZE, SEEK_SET);
+
+        /* Scan all entries; most recent wins, active after frozen */
+        tqdb_wal_entry_t e;
+        for (uint32_t i = 0; i < segs[s].entry_count && tqdb_wal_read_entry(f, &e); i++) {
+            if (e.type_idx == type_idx && e.id == id) {
+                if (e.op == TQDB_WAL_OP_MERGE) {
+                    /* Nothing to fold into once deleted */
+                    if (out->op != TQDB_WAL_OP_DELETE) {
+                        ok = ok && tqdb_wal_chain_add(db, &out->chain, &segs[s],
+                                                      e.data_pos, e.op);
+                    }
+                } else if (e.op == TQDB_WAL_OP_PATCH) {
+                    out->op = e.op;
+                    ok = ok && tqdb_wal_chain_add(db, &out->chain, &segs[s],
+                                                  e.data_pos, e.op);
+                } else {
+                    out->op = e.op;
+                    out->image_path = e.op == TQDB_WAL_OP_DELETE ? NULL : segs[s].path;
+                    out->image_pos = e.data_pos;
+                    out->image_len = e.data_len;
+                    out->chain.count = 0;
+                }
+            }
+
+            /* Skip entity data */
+            if (e.data_len > 0) {
+                fseek(f, e.data_len, SEEK_CUR);
+            }
+        }
+
+        tqdb_session_put(session, f);
     }
 
-    if (out_op) *out_op = found_op;
+    if (!ok) tqdb_wal_chain_free(db, &out->chain);
+    return ok;
+}
 
-    /* If deleted, return not found */
-    if (found_op == TQDB_WAL_OP_DELETE) {
-        fclose(f);
-        return TQDB_ERR_NOT_FOUND;
+/* Load the key's base: the WAL image, or the main file entry */
+static tqdb_err_t wal_load_base(tqdb_session_t session, uint8_t type_idx, uint32_t id,
+                                const wal_lookup_t* lk, void* out_entity) {
+    tqdb_t db = session->db;
+    const tqdb_trait_t* trait = db->traits[type_idx];
+
+    if (!lk->image_path) {
+        tqdb_err_t err = tqdb_main_find(session, type_idx, id, out_entity);
+        if (err != TQDB_OK && trait->destroy) trait->destroy(out_entity);
+        return err;
     }
 
-    /* Read entity data if requested */
-    if (out_entity && found_data_len > 0) {
-        fseek(f, found_data_pos, SEEK_SET);
+    if (trait->init) trait->init(out_entity);
+    if (lk->image_len == 0) return TQDB_OK;
 
-        tqdb_reader_t r;
-        tqdb_reader_init(&r, f, db->scratch, half);
+    FILE* f = tqdb_session_seg(session, lk->image_path);
+    if (!f) {
+        if (trait->destroy) trait->destroy(out_entity);
+        return TQDB_ERR_IO;
+    }
+    fseek(f, lk->image_pos, SEEK_SET);
 
-        if (trait->init) trait->init(out_entity);
-        trait->read(&r, out_entity);
+    tqdb_reader_t r;
+    tqdb_reader_init(&r, f, session->buf, db->scratch_size / 2);
+    trait->read(&r, out_entity);
 
-        if (tqdb_read_error(&r)) {
-            if (trait->destroy) trait->destroy(out_entity);
-            fclose(f);
-            return TQDB_ERR_CORRUPT;
-        }
+    tqdb_session_put(session, f);
+    if (tqdb_read_error(&r)) {
+        if (trait->destroy) trait->destroy(out_entity);
+        return TQDB_ERR_CORRUPT;
     }
+    return TQDB_OK;
+}
 
-    fclose(f);
+/* Load the base and fold the chain into it */
+static tqdb_err_t wal_materialize(tqdb_session_t session, uint8_t type_idx, uint32_t id,
+                                  const wal_lookup_t* lk, void* out_entity) {
+    tqdb_t db = session->db;
+    const tqdb_trait_t* trait = db->traits[type_idx];
+
+    tqdb_err_t err = wal_load_base(session, type_idx, id, lk, out_entity);
+    if (err != TQDB_OK) return err;
+
+    if (!tqdb_wal_chain_apply(db, trait, &lk->chain, out_entity)) {
+        if (trait->destroy) trait->destroy(out_entity);
+        return TQDB_ERR_CORRUPT;
+    }
     return TQDB_OK;
 }
 
+tqdb_err_t tqdb_wal_find(tqdb_session_t session, uint8_t type_idx, uint32_t id,
+                         uint8_t* out_op, void* out_entity) {
+    tqdb_t db = session->db;
+    if (!db->wal.enabled || !db->wal.path) return TQDB_ERR_NOT_FOUND;
+    if (id == 0 || session->seg_count == 0) return TQDB_ERR_NOT_FOUND;
+
+    wal_lookup_t lk;
+    if (!wal_lookup(session, type_idx, id, &lk)) return TQDB_ERR_NO_MEM;
+
+    if (lk.op == 0 && lk.chain.count == 0) {
+        return TQDB_ERR_NOT_FOUND;
+    }
+
+    if (out_op) *out_op = lk.op != 0 ? lk.op : TQDB_WAL_OP_MERGE;
+
+    /* If deleted, return not found */
+    tqdb_err_t err = TQDB_OK;
+    if (lk.op == TQDB_WAL_OP_DELETE) {
+        err = TQDB_ERR_NOT_FOUND;
+    } else if (!out_entity) {
+        /* Existence: merges alone do not prove the main entry is there */
+        if (lk.op == 0) err = TQDB_ERR_NOT_FOUND;
+    } else {
+        err = wal_materialize(session, type_idx, id, &lk, out_entity);
+    }
+
+    tqdb_wal_chain_free(db, &lk.chain);
+    return err;
+}
+
+tqdb_err_t tqdb_wal_find_base(tqdb_session_t session, uint8_t type_idx, uint32_t id,
+                              void* out_entity, bool* out_patchable) {
+    tqdb_t db = session->db;
+    wal_lookup_t lk;
+    memset(&lk, 0, sizeof(lk));
+
+    /* The writer's session; other types may be appending meanwhile */
+    tqdb_reader_enter(db);
+    session->seg_count = db->wal.enabled ? tqdb_wal_segments(db, session->segs) : 0;
+    tqdb_reader_leave(db);
+    if (db->wal.path && session->seg_count > 0) {
+        if (!wal_lookup(session, type_idx, id, &lk)) return TQDB_ERR_NO_MEM;
+    }
+    if (lk.op == TQDB_WAL_OP_DELETE) {
+        tqdb_wal_chain_free(db, &lk.chain);
+        return TQDB_ERR_NOT_FOUND;
+    }
+
+    /*
+     * New patches diff against the state the active segment started from.
+     * A PATCH may not follow a MERGE in its segment (checkpoint folds
+     * MERGEs in place), so those keys log a full image instead.
+     */
+    *out_patchable = true;
+    tqdb_wal_chain_t* chain = &lk.chain;
+    while (chain->count > 0 && chain->links[chain->count - 1].path == db->wal.path) {
+        if (chain->links[chain->count - 1].op == TQDB_WAL_OP_MERGE) *out_patchable = false;
+        chain->count--;
+    }
+
+    tqdb_err_t err = wal_materialize(session, type_idx, id, &lk, out_entity);
+    tqdb_wal_chain_free(db, &lk.chain);
+    return err;
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * WAL Checkpoint
  * ═══════════════════════════════════════════════════════════════════════════ */
 
+/**
+ * Estimated bytes moved by a checkpoint: the main file is read and
+ * rewritten, the pending WAL read once. Only the main file term is cached;
+ * the WAL term grows with every append.
+ */
+static uint64_t wal_rewrite_cost(tqdb_t db) {
+    if (!db->wal.main_cost_known) {
+        uint32_t main_size = 0;
+        FILE* f = fopen(db->db_path, "rb");
+        if (f) {
+            fseek(f, 0, SEEK_END);
+            main_size = (uint32_t)ftell(f);
+            fclose(f);
+        }
+        db->wal.main_cost = main_size > UINT32_MAX / 2 ? UINT32_MAX : 2 * main_size;
+        db->wal.main_cost_known = true;
+    }
+    return (uint64_t)db->wal.main_cost + db->wal.file_size + db->wal.frozen_size;
+}
+
+void tqdb_wal_note_scan(tqdb_t db) {
+    uint32_t bytes = db->wal.file_size + db->wal.frozen_size;
+    db->wal.scan_bytes = db->wal.scan_bytes > UINT32_MAX - bytes ? UINT32_MAX
+                                                                  : db->wal.scan_bytes + bytes;
+}
+
 bool tqdb_wal_should_checkpoint(tqdb_t db) {
     if (!db || !db->wal.enabled) return false;
 
+    if (db->wal.policy == TQDB_CHECKPOINT_ADAPTIVE) {
+        if (db->wal.entry_count == 0) return false;
+        if (db->wal.max_size > 0 && db->wal.file_size >= db->wal.max_size) {
+            return true;
+        }
+
+        /* The rewrite costs at least one WAL read: skip the estimate until then */
+        if (db->wal.scan_bytes < db->wal.file_size + db->wal.frozen_size) return false;
+        return db->wal.scan_bytes >= wal_rewrite_cost(db);
+    }
+
     if (db->wal.max_entries > 0 && db->wal.entry_count >= db->wal.max_entries) {
         return true;
     }
@@ -418,22 +1150,156 @@ bool tqdb_wal_should_checkpoint(tqdb_t db) {
     return false;
 }
 
-/* Forward declaration - implemented in tqdb_core.c */
-extern tqdb_err_t tqdb_checkpoint_merge(tqdb_t db);
+static uint32_t wal_key_hash(uint64_t key) {
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/* Insert into the key set; found tells whether the key was already there */
+static bool wal_keys_insert(tqdb_t db, uint64_t key, bool* found) {
+    tqdb_wal_t* w = &db->wal;
+
+    /* Keep the load under 3/4 so probes stay short */
+    if ((uint64_t)(w->key_count + 1) * 4 > (uint64_t)w->key_cap * 3) {
+        uint32_t cap = w->key_cap ? w->key_cap * 2 : TQDB_WAL_KEYS_MIN;
+        uint64_t* keys = (uint64_t*)tqdb_alloc(db, cap * sizeof(uint64_t));
+        if (!keys) return false;
+        memset(keys, 0, cap * sizeof(uint64_t));
+        for (uint32_t i = 0; i < w->key_cap; i++) {
+            if (w->keys[i] == 0) continue;
+            uint32_t j = wal_key_hash(w->keys[i]) & (cap - 1);
+            while (keys[j] != 0) j = (j + 1) & (cap - 1);
+            keys[j] = w->keys[i];
+        }
+        tqdb_dealloc(db, w->keys);
+        w->keys = keys;
+        w->key_cap = cap;
+    }
+
+    uint32_t mask = w->key_cap - 1;
+    uint32_t i = wal_key_hash(key) & mask;
+    while (w->keys[i] != 0) {
+        if (w->keys[i] == key) {
+            *found = true;
+            return true;
+        }
+        i = (i + 1) & mask;
+    }
+    w->keys[i] = key;
+    w->key_count++;
+    *found = false;
+    return true;
+}
+
+void tqdb_wal_keys_clear(tqdb_t db) {
+    if (db->wal.keys) memset(db->wal.keys, 0, db->wal.key_cap * sizeof(uint64_t));
+    db->wal.key_count = 0;
+    db->wal.key_entries = 0;
+    db->wal.dup_count = 0;
+}
+
+/**
+ * Cover one more active WAL entry. It supersedes an older record when its
+ * key is already logged, except a MERGE operand, which compaction keeps.
+ */
+bool tqdb_wal_key_add(tqdb_t db, uint8_t op, uint8_t type_idx, uint32_t id) {
+    bool found;
+    if (!wal_keys_insert(db, ((uint64_t)type_idx + 1) << 32 | id, &found)) return false;
+    if (found && op != TQDB_WAL_OP_MERGE) db->wal.dup_count++;
+    db->wal.key_entries++;
+    return true;
+}
+
+/* Cover the entries the set missed: recovered, or appended by another process */
+static bool wal_keys_rebuild(tqdb_t db) {
+    tqdb_wal_keys_clear(db);
+
+    FILE* f = fopen(db->wal.path, "rb");
+    if (!f) return false;
+    tqdb_wal_header_t hdr;
+    bool ok = tqdb_wal_read_header(f, &hdr) && hdr.magic == TQDB_WAL_MAGIC &&
+              hdr.version == TQDB_WAL_VERSION;
+
+    tqdb_wal_entry_t e;
+    for (uint32_t i = 0; ok && i < db->wal.entry_count; i++) {
+        ok = tqdb_wal_read_entry(f, &e) && tqdb_wal_key_add(db, e.op, e.type_idx, e.id);
+        if (ok && e.data_len > 0) fseek(f, e.data_len, SEEK_CUR);
+    }
+    fclose(f);
+
+    if (!ok) tqdb_wal_keys_clear(db);
+    return ok;
+}
+
+/** Compaction pays off when enough of the active WAL is superseded */
+static bool wal_should_compact(tqdb_t db) {
+    if (db->wal.compact_percent > 100) return false;
+    if (db->wal.entry_count < TQDB_WAL_COMPACT_MIN_ENTRIES) return false;
+    if (db->wal.key_entries != db->wal.entry_count && !wal_keys_rebuild(db)) return false;
+    return (uint64_t)db->wal.dup_count * 100 >=
+           (uint64_t)db->wal.entry_count * db->wal.compact_percent;
+}
+
+tqdb_err_t tqdb_wal_maybe_checkpoint(tqdb_t db) {
+    if (!tqdb_wal_should_checkpoint(db)) return TQDB_OK;
+
+    if (wal_should_compact(db)) {
+        tqdb_err_t err = tqdb_checkpoint_compact(db);
+        if (err != TQDB_OK) return err;
+        if (!tqdb_wal_should_checkpoint(db)) return TQDB_OK;
+    }
+    if (db->wal.background) {
+        return tqdb_checkpoint_rotate(db);
+    }
+    return tqdb_wal_checkpoint_internal(db);
+}
 
 tqdb_err_t tqdb_wal_checkpoint_internal(tqdb_t db) {
     if (!db || !db->wal.enabled) return TQDB_OK;
-    if (db->wal.entry_count == 0) return TQDB_OK;
+    if (tqdb_wal_pending(db) == 0 && !db->wal.ckpt_running) return TQDB_OK;
 
     /* Merge WAL into main DB */
     tqdb_err_t err = tqdb_checkpoint_merge(db);
     if (err != TQDB_OK) return err;
 
     /* Clear WAL */
+    tqdb_wal_retire(db, db->wal.path);
     db->wal.db_crc = tqdb_wal_compute_db_crc(db);
     return wal_create(db);
 }
 
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Highest Logged ID
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+uint32_t tqdb_wal_max_id(tqdb_t db, uint8_t type_idx) {
+    if (!db || !db->wal.enabled || !db->wal.path) return 0;
+
+    tqdb_wal_seg_t segs[TQDB_WAL_MAX_SEGMENTS];
+    tqdb_reader_enter(db);
+    size_t seg_count = tqdb_wal_segments(db, segs);
+    tqdb_reader_leave(db);
+
+    uint32_t max_id = 0;
+    for (size_t s = 0; s < seg_count; s++) {
+        FILE* f = fopen(segs[s].path, "rb");
+        if (!f) continue;
+
+        fseek(f, TQDB_WAL_HEADER_SIZE, SEEK_SET);
+
+        tqdb_wal_entry_t e;
+        for (uint32_t i = 0; i < segs[s].entry_count && tqdb_wal_read_entry(f, &e); i++) {
+            if (e.type_idx == type_idx && e.id > max_id) {
+                max_id = e.id;
+            }
+            if (e.data_len > 0) fseek(f, e.data_len, SEEK_CUR);
+        }
+
+        fclose(f);
+    }
+
+    return max_id;
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Compute DB CRC
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -3,11 +3,14 @@
  * @brief TQDB unit tests
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "../tqdb.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #define TEST_DB_PATH "test/test.tqdb"
 #define TEST_WAL_PATH "test/test.tqdb.wal"
@@ -97,8 +100,101 @@ static void cleanup(void) {
     remove(TEST_DB_PATH ".tmp");
     remove(TEST_DB_PATH ".bak");
     remove(TEST_WAL_PATH);
+    remove(TEST_DB_PATH ".spill");
+    remove(TEST_DB_PATH ".ckpt");
+    remove(TEST_WAL_PATH ".1");
+    remove(TEST_WAL_PATH ".new");
+    remove(TEST_WAL_PATH ".hist");
+    remove(TEST_DB_PATH ".warm");
+    remove(TEST_DB_PATH ".shm");
+}
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Test Platform Ops (pthreads)
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+static void* pt_mutex_create(void) {
+    pthread_mutex_t* m = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+    if (m) pthread_mutex_init(m, NULL);
+    return m;
+}
+
+static void pt_mutex_destroy(void* m) {
+    pthread_mutex_destroy((pthread_mutex_t*)m);
+    free(m);
+}
+
+static bool pt_mutex_lock(void* m, uint32_t timeout_ms) {
+    (void)timeout_ms;
+    return pthread_mutex_lock((pthread_mutex_t*)m) == 0;
+}
+
+static void pt_mutex_unlock(void* m) {
+    pthread_mutex_unlock((pthread_mutex_t*)m);
+}
+
+static tqdb_mutex_ops_t PT_MUTEX = {
+    pt_mutex_create, pt_mutex_destroy, pt_mutex_lock, pt_mutex_unlock, NULL, NULL
+};
+
+typedef struct {
+    pthread_t handle;
+    void (*fn)(void* arg);
+    void* arg;
+} pt_thread_t;
+
+static void* pt_thread_main(void* p) {
+    pt_thread_t* t = (pt_thread_t*)p;
+    t->fn(t->arg);
+    return NULL;
+}
+
+static void* pt_thread_start(void (*fn)(void* arg), void* arg) {
+    pt_thread_t* t = (pt_thread_t*)malloc(sizeof(pt_thread_t));
+    if (!t) return NULL;
+    t->fn = fn;
+    t->arg = arg;
+    if (pthread_create(&t->handle, NULL, pt_thread_main, t) != 0) {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+static void pt_thread_join(void* p) {
+    pt_thread_t* t = (pt_thread_t*)p;
+    pthread_join(t->handle, NULL);
+    free(t);
+}
+
+static tqdb_thread_ops_t PT_THREAD = { pt_thread_start, pt_thread_join };
+
+/* Allocator that counts calls */
+static size_t s_alloc_calls;
+
+static void* counting_malloc(size_t size) {
+    s_alloc_calls++;
+    return malloc(size);
+}
+
+static tqdb_alloc_t COUNTING_ALLOC = { counting_malloc, free, NULL };
+
+/* Counts allocator calls made off the thread that set s_alloc_owner */
+static pthread_t s_alloc_owner;
+static size_t s_foreign_allocs;
+
+static void* owner_malloc(size_t size) {
+    if (!pthread_equal(pthread_self(), s_alloc_owner)) s_foreign_allocs++;
+    return malloc(size);
+}
+
+static void owner_free(void* ptr) {
+    if (!pthread_equal(pthread_self(), s_alloc_owner)) s_foreign_allocs++;
+    free(ptr);
 }
 
+static tqdb_alloc_t OWNER_ALLOC = { owner_malloc, owner_free, NULL };
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Tests
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -727,49 +823,231 @@ static bool test_wal_auto_checkpoint(void) {
     return true;
 }
 
+typedef struct {
+    uint32_t last_id;
+    int count;
+    bool sorted;
+} order_check_t;
+
+static bool order_callback(const void* entity, void* ctx) {
+    const test_item_t* item = (const test_item_t*)entity;
+    order_check_t* oc = (order_check_t*)ctx;
+    if (item->id <= oc->last_id) oc->sorted = false;
+    oc->last_id = item->id;
+    oc->count++;
+    return true;
+}
+
+static bool test_wal_checkpoint_spill(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 100000,
+        .wal_max_size = 100000000,
+        .checkpoint_mem_budget = 1024  /* Forces many spilled runs */
+    };
+
+    tqdb_open(&cfg, &db);
+    tqdb_register(db, &ITEM_TRAIT);
+
+    /* Seed main DB so the merge has something to join against */
+    test_item_t item;
+    for (int i = 0; i < 100; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        tqdb_add(db, "Item", &item);
+    }
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+
+    /* Add, update twice and delete every third, all in one WAL */
+    for (int i = 100; i < 500; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        tqdb_add(db, "Item", &item);
+    }
+    for (int pass = 1; pass <= 2; pass++) {
+        for (uint32_t id = 1; id <= 500; id++) {
+            item.id = id;
+            snprintf(item.name, sizeof(item.name), "Item %u", (unsigned)id);
+            item.value = (int32_t)(id * 10 + pass);
+            tqdb_update(db, "Item", id, &item);
+        }
+    }
+    for (uint32_t id = 3; id <= 500; id += 3) {
+        tqdb_delete(db, "Item", id);
+    }
+
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+
+    /* Spill file is cleaned up */
+    FILE* spill = fopen(TEST_DB_PATH ".spill", "rb");
+    ASSERT(spill == NULL);
+
+    ASSERT(tqdb_count(db, "Item") == 500 - 166);
+
+    test_item_t retrieved;
+    ASSERT(tqdb_get(db, "Item", 250, &retrieved) == TQDB_OK);
+    ASSERT(retrieved.value == 2502);
+    ASSERT(tqdb_get(db, "Item", 7, &retrieved) == TQDB_OK);
+    ASSERT(retrieved.value == 72);
+    ASSERT(tqdb_get(db, "Item", 9, &retrieved) == TQDB_ERR_NOT_FOUND);
+
+    /* Checkpoint output is ID-sorted */
+    order_check_t oc = { 0, 0, true };
+    tqdb_foreach(db, "Item", order_callback, &oc);
+    ASSERT(oc.sorted);
+    ASSERT(oc.count == 500 - 166);
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_wal_ids_after_reopen(void) {
+    cleanup();
+
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH
+    };
+
+    /* Add then update in the same WAL, close (checkpoint) */
+    {
+        tqdb_t db;
+        tqdb_open(&cfg, &db);
+        tqdb_register(db, &ITEM_TRAIT);
+
+        test_item_t item = { .id = 0, .name = "First", .value = 1 };
+        tqdb_add(db, "Item", &item);
+        item.value = 2;
+        tqdb_update(db, "Item", item.id, &item);
+
+        tqdb_close(db);
+    }
+
+    /* New IDs continue after existing ones */
+    {
+        tqdb_t db;
+        tqdb_open(&cfg, &db);
+        tqdb_register(db, &ITEM_TRAIT);
+
+        test_item_t retrieved;
+        ASSERT(tqdb_get(db, "Item", 1, &retrieved) == TQDB_OK);
+        ASSERT(retrieved.value == 2);
+
+        test_item_t item = { .id = 0, .name = "Second", .value = 3 };
+        tqdb_add(db, "Item", &item);
+        ASSERT(item.id == 2);
+        ASSERT(tqdb_count(db, "Item") == 2);
+
+        tqdb_close(db);
+    }
+
+    return true;
+}
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Cache Tests
  * ═══════════════════════════════════════════════════════════════════════════ */
 
-static bool test_cache_basic(void) {
+
+static bool test_wal_background_checkpoint(void) {
     cleanup();
 
-    tqdb_t db;
     tqdb_config_t cfg = {
         .db_path = TEST_DB_PATH,
-        .enable_cache = true,
-        .cache_size = 8
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 20,
+        .mutex = &PT_MUTEX,
+        .thread = &PT_THREAD,
+        .background_checkpoint = true
     };
 
-    tqdb_err_t err = tqdb_open(&cfg, &db);
-    ASSERT(err == TQDB_OK);
+    {
+        tqdb_t db;
+        ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+        tqdb_register(db, &ITEM_TRAIT);
 
-    tqdb_register(db, &ITEM_TRAIT);
+        /* Writes keep landing while workers merge frozen segments */
+        test_item_t item;
+        for (int i = 0; i < 300; i++) {
+            item.id = 0;
+            snprintf(item.name, sizeof(item.name), "Item %d", i);
+            item.value = i;
+            ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+            if (i % 3 == 2) {
+                item.value = i * 10;
+                ASSERT(tqdb_update(db, "Item", item.id, &item) == TQDB_OK);
+            }
+
+            /* Every item is readable whichever segment holds it */
+            test_item_t retrieved;
+            uint32_t probe = item.id / 2 + 1;
+            ASSERT(tqdb_get(db, "Item", probe, &retrieved) == TQDB_OK);
+            ASSERT(retrieved.id == probe);
+        }
+        ASSERT(tqdb_delete(db, "Item", 5) == TQDB_OK);
+
+        ASSERT(tqdb_count(db, "Item") == 299);
+        test_item_t retrieved;
+        ASSERT(tqdb_get(db, "Item", 3, &retrieved) == TQDB_OK);
+        ASSERT(retrieved.value == 20);
+        ASSERT(tqdb_get(db, "Item", 5, &retrieved) == TQDB_ERR_NOT_FOUND);
 
-    /* Add an item */
-    test_item_t item = { .id = 0, .name = "Cached Item", .value = 42 };
-    tqdb_add(db, "Item", &item);
-    uint32_t item_id = item.id;
+        order_check_t oc = { 0, 0, true };
+        tqdb_foreach(db, "Item", order_callback, &oc);
+        ASSERT(oc.count == 299);
 
-    /* First get - cache miss */
-    test_item_t retrieved;
-    tqdb_get(db, "Item", item_id, &retrieved);
-    ASSERT(retrieved.value == 42);
+        tqdb_close(db);
+    }
 
-    /* Second get - should be cache hit */
-    tqdb_get(db, "Item", item_id, &retrieved);
-    ASSERT(retrieved.value == 42);
+    /* Close drains the worker and both segments */
+    FILE* frozen = fopen(TEST_WAL_PATH ".1", "rb");
+    ASSERT(frozen == NULL);
+    FILE* ckpt = fopen(TEST_DB_PATH ".ckpt", "rb");
+    ASSERT(ckpt == NULL);
 
-    /* Check cache stats */
-    size_t hits, misses;
-    tqdb_cache_stats(db, &hits, &misses);
-    ASSERT(hits >= 1);  /* At least one hit */
+    {
+        tqdb_t db;
+        ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+        tqdb_register(db, &ITEM_TRAIT);
+
+        size_t entries;
+        tqdb_wal_stats(db, &entries, NULL);
+        ASSERT(entries == 0);
+        ASSERT(tqdb_count(db, "Item") == 299);
+
+        test_item_t retrieved;
+        ASSERT(tqdb_get(db, "Item", 300, &retrieved) == TQDB_OK);
+        ASSERT(retrieved.value == 2990);
+
+        order_check_t oc = { 0, 0, true };
+        tqdb_foreach(db, "Item", order_callback, &oc);
+        ASSERT(oc.sorted);
+        ASSERT(oc.count == 299);
+
+        tqdb_close(db);
+    }
 
-    tqdb_close(db);
     return true;
 }
 
-static bool test_cache_with_wal(void) {
+
+static uint32_t fake_now_us = 0;
+
+static uint32_t fake_clock_us(void) {
+    fake_now_us += 100;  /* Every reading costs 100 us */
+    return fake_now_us;
+}
+
+static bool test_wal_checkpoint_step(void) {
     cleanup();
 
     tqdb_t db;
@@ -777,84 +1055,2251 @@ static bool test_cache_with_wal(void) {
         .db_path = TEST_DB_PATH,
         .enable_wal = true,
         .wal_path = TEST_WAL_PATH,
-        .enable_cache = true,
-        .cache_size = 16
+        .wal_max_entries = 100000,
+        .wal_max_size = 100000000,
+        .checkpoint_mem_budget = 1024
     };
 
     tqdb_open(&cfg, &db);
     tqdb_register(db, &ITEM_TRAIT);
 
-    /* Add items (goes to WAL, should also populate cache) */
     test_item_t item;
-    uint32_t ids[5];
-    for (int i = 0; i < 5; i++) {
+    for (int i = 0; i < 200; i++) {
         item.id = 0;
         snprintf(item.name, sizeof(item.name), "Item %d", i);
-        item.value = i * 100;
+        item.value = i;
         tqdb_add(db, "Item", &item);
-        ids[i] = item.id;
     }
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+    for (uint32_t id = 1; id <= 200; id += 2) {
+        item.id = id;
+        snprintf(item.name, sizeof(item.name), "Item %u", (unsigned)id);
+        item.value = -(int32_t)id;
+        tqdb_update(db, "Item", id, &item);
+    }
+    tqdb_delete(db, "Item", 10);
 
-    /* Get items - should be cache hits since WAL append updates cache */
-    test_item_t retrieved;
-    for (int i = 0; i < 5; i++) {
-        tqdb_err_t err = tqdb_get(db, "Item", ids[i], &retrieved);
-        ASSERT(err == TQDB_OK);
-        ASSERT(retrieved.value == i * 100);
+    /* Byte budget: many small steps, interleaved with reads and writes */
+    bool done = false;
+    int steps = 0;
+    while (!done) {
+        ASSERT(tqdb_checkpoint_step(db, 512, &done) == TQDB_OK);
+        steps++;
+
+        test_item_t retrieved;
+        ASSERT(tqdb_get(db, "Item", 11, &retrieved) == TQDB_OK);
+        ASSERT(retrieved.value == -11);
+        ASSERT(tqdb_get(db, "Item", 10, &retrieved) == TQDB_ERR_NOT_FOUND);
+
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Step %d", steps);
+        item.value = 1000 + steps;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+        ASSERT(steps < 1000);
     }
+    ASSERT(steps > 2);
+    ASSERT(tqdb_count(db, "Item") == (size_t)(199 + steps));
 
-    /* Check stats - should have cache hits */
-    size_t hits, misses;
-    tqdb_cache_stats(db, &hits, &misses);
-    ASSERT(hits >= 5);
+    FILE* frozen = fopen(TEST_WAL_PATH ".1", "rb");
+    ASSERT(frozen == NULL);
 
-    /* Update an item */
-    tqdb_get(db, "Item", ids[2], &retrieved);
-    retrieved.value = 999;
-    tqdb_update(db, "Item", ids[2], &retrieved);
+    /* Only the entries written between steps are left */
+    size_t entries;
+    tqdb_wal_stats(db, &entries, NULL);
+    ASSERT(entries == (size_t)steps);
+    tqdb_close(db);
 
-    /* Get updated value - should reflect update in cache */
-    tqdb_get(db, "Item", ids[2], &retrieved);
-    ASSERT(retrieved.value == 999);
+    /* Time budget via the clock hook */
+    cfg.clock_us = fake_clock_us;
+    tqdb_open(&cfg, &db);
+    tqdb_register(db, &ITEM_TRAIT);
+    for (uint32_t id = 1; id <= 200; id++) {
+        item.id = id;
+        snprintf(item.name, sizeof(item.name), "Item %u", (unsigned)id);
+        item.value = (int32_t)id * 3;
+        tqdb_update(db, "Item", id, &item);
+    }
+
+    done = false;
+    steps = 0;
+    while (!done && steps < 1000) {
+        ASSERT(tqdb_checkpoint_step(db, 1000, &done) == TQDB_OK);
+        steps++;
+    }
+    ASSERT(done);
+    ASSERT(steps > 2);
+
+    /* Nothing pending: a step is immediately done */
+    ASSERT(tqdb_checkpoint_step(db, 1000, &done) == TQDB_OK);
+    ASSERT(done);
+
+    test_item_t retrieved;
+    ASSERT(tqdb_get(db, "Item", 150, &retrieved) == TQDB_OK);
+    ASSERT(retrieved.value == 450);
+    ASSERT(tqdb_get(db, "Item", 10, &retrieved) == TQDB_ERR_NOT_FOUND);
+
+    order_check_t oc = { 0, 0, true };
+    tqdb_foreach(db, "Item", order_callback, &oc);
+    ASSERT(oc.sorted);
 
     tqdb_close(db);
     return true;
 }
 
-static bool test_cache_clear(void) {
+
+static bool test_wal_adaptive_checkpoint(void) {
     cleanup();
 
     tqdb_t db;
     tqdb_config_t cfg = {
         .db_path = TEST_DB_PATH,
-        .enable_cache = true,
-        .cache_size = 8
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 10,  /* Ignored by the adaptive policy */
+        .checkpoint_policy = TQDB_CHECKPOINT_ADAPTIVE
     };
 
     tqdb_open(&cfg, &db);
     tqdb_register(db, &ITEM_TRAIT);
 
-    test_item_t item = { .id = 0, .name = "Item", .value = 1 };
-    tqdb_add(db, "Item", &item);
-    uint32_t item_id = item.id;
+    /* Write-heavy: with nobody reading, the WAL is left to grow */
+    test_item_t item;
+    for (int i = 0; i < 300; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        tqdb_add(db, "Item", &item);
+    }
+    size_t entries;
+    tqdb_wal_stats(db, &entries, NULL);
+    ASSERT(entries == 300);
+
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+    for (uint32_t id = 1; id <= 20; id++) {
+        item.id = id;
+        snprintf(item.name, sizeof(item.name), "Item %u", (unsigned)id);
+        item.value = -(int32_t)id;
+        tqdb_update(db, "Item", id, &item);
+    }
 
-    /* Get to populate cache */
+    /* Read-heavy: a few scans are cheaper than rewriting the main file */
     test_item_t retrieved;
-    tqdb_get(db, "Item", item_id, &retrieved);
-    tqdb_get(db, "Item", item_id, &retrieved);
+    for (int i = 0; i < 3; i++) {
+        ASSERT(tqdb_get(db, "Item", 250, &retrieved) == TQDB_OK);
+    }
+    tqdb_wal_stats(db, &entries, NULL);
+    ASSERT(entries > 0);
+
+    /* ...but enough of them pay for a checkpoint */
+    int reads = 0;
+    while (entries > 0 && reads < 200) {
+        ASSERT(tqdb_get(db, "Item", 250, &retrieved) == TQDB_OK);
+        tqdb_wal_stats(db, &entries, NULL);
+        reads++;
+    }
+    ASSERT(entries == 0);
+    ASSERT(reads < 200);
+
+    ASSERT(tqdb_get(db, "Item", 7, &retrieved) == TQDB_OK);
+    ASSERT(retrieved.value == -7);
+    ASSERT(tqdb_count(db, "Item") == 300);
+
+    /* Appends after the first estimate add to the rewrite cost */
+    FILE* main_file = fopen(TEST_DB_PATH, "rb");
+    ASSERT(main_file != NULL);
+    fseek(main_file, 0, SEEK_END);
+    size_t main_size = (size_t)ftell(main_file);
+    fclose(main_file);
+
+    item.id = 1;
+    ASSERT(tqdb_update(db, "Item", 1, &item) == TQDB_OK);
+    for (int i = 0; i < 3; i++) {
+        ASSERT(tqdb_get(db, "Item", 250, &retrieved) == TQDB_OK);  /* Estimated here */
+    }
+    size_t wal_size = 0;
+    while (wal_size < 4 * main_size) {  /* New keys: nothing to compact */
+        item.id = 0;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+        tqdb_wal_stats(db, &entries, &wal_size);
+    }
 
-    size_t hits_before;
-    tqdb_cache_stats(db, &hits_before, NULL);
-    ASSERT(hits_before >= 1);
+    /* A WAL scan now outweighs the main file term alone, not the whole rewrite */
+    for (int i = 0; i < 2; i++) {
+        ASSERT(tqdb_get(db, "Item", 250, &retrieved) == TQDB_OK);
+    }
+    tqdb_wal_stats(db, &entries, NULL);
+    ASSERT(entries > 0);
 
-    /* Clear cache */
-    tqdb_cache_clear(db);
+    tqdb_close(db);
+    return true;
+}
 
-    /* Stats should be reset */
-    size_t hits_after, misses_after;
-    tqdb_cache_stats(db, &hits_after, &misses_after);
-    ASSERT(hits_after == 0);
-    ASSERT(misses_after == 0);
+
+#include <sys/stat.h>
+
+static bool test_wal_compaction(void) {
+    cleanup();
+
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 20
+    };
+
+    {
+        tqdb_t db;
+        tqdb_open(&cfg, &db);
+        tqdb_register(db, &ITEM_TRAIT);
+
+        test_item_t item;
+        for (int i = 0; i < 5; i++) {
+            item.id = 0;
+            snprintf(item.name, sizeof(item.name), "Item %d", i);
+            item.value = i;
+            tqdb_add(db, "Item", &item);
+        }
+
+        /* A hot entity: the WAL is compacted instead of checkpointed */
+        for (int i = 0; i < 200; i++) {
+            item.id = 1;
+            snprintf(item.name, sizeof(item.name), "Hot");
+            item.value = i;
+            ASSERT(tqdb_update(db, "Item", 1, &item) == TQDB_OK);
+        }
+        FILE* main_file = fopen(TEST_DB_PATH, "rb");
+        ASSERT(main_file == NULL);
+
+        size_t entries;
+        tqdb_wal_stats(db, &entries, NULL);
+        ASSERT(entries < 20);
+
+        test_item_t retrieved;
+        ASSERT(tqdb_get(db, "Item", 1, &retrieved) == TQDB_OK);
+        ASSERT(retrieved.value == 199);
+        ASSERT(tqdb_count(db, "Item") == 5);
+
+        /* Added then deleted within the WAL: both records go */
+        ASSERT(tqdb_delete(db, "Item", 5) == TQDB_OK);
+        ASSERT(tqdb_wal_compact(db) == TQDB_OK);
+        tqdb_wal_stats(db, &entries, NULL);
+        ASSERT(entries == 4);
+        ASSERT(tqdb_count(db, "Item") == 4);
+        ASSERT(tqdb_get(db, "Item", 5, &retrieved) == TQDB_ERR_NOT_FOUND);
+
+        tqdb_close(db);
+    }
+
+    {
+        tqdb_t db;
+        tqdb_open(&cfg, &db);
+        tqdb_register(db, &ITEM_TRAIT);
+
+        test_item_t retrieved;
+        ASSERT(tqdb_get(db, "Item", 1, &retrieved) == TQDB_OK);
+        ASSERT(retrieved.value == 199);
+        ASSERT(strcmp(retrieved.name, "Hot") == 0);
+        ASSERT(tqdb_get(db, "Item", 4, &retrieved) == TQDB_OK);
+        ASSERT(retrieved.value == 3);
+        ASSERT(tqdb_count(db, "Item") == 4);
+
+        tqdb_close(db);
+    }
+
+    /* Unique keys supersede nothing: the threshold checkpoints, never compacts */
+    {
+        cleanup();
+        cfg.wal_max_entries = 2000;
+        cfg.wal_max_size = 1024 * 1024;
+
+        tqdb_t db;
+        tqdb_open(&cfg, &db);
+        tqdb_register(db, &ITEM_TRAIT);
+        mkdir(TEST_WAL_PATH ".new", 0755);  /* A compaction could not write its file */
+
+        test_item_t item;
+        for (int i = 0; i < 3000; i++) {
+            item.id = 0;
+            snprintf(item.name, sizeof(item.name), "Unique %d", i);
+            item.value = i;
+            ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+        }
+
+        size_t entries;
+        tqdb_wal_stats(db, &entries, NULL);
+        ASSERT(entries == 1000);
+        ASSERT(tqdb_count(db, "Item") == 3000);
+
+        tqdb_close(db);
+        cleanup();
+    }
+
+    return true;
+}
+
+/* Wide entity with a field-level WAL delta */
+#define GAUGE_FIELDS 32
+#define GAUGE_MAX_PATCH 8
+
+typedef struct {
+    uint32_t id;
+    int32_t fields[GAUGE_FIELDS];
+} test_gauge_t;
+
+static void gauge_write(tqdb_writer_t* w, const void* e) {
+    const test_gauge_t* g = (const test_gauge_t*)e;
+    tqdb_write_u32(w, g->id);
+    for (int i = 0; i < GAUGE_FIELDS; i++) tqdb_write_i32(w, g->fields[i]);
+}
+
+static void gauge_read(tqdb_reader_t* r, void* e) {
+    test_gauge_t* g = (test_gauge_t*)e;
+    g->id = tqdb_read_u32(r);
+    for (int i = 0; i < GAUGE_FIELDS; i++) g->fields[i] = tqdb_read_i32(r);
+}
+
+static uint32_t gauge_get_id(const void* e) {
+    return ((const test_gauge_t*)e)->id;
+}
+
+static void gauge_set_id(void* e, uint32_t id) {
+    ((test_gauge_t*)e)->id = id;
+}
+
+static bool gauge_diff(tqdb_writer_t* w, const void* base, const void* entity) {
+    const test_gauge_t* a = (const test_gauge_t*)base;
+    const test_gauge_t* b = (const test_gauge_t*)entity;
+    uint8_t changed = 0;
+    for (int i = 0; i < GAUGE_FIELDS; i++) changed += a->fields[i] != b->fields[i];
+    if (changed > GAUGE_MAX_PATCH) return false;
+
+    tqdb_write_u8(w, changed);
+    for (int i = 0; i < GAUGE_FIELDS; i++) {
+        if (a->fields[i] == b->fields[i]) continue;
+        tqdb_write_u8(w, (uint8_t)i);
+        tqdb_write_i32(w, b->fields[i]);
+    }
+    return true;
+}
+
+static void gauge_patch(tqdb_reader_t* r, void* e) {
+    test_gauge_t* g = (test_gauge_t*)e;
+    uint8_t changed = tqdb_read_u8(r);
+    for (uint8_t i = 0; i < changed && !tqdb_read_error(r); i++) {
+        uint8_t field = tqdb_read_u8(r);
+        int32_t value = tqdb_read_i32(r);
+        if (field < GAUGE_FIELDS) g->fields[field] = value;
+    }
+}
+
+/* Merge operand: add delta to one field */
+typedef struct {
+    uint8_t field;
+    int32_t delta;
+} gauge_add_t;
+
+static void gauge_merge_write(tqdb_writer_t* w, const void* operand) {
+    const gauge_add_t* op = (const gauge_add_t*)operand;
+    tqdb_write_u8(w, op->field);
+    tqdb_write_i32(w, op->delta);
+}
+
+static void gauge_merge(tqdb_reader_t* r, void* e) {
+    test_gauge_t* g = (test_gauge_t*)e;
+    uint8_t field = tqdb_read_u8(r);
+    int32_t delta = tqdb_read_i32(r);
+    if (field < GAUGE_FIELDS) g->fields[field] += delta;
+}
+
+static const tqdb_trait_t GAUGE_TRAIT = {
+    .name = "Gauge",
+    .max_count = 1000,
+    .struct_size = sizeof(test_gauge_t),
+    .write = gauge_write,
+    .read = gauge_read,
+    .get_id = gauge_get_id,
+    .set_id = gauge_set_id,
+    .diff = gauge_diff,
+    .patch = gauge_patch,
+    .merge_write = gauge_merge_write,
+    .merge = gauge_merge
+};
+
+static bool gauge_sum_fn(const void* entity, void* ctx) {
+    const test_gauge_t* g = (const test_gauge_t*)entity;
+    for (int i = 0; i < GAUGE_FIELDS; i++) *(int64_t*)ctx += g->fields[i];
+    return true;
+}
+
+static bool check_gauges(tqdb_t db) {
+    test_gauge_t g;
+    ASSERT(tqdb_get(db, "Gauge", 1, &g) == TQDB_OK);
+    ASSERT(g.fields[0] == 99 && g.fields[1] == 1);
+    ASSERT(tqdb_get(db, "Gauge", 2, &g) == TQDB_OK);
+    ASSERT(g.fields[3] == 1);   /* Reverted to the base value */
+    ASSERT(tqdb_get(db, "Gauge", 3, &g) == TQDB_OK);
+    ASSERT(g.fields[0] == 1000 && g.fields[31] == 5);
+    ASSERT(tqdb_count(db, "Gauge") == 3);
+
+    int64_t sum = 0;
+    ASSERT(tqdb_foreach(db, "Gauge", gauge_sum_fn, &sum) == TQDB_OK);
+    ASSERT(sum == (99 + 31) + 32 + (1000 + 5 + 30 * 100));
+    return true;
+}
+
+static bool test_wal_patch_records(void) {
+    cleanup();
+
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 1000
+    };
+
+    tqdb_t db;
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &GAUGE_TRAIT);
+
+    test_gauge_t g = {0};
+    for (int i = 0; i < GAUGE_FIELDS; i++) g.fields[i] = 1;
+    for (int i = 0; i < 3; i++) {
+        g.id = 0;
+        ASSERT(tqdb_add(db, "Gauge", &g) == TQDB_OK);
+    }
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+
+    /* One field per update: each record carries a few bytes, not the entity */
+    size_t before;
+    tqdb_wal_stats(db, NULL, &before);
+    for (int i = 0; i < 100; i++) {
+        g.id = 1;
+        g.fields[0] = i;
+        ASSERT(tqdb_update(db, "Gauge", 1, &g) == TQDB_OK);
+    }
+    size_t after;
+    tqdb_wal_stats(db, NULL, &after);
+    ASSERT(after - before < 100 * 32);  /* A full image record is 146 bytes */
+
+    /* A field changed and changed back must not stick */
+    for (int i = 0; i < GAUGE_FIELDS; i++) g.fields[i] = 1;
+    g.id = 2;
+    g.fields[3] = 7;
+    ASSERT(tqdb_update(db, "Gauge", 2, &g) == TQDB_OK);
+    g.fields[3] = 1;
+    ASSERT(tqdb_update(db, "Gauge", 2, &g) == TQDB_OK);
+
+    /* Too many changes log a full image; later patches build on it */
+    g.id = 3;
+    for (int i = 0; i < GAUGE_FIELDS; i++) g.fields[i] = 100;
+    ASSERT(tqdb_update(db, "Gauge", 3, &g) == TQDB_OK);
+    g.fields[0] = 1000;
+    g.fields[31] = 5;
+    ASSERT(tqdb_update(db, "Gauge", 3, &g) == TQDB_OK);
+
+    ASSERT(tqdb_update(db, "Gauge", 9, &g) == TQDB_ERR_NOT_FOUND);
+
+    /* Still a patch against the main file image */
+    g.id = 1;
+    for (int i = 0; i < GAUGE_FIELDS; i++) g.fields[i] = 1;
+    g.fields[0] = 99;
+    ASSERT(tqdb_update(db, "Gauge", 1, &g) == TQDB_OK);
+
+    ASSERT(check_gauges(db));
+    ASSERT(tqdb_wal_compact(db) == TQDB_OK);
+    ASSERT(check_gauges(db));
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+    ASSERT(check_gauges(db));
+    tqdb_close(db);
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &GAUGE_TRAIT);
+    ASSERT(check_gauges(db));
+    tqdb_close(db);
+
+    /* Patches straddling a frozen segment: fields flip back and forth */
+    cleanup();
+    cfg.wal_max_entries = 5;
+    cfg.mutex = &PT_MUTEX;
+    cfg.thread = &PT_THREAD;
+    cfg.background_checkpoint = true;
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &GAUGE_TRAIT);
+
+    test_gauge_t model = {0};
+    ASSERT(tqdb_add(db, "Gauge", &model) == TQDB_OK);
+    for (int i = 0; i < 200; i++) {
+        model.fields[i % 4] = (i / 4) % 2 ? i : 0;
+        ASSERT(tqdb_update(db, "Gauge", model.id, &model) == TQDB_OK);
+        ASSERT(tqdb_get(db, "Gauge", model.id, &g) == TQDB_OK);
+        ASSERT(memcmp(&g, &model, sizeof(g)) == 0);
+    }
+    tqdb_close(db);
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &GAUGE_TRAIT);
+    ASSERT(tqdb_get(db, "Gauge", model.id, &g) == TQDB_OK);
+    ASSERT(memcmp(&g, &model, sizeof(g)) == 0);
+    tqdb_close(db);
+    return true;
+}
+
+/* Counter entity with several merge operators */
+#define COUNTER_RECENT 4
+
+typedef struct {
+    uint32_t id;
+    int32_t total;
+    int32_t peak;
+    uint8_t recent_count;
+    uint32_t recent[COUNTER_RECENT];
+} test_counter_t;
+
+enum { COUNTER_ADD, COUNTER_MAX, COUNTER_PUSH };
+
+typedef struct {
+    uint8_t kind;
+    int32_t value;
+} counter_op_t;
+
+static void counter_write(tqdb_writer_t* w, const void* e) {
+    const test_counter_t* c = (const test_counter_t*)e;
+    tqdb_write_u32(w, c->id);
+    tqdb_write_i32(w, c->total);
+    tqdb_write_i32(w, c->peak);
+    tqdb_write_u8(w, c->recent_count);
+    for (int i = 0; i < c->recent_count; i++) tqdb_write_u32(w, c->recent[i]);
+}
+
+static void counter_read(tqdb_reader_t* r, void* e) {
+    test_counter_t* c = (test_counter_t*)e;
+    c->id = tqdb_read_u32(r);
+    c->total = tqdb_read_i32(r);
+    c->peak = tqdb_read_i32(r);
+    c->recent_count = tqdb_read_u8(r);
+    if (c->recent_count > COUNTER_RECENT) c->recent_count = COUNTER_RECENT;
+    for (int i = 0; i < c->recent_count; i++) c->recent[i] = tqdb_read_u32(r);
+}
+
+static uint32_t counter_get_id(const void* e) {
+    return ((const test_counter_t*)e)->id;
+}
+
+static void counter_set_id(void* e, uint32_t id) {
+    ((test_counter_t*)e)->id = id;
+}
+
+static void counter_init(void* e) {
+    memset(e, 0, sizeof(test_counter_t));
+}
+
+static void counter_merge_write(tqdb_writer_t* w, const void* operand) {
+    const counter_op_t* op = (const counter_op_t*)operand;
+    tqdb_write_u8(w, op->kind);
+    tqdb_write_i32(w, op->value);
+}
+
+static void counter_merge(tqdb_reader_t* r, void* e) {
+    test_counter_t* c = (test_counter_t*)e;
+    uint8_t kind = tqdb_read_u8(r);
+    int32_t value = tqdb_read_i32(r);
+    switch (kind) {
+    case COUNTER_ADD:
+        c->total += value;
+        break;
+    case COUNTER_MAX:
+        if (value > c->peak) c->peak = value;
+        break;
+    case COUNTER_PUSH:
+        /* Bounded list: keep the newest entries */
+        if (c->recent_count == COUNTER_RECENT) {
+            memmove(c->recent, c->recent + 1, (COUNTER_RECENT - 1) * sizeof(uint32_t));
+            c->recent_count--;
+        }
+        c->recent[c->recent_count++] = (uint32_t)value;
+        break;
+    }
+}
+
+static const tqdb_trait_t COUNTER_TRAIT = {
+    .name = "Counter",
+    .max_count = 1000,
+    .struct_size = sizeof(test_counter_t),
+    .write = counter_write,
+    .read = counter_read,
+    .get_id = counter_get_id,
+    .set_id = counter_set_id,
+    .init = counter_init,
+    .merge_write = counter_merge_write,
+    .merge = counter_merge
+};
+
+static bool counter_total_fn(const void* entity, void* ctx) {
+    *(int64_t*)ctx += ((const test_counter_t*)entity)->total;
+    return true;
+}
+
+static bool check_counters(tqdb_t db) {
+    test_counter_t c;
+    ASSERT(tqdb_get(db, "Counter", 1, &c) == TQDB_OK);
+    ASSERT(c.total == 1000 + 5 + 45 && c.peak == 49);
+    ASSERT(c.recent_count == COUNTER_RECENT && c.recent[0] == 46 && c.recent[3] == 49);
+    ASSERT(tqdb_get(db, "Counter", 2, &c) == TQDB_ERR_NOT_FOUND);
+    ASSERT(tqdb_get(db, "Counter", 3, &c) == TQDB_OK);
+    ASSERT(c.total == 7);
+    ASSERT(tqdb_get(db, "Counter", 99, &c) == TQDB_ERR_NOT_FOUND);
+    ASSERT(tqdb_count(db, "Counter") == 2);
+
+    int64_t total = 0;
+    ASSERT(tqdb_foreach(db, "Counter", counter_total_fn, &total) == TQDB_OK);
+    ASSERT(total == 1050 + 7);
+
+    test_gauge_t g;
+    ASSERT(tqdb_get(db, "Gauge", 1, &g) == TQDB_OK);
+    ASSERT(g.fields[0] == 2 && g.fields[1] == 22 && g.fields[2] == 0);
+    return true;
+}
+
+static bool test_wal_merge_operators(void) {
+    cleanup();
+
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 1000,
+        .checkpoint_mem_budget = 1024  /* Operands span spilled runs */
+    };
+
+    tqdb_t db;
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &COUNTER_TRAIT);
+    tqdb_register(db, &GAUGE_TRAIT);
+
+    test_counter_t c = {0};
+    for (int i = 0; i < 2; i++) {
+        c.id = 0;
+        ASSERT(tqdb_add(db, "Counter", &c) == TQDB_OK);
+    }
+    test_gauge_t g = {0};
+    ASSERT(tqdb_add(db, "Gauge", &g) == TQDB_OK);
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+
+    /* Blind writes: no lookups, folded on read */
+    counter_op_t op = { COUNTER_ADD, 10 };
+    for (int i = 0; i < 100; i++) ASSERT(tqdb_merge(db, "Counter", 1, &op) == TQDB_OK);
+    ASSERT(tqdb_get(db, "Counter", 1, &c) == TQDB_OK);
+    ASSERT(c.total == 1000);
+
+    /* A full update, then more operands on top of it */
+    c.total = 1000;
+    ASSERT(tqdb_update(db, "Counter", 1, &c) == TQDB_OK);
+    op.value = 5;
+    ASSERT(tqdb_merge(db, "Counter", 1, &op) == TQDB_OK);
+    for (int i = 0; i < 50; i++) {
+        counter_op_t ops[3] = { { COUNTER_ADD, i >= 40 }, { COUNTER_MAX, i }, { COUNTER_PUSH, i } };
+        for (int k = 0; k < 3; k++) ASSERT(tqdb_merge(db, "Counter", 1, &ops[k]) == TQDB_OK);
+    }
+    op.value = 40;  /* Net +35 with the next one */
+    ASSERT(tqdb_merge(db, "Counter", 1, &op) == TQDB_OK);
+    op.value = -5;
+    ASSERT(tqdb_merge(db, "Counter", 1, &op) == TQDB_OK);
+
+    /* Deleted, missing and added-in-WAL targets */
+    ASSERT(tqdb_delete(db, "Counter", 2) == TQDB_OK);
+    op.value = 1;
+    ASSERT(tqdb_merge(db, "Counter", 2, &op) == TQDB_OK);
+    ASSERT(tqdb_merge(db, "Counter", 99, &op) == TQDB_OK);
+    c.id = 0;
+    c.total = 0;
+    ASSERT(tqdb_add(db, "Counter", &c) == TQDB_OK);
+    op.value = 7;
+    ASSERT(tqdb_merge(db, "Counter", c.id, &op) == TQDB_OK);
+    ASSERT(!tqdb_exists(db, "Counter", 99));
+
+    /* An update after an operand logs a full image, later ones patch it */
+    gauge_add_t add = { 0, 10 };
+    ASSERT(tqdb_merge(db, "Gauge", 1, &add) == TQDB_OK);
+    ASSERT(tqdb_get(db, "Gauge", 1, &g) == TQDB_OK);
+    ASSERT(g.fields[0] == 10);
+    g.fields[0] = 0;  /* Back to the base value: a patch would miss it */
+    g.fields[1] = 20;
+    ASSERT(tqdb_update(db, "Gauge", 1, &g) == TQDB_OK);
+    g.fields[2] = 3;
+    ASSERT(tqdb_update(db, "Gauge", 1, &g) == TQDB_OK);
+    g.fields[2] = 0;
+    ASSERT(tqdb_update(db, "Gauge", 1, &g) == TQDB_OK);
+    add.delta = 2;
+    ASSERT(tqdb_merge(db, "Gauge", 1, &add) == TQDB_OK);
+    add.field = 1;
+    ASSERT(tqdb_merge(db, "Gauge", 1, &add) == TQDB_OK);
+
+    ASSERT(check_counters(db));
+    ASSERT(tqdb_wal_compact(db) == TQDB_OK);
+    ASSERT(check_counters(db));
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+    ASSERT(check_counters(db));
+    tqdb_close(db);
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &COUNTER_TRAIT);
+    tqdb_register(db, &GAUGE_TRAIT);
+    ASSERT(check_counters(db));
+    tqdb_close(db);
+
+    /* Without a WAL the operand is applied at once */
+    cleanup();
+    tqdb_config_t plain = { .db_path = TEST_DB_PATH };
+    ASSERT(tqdb_open(&plain, &db) == TQDB_OK);
+    tqdb_register(db, &COUNTER_TRAIT);
+    c.id = 0;
+    c.total = 1;
+    ASSERT(tqdb_add(db, "Counter", &c) == TQDB_OK);
+    op.value = 2;
+    ASSERT(tqdb_merge(db, "Counter", c.id, &op) == TQDB_OK);
+    ASSERT(tqdb_merge(db, "Counter", 42, &op) == TQDB_ERR_NOT_FOUND);
+    ASSERT(tqdb_merge(db, "Counter", c.id, NULL) == TQDB_ERR_INVALID_ARG);
+    ASSERT(tqdb_get(db, "Counter", c.id, &c) == TQDB_OK);
+    ASSERT(c.total == 3);
+    tqdb_close(db);
+    return true;
+}
+
+/* Change feed collector */
+#define FEED_MAX 16
+
+typedef struct {
+    uint32_t ids[FEED_MAX];
+    uint64_t lsns[FEED_MAX];
+    int32_t values[FEED_MAX];  /* -1 = deleted */
+    size_t count;
+} feed_t;
+
+static bool collect_change(const char* type, uint32_t id, uint64_t lsn,
+                           const void* entity, void* ctx) {
+    feed_t* feed = (feed_t*)ctx;
+    if (strcmp(type, "Item") != 0 || feed->count == FEED_MAX) return false;
+    feed->ids[feed->count] = id;
+    feed->lsns[feed->count] = lsn;
+    feed->values[feed->count] = entity ? ((const test_item_t*)entity)->value : -1;
+    feed->count++;
+    return true;
+}
+
+static bool test_wal_change_feed(void) {
+    cleanup();
+
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_history = 4
+    };
+
+    tqdb_t db;
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+
+    uint64_t lsn;
+    ASSERT(tqdb_wal_lsn(db, &lsn) == TQDB_OK);
+    ASSERT(lsn == 0);
+
+    test_item_t item;
+    for (int i = 0; i < 3; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+    tqdb_wal_lsn(db, &lsn);
+    ASSERT(lsn == 3);
+
+    feed_t feed = {0};
+    ASSERT(tqdb_changes_since(db, 0, collect_change, &feed) == TQDB_OK);
+    ASSERT(feed.count == 3);
+    ASSERT(feed.ids[0] == 1 && feed.lsns[0] == 1 && feed.values[0] == 0);
+    ASSERT(feed.ids[2] == 3 && feed.lsns[2] == 3 && feed.values[2] == 2);
+
+    /* Each key once, at its latest change, with its current value */
+    item.id = 1;
+    item.value = 10;
+    tqdb_update(db, "Item", 1, &item);
+    tqdb_delete(db, "Item", 2);
+    item.value = 11;
+    tqdb_update(db, "Item", 1, &item);
+
+    memset(&feed, 0, sizeof(feed));
+    ASSERT(tqdb_changes_since(db, 3, collect_change, &feed) == TQDB_OK);
+    ASSERT(feed.count == 2);
+    ASSERT(feed.ids[0] == 2 && feed.lsns[0] == 5 && feed.values[0] == -1);
+    ASSERT(feed.ids[1] == 1 && feed.lsns[1] == 6 && feed.values[1] == 11);
+
+    /* History outlives the checkpoint, up to wal_history records */
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+    tqdb_wal_lsn(db, &lsn);
+    ASSERT(lsn == 6);
+    memset(&feed, 0, sizeof(feed));
+    ASSERT(tqdb_changes_since(db, 3, collect_change, &feed) == TQDB_OK);
+    ASSERT(feed.count == 2);
+    ASSERT(feed.ids[1] == 1 && feed.values[1] == 11);
+    ASSERT(tqdb_changes_since(db, 1, collect_change, &feed) == TQDB_ERR_EXPIRED);
+    memset(&feed, 0, sizeof(feed));
+    ASSERT(tqdb_changes_since(db, 2, collect_change, &feed) == TQDB_OK);
+    ASSERT(feed.count == 3);
+    tqdb_close(db);
+
+    /* LSNs continue after reopening */
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+    item.id = 3;
+    item.value = 30;
+    ASSERT(tqdb_update(db, "Item", 3, &item) == TQDB_OK);
+    tqdb_wal_lsn(db, &lsn);
+    ASSERT(lsn == 7);
+    memset(&feed, 0, sizeof(feed));
+    ASSERT(tqdb_changes_since(db, 5, collect_change, &feed) == TQDB_OK);
+    ASSERT(feed.count == 2);
+    ASSERT(feed.ids[0] == 1 && feed.ids[1] == 3 && feed.values[1] == 30);
+    tqdb_close(db);
+
+    /* Without history, checkpointed and compacted-away changes expire */
+    cfg.wal_history = 0;
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+    FILE* hist = fopen(TEST_WAL_PATH ".hist", "rb");
+    ASSERT(hist == NULL);
+    ASSERT(tqdb_changes_since(db, 6, collect_change, &feed) == TQDB_ERR_EXPIRED);
+    memset(&feed, 0, sizeof(feed));
+    ASSERT(tqdb_changes_since(db, 7, collect_change, &feed) == TQDB_OK);
+    ASSERT(feed.count == 0);
+
+    item.id = 0;
+    item.value = 40;
+    ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    ASSERT(tqdb_update(db, "Item", 1, &item) == TQDB_OK);
+    ASSERT(tqdb_delete(db, "Item", item.id) == TQDB_OK);
+    ASSERT(tqdb_wal_compact(db) == TQDB_OK);
+    ASSERT(tqdb_changes_since(db, 7, collect_change, &feed) == TQDB_ERR_EXPIRED);
+    memset(&feed, 0, sizeof(feed));
+    ASSERT(tqdb_changes_since(db, 10, collect_change, &feed) == TQDB_OK);
+    ASSERT(feed.count == 0);
+    tqdb_close(db);
+
+    return true;
+}
+
+typedef struct {
+    tqdb_t db;
+    int count;
+    int64_t sum;
+} snap_scan_t;
+
+static bool snap_scan_fn(const void* entity, void* ctx) {
+    snap_scan_t* s = (snap_scan_t*)ctx;
+    s->count++;
+    s->sum += ((const test_item_t*)entity)->value;
+
+    /* The scan holds no lock: writers get through mid-scan */
+    test_item_t item = { .id = 0, .name = "Concurrent", .value = 1000 };
+    return tqdb_add(s->db, "Item", &item) == TQDB_OK;
+}
+
+static bool test_wal_snapshot(void) {
+    cleanup();
+
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .mutex = &PT_MUTEX
+    };
+
+    tqdb_t db;
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+    tqdb_register(db, &GAUGE_TRAIT);
+
+    test_item_t item;
+    for (int i = 0; i < 6; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+    test_gauge_t g = {0};
+    ASSERT(tqdb_add(db, "Gauge", &g) == TQDB_OK);
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+
+    /* Pending in the WAL when the snapshot is taken: a delete and a patch */
+    tqdb_delete(db, "Item", 6);
+    g.fields[5] = 7;
+    ASSERT(tqdb_update(db, "Gauge", g.id, &g) == TQDB_OK);
+
+    tqdb_snapshot_t snap;
+    ASSERT(tqdb_snapshot_open(db, &snap) == TQDB_OK);
+    ASSERT(tqdb_snapshot_lsn(snap) == 9);
+
+    /* Changes after the snapshot, including files replaced underneath it */
+    item.id = 1;
+    item.value = 100;
+    ASSERT(tqdb_update(db, "Item", 1, &item) == TQDB_OK);
+    tqdb_delete(db, "Item", 2);
+    g.fields[5] = 8;
+    ASSERT(tqdb_update(db, "Gauge", g.id, &g) == TQDB_OK);
+    ASSERT(tqdb_wal_compact(db) == TQDB_OK);
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+
+    snap_scan_t scan = { .db = db };
+    ASSERT(tqdb_snapshot_foreach(snap, "Item", snap_scan_fn, &scan) == TQDB_OK);
+    ASSERT(scan.count == 5);
+    ASSERT(scan.sum == 0 + 1 + 2 + 3 + 4);
+    ASSERT(tqdb_count(db, "Item") == 4 + 5);
+
+    int64_t sum = 0;
+    ASSERT(tqdb_snapshot_foreach(snap, "Gauge", gauge_sum_fn, &sum) == TQDB_OK);
+    ASSERT(sum == 7);
+    sum = 0;
+    ASSERT(tqdb_foreach(db, "Gauge", gauge_sum_fn, &sum) == TQDB_OK);
+    ASSERT(sum == 8);
+
+    ASSERT(tqdb_snapshot_foreach(snap, "Nope", gauge_sum_fn, &sum) == TQDB_ERR_NOT_REGISTERED);
+    tqdb_snapshot_close(snap);
+    tqdb_close(db);
+
+    return true;
+}
+
+static bool test_wal_live_ids(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 30
+    };
+
+    for (int round = 0; round < 2; round++) {
+        ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+        tqdb_register(db, &ITEM_TRAIT);
+
+        if (round == 0) {
+            /* Spans auto-checkpoints, so the IDs end up in both files */
+            test_item_t item = { .name = "Live", .value = 1 };
+            ASSERT(tqdb_count(db, "Item") == 0);
+            for (int i = 1; i <= 50; i++) {
+                item.id = 0;
+                ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+            }
+            for (uint32_t id = 3; id <= 50; id += 3) {
+                ASSERT(tqdb_delete(db, "Item", id) == TQDB_OK);
+            }
+            ASSERT(tqdb_delete(db, "Item", 3) == TQDB_ERR_NOT_FOUND);
+        }
+
+        /* Round 1 rebuilds the bitmap from the files */
+        ASSERT(tqdb_count(db, "Item") == 34);
+        for (uint32_t id = 1; id <= 60; id++) {
+            bool live = id <= 50 && id % 3 != 0;
+            test_item_t out;
+            ASSERT(tqdb_exists(db, "Item", id) == live);
+            ASSERT(tqdb_get(db, "Item", id, &out) == (live ? TQDB_OK : TQDB_ERR_NOT_FOUND));
+        }
+        ASSERT(tqdb_update(db, "Item", 100000, &(test_item_t){ .value = 2 }) == TQDB_ERR_NOT_FOUND);
+
+        tqdb_close(db);
+    }
+    return true;
+}
+
+/* Per-range tally for tqdb_foreach_parallel */
+typedef struct {
+    uint32_t count;
+    int64_t sum;
+    uint32_t min_id;
+    uint32_t max_id;
+} par_tally_t;
+
+static bool par_tally_item(const void* entity, void* ctx) {
+    const test_item_t* item = (const test_item_t*)entity;
+    par_tally_t* t = (par_tally_t*)ctx;
+    if (t->count == 0 || item->id < t->min_id) t->min_id = item->id;
+    if (item->id > t->max_id) t->max_id = item->id;
+    t->count++;
+    t->sum += item->value;
+    return true;
+}
+
+/* Tally only the first entity of a range */
+static bool par_first_item(const void* entity, void* ctx) {
+    par_tally_item(entity, ctx);
+    return false;
+}
+
+static bool test_foreach_parallel(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 1000,
+        .thread = &PT_THREAD,
+        .alloc = &OWNER_ALLOC  /* Not thread-safe: the workers must not call it */
+    };
+    s_alloc_owner = pthread_self();
+    s_foreign_allocs = 0;
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+    ASSERT(tqdb_register(db, &GAUGE_TRAIT) == TQDB_OK);
+
+    test_item_t item = { .name = "Par" };
+    for (int i = 0; i < 400; i++) {
+        item.id = 0;
+        item.value = i + 1;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+    test_gauge_t g;
+    for (int i = 0; i < 5; i++) {
+        memset(&g, 0, sizeof(g));
+        for (int f = 0; f < GAUGE_FIELDS; f++) g.fields[f] = 1;
+        ASSERT(tqdb_add(db, "Gauge", &g) == TQDB_OK);
+    }
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+
+    /* A WAL over the main file: updates, deletes and new entities */
+    for (uint32_t id = 10; id <= 400; id += 10) {
+        item.id = id;
+        item.value = 1000;
+        ASSERT(tqdb_update(db, "Item", id, &item) == TQDB_OK);
+    }
+    for (uint32_t id = 7; id <= 400; id += 7) {
+        ASSERT(tqdb_delete(db, "Item", id) == TQDB_OK);
+    }
+    for (int i = 0; i < 20; i++) {
+        item.id = 0;
+        item.value = 5;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+    ASSERT(tqdb_get(db, "Gauge", 2, &g) == TQDB_OK);
+    g.fields[3] = 50;
+    ASSERT(tqdb_update(db, "Gauge", 2, &g) == TQDB_OK);  /* Patch */
+    gauge_add_t add = { 0, 9 };
+    ASSERT(tqdb_merge(db, "Gauge", 4, &add) == TQDB_OK);
+    memset(&g, 0, sizeof(g));
+    g.fields[0] = 100;
+    ASSERT(tqdb_add(db, "Gauge", &g) == TQDB_OK);
+
+    par_tally_t serial = { 0, 0, 0, 0 };
+    ASSERT(tqdb_foreach(db, "Item", par_tally_item, &serial) == TQDB_OK);
+    ASSERT(serial.count == 400 - 57 + 20);
+
+    /* Ranges follow ID order; WAL-only entities go to the last one */
+    par_tally_t tallies[4];
+    void* ctxs[4];
+    memset(tallies, 0, sizeof(tallies));
+    for (int i = 0; i < 4; i++) ctxs[i] = &tallies[i];
+    ASSERT(tqdb_foreach_parallel(db, "Item", 4, par_tally_item, ctxs) == TQDB_OK);
+    uint32_t count = 0;
+    int64_t sum = 0;
+    for (int i = 0; i < 4; i++) {
+        ASSERT(tallies[i].count > 0);
+        if (i > 0) ASSERT(tallies[i - 1].max_id < tallies[i].min_id);
+        count += tallies[i].count;
+        sum += tallies[i].sum;
+    }
+    ASSERT(count == serial.count && sum == serial.sum);
+    ASSERT(tallies[3].max_id == 420);
+
+    /* A stopped last range also skips the WAL-only entities after it */
+    memset(tallies, 0, sizeof(tallies));
+    ASSERT(tqdb_foreach_parallel(db, "Item", 4, par_first_item, ctxs) == TQDB_OK);
+    for (int i = 0; i < 4; i++) ASSERT(tallies[i].count == 1);
+    ASSERT(tallies[3].max_id <= 400);
+
+    /* Without skip the section is one range; patches and merges still fold */
+    int64_t gauge_serial = 0, gauge_sums[3] = { 0, 0, 0 };
+    void* gauge_ctxs[3] = { &gauge_sums[0], &gauge_sums[1], &gauge_sums[2] };
+    ASSERT(tqdb_foreach(db, "Gauge", gauge_sum_fn, &gauge_serial) == TQDB_OK);
+    ASSERT(gauge_serial == 5 * GAUGE_FIELDS + 49 + 9 + 100);
+    ASSERT(tqdb_foreach_parallel(db, "Gauge", 3, gauge_sum_fn, gauge_ctxs) == TQDB_OK);
+    ASSERT(gauge_sums[0] == gauge_serial - 100 && gauge_sums[1] == 0 && gauge_sums[2] == 100);
+
+    ASSERT(tqdb_foreach_parallel(db, "Item", 0, par_tally_item, ctxs) == TQDB_ERR_INVALID_ARG);
+    ASSERT(tqdb_foreach_parallel(db, "Nope", 2, par_tally_item, ctxs) ==
+           TQDB_ERR_NOT_REGISTERED);
+    ASSERT(s_foreign_allocs == 0);
+
+    tqdb_close(db);
+    return true;
+}
+
+#if TQDB_ENABLE_PTHREAD
+typedef struct {
+    tqdb_t db;
+    tqdb_err_t err;
+    int32_t value;
+    int bad;
+    bool own_session;
+} shared_reader_t;
+
+static void* shared_get(void* p) {
+    shared_reader_t* reader = (shared_reader_t*)p;
+    test_item_t item;
+    reader->err = tqdb_get(reader->db, "Item", 1, &item);
+    reader->value = item.value;
+    return NULL;
+}
+
+/* Another reader finishes while this scan holds the lock shared */
+static bool scan_with_reader(const void* entity, void* ctx) {
+    (void)entity;
+    shared_reader_t* reader = (shared_reader_t*)ctx;
+    if (reader->err != TQDB_ERR_TIMEOUT) return true;
+    pthread_t t;
+    if (pthread_create(&t, NULL, shared_get, reader) == 0) pthread_join(t, NULL);
+    return true;
+}
+
+static void* shared_scanner(void* p) {
+    shared_reader_t* reader = (shared_reader_t*)p;
+    tqdb_session_t session = NULL;
+    if (reader->own_session && tqdb_session_open(reader->db, &session) != TQDB_OK) {
+        reader->bad++;
+    }
+
+    test_item_t item;
+    for (int round = 0; round < 100; round++) {
+        for (uint32_t id = 1; id <= 20; id++) {
+            tqdb_err_t err = session ? tqdb_session_get(session, "Item", id, &item)
+                                     : tqdb_get(reader->db, "Item", id, &item);
+            if (err != TQDB_OK || item.value % 1000 != (int32_t)id) reader->bad++;
+        }
+        if (tqdb_count(reader->db, "Item") != 20) reader->bad++;
+    }
+
+    tqdb_session_close(session);
+    return NULL;
+}
+
+static bool test_shared_reads(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .mutex = tqdb_pthread_mutex_ops(),
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 50
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+
+    test_item_t item = { .name = "Shared" };
+    for (int i = 1; i <= 20; i++) {
+        item.id = 0;
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+    ASSERT(tqdb_count(db, "Item") == 20);
+
+    /* An exclusive lock would time the inner read out */
+    shared_reader_t inner = { db, TQDB_ERR_TIMEOUT, 0, 0, false };
+    ASSERT(tqdb_foreach(db, "Item", scan_with_reader, &inner) == TQDB_OK);
+    ASSERT(inner.err == TQDB_OK && inner.value == 1);
+
+    /* Readers run alongside updates and the checkpoints they trigger; half use sessions */
+    pthread_t threads[4];
+    shared_reader_t readers[4];
+    for (int t = 0; t < 4; t++) {
+        readers[t] = (shared_reader_t){ db, TQDB_OK, 0, 0, t % 2 == 1 };
+        ASSERT(pthread_create(&threads[t], NULL, shared_scanner, &readers[t]) == 0);
+    }
+    for (int round = 1; round <= 10; round++) {
+        for (uint32_t id = 1; id <= 20; id++) {
+            item.id = id;
+            item.value = round * 1000 + (int32_t)id;
+            ASSERT(tqdb_update(db, "Item", id, &item) == TQDB_OK);
+        }
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+        ASSERT(readers[t].bad == 0);
+    }
+
+    ASSERT(tqdb_get(db, "Item", 7, &item) == TQDB_OK && item.value == 10007);
+
+    tqdb_close(db);
+    return true;
+}
+
+typedef struct {
+    tqdb_t db;
+    int added;
+    int bad;
+} item_ingest_t;
+
+static void* ingest_items(void* p) {
+    item_ingest_t* ingest = (item_ingest_t*)p;
+    test_item_t item = { .name = "Ingest" };
+    for (int i = 0; i < 200 && ingest->bad == 0; i++) {
+        item.id = 0;
+        item.value = i;
+        if (tqdb_add(ingest->db, "Item", &item) == TQDB_OK) {
+            ingest->added++;
+        } else {
+            ingest->bad++;
+        }
+    }
+    return NULL;
+}
+
+/* Writes to another type finish while this scan holds its stripe */
+static bool scan_with_ingest(const void* entity, void* ctx) {
+    (void)entity;
+    item_ingest_t* ingest = (item_ingest_t*)ctx;
+    if (ingest->added + ingest->bad > 0) return true;
+    pthread_t t;
+    if (pthread_create(&t, NULL, ingest_items, ingest) == 0) pthread_join(t, NULL);
+    return true;
+}
+
+static item_ingest_t* s_slow_ingest;  /* Armed for one slow encode */
+
+/* Encodes an item only once a whole ingest of another type has gone in */
+static void slow_item_write(tqdb_writer_t* w, const void* e) {
+    item_ingest_t* ingest = s_slow_ingest;
+    s_slow_ingest = NULL;
+    pthread_t t;
+    if (ingest && pthread_create(&t, NULL, ingest_items, ingest) == 0) pthread_join(t, NULL);
+    item_write(w, e);
+}
+
+static const tqdb_trait_t SLOW_ITEM_TRAIT = {
+    .name = "SlowItem",
+    .max_count = 1000,
+    .struct_size = sizeof(test_item_t),
+    .write = slow_item_write,
+    .read = item_read,
+    .get_id = item_get_id,
+    .set_id = item_set_id,
+    .init = item_init,
+    .skip = item_skip
+};
+
+/* Gauges are updated whole, so every field of one must agree */
+static void* gauge_reader(void* p) {
+    shared_reader_t* reader = (shared_reader_t*)p;
+    test_gauge_t g;
+    for (int round = 0; round < 200; round++) {
+        uint32_t id = (uint32_t)round % 10 + 1;
+        if (tqdb_get(reader->db, "Gauge", id, &g) != TQDB_OK) {
+            reader->bad++;
+            continue;
+        }
+        for (int i = 1; i < GAUGE_FIELDS; i++) {
+            if (g.fields[i] != g.fields[0]) reader->bad++;
+        }
+    }
+    return NULL;
+}
+
+static bool test_striped_writes(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .mutex = tqdb_pthread_mutex_ops(),
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 100
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+    ASSERT(tqdb_register(db, &GAUGE_TRAIT) == TQDB_OK);
+    ASSERT(tqdb_register(db, &SLOW_ITEM_TRAIT) == TQDB_OK);
+
+    test_gauge_t g;
+    for (int i = 1; i <= 10; i++) {
+        memset(&g, 0, sizeof(g));
+        ASSERT(tqdb_add(db, "Gauge", &g) == TQDB_OK);
+    }
+
+    /* Writes taking the mutex exclusively would time out behind the scan */
+    item_ingest_t inner = { db, 0, 0 };
+    ASSERT(tqdb_foreach(db, "Gauge", scan_with_ingest, &inner) == TQDB_OK);
+    ASSERT(inner.added == 200 && inner.bad == 0);
+    ASSERT(tqdb_count(db, "Item") == 200);
+
+    /* Ingest and lookups of another type, alongside its updates and the checkpoints */
+    pthread_t ingest_threads[2], reader_threads[2];
+    item_ingest_t ingest[2];
+    shared_reader_t readers[2];
+    for (int t = 0; t < 2; t++) {
+        ingest[t] = (item_ingest_t){ db, 0, 0 };
+        readers[t] = (shared_reader_t){ db, TQDB_OK, 0, 0, false };
+        ASSERT(pthread_create(&ingest_threads[t], NULL, ingest_items, &ingest[t]) == 0);
+        ASSERT(pthread_create(&reader_threads[t], NULL, gauge_reader, &readers[t]) == 0);
+    }
+    for (int round = 1; round <= 20; round++) {
+        for (uint32_t id = 1; id <= 10; id++) {
+            g.id = id;
+            for (int i = 0; i < GAUGE_FIELDS; i++) g.fields[i] = round;
+            ASSERT(tqdb_update(db, "Gauge", id, &g) == TQDB_OK);
+        }
+    }
+    for (int t = 0; t < 2; t++) {
+        pthread_join(ingest_threads[t], NULL);
+        pthread_join(reader_threads[t], NULL);
+        ASSERT(ingest[t].added == 200 && ingest[t].bad == 0);
+        ASSERT(readers[t].bad == 0);
+    }
+
+    ASSERT(tqdb_count(db, "Item") == 600);
+    ASSERT(tqdb_get(db, "Gauge", 4, &g) == TQDB_OK && g.fields[GAUGE_FIELDS - 1] == 20);
+
+    /* IDs stayed unique across the writers */
+    test_item_t item;
+    ASSERT(tqdb_get(db, "Item", 600, &item) == TQDB_OK);
+    ASSERT(tqdb_get(db, "Item", 601, &item) == TQDB_ERR_NOT_FOUND);
+
+    /* A slow write holds only its own type: the ingest finishes inside its encode */
+    item_ingest_t slow = { db, 0, 0 };
+    s_slow_ingest = &slow;
+    item = (test_item_t){ .name = "Slow" };
+    ASSERT(tqdb_add(db, "SlowItem", &item) == TQDB_OK);
+    ASSERT(slow.added == 200 && slow.bad == 0);
+    ASSERT(tqdb_count(db, "Item") == 800 && tqdb_count(db, "SlowItem") == 1);
+
+    tqdb_close(db);
+    return true;
+}
+#endif
+
+#if TQDB_ENABLE_MULTIPROC
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const tqdb_config_t MP_CONFIG = {
+    .db_path = TEST_DB_PATH,
+    .enable_wal = true,
+    .wal_path = TEST_WAL_PATH,
+    .wal_max_entries = 1000,
+    .multi_process = true,
+    .enable_cache = true,
+    .cache_size = 64
+};
+
+/* Pass a step token over a pipe (false once the other side is gone) */
+static bool mp_signal(int fd) {
+    char c = 1;
+    return write(fd, &c, 1) == 1;
+}
+
+static bool mp_wait(int fd) {
+    char c;
+    return read(fd, &c, 1) == 1;
+}
+
+static bool mp_child(int rd, int wr) {
+    tqdb_t db;
+    ASSERT(mp_wait(rd));
+    ASSERT(tqdb_open(&MP_CONFIG, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+
+    /* Adds alongside the parent's */
+    for (int i = 0; i < 150; i++) {
+        test_item_t item = { .id = 0, .name = "child" };
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+        item.value = (int32_t)item.id;
+        ASSERT(tqdb_update(db, "Item", item.id, &item) == TQDB_OK);
+    }
+    ASSERT(mp_signal(wr) && mp_wait(rd));
+
+    /* Update the parent's cached seed: read back from the WAL tail */
+    test_item_t seed;
+    ASSERT(tqdb_get(db, "Item", 1, &seed) == TQDB_OK);
+    seed.value = 42;
+    ASSERT(tqdb_update(db, "Item", 1, &seed) == TQDB_OK);
+    ASSERT(mp_signal(wr) && mp_wait(rd));
+
+    /* Checkpoint, then update: a new generation */
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+    seed.value = 43;
+    ASSERT(tqdb_update(db, "Item", 1, &seed) == TQDB_OK);
+
+    tqdb_close(db);  /* The parent still has it open: no checkpoint */
+    return mp_signal(wr);
+}
+
+static bool test_multi_process(void) {
+    cleanup();
+
+    int to_child[2], to_parent[2];
+    ASSERT(pipe(to_child) == 0 && pipe(to_parent) == 0);
+    fflush(stdout);
+    pid_t pid = fork();
+    ASSERT(pid >= 0);
+    if (pid == 0) {
+        close(to_child[1]);
+        close(to_parent[0]);
+        _exit(mp_child(to_child[0], to_parent[1]) ? 0 : 1);
+    }
+    close(to_child[0]);
+    close(to_parent[1]);
+    int rd = to_parent[0], wr = to_child[1];
+
+    tqdb_t db;
+    ASSERT(tqdb_open(&MP_CONFIG, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+
+    tqdb_config_t other = MP_CONFIG;
+    other.enable_wal = false;
+    other.wal_path = NULL;
+    tqdb_t bad;
+    ASSERT(tqdb_open(&other, &bad) == TQDB_ERR_INVALID_ARG);
+
+    test_item_t seed = { .id = 0, .name = "seed", .value = 1 };
+    ASSERT(tqdb_add(db, "Item", &seed) == TQDB_OK && seed.id == 1);
+    ASSERT(tqdb_get(db, "Item", 1, &seed) == TQDB_OK);  /* Cached */
+    ASSERT(mp_signal(wr));
+
+    for (int i = 0; i < 150; i++) {
+        test_item_t item = { .id = 0, .name = "parent" };
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+        item.value = (int32_t)item.id;
+        ASSERT(tqdb_update(db, "Item", item.id, &item) == TQDB_OK);
+    }
+    ASSERT(mp_wait(rd));
+
+    /* IDs stayed unique across the processes */
+    ASSERT(tqdb_count(db, "Item") == 301);
+    test_item_t item;
+    for (uint32_t id = 2; id <= 301; id++) {
+        ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+        ASSERT(item.value == (int32_t)id);
+    }
+    ASSERT(tqdb_get(db, "Item", 302, &item) == TQDB_ERR_NOT_FOUND);
+    ASSERT(mp_signal(wr) && mp_wait(rd));
+
+    ASSERT(tqdb_get(db, "Item", 1, &item) == TQDB_OK && item.value == 42);
+    ASSERT(tqdb_get(db, "Item", 1, &item) == TQDB_OK && item.value == 42);
+    ASSERT(mp_signal(wr) && mp_wait(rd));
+
+    ASSERT(tqdb_get(db, "Item", 1, &item) == TQDB_OK && item.value == 43);
+    item = (test_item_t){ .id = 0, .name = "last" };
+    ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK && item.id == 302);
+
+    int status;
+    ASSERT(waitpid(pid, &status, 0) == pid);
+    ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(rd);
+    close(wr);
+
+    tqdb_close(db);  /* Last one out checkpoints */
+
+    tqdb_config_t plain = { .db_path = TEST_DB_PATH, .wal_path = TEST_WAL_PATH };
+    ASSERT(tqdb_open(&plain, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+    size_t pending;
+    ASSERT(tqdb_wal_stats(db, &pending, NULL) == TQDB_OK && pending == 0);
+    ASSERT(tqdb_count(db, "Item") == 302);
+    tqdb_close(db);
+    return true;
+}
+#endif
+
+static bool test_sessions(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &GAUGE_TRAIT) == TQDB_OK);  /* No skip: decoded on the way to items */
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+
+    test_gauge_t gauge = {0};
+    for (int i = 1; i <= 5; i++) {
+        gauge.id = 0;
+        gauge.fields[0] = i;
+        ASSERT(tqdb_add(db, "Gauge", &gauge) == TQDB_OK);
+    }
+    test_item_t item = { .name = "Session" };
+    for (int i = 1; i <= 10; i++) {
+        item.id = 0;
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+
+    item.id = 2;
+    item.value = 200;
+    ASSERT(tqdb_update(db, "Item", 2, &item) == TQDB_OK);
+    ASSERT(tqdb_delete(db, "Item", 3) == TQDB_OK);
+    ASSERT(tqdb_merge(db, "Gauge", 1, &(gauge_add_t){ .field = 0, .delta = 5 }) == TQDB_OK);
+
+    /* Same answers as the database, from the main file and the WAL */
+    tqdb_session_t session;
+    ASSERT(tqdb_session_open(db, &session) == TQDB_OK);
+    for (uint32_t id = 1; id <= 10; id++) {
+        test_item_t out;
+        tqdb_err_t err = tqdb_session_get(session, "Item", id, &out);
+        if (id == 3) {
+            ASSERT(err == TQDB_ERR_NOT_FOUND && !tqdb_session_exists(session, "Item", id));
+        } else {
+            ASSERT(err == TQDB_OK && out.value == (id == 2 ? 200 : (int32_t)id));
+            ASSERT(tqdb_session_exists(session, "Item", id));
+        }
+    }
+    ASSERT(tqdb_session_get(session, "Gauge", 1, &gauge) == TQDB_OK && gauge.fields[0] == 6);
+
+    foreach_count = 0;
+    ASSERT(tqdb_session_foreach(session, "Item", foreach_callback, NULL) == TQDB_OK);
+    ASSERT(foreach_count == 9);
+    int64_t sum = 0;
+    ASSERT(tqdb_session_foreach(session, "Gauge", gauge_sum_fn, &sum) == TQDB_OK && sum == 20);
+
+    /* Held files are reopened once a checkpoint replaces them */
+    ASSERT(tqdb_checkpoint(db) == TQDB_OK);
+    item.id = 4;
+    item.value = 400;
+    ASSERT(tqdb_update(db, "Item", 4, &item) == TQDB_OK);
+    ASSERT(tqdb_session_get(session, "Item", 2, &item) == TQDB_OK && item.value == 200);
+    ASSERT(tqdb_session_get(session, "Item", 4, &item) == TQDB_OK && item.value == 400);
+    ASSERT(tqdb_session_get(session, "Item", 3, &item) == TQDB_ERR_NOT_FOUND);
+
+    tqdb_session_close(session);
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_resident_type(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 16
+    };
+    tqdb_trait_t resident = GAUGE_TRAIT;
+    resident.resident = true;
+
+    /* Entities are copied shallowly, so destroy is refused */
+    tqdb_trait_t owning = resident;
+    owning.name = "Owning";
+    owning.destroy = free;
+
+    for (int round = 0; round < 2; round++) {
+        ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+        ASSERT(tqdb_register(db, &owning) == TQDB_ERR_INVALID_ARG);
+        ASSERT(tqdb_register(db, &resident) == TQDB_OK);
+
+        if (round == 0) {
+            /* Spans auto-checkpoints, after the copy was loaded */
+            ASSERT(tqdb_count(db, "Gauge") == 0);
+            for (int i = 1; i <= 30; i++) {
+                test_gauge_t g = { .id = 0 };
+                g.fields[0] = i;
+                ASSERT(tqdb_add(db, "Gauge", &g) == TQDB_OK);
+            }
+            test_gauge_t g;
+            ASSERT(tqdb_get(db, "Gauge", 5, &g) == TQDB_OK);
+            g.fields[1] = 7;
+            ASSERT(tqdb_update(db, "Gauge", 5, &g) == TQDB_OK);
+            ASSERT(tqdb_merge(db, "Gauge", 6, &(gauge_add_t){ .field = 0, .delta = 100 }) == TQDB_OK);
+            for (uint32_t id = 10; id <= 30; id += 10) {
+                ASSERT(tqdb_delete(db, "Gauge", id) == TQDB_OK);
+            }
+            ASSERT(tqdb_delete(db, "Gauge", 10) == TQDB_ERR_NOT_FOUND);
+        }
+
+        /* Round 1 loads the copy from the files */
+        ASSERT(tqdb_count(db, "Gauge") == 27);
+        test_gauge_t g;
+        ASSERT(tqdb_get(db, "Gauge", 5, &g) == TQDB_OK);
+        ASSERT(g.fields[0] == 5 && g.fields[1] == 7);
+        ASSERT(tqdb_get(db, "Gauge", 6, &g) == TQDB_OK);
+        ASSERT(g.fields[0] == 106);
+        ASSERT(tqdb_get(db, "Gauge", 20, &g) == TQDB_ERR_NOT_FOUND);
+        ASSERT(tqdb_exists(db, "Gauge", 29) && !tqdb_exists(db, "Gauge", 31));
+
+        int64_t sum = 0;
+        ASSERT(tqdb_foreach(db, "Gauge", gauge_sum_fn, &sum) == TQDB_OK);
+        ASSERT(sum == 30 * 31 / 2 - 60 + 7 + 100);
+
+        tqdb_close(db);
+    }
+    return true;
+}
+
+static bool test_cache_basic(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_cache = true,
+        .cache_size = 8
+    };
+
+    tqdb_err_t err = tqdb_open(&cfg, &db);
+    ASSERT(err == TQDB_OK);
+
+    tqdb_register(db, &ITEM_TRAIT);
+
+    /* Add an item */
+    test_item_t item = { .id = 0, .name = "Cached Item", .value = 42 };
+    tqdb_add(db, "Item", &item);
+    uint32_t item_id = item.id;
+
+    /* First get - cache miss */
+    test_item_t retrieved;
+    tqdb_get(db, "Item", item_id, &retrieved);
+    ASSERT(retrieved.value == 42);
+
+    /* Second get - should be cache hit */
+    tqdb_get(db, "Item", item_id, &retrieved);
+    ASSERT(retrieved.value == 42);
+
+    /* Check cache stats */
+    size_t hits, misses;
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits >= 1);  /* At least one hit */
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_with_wal(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .enable_cache = true,
+        .cache_size = 16
+    };
+
+    tqdb_open(&cfg, &db);
+    tqdb_register(db, &ITEM_TRAIT);
+
+    /* Add items (goes to WAL, should also populate cache) */
+    test_item_t item;
+    uint32_t ids[5];
+    for (int i = 0; i < 5; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i * 100;
+        tqdb_add(db, "Item", &item);
+        ids[i] = item.id;
+    }
+
+    /* Get items - should be cache hits since WAL append updates cache */
+    test_item_t retrieved;
+    for (int i = 0; i < 5; i++) {
+        tqdb_err_t err = tqdb_get(db, "Item", ids[i], &retrieved);
+        ASSERT(err == TQDB_OK);
+        ASSERT(retrieved.value == i * 100);
+    }
+
+    /* Check stats - should have cache hits */
+    size_t hits, misses;
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits >= 5);
+
+    /* Update an item */
+    tqdb_get(db, "Item", ids[2], &retrieved);
+    retrieved.value = 999;
+    tqdb_update(db, "Item", ids[2], &retrieved);
+
+    /* Get updated value - should reflect update in cache */
+    tqdb_get(db, "Item", ids[2], &retrieved);
+    ASSERT(retrieved.value == 999);
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_clear(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_cache = true,
+        .cache_size = 8
+    };
+
+    tqdb_open(&cfg, &db);
+    tqdb_register(db, &ITEM_TRAIT);
+
+    test_item_t item = { .id = 0, .name = "Item", .value = 1 };
+    tqdb_add(db, "Item", &item);
+    uint32_t item_id = item.id;
+
+    /* Get to populate cache */
+    test_item_t retrieved;
+    tqdb_get(db, "Item", item_id, &retrieved);
+    tqdb_get(db, "Item", item_id, &retrieved);
+
+    size_t hits_before;
+    tqdb_cache_stats(db, &hits_before, NULL);
+    ASSERT(hits_before >= 1);
+
+    /* Clear cache */
+    tqdb_cache_clear(db);
+
+    /* Stats should be reset */
+    size_t hits_after, misses_after;
+    tqdb_cache_stats(db, &hits_after, &misses_after);
+    ASSERT(hits_after == 0);
+    ASSERT(misses_after == 0);
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_lru_order(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_cache = true,
+        .cache_size = 4
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+
+    test_item_t item;
+    for (int i = 1; i <= 5; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+
+    /* Fill the cache, then promote 1 so 2 becomes least recently used */
+    for (uint32_t id = 1; id <= 4; id++) ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+    ASSERT(tqdb_get(db, "Item", 1, &item) == TQDB_OK);
+    ASSERT(tqdb_get(db, "Item", 5, &item) == TQDB_OK);
+
+    size_t hits, misses;
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == 1 && misses == 5);
+
+    /* 2 was evicted; everything else is still cached */
+    const uint32_t cached[] = { 1, 3, 4, 5 };
+    for (size_t i = 0; i < 4; i++) ASSERT(tqdb_get(db, "Item", cached[i], &item) == TQDB_OK);
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == 5 && misses == 5);
+
+    ASSERT(tqdb_get(db, "Item", 2, &item) == TQDB_OK);
+    ASSERT(item.value == 2);
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == 5 && misses == 6);
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_slru_scan(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_cache = true,
+        .cache_size = 10,
+        .cache_policy = TQDB_CACHE_SLRU
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+
+    test_item_t item;
+    for (int i = 1; i <= 60; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+
+    /* Read the hot set twice so it is protected */
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t id = 1; id <= 5; id++) ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+    }
+
+    /* A one-off scan only cycles through probation */
+    for (uint32_t id = 6; id <= 60; id++) ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+
+    size_t hits, misses;
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == 5 && misses == 60);
+
+    for (uint32_t id = 1; id <= 5; id++) {
+        ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+        ASSERT(item.value == (int32_t)id);
+    }
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == 10 && misses == 60);
+
+    size_t probation_hits, protected_hits;
+    tqdb_cache_segment_stats(db, &probation_hits, &protected_hits);
+    ASSERT(probation_hits == 5 && protected_hits == 5);
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_slab(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .alloc = &COUNTING_ALLOC,
+        .enable_cache = true,
+        .cache_size = 8
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+
+    test_item_t item;
+    for (int i = 1; i <= 40; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+
+    /* The first miss sets up the type's slab */
+    ASSERT(tqdb_get(db, "Item", 1, &item) == TQDB_OK);
+
+    /* Every further miss evicts into a slab block: no allocator calls */
+    s_alloc_calls = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        for (uint32_t id = 1; id <= 40; id++) {
+            ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+            ASSERT(item.value == (int32_t)id);
+        }
+    }
+    ASSERT(s_alloc_calls == 0);
+
+    size_t hits, misses;
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(misses > 100);
+
+    tqdb_close(db);
+
+    /* Under a byte budget the blocks come from an arena of that size */
+    cfg.cache_size = 0;
+    cfg.cache_bytes = 8 * sizeof(test_item_t);
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+    ASSERT(tqdb_get(db, "Item", 1, &item) == TQDB_OK);
+
+    s_alloc_calls = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        for (uint32_t id = 1; id <= 40; id++) {
+            ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+            ASSERT(item.value == (int32_t)id);
+        }
+    }
+    ASSERT(s_alloc_calls == 0);
+    ASSERT(tqdb_cache_bytes(db, NULL) <= cfg.cache_bytes);
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_l2(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_cache = true,
+        .cache_size = 4,
+        .cache_l2_bytes = 4096
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+
+    test_item_t item;
+    for (int i = 1; i <= 12; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+    for (uint32_t id = 1; id <= 12; id++) ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+
+    /* 1-8 were demoted, each in a fraction of the struct's size */
+    size_t l2_hits, l2_bytes;
+    tqdb_cache_l2_stats(db, &l2_hits, &l2_bytes);
+    ASSERT(l2_hits == 0 && l2_bytes > 0 && l2_bytes < 8 * sizeof(test_item_t) / 2);
+
+    for (uint32_t id = 1; id <= 8; id++) {
+        ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+        ASSERT(item.value == (int32_t)id);
+        char name[16];
+        snprintf(name, sizeof(name), "Item %u", (unsigned)id);
+        ASSERT(strcmp(item.name, name) == 0);
+    }
+
+    size_t hits, misses;
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == 8 && misses == 12);
+    tqdb_cache_l2_stats(db, &l2_hits, NULL);
+    ASSERT(l2_hits == 8);
+
+    /* An update replaces the demoted copy too */
+    item.id = 10;
+    item.value = 1000;
+    ASSERT(tqdb_update(db, "Item", 10, &item) == TQDB_OK);
+    ASSERT(tqdb_get(db, "Item", 10, &item) == TQDB_OK);
+    ASSERT(item.value == 1000);
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_pinned_refs(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .enable_cache = true,
+        .cache_size = 4
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+    test_item_t item = { .name = "Pinned" };
+    for (int i = 1; i <= 10; i++) {
+        item.id = 0;
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+
+    /* A miss loads and pins; the pinned entry outlives a full cache turnover */
+    tqdb_ref_t one, two, again;
+    ASSERT(tqdb_get_ref(db, "Item", 1, &one) == TQDB_OK);
+    ASSERT(((const test_item_t*)one.entity)->value == 1);
+    for (uint32_t id = 3; id <= 10; id++) ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+    ASSERT(tqdb_get_ref(db, "Item", 1, &again) == TQDB_OK);
+    ASSERT(again.entity == one.entity);
+    tqdb_release_ref(db, &again);
+
+    /* A write replaces the cached version, not the pinned one */
+    ASSERT(tqdb_get_ref(db, "Item", 2, &two) == TQDB_OK);
+    item.id = 2;
+    item.value = 200;
+    ASSERT(tqdb_update(db, "Item", 2, &item) == TQDB_OK);
+    ASSERT(tqdb_get(db, "Item", 2, &item) == TQDB_OK && item.value == 200);
+    ASSERT(((const test_item_t*)two.entity)->value == 2);
+    tqdb_cache_clear(db);
+    ASSERT(((const test_item_t*)one.entity)->value == 1);
+    tqdb_release_ref(db, &two);
+    tqdb_release_ref(db, &one);
+
+    /* Released entries are reused */
+    for (uint32_t id = 1; id <= 10; id++) ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+    ASSERT(tqdb_delete(db, "Item", 5) == TQDB_OK);
+    ASSERT(tqdb_get_ref(db, "Item", 5, &one) == TQDB_ERR_NOT_FOUND);
+    tqdb_close(db);
+
+    /* Without a cache the ref is a private copy */
+    cfg.enable_cache = false;
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+    ASSERT(tqdb_get_ref(db, "Item", 7, &one) == TQDB_OK);
+    ASSERT(((const test_item_t*)one.entity)->value == 7);
+    tqdb_release_ref(db, &one);
+    ASSERT(one.entity == NULL);
+    tqdb_close(db);
+
+    return true;
+}
+
+typedef struct {
+    tqdb_t db;
+    int bad;
+} shard_reader_t;
+
+static void* shard_reader(void* p) {
+    shard_reader_t* reader = (shard_reader_t*)p;
+    test_item_t item;
+    for (int round = 0; round < 200; round++) {
+        for (uint32_t id = 1; id <= 16; id++) {
+            if (tqdb_get(reader->db, "Item", id, &item) != TQDB_OK ||
+                item.value != (int32_t)id * 10) {
+                reader->bad++;
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool test_cache_shards(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .mutex = &PT_MUTEX,
+        .enable_cache = true,
+        .cache_size = 64,
+        .cache_shards = 3   /* Rounded up to 4 */
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+
+    test_item_t item = { .name = "Shard" };
+    for (int i = 1; i <= 16; i++) {
+        item.id = 0;
+        item.value = i * 10;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+
+    /* 16 entries per shard hold all 16 items whatever the hash spread */
+    for (uint32_t id = 1; id <= 16; id++) ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+    ASSERT(tqdb_cache_bytes(db, "Item") == 16 * 80);
+
+    pthread_t threads[4];
+    shard_reader_t readers[4];
+    for (int t = 0; t < 4; t++) {
+        readers[t].db = db;
+        readers[t].bad = 0;
+        ASSERT(pthread_create(&threads[t], NULL, shard_reader, &readers[t]) == 0);
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+        ASSERT(readers[t].bad == 0);
+    }
+
+    /* Per-shard counters add up */
+    size_t hits, misses;
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == 4 * 200 * 16 && misses == 16);
+
+    /* Writes invalidate in the right shard */
+    item.id = 3;
+    item.value = 7;
+    ASSERT(tqdb_update(db, "Item", 3, &item) == TQDB_OK);
+    ASSERT(tqdb_get(db, "Item", 3, &item) == TQDB_OK && item.value == 7);
+    ASSERT(tqdb_delete(db, "Item", 4) == TQDB_OK);
+    ASSERT(!tqdb_exists(db, "Item", 4));
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_warmup(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .enable_cache = true,
+        .cache_size = 8,
+        .cache_persist = true
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+    test_item_t item = { .name = "Warm" };
+    for (int i = 1; i <= 40; i++) {
+        item.id = 0;
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+    }
+    for (uint32_t id = 5; id <= 25; id += 5) ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+    tqdb_close(db);
+
+    /* The keys come back when the type is registered */
+    size_t hits, misses;
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+    for (uint32_t id = 5; id <= 25; id += 5) {
+        ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+        ASSERT(item.value == (int32_t)id);
+    }
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == 5 && misses == 0);
+
+    /* Unsorted, repeated and unknown IDs are fine */
+    uint32_t ids[] = { 31, 2, 31, 999, 0, 17 };
+    ASSERT(tqdb_prefetch(db, "Item", ids, 6) == TQDB_OK);
+    ASSERT(tqdb_prefetch(db, "Nope", ids, 6) == TQDB_ERR_NOT_REGISTERED);
+    tqdb_cache_clear(db);
+    ASSERT(tqdb_prefetch(db, "Item", ids, 6) == TQDB_OK);
+    for (int i = 0; i < 6; i++) {
+        if (ids[i] == 0 || ids[i] == 999) continue;
+        ASSERT(tqdb_get(db, "Item", ids[i], &item) == TQDB_OK);
+        ASSERT(item.value == (int32_t)ids[i]);
+    }
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == 4 && misses == 0);
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_byte_quotas(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_cache = true,
+        .cache_bytes = 800
+    };
+
+    /* Items count 80 bytes each: 10 fit the budget */
+    tqdb_trait_t hot = ITEM_TRAIT;
+    hot.name = "Hot";
+    hot.cache_min_bytes = 4 * 80;
+    tqdb_trait_t bulk = ITEM_TRAIT;
+    bulk.name = "Bulk";
+    bulk.cache_max_bytes = 3 * 80;
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    ASSERT(tqdb_register(db, &hot) == TQDB_OK);
+    ASSERT(tqdb_register(db, &bulk) == TQDB_OK);
+    ASSERT(tqdb_register(db, &ITEM_TRAIT) == TQDB_OK);
+
+    const char* types[] = { "Hot", "Bulk", "Item" };
+    test_item_t item;
+    for (int t = 0; t < 3; t++) {
+        for (int i = 1; i <= 20; i++) {
+            item.id = 0;
+            snprintf(item.name, sizeof(item.name), "%s %d", types[t], i);
+            item.value = i;
+            ASSERT(tqdb_add(db, types[t], &item) == TQDB_OK);
+        }
+    }
+
+    for (uint32_t id = 1; id <= 4; id++) ASSERT(tqdb_get(db, "Hot", id, &item) == TQDB_OK);
+    ASSERT(tqdb_cache_bytes(db, "Hot") == 320);
+
+    /* Bulk is capped at its maximum */
+    for (uint32_t id = 1; id <= 20; id++) ASSERT(tqdb_get(db, "Bulk", id, &item) == TQDB_OK);
+    ASSERT(tqdb_cache_bytes(db, "Bulk") == 240);
+
+    /* Items fill the rest of the budget without touching Hot's minimum */
+    for (uint32_t id = 1; id <= 20; id++) ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+    ASSERT(tqdb_cache_bytes(db, NULL) <= 800);
+    ASSERT(tqdb_cache_bytes(db, "Hot") == 320);
+    ASSERT(tqdb_cache_bytes(db, "Item") == 480);
+
+    size_t hits_before, hits, misses;
+    tqdb_cache_stats(db, &hits_before, &misses);
+    for (uint32_t id = 1; id <= 4; id++) {
+        ASSERT(tqdb_get(db, "Hot", id, &item) == TQDB_OK);
+        ASSERT(item.value == (int32_t)id);
+    }
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits == hits_before + 4);
+
+    tqdb_cache_clear(db);
+    ASSERT(tqdb_cache_bytes(db, NULL) == 0);
+
+    /* A minimum above the maximum is rejected */
+    tqdb_trait_t bad = ITEM_TRAIT;
+    bad.name = "Bad";
+    bad.cache_min_bytes = 200;
+    bad.cache_max_bytes = 100;
+    ASSERT(tqdb_register(db, &bad) == TQDB_ERR_INVALID_ARG);
+
+    tqdb_close(db);
+    return true;
+}
+
+static bool test_cache_churn(void) {
+    cleanup();
+
+    tqdb_t db;
+    tqdb_config_t cfg = {
+        .db_path = TEST_DB_PATH,
+        .enable_wal = true,
+        .wal_path = TEST_WAL_PATH,
+        .wal_max_entries = 100000,
+        .enable_cache = true,
+        .cache_size = 64
+    };
+
+    ASSERT(tqdb_open(&cfg, &db) == TQDB_OK);
+    tqdb_register(db, &ITEM_TRAIT);
+
+    enum { N = 400 };
+    int32_t model[N + 1];
+    test_item_t item;
+    for (int i = 1; i <= N; i++) {
+        item.id = 0;
+        snprintf(item.name, sizeof(item.name), "Item %d", i);
+        item.value = i;
+        ASSERT(tqdb_add(db, "Item", &item) == TQDB_OK);
+        model[i] = i;
+    }
+
+    /* Evictions, overwrites and deletes shuffle the index probe chains */
+    uint32_t seed = 12345;
+    for (int step = 0; step < 4000; step++) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t id = 1 + (seed >> 8) % (step % 4 ? 32 : N);
+        switch ((seed >> 4) % 8) {
+        case 0:
+            if (id <= 32) break;  /* Keep the hot set alive */
+            if (model[id] >= 0) ASSERT(tqdb_delete(db, "Item", id) == TQDB_OK);
+            model[id] = -1;
+            break;
+        case 1:
+            if (model[id] < 0) break;
+            item.id = id;
+            item.value = step;
+            ASSERT(tqdb_update(db, "Item", id, &item) == TQDB_OK);
+            model[id] = step;
+            break;
+        default:
+            if (model[id] < 0) {
+                ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_ERR_NOT_FOUND);
+            } else {
+                ASSERT(tqdb_get(db, "Item", id, &item) == TQDB_OK);
+                ASSERT(item.value == model[id]);
+            }
+            break;
+        }
+    }
+
+    size_t hits, misses;
+    tqdb_cache_stats(db, &hits, &misses);
+    ASSERT(hits > misses);
 
     tqdb_close(db);
     return true;
@@ -891,12 +3336,42 @@ int main(void) {
     TEST(wal_update_delete);
     TEST(wal_checkpoint);
     TEST(wal_auto_checkpoint);
+    TEST(wal_checkpoint_spill);
+    TEST(wal_ids_after_reopen);
+    TEST(wal_background_checkpoint);
+    TEST(wal_checkpoint_step);
+    TEST(wal_adaptive_checkpoint);
+    TEST(wal_compaction);
+    TEST(wal_patch_records);
+    TEST(wal_merge_operators);
+    TEST(wal_change_feed);
+    TEST(wal_snapshot);
+    TEST(wal_live_ids);
+    TEST(foreach_parallel);
+#if TQDB_ENABLE_PTHREAD
+    TEST(shared_reads);
+    TEST(striped_writes);
+#endif
+#if TQDB_ENABLE_MULTIPROC
+    TEST(multi_process);
+#endif
+    TEST(sessions);
+    TEST(resident_type);
 
     printf("\n  --- Cache Tests ---\n\n");
 
     TEST(cache_basic);
     TEST(cache_with_wal);
     TEST(cache_clear);
+    TEST(cache_lru_order);
+    TEST(cache_slru_scan);
+    TEST(cache_slab);
+    TEST(cache_byte_quotas);
+    TEST(cache_warmup);
+    TEST(cache_l2);
+    TEST(cache_pinned_refs);
+    TEST(cache_shards);
+    TEST(cache_churn);
 
     printf("\n═══════════════════════════════════════════════════════════════\n");
     printf("  Results: %d/%d tests passed\n", tests_passed, tests_run);
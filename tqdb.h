@@ -62,6 +62,14 @@ extern "C" {
 #define TQDB_WAL_MAX_SIZE_DEFAULT 65536
 #endif
 
+#ifndef TQDB_CHECKPOINT_MEM_BUDGET_DEFAULT
+#define TQDB_CHECKPOINT_MEM_BUDGET_DEFAULT 4096
+#endif
+
+#ifndef TQDB_WAL_COMPACT_PERCENT_DEFAULT
+#define TQDB_WAL_COMPACT_PERCENT_DEFAULT 50
+#endif
+
 /* Cache defaults */
 #ifndef TQDB_CACHE_SIZE_DEFAULT
 #define TQDB_CACHE_SIZE_DEFAULT 16
@@ -81,6 +89,20 @@ extern "C" {
 #define TQDB_ENABLE_CACHE 1
 #endif
 
+/* POSIX threads mutex ops (0 by default: the core needs only standard C) */
+#ifndef TQDB_ENABLE_PTHREAD
+#define TQDB_ENABLE_PTHREAD 0
+#endif
+
+/* Multi-process access through POSIX file locks and a shared mapping (0 by default) */
+#ifndef TQDB_ENABLE_MULTIPROC
+#define TQDB_ENABLE_MULTIPROC 0
+#endif
+
+#if TQDB_ENABLE_MULTIPROC && !TQDB_ENABLE_WAL
+#error "TQDB_ENABLE_MULTIPROC requires TQDB_ENABLE_WAL"
+#endif
+
 /* Custom allocator macros (default to stdlib) */
 #ifndef TQDB_MALLOC
 #include <stdlib.h>
@@ -111,7 +133,8 @@ typedef enum {
     TQDB_ERR_CORRUPT,         /**< Database file corrupt */
     TQDB_ERR_FULL,            /**< Max entities reached */
     TQDB_ERR_TIMEOUT,         /**< Mutex timeout */
-    TQDB_ERR_NOT_REGISTERED   /**< Entity type not registered */
+    TQDB_ERR_NOT_REGISTERED,  /**< Entity type not registered */
+    TQDB_ERR_EXPIRED          /**< Requested changes are no longer retained */
 } tqdb_err_t;
 
 /* ═══════════════════════════════════════════════════════════════════════════
@@ -121,6 +144,12 @@ typedef enum {
 /** Database handle */
 typedef struct tqdb_s* tqdb_t;
 
+/** Read-only snapshot of a database */
+typedef struct tqdb_snapshot_s* tqdb_snapshot_t;
+
+/** Per-thread reader session */
+typedef struct tqdb_session_s* tqdb_session_t;
+
 /** Binary writer handle (for trait->write callbacks) */
 typedef struct tqdb_writer_s tqdb_writer_t;
 
@@ -148,14 +177,45 @@ typedef struct {
 /**
  * Optional mutex operations for thread-safe access.
  * Pass NULL to tqdb_config_t.mutex for single-threaded use.
+ * With lock_shared and unlock_shared set, the mutex is a reader-writer
+ * lock: tqdb_get, tqdb_get_ref, tqdb_exists, tqdb_count and tqdb_foreach
+ * take it shared and run together; checkpoints take it with lock. Writes
+ * take it with lock too unless the WAL is enabled: then they take it shared
+ * plus a mutex created per registered trait, so types do not contend.
+ * A timeout of 0 should try the lock once.
  */
 typedef struct {
     void* (*create)(void);                          /**< Create mutex, return handle */
     void  (*destroy)(void* mutex);                  /**< Destroy mutex */
     bool  (*lock)(void* mutex, uint32_t timeout_ms); /**< Lock with timeout, return success */
     void  (*unlock)(void* mutex);                   /**< Unlock */
+    bool  (*lock_shared)(void* mutex, uint32_t timeout_ms); /**< Optional: lock for reading */
+    void  (*unlock_shared)(void* mutex);            /**< Optional: release a shared lock */
 } tqdb_mutex_ops_t;
 
+#if TQDB_ENABLE_PTHREAD
+/**
+ * Mutex ops backed by pthread_rwlock_t, shared locks included.
+ * A timeout of UINT32_MAX waits forever.
+ *
+ * @return Ops to pass as tqdb_config_t.mutex
+ */
+tqdb_mutex_ops_t* tqdb_pthread_mutex_ops(void);
+#endif
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Thread Interface (Optional)
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/**
+ * Optional thread operations for background work.
+ * Pass NULL to tqdb_config_t.thread to do all work on the calling thread.
+ */
+typedef struct {
+    void* (*start)(void (*fn)(void* arg), void* arg);  /**< Start thread running fn(arg), return handle (NULL = failed) */
+    void  (*join)(void* thread);                       /**< Wait for thread to finish and release handle */
+} tqdb_thread_ops_t;
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Entity Trait
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -181,12 +241,54 @@ typedef struct {
     void (*init)(void* entity);       /**< Initialize before read (e.g., zero memory) */
     void (*destroy)(void* entity);    /**< Cleanup before free (e.g., free internal allocs) */
     void (*skip)(tqdb_reader_t* r);   /**< Skip entity in stream without full read */
+
+    /* Optional WAL delta pair (both or neither). Updates log only the fields
+     * diff writes; patch must accept an empty patch. */
+    bool (*diff)(tqdb_writer_t* w, const void* base, const void* entity);  /**< Write changes from base to entity; false = log the full entity */
+    void (*patch)(tqdb_reader_t* r, void* entity);  /**< Apply changes written by diff */
+
+    /* Optional merge operator pair (both or neither) for tqdb_merge(). An
+     * operand can select among several operators (increment, max, ...). */
+    void (*merge_write)(tqdb_writer_t* w, const void* operand);  /**< Serialize an operand */
+    void (*merge)(tqdb_reader_t* r, void* entity);  /**< Fold a serialized operand into entity */
+
+    /* Optional cache quotas in bytes (0 = none). An entity counts as
+     * struct_size rounded up to 8 bytes. */
+    size_t cache_min_bytes;   /**< Not evicted for other types below this many bytes */
+    size_t cache_max_bytes;   /**< Never more than this many bytes cached */
+
+    /* Optional: keep the whole type in memory, sorted by ID. Loaded on first
+     * use; reads, counts and iteration never touch the files. Entities are
+     * copied shallowly, so a resident type may not have destroy. */
+    bool resident;
 } tqdb_trait_t;
 
 /* ═══════════════════════════════════════════════════════════════════════════
  * Database Configuration
  * ═══════════════════════════════════════════════════════════════════════════ */
 
+#if TQDB_ENABLE_WAL
+/**
+ * Auto-checkpoint policy.
+ */
+typedef enum {
+    TQDB_CHECKPOINT_THRESHOLD = 0, /**< Checkpoint at wal_max_entries or wal_max_size (default) */
+    TQDB_CHECKPOINT_ADAPTIVE       /**< Checkpoint once WAL bytes scanned by reads exceed the
+                                        cost of rewriting the main file; wal_max_size caps the WAL */
+} tqdb_checkpoint_policy_t;
+#endif
+
+#if TQDB_ENABLE_CACHE
+/**
+ * Cache replacement policy.
+ */
+typedef enum {
+    TQDB_CACHE_LRU = 0,  /**< Evict the least recently used entity (default) */
+    TQDB_CACHE_SLRU      /**< Segmented LRU: entities read once are evicted before ones
+                              read again, so one-off scans don't flush the hot set */
+} tqdb_cache_policy_t;
+#endif
+
 /**
  * Database configuration.
  * Only db_path is required; all other fields have sensible defaults.
@@ -198,6 +300,9 @@ typedef struct {
 
     tqdb_alloc_t* alloc;       /**< Optional: custom allocator (NULL = use TQDB_MALLOC/FREE) */
     tqdb_mutex_ops_t* mutex;   /**< Optional: mutex ops (NULL = no locking) */
+    tqdb_thread_ops_t* thread; /**< Optional: thread ops for background work (NULL = none) */
+    uint32_t (*clock_us)(void); /**< Optional: monotonic microsecond clock for time budgets
+                                     (NULL = budgets count bytes processed) */
 
     uint8_t* scratch_buf;      /**< Optional: user-provided scratch buffer */
     size_t scratch_size;       /**< Scratch size (0 = TQDB_DEFAULT_SCRATCH_SIZE) */
@@ -208,12 +313,47 @@ typedef struct {
     const char* wal_path;      /**< Optional: WAL file path (NULL = db_path + ".wal") */
     size_t wal_max_entries;    /**< Auto-checkpoint after N entries (0 = TQDB_WAL_MAX_ENTRIES_DEFAULT) */
     size_t wal_max_size;       /**< Auto-checkpoint at size bytes (0 = TQDB_WAL_MAX_SIZE_DEFAULT) */
+    size_t checkpoint_mem_budget; /**< Checkpoint sort memory in bytes; larger WALs spill to
+                                       db_path + ".spill" (0 = TQDB_CHECKPOINT_MEM_BUDGET_DEFAULT) */
+    uint8_t wal_compact_percent; /**< Compact the WAL instead of checkpointing when this share of
+                                      entries is superseded (0 = TQDB_WAL_COMPACT_PERCENT_DEFAULT,
+                                      over 100 = never) */
+    tqdb_checkpoint_policy_t checkpoint_policy; /**< When to auto-checkpoint (default: thresholds) */
+    bool background_checkpoint; /**< Checkpoint on a worker thread (requires mutex and thread ops).
+                                     The full WAL is frozen as wal_path + ".1" and writes go to a
+                                     fresh WAL until the merged file is swapped in. The worker
+                                     allocates through alloc, which must then be thread-safe. */
+    size_t wal_history;        /**< Keep the keys of up to N checkpointed WAL records in
+                                    wal_path + ".hist" for tqdb_changes_since() (0 = none) */
+#endif
+
+#if TQDB_ENABLE_MULTIPROC
+    /* Multi-process options */
+    bool multi_process;        /**< Share the files with other processes that set it too
+                                    (requires the WAL; not with background_checkpoint).
+                                    Each call takes an fcntl lock on db_path + ".shm",
+                                    shared for reads, and picks up other processes' writes
+                                    from the WAL counts and ID counters mapped there. Types
+                                    must be registered in the same order everywhere, and a
+                                    process may open the database only once. */
 #endif
 
 #if TQDB_ENABLE_CACHE
     /* Cache options */
     bool enable_cache;         /**< Enable read cache (default: false) */
     size_t cache_size;         /**< Max cached entities (0 = TQDB_CACHE_SIZE_DEFAULT if enabled) */
+    tqdb_cache_policy_t cache_policy; /**< Replacement policy (default: LRU) */
+    size_t cache_bytes;        /**< Hard ceiling on cached entity bytes (0 = cache_size only).
+                                    With cache_size 0 the cache then holds up to cache_bytes / 32
+                                    entities. See the trait's cache_min_bytes and cache_max_bytes. */
+    size_t cache_shards;       /**< Split the cache into this many lock-striped shards, rounded up
+                                    to a power of two (0 = 1). Each shard takes an equal share
+                                    of cache_size, cache_bytes and the trait quotas, and gets its
+                                    own lock from mutex ops. */
+    bool cache_persist;        /**< Save the cached keys to db_path + ".warm" at close and prefetch
+                                    them once the same number of types is registered again */
+    size_t cache_l2_bytes;     /**< Second cache tier holding evicted entities serialized, read
+                                    back on a hit (0 = none). Counted apart from cache_bytes. */
 #endif
 } tqdb_config_t;
 
@@ -230,6 +370,15 @@ typedef void (*tqdb_modify_fn)(void* entity, void* ctx);
 /** Filter callback. Return true to keep, false to delete/skip. */
 typedef bool (*tqdb_filter_fn)(const void* entity, void* ctx);
 
+#if TQDB_ENABLE_WAL
+/**
+ * Change feed callback. entity is the current value, NULL if deleted.
+ * Return true to continue, false to stop.
+ */
+typedef bool (*tqdb_change_fn)(const char* type, uint32_t id, uint64_t lsn,
+                               const void* entity, void* ctx);
+#endif
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Lifecycle Functions
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -290,6 +439,37 @@ tqdb_err_t tqdb_add(tqdb_t db, const char* type, void* entity);
  */
 tqdb_err_t tqdb_get(tqdb_t db, const char* type, uint32_t id, void* out);
 
+/** Pinned read-only entity from tqdb_get_ref */
+typedef struct {
+    const void* entity;        /**< Valid until tqdb_release_ref; never write through it */
+    uint32_t shard;            /**< Internal */
+    uint32_t slot;             /**< Internal (0 = private copy) */
+    uint8_t type_idx;          /**< Internal */
+} tqdb_ref_t;
+
+/**
+ * Get an entity by ID without copying it. On a cache hit the cached entity
+ * itself is returned and pinned: it is not evicted, and a later write
+ * replaces it in the cache without touching the pinned version. Without a
+ * cache, for resident types, or when every cache entry is pinned, the ref
+ * holds a private copy. Every successful call needs one tqdb_release_ref.
+ *
+ * @param db Database handle
+ * @param type Entity type name
+ * @param id Entity ID
+ * @param out_ref Output: the pinned entity
+ * @return TQDB_OK, TQDB_ERR_NOT_FOUND if not exists
+ */
+tqdb_err_t tqdb_get_ref(tqdb_t db, const char* type, uint32_t id, tqdb_ref_t* out_ref);
+
+/**
+ * Unpin an entity from tqdb_get_ref. The pointer is invalid afterwards.
+ *
+ * @param db Database handle
+ * @param ref Ref from tqdb_get_ref
+ */
+void tqdb_release_ref(tqdb_t db, tqdb_ref_t* ref);
+
 /**
  * Update an existing entity.
  *
@@ -311,6 +491,23 @@ tqdb_err_t tqdb_update(tqdb_t db, const char* type, uint32_t id, const void* ent
  */
 tqdb_err_t tqdb_delete(tqdb_t db, const char* type, uint32_t id);
 
+/**
+ * Apply a merge operand to an entity without reading it.
+ *
+ * With the WAL enabled this only appends the operand; it is folded into the
+ * entity by reads and checkpoints, in write order. Operands for an entity
+ * that does not exist are dropped when folded. Without the WAL the operand
+ * is applied to the stored entity immediately.
+ *
+ * @param db Database handle
+ * @param type Entity type name (trait must set merge_write and merge)
+ * @param id Entity ID
+ * @param operand Operand passed to the trait's merge_write
+ * @return TQDB_OK, TQDB_ERR_INVALID_ARG if the trait has no merge operator,
+ *         TQDB_ERR_NOT_FOUND if not exists (without WAL only)
+ */
+tqdb_err_t tqdb_merge(tqdb_t db, const char* type, uint32_t id, const void* operand);
+
 /**
  * Check if an entity exists.
  *
@@ -345,6 +542,31 @@ size_t tqdb_count(tqdb_t db, const char* type);
  */
 tqdb_err_t tqdb_foreach(tqdb_t db, const char* type, tqdb_iter_fn fn, void* ctx);
 
+/**
+ * Iterate over all entities of a type on several threads.
+ *
+ * The type's main file section is split into nthreads ranges of records,
+ * each decoded through its own file handle and buffer on a thread from
+ * tqdb_config_t.thread (the first range, and all of them without thread
+ * ops, on the calling thread). Range boundaries are found with the trait's
+ * skip; a type without one is a single range. WAL records apply as in
+ * tqdb_foreach. Entities that are only in the WAL are not parallelised:
+ * once the ranges finish they go to ctxs[nthreads - 1] on the calling
+ * thread, unless that range was ended by fn returning false. The database
+ * stays locked for reading throughout. Buffers are allocated on the calling
+ * thread, so config.alloc need not be thread-safe.
+ *
+ * @param db Database handle
+ * @param type Entity type name
+ * @param nthreads Number of ranges (at least 1)
+ * @param fn Iterator callback, called concurrently from different ranges
+ *           (return false to end its range)
+ * @param ctxs nthreads contexts: range i passes ctxs[i] to fn
+ * @return TQDB_OK on success
+ */
+tqdb_err_t tqdb_foreach_parallel(tqdb_t db, const char* type, size_t nthreads,
+                                 tqdb_iter_fn fn, void* const* ctxs);
+
 /**
  * Modify entities matching a filter.
  *
@@ -372,6 +594,116 @@ tqdb_err_t tqdb_modify_where(tqdb_t db, const char* type,
 tqdb_err_t tqdb_delete_where(tqdb_t db, const char* type,
                              tqdb_filter_fn filter, void* ctx);
 
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Snapshots
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/**
+ * Open a read-only snapshot of the database as it is now.
+ *
+ * The snapshot keeps the current main file and WAL segments open, so
+ * scans over it run without the database lock while writers and
+ * checkpoints carry on. Relies on open files outliving rename and remove
+ * (POSIX); elsewhere checkpoints fail until the snapshot is closed.
+ * A snapshot is used by one thread at a time and closed before tqdb_close().
+ * Scans allocate through config.alloc, which must then be thread-safe.
+ *
+ * @param db Database handle
+ * @param out_snap Output: snapshot handle
+ * @return TQDB_OK on success
+ */
+tqdb_err_t tqdb_snapshot_open(tqdb_t db, tqdb_snapshot_t* out_snap);
+
+/**
+ * Close a snapshot and release its files.
+ *
+ * @param snap Snapshot handle (safe to pass NULL)
+ */
+void tqdb_snapshot_close(tqdb_snapshot_t snap);
+
+/**
+ * Iterate over all entities of a type as of the snapshot.
+ *
+ * @param snap Snapshot handle
+ * @param type Entity type name
+ * @param fn Iterator callback (return false to stop)
+ * @param ctx User context passed to callback
+ * @return TQDB_OK on success
+ */
+tqdb_err_t tqdb_snapshot_foreach(tqdb_snapshot_t snap, const char* type,
+                                 tqdb_iter_fn fn, void* ctx);
+
+#if TQDB_ENABLE_WAL
+/**
+ * Get the newest LSN a snapshot includes. After a full sync from the
+ * snapshot, tqdb_changes_since() picks up from here.
+ *
+ * @param snap Snapshot handle
+ * @return LSN (0 if none)
+ */
+uint64_t tqdb_snapshot_lsn(tqdb_snapshot_t snap);
+#endif
+
+/* ═══════════════════════════════════════════════════════════════════════════
+ * Sessions
+ * ═══════════════════════════════════════════════════════════════════════════ */
+
+/**
+ * Open a reader session: a scratch buffer, file handles and decode space
+ * of its own. Reads through a session see the live database like
+ * tqdb_get() does, but share nothing with other readers, so with shared
+ * mutex ops threads reading through their own sessions scale across
+ * cores. Its handles stay open between reads and are reopened after a
+ * checkpoint replaces the files (see tqdb_snapshot_open() for platforms).
+ * A session runs one read at a time and is closed before tqdb_close().
+ *
+ * @param db Database handle
+ * @param out_session Output: session handle
+ * @return TQDB_OK on success
+ */
+tqdb_err_t tqdb_session_open(tqdb_t db, tqdb_session_t* out_session);
+
+/**
+ * Close a session and release its files and buffers.
+ *
+ * @param session Session handle (safe to pass NULL)
+ */
+void tqdb_session_close(tqdb_session_t session);
+
+/**
+ * tqdb_get() through a session.
+ *
+ * @param session Session handle
+ * @param type Entity type name
+ * @param id Entity ID
+ * @param out Output: entity data
+ * @return TQDB_OK, or TQDB_ERR_NOT_FOUND
+ */
+tqdb_err_t tqdb_session_get(tqdb_session_t session, const char* type, uint32_t id, void* out);
+
+/**
+ * tqdb_exists() through a session.
+ *
+ * @param session Session handle
+ * @param type Entity type name
+ * @param id Entity ID
+ * @return true if the entity exists
+ */
+bool tqdb_session_exists(tqdb_session_t session, const char* type, uint32_t id);
+
+/**
+ * tqdb_foreach() through a session. The callback must not read through
+ * the same session; other sessions and the database are fine.
+ *
+ * @param session Session handle
+ * @param type Entity type name
+ * @param fn Iterator callback (return false to stop)
+ * @param ctx User context passed to callback
+ * @return TQDB_OK on success
+ */
+tqdb_err_t tqdb_session_foreach(tqdb_session_t session, const char* type,
+                                tqdb_iter_fn fn, void* ctx);
+
 /* ═══════════════════════════════════════════════════════════════════════════
  * Maintenance
  * ═══════════════════════════════════════════════════════════════════════════ */
@@ -400,21 +732,84 @@ tqdb_err_t tqdb_flush(tqdb_t db);
 /**
  * Force WAL checkpoint - merge WAL entries into main database.
  * Called automatically when thresholds are reached.
+ * Waits for a running background checkpoint before merging the rest.
  *
  * @param db Database handle
  * @return TQDB_OK on success
  */
 tqdb_err_t tqdb_checkpoint(tqdb_t db);
 
+/**
+ * Compact the WAL without touching the main database.
+ * Keeps only the latest record per entity and drops entities added and
+ * deleted within the WAL. Runs automatically in place of a checkpoint
+ * when enough of the WAL is superseded (see wal_compact_percent).
+ *
+ * @param db Database handle
+ * @return TQDB_OK on success
+ */
+tqdb_err_t tqdb_wal_compact(tqdb_t db);
+
+/**
+ * Advance an incremental checkpoint by one bounded step.
+ * For single-threaded loops that cannot afford a full tqdb_checkpoint().
+ *
+ * The first step freezes the WAL (as background checkpoints do) and later
+ * writes go to a fresh WAL. Each step sorts and merges frozen entries into
+ * db_path + ".ckpt" until the budget is used up; the last step swaps the
+ * merged file in. Reads and writes stay correct between steps; a WAL
+ * threshold tripped meanwhile completes the pending merge synchronously.
+ *
+ * @param db Database handle
+ * @param budget_us Step budget in microseconds, measured with config.clock_us.
+ *                  Without a clock, the budget counts bytes processed.
+ *                  0 runs the checkpoint to completion.
+ * @param out_done Output: true once the merged file is installed or there
+ *                 was nothing to merge (can be NULL)
+ * @return TQDB_OK on success, TQDB_ERR_INVALID_ARG with multi_process
+ */
+tqdb_err_t tqdb_checkpoint_step(tqdb_t db, uint32_t budget_us, bool* out_done);
+
 /**
  * Get current WAL statistics.
  *
  * @param db Database handle
  * @param out_entry_count Output: number of entries in WAL (can be NULL)
  * @param out_size Output: current WAL file size in bytes (can be NULL)
+ *
+ * Both include a frozen segment still waiting for a background checkpoint.
  * @return TQDB_OK on success
  */
 tqdb_err_t tqdb_wal_stats(tqdb_t db, size_t* out_entry_count, size_t* out_size);
+
+/**
+ * Get the log sequence number (LSN) of the newest WAL record.
+ * Every write gets the next LSN; they keep increasing across checkpoints.
+ *
+ * @param db Database handle
+ * @param out_lsn Output: newest LSN (0 before the first write)
+ * @return TQDB_OK on success
+ */
+tqdb_err_t tqdb_wal_lsn(tqdb_t db, uint64_t* out_lsn);
+
+/**
+ * Report every entity changed after lsn, for incremental sync.
+ *
+ * Each changed entity is reported once, in LSN order, with the LSN of its
+ * latest change and its current value. Pass the largest LSN seen (or
+ * tqdb_wal_lsn() after a full sync) to the next call. Changes stay
+ * available while in the WAL, and after checkpoints for the last
+ * config.wal_history records. The callback runs under the database lock
+ * and must not call back into the database.
+ *
+ * @param db Database handle
+ * @param lsn Report changes with a larger LSN
+ * @param fn Callback
+ * @param ctx User context
+ * @return TQDB_OK, TQDB_ERR_EXPIRED if changes after lsn were already
+ *         dropped (resync from tqdb_foreach)
+ */
+tqdb_err_t tqdb_changes_since(tqdb_t db, uint64_t lsn, tqdb_change_fn fn, void* ctx);
 #endif /* TQDB_ENABLE_WAL */
 
 #if TQDB_ENABLE_CACHE
@@ -437,6 +832,49 @@ void tqdb_cache_clear(tqdb_t db);
  * @param out_misses Output: number of cache misses (can be NULL)
  */
 void tqdb_cache_stats(tqdb_t db, size_t* out_hits, size_t* out_misses);
+
+/**
+ * Get the entity bytes held in the cache.
+ *
+ * @param db Database handle
+ * @param type Entity type name (NULL = all types)
+ * @return Bytes cached (0 if type not registered)
+ */
+size_t tqdb_cache_bytes(tqdb_t db, const char* type);
+
+/**
+ * Split cache hits by where the entity was found. Under SLRU, probation
+ * hits are second reads of new entities and protected hits are reads of
+ * the hot set; under LRU every hit counts as probation.
+ *
+ * @param db Database handle
+ * @param out_probation_hits Output: hits on probationary entities (can be NULL)
+ * @param out_protected_hits Output: hits on protected entities (can be NULL)
+ */
+void tqdb_cache_segment_stats(tqdb_t db, size_t* out_probation_hits,
+                              size_t* out_protected_hits);
+
+/**
+ * Get second tier statistics (see cache_l2_bytes).
+ *
+ * @param db Database handle
+ * @param out_hits Output: hits deserialized from the second tier (can be NULL)
+ * @param out_bytes Output: serialized bytes it holds (can be NULL)
+ */
+void tqdb_cache_l2_stats(tqdb_t db, size_t* out_hits, size_t* out_bytes);
+
+/**
+ * Load entities into the cache with a single scan of their type, ahead of
+ * the reads that need them. IDs that do not exist are skipped; a list
+ * longer than the cache evicts its own earlier entries.
+ *
+ * @param db Database handle
+ * @param type Entity type name
+ * @param ids IDs to load, in any order
+ * @param n Number of IDs
+ * @return TQDB_OK (also without a cache), or error code
+ */
+tqdb_err_t tqdb_prefetch(tqdb_t db, const char* type, const uint32_t* ids, size_t n);
 #endif /* TQDB_ENABLE_CACHE */
 
 /* ═══════════════════════════════════════════════════════════════════════════
@@ -593,6 +1031,16 @@ tqdb_err_t tqdb_query_limit(tqdb_query_t q, size_t limit);
  */
 tqdb_err_t tqdb_query_offset(tqdb_query_t q, size_t offset);
 
+/**
+ * Run the query against a snapshot instead of the live database.
+ * Execution then takes no database lock.
+ *
+ * @param q Query handle
+ * @param snap Snapshot of the query's database (NULL = live database)
+ * @return TQDB_OK on success
+ */
+tqdb_err_t tqdb_query_snapshot(tqdb_query_t q, tqdb_snapshot_t snap);
+
 /**
  * Execute query and iterate over matching entities.
  *